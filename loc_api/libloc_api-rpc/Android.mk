@@ -51,7 +51,8 @@ LOCAL_COPY_HEADERS:= \
 	$(RPC_INC)/loc_api.h \
 	$(RPC_INC)/loc_api_fixup.h \
 	$(RPC_INC)/loc_api_rpc_glue.h \
-	$(RPC_INC)/loc_apicb_appinit.h      		     
+	$(RPC_INC)/loc_apicb_appinit.h \
+	$(RPC_INC)/loc_api_sim.h
 
 LOCAL_C_INCLUDES:= \
 	$(LOCAL_PATH) \
@@ -63,4 +64,23 @@ LOCAL_MODULE:= libloc_api-rpc
 
 include $(BUILD_STATIC_LIBRARY)
 
+# Host build, talks to the in-process modem simulator instead of the RPC router
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	$(filter-out src/loc_apicb_appinit.c,$(generated_files)) \
+	src/loc_api_sim.c
+
+LOCAL_CFLAGS:=-fno-short-enums
+LOCAL_CFLAGS+=-include $(RPC_INC)/loc_api_sim.h
+LOCAL_CFLAGS+=-DDEBUG -DLOC_API_HOST_SIM
+
+LOCAL_C_INCLUDES:= \
+	$(LOCAL_PATH) \
+	$(LOCAL_PATH)/$(RPC_INC)
+
+LOCAL_MODULE:= libloc_api-rpc
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
 endif
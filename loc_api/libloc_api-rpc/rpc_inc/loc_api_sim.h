@@ -0,0 +1,142 @@
+/******************************************************************************
+  @file:  loc_api_sim.h
+  @brief:  Host-side LOC_APIPROG modem simulator
+
+  DESCRIPTION
+     Stand-in for the modem side of the Loc API RPC interface, used by the
+     host build of libloc_api-rpc/libloc_api. The simulator serves
+     rpc_loc_open, rpc_loc_close, rpc_loc_start_fix, rpc_loc_stop_fix and
+     rpc_loc_ioctl in-process, marshalling every call through the generated
+     XDR routines, and calls back through loc_apicbprog_0x00010001 with
+     scripted position, satellite, NMEA and ioctl report events.
+
+  INITIALIZATION AND SEQUENCING REQUIREMENTS
+     Configure with loc_api_sim_set_config() before loc_api_glue_init().
+     The simulator thread is started by loc_apicb_app_init() and stopped by
+     loc_apicb_app_deinit(), i.e. by the glue init/deinit calls.
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+  -----------------------------------------------------------------------------
+ ******************************************************************************/
+
+#ifndef LOC_API_SIM_H
+#define LOC_API_SIM_H
+
+#include <stdint.h>
+
+/* The host has no libcommondefs-rpc, provide the basic types it defines */
+typedef int32_t  int32;
+typedef uint32_t uint32;
+typedef int16_t  int16;
+typedef uint16_t uint16;
+typedef int8_t   int8;
+typedef uint8_t  uint8;
+
+#include "rpc_inc/loc_api_common.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Client handle returned by the simulated rpc_loc_open */
+#define LOC_API_SIM_CLIENT_HANDLE  1
+
+/* Simulator configuration, all intervals in msec, 0 disables the stream */
+typedef struct
+{
+    int      position_interval_ms;   /* RPC_LOC_EVENT_PARSED_POSITION_REPORT */
+    int      sv_interval_ms;         /* RPC_LOC_EVENT_SATELLITE_REPORT */
+    int      nmea_interval_ms;       /* RPC_LOC_EVENT_NMEA_POSITION_REPORT */
+    int      sv_count;               /* SVs per satellite report, max RPC_LOC_API_MAX_SV_COUNT */
+    int      sv_no_eph_every;        /* every nth SV is reported without ephemeris, 0 for none */
+    int      nmea_length;            /* bytes per NMEA report, max RPC_LOC_API_MAX_NMEA_STRING_LENGTH */
+    int      ioctl_delay_ms;         /* loc_ioctl to RPC_LOC_EVENT_IOCTL_REPORT delay */
+    int      rpc_call_us;            /* time every client call takes, in usec */
+    int32    ioctl_status;           /* status reported in RPC_LOC_EVENT_IOCTL_REPORT */
+    uint32   xtra_max_file_size;     /* reported by QUERY_PREDICTED_ORBITS_DATA_SOURCE */
+    uint32   xtra_max_part_size;
+    uint16   xtra_valid_hours;       /* validity of an injected XTRA file */
+    const char* xtra_servers[3];     /* reported by QUERY_PREDICTED_ORBITS_DATA_SOURCE, NULL for none */
+    int      agps_ttff_ms;           /* MS-based/assisted sessions, and speed or accuracy optimal ones, first
+                                        ask for a SUPL connection and fix this long after it is open, 0 to
+                                        fix as in standalone mode */
+    int      standalone_ttff_ms;     /* other sessions fix this long after the start, 0 for one
+                                        position interval */
+    int      atl_ready_ms;           /* an open status sooner than this after the request is refused */
+    int      atl_ni_delay_ms;        /* an NI SUPL session asks for a connection of its own this long
+                                        after the session's request, 0 for none */
+    int      slp_timeout_ms;         /* once its SUPL connection is open, an MS-based session connects
+                                        to the SLP set by SET_UMTS_SLP_SERVER_ADDR and waits this long
+                                        for its first byte, the session fails without it; 0 skips this */
+    int      server_ready_ms;        /* client calls fail with RPC_PROGUNAVAIL until this long after
+                                        the configuration is set, as before the modem's server is up */
+} loc_api_sim_config_s_type;
+
+/* Counters kept by the simulator */
+typedef struct
+{
+    uint32   ioctls_received;
+    uint32   positions_sent;
+    uint32   sv_reports_sent;
+    uint32   nmea_reports_sent;
+    uint32   ioctl_reports_sent;
+    uint32   other_events_sent;
+    /* XTRA parts taken by INJECT_PREDICTED_ORBITS_DATA, files that passed the checks */
+    uint32   xtra_parts_received;
+    uint32   xtra_bytes_received;
+    uint32   xtra_files_received;
+    /* SUPL connections asked for, open/close status reports taken or refused */
+    uint32   atl_open_requests;
+    uint32   atl_open_reports;
+    uint32   atl_open_refused;
+    uint32   atl_close_reports;
+    /* Most SUPL connections open at once, statuses for no such connection */
+    uint32   atl_conns_max;
+    uint32   atl_stale_reports;
+    /* RPC_LOC_IOCTL_SET_UMTS_SLP_SERVER_ADDR calls and the last URL set */
+    uint32   slp_servers_set;
+    char     slp_server[64];
+    /* Sessions that reached the SLP or failed to, see slp_timeout_ms */
+    uint32   slp_sessions;
+    uint32   slp_failures;
+    /* INFORM_NI_USER_RESPONSE calls, those letting a SUPL NI session go ahead,
+       and the last one's time from the response to its connection's open status */
+    uint32   ni_responses;
+    uint32   ni_accepted;
+    uint64_t ni_open_us;
+    /* Client calls refused while the server was not up yet */
+    uint32   calls_refused;
+    /* Time the callback thread spent inside loc_apicbprog_0x00010001 */
+    uint32   callback_count;
+    uint64_t callback_us_total;
+    uint64_t callback_us_max;
+} loc_api_sim_stats_s_type;
+
+extern void loc_api_sim_get_default_config(loc_api_sim_config_s_type *config);
+extern void loc_api_sim_set_config(const loc_api_sim_config_s_type *config);
+
+/* Queues one scripted event, delivered after delay_ms if the client registered for it */
+extern int loc_api_sim_post_event(
+      rpc_loc_event_mask_type               loc_event,
+      const rpc_loc_event_payload_u_type*   loc_event_payload,
+      int                                   delay_ms
+);
+
+extern void loc_api_sim_get_stats(loc_api_sim_stats_s_type *stats);
+extern void loc_api_sim_reset_stats(void);
+
+/* CLOCK_MONOTONIC in usec, also the clock used for position timestamps */
+extern uint64_t loc_api_sim_now_us(void);
+
+/* Transport used by loc_api_glue_init in the host build */
+extern CLIENT* loc_api_sim_clnt_create(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOC_API_SIM_H */
@@ -62,6 +62,11 @@ when       who      what, where, why
 /* Callback init */
 #include "rpc_inc/loc_apicb_appinit.h"
 
+#ifdef LOC_API_HOST_SIM
+/* In-process modem simulator */
+#include "rpc_inc/loc_api_sim.h"
+#endif
+
 /* Logging */
 #define LOG_TAG "lib_api_rpc_glue"
 #include <utils/Log.h>
@@ -161,7 +166,11 @@ int loc_api_glue_init(void)
     {
         /* Print msg */
         LOGD("Trying to create RPC client...\n");
+#ifdef LOC_API_HOST_SIM
+        loc_api_clnt = loc_api_sim_clnt_create();
+#else
         loc_api_clnt = clnt_create(NULL, LOC_APIPROG, /*LOC_APIVERS*/ 0x00010000, NULL);
+#endif
         LOGD("Created loc_api_clnt ---- %x\n", (unsigned int)loc_api_clnt);
 
         if (loc_api_clnt == NULL)
@@ -177,6 +186,9 @@ int loc_api_glue_init(void)
             LOGD("Loc API callback initialized.\n");
         } else {
             fprintf(stderr, "Loc API callback initialization failed.\n");
+            /* Drop the client so that the next call tries again */
+            clnt_destroy(loc_api_clnt);
+            loc_api_clnt = NULL;
             return 0;
         }
     }
@@ -347,12 +359,13 @@ int32 loc_ioctl(
     return (int32) rets.loc_ioctl_result;
 }
 
-/* Returns 0 if error */
+/* Returns RPC_LOC_API_RPC_FAILURE if the server does not answer */
 int32 loc_api_null(void)
 {
     LOC_GLUE_CHECK_INIT(int32);
 
-    int32 rets;
+    /* The null procedure returns nothing, rets is left as is */
+    int32 rets = 1;
     enum clnt_stat stat = RPC_SUCCESS;
 
     stat = RPC_FUNC_VERSION(rpc_loc_api_null_, LOC_APIVERS)(NULL, &rets, loc_api_clnt);
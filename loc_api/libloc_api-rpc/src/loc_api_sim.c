@@ -0,0 +1,1538 @@
+/******************************************************************************
+  @file  loc_api_sim.c
+  @brief Host-side LOC_APIPROG modem simulator
+
+  DESCRIPTION
+  Serves the LOC_APIPROG procedures in-process for the host build and
+  calls back through loc_apicbprog_0x00010001, so that the HAL can be
+  exercised and benchmarked without a modem.
+
+  Client calls go through a CLIENT whose cl_call marshals the arguments
+  with the generated XDR routines, decodes them again on the "modem" side
+  and runs the rpc_loc_*_svc procedure, like the RPC router would.
+  Callbacks are XDR encoded and handed to loc_apicbprog_0x00010001 through
+  an in-memory SVCXPRT, so the payload lifetime (svc_freeargs right after
+  the callback returns) is the same as on the target.
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+  -----------------------------------------------------------------------------
+ ******************************************************************************/
+
+/*=====================================================================
+                        EDIT HISTORY FOR MODULE
+
+  This section contains comments describing changes made to the module.
+  Notice that changes are listed in reverse chronological order.
+
+when       who      what, where, why
+--------   ---      -------------------------------------------------------
+10/17/26            Initial version
+
+======================================================================*/
+
+/*=====================================================================
+
+                     INCLUDE FILES FOR MODULE
+
+======================================================================*/
+#define LOG_NDEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <rpc/rpc.h>
+
+#include "rpc_inc/loc_api_rpc_glue.h"
+#include "rpc_inc/loc_api_sim.h"
+#include "rpc_inc/loc_apicb_appinit.h"
+
+/* Logging */
+#define LOG_TAG "loc_api_sim"
+#include <utils/Log.h>
+
+/* Comment this out to enable logging */
+#undef LOGD
+#define LOGD(...) {}
+
+/*=====================================================================
+     Data declarations
+======================================================================*/
+
+/* Large enough for any call or event, including a maximum size XTRA part */
+#define LOC_API_SIM_XDR_BUF_SIZE  (80 * 1024)
+
+/* SUPL connections the simulated modem keeps at once */
+#define LOC_API_SIM_MAX_ATL_CONNS  4
+
+#define LOC_API_SIM_NMEA_SENTENCE \
+    "$GPGGA,123519,3723.465,N,12205.164,W,1,08,0.9,545.4,M,46.9,M,,*47\r\n"
+
+extern void loc_apicbprog_0x00010001(struct svc_req *rqstp, register SVCXPRT *transp);
+
+typedef struct loc_api_sim_event loc_api_sim_event;
+struct loc_api_sim_event {
+    loc_api_sim_event             *next;
+    uint64_t                       due_us;
+    rpc_loc_event_mask_type        loc_event;
+    rpc_loc_event_payload_u_type   loc_event_payload;  /* XDR allocated copy */
+};
+
+typedef struct
+{
+    rpc_loc_server_connection_handle handle;  /* 0 for a free slot */
+    int                            requested;   /* open status still expected */
+    int                            fix_session; /* the fix waits for it, an NI session's does not */
+    uint64_t                       request_us;
+} loc_api_sim_atl_conn;
+
+typedef struct
+{
+    pthread_mutex_t                lock;
+    pthread_cond_t                 cond;
+    int                            cond_initialized;
+    pthread_t                      thread;
+    int                            thread_running;
+    int                            thread_need_exit;
+
+    loc_api_sim_config_s_type      config;
+    loc_api_sim_stats_s_type       stats;
+    /* When the configuration was set, see server_ready_ms */
+    uint64_t                       config_time_us;
+
+    /* Client state */
+    int                            client_open;
+    rpc_loc_event_mask_type        event_mask;
+    rpc_uint32                     cb_id;
+
+    /* Fix session state, next due time of each report stream */
+    int                            fix_active;
+    uint32                         fix_count;
+    uint32                         session_id;
+    uint64_t                       next_position_us;
+    uint64_t                       next_sv_us;
+    uint64_t                       next_nmea_us;
+
+    /* XTRA file being injected, next part expected and bytes so far */
+    uint32                         xtra_next_part;
+    uint32                         xtra_total_size;
+    uint32                         xtra_size;
+    int                            xtra_failed;
+    /* UTC time of the last good XTRA file, 0 if none */
+    time_t                         xtra_inject_time;
+
+    /* Operation mode from SET_FIX_CRITERIA, SUPL connections asked for or open */
+    rpc_loc_operation_mode_e_type  oper_mode;
+    rpc_loc_server_connection_handle atl_last_handle;
+    loc_api_sim_atl_conn           atl_conns[LOC_API_SIM_MAX_ATL_CONNS];
+    /* Connection of the NI session the user let go ahead, and when */
+    rpc_loc_server_connection_handle ni_conn_handle;
+    uint64_t                       ni_response_us;
+
+    /* One-shot events sorted by due time */
+    loc_api_sim_event             *events;
+} loc_api_sim_data_s_type;
+
+static loc_api_sim_data_s_type loc_api_sim = {
+    .lock   = PTHREAD_MUTEX_INITIALIZER,
+    .config = {
+        .position_interval_ms = 1000,
+        .sv_interval_ms       = 1000,
+        .nmea_interval_ms     = 1000,
+        .sv_count             = 12,
+        .sv_no_eph_every      = 4,
+        .nmea_length          = 512,
+        .ioctl_delay_ms       = 20,
+        .ioctl_status         = RPC_LOC_API_SUCCESS,
+        .xtra_max_file_size   = 100 * 1024,
+        .xtra_max_part_size   = 8 * 1024,
+        .xtra_valid_hours     = 7 * 24,
+    },
+};
+
+/* Serializes client calls, like a single RPC channel */
+static pthread_mutex_t loc_api_sim_call_lock = PTHREAD_MUTEX_INITIALIZER;
+static char loc_api_sim_call_buf[LOC_API_SIM_XDR_BUF_SIZE];
+
+/* Used under loc_api_sim.lock */
+static char loc_api_sim_copy_buf[LOC_API_SIM_XDR_BUF_SIZE];
+
+/* Used by the simulator thread only */
+static char loc_api_sim_cb_buf[LOC_API_SIM_XDR_BUF_SIZE];
+static u_int loc_api_sim_cb_len;
+
+static CLIENT loc_api_sim_clnt;
+static struct clnt_ops loc_api_sim_clnt_ops;
+static SVCXPRT loc_api_sim_xprt;
+static struct xp_ops loc_api_sim_xp_ops;
+
+/*=====================================================================
+     Helpers
+======================================================================*/
+
+uint64_t loc_api_sim_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Deep copy of an event payload, done with an XDR encode/decode round trip */
+static int loc_api_sim_copy_payload(rpc_loc_event_payload_u_type *dst,
+        const rpc_loc_event_payload_u_type *src)
+{
+    XDR xdrs;
+    u_int len;
+    bool_t ok;
+
+    xdrmem_create(&xdrs, loc_api_sim_copy_buf, sizeof(loc_api_sim_copy_buf), XDR_ENCODE);
+    ok = xdr_rpc_loc_event_payload_u_type(&xdrs, (rpc_loc_event_payload_u_type*) src);
+    len = xdr_getpos(&xdrs);
+    xdr_destroy(&xdrs);
+    if (!ok)
+    {
+        return -1;
+    }
+
+    memset(dst, 0, sizeof(*dst));
+    xdrmem_create(&xdrs, loc_api_sim_copy_buf, len, XDR_DECODE);
+    ok = xdr_rpc_loc_event_payload_u_type(&xdrs, dst);
+    xdr_destroy(&xdrs);
+
+    return ok ? 0 : -1;
+}
+
+/* Called with loc_api_sim.lock held */
+static int loc_api_sim_queue_event_locked(rpc_loc_event_mask_type loc_event,
+        const rpc_loc_event_payload_u_type *loc_event_payload, int delay_ms)
+{
+    loc_api_sim_event *event, **pos;
+    rpc_loc_event_payload_u_type payload;
+
+    event = (loc_api_sim_event*) malloc(sizeof(loc_api_sim_event));
+    if (event == NULL)
+    {
+        return -1;
+    }
+
+    // The union arm is selected by the event type
+    payload = *loc_event_payload;
+    payload.disc = loc_event;
+    if (loc_api_sim_copy_payload(&event->loc_event_payload, &payload) != 0)
+    {
+        LOGE("loc_api_sim_queue_event: cannot encode event 0x%llx", loc_event);
+        free(event);
+        return -1;
+    }
+    event->loc_event = loc_event;
+    event->due_us = loc_api_sim_now_us() + (uint64_t) delay_ms * 1000;
+
+    /* Keep the list sorted, events with the same due time stay in order */
+    pos = &loc_api_sim.events;
+    while (*pos != NULL && (*pos)->due_us <= event->due_us)
+    {
+        pos = &(*pos)->next;
+    }
+    event->next = *pos;
+    *pos = event;
+
+    if (loc_api_sim.cond_initialized)
+    {
+        pthread_cond_signal(&loc_api_sim.cond);
+    }
+    return 0;
+}
+
+static void loc_api_sim_free_event(loc_api_sim_event *event)
+{
+    xdr_free((xdrproc_t) xdr_rpc_loc_event_payload_u_type, (char*) &event->loc_event_payload);
+    free(event);
+}
+
+/* Called with loc_api_sim.lock held */
+static void loc_api_sim_queue_server_request_locked(rpc_loc_server_request_e_type request,
+                                                    rpc_loc_server_connection_handle conn_handle, int delay_ms)
+{
+    rpc_loc_event_payload_u_type payload;
+    rpc_loc_server_request_s_type *request_ptr;
+
+    memset(&payload, 0, sizeof(payload));
+    request_ptr = &payload.rpc_loc_event_payload_u_type_u.loc_server_request;
+    request_ptr->event = request;
+    request_ptr->payload.disc = request;
+    if (request == RPC_LOC_SERVER_REQUEST_OPEN)
+    {
+        request_ptr->payload.rpc_loc_server_request_u_type_u.open_req.conn_handle = conn_handle;
+        request_ptr->payload.rpc_loc_server_request_u_type_u.open_req.protocol = RPC_LOC_SERVER_PROTOCOL_SUPL;
+    }
+    else
+    {
+        request_ptr->payload.rpc_loc_server_request_u_type_u.close_req.conn_handle = conn_handle;
+    }
+
+    loc_api_sim_queue_event_locked(RPC_LOC_EVENT_LOCATION_SERVER_REQUEST, &payload, delay_ms);
+}
+
+/* Asks for a new SUPL connection delay_ms from now, returns its handle or 0,
+   called with loc_api_sim.lock held */
+static rpc_loc_server_connection_handle loc_api_sim_atl_open_locked(int fix_session, int delay_ms)
+{
+    loc_api_sim_atl_conn *conn = NULL;
+    uint32 i;
+
+    for (i = 0; i < LOC_API_SIM_MAX_ATL_CONNS && conn == NULL; i++)
+    {
+        if (loc_api_sim.atl_conns[i].handle == 0)
+        {
+            conn = &loc_api_sim.atl_conns[i];
+        }
+    }
+    if (conn == NULL)
+    {
+        return 0;
+    }
+
+    conn->handle = ++loc_api_sim.atl_last_handle;
+    conn->requested = TRUE;
+    conn->fix_session = fix_session;
+    conn->request_us = loc_api_sim_now_us() + (uint64_t) delay_ms * 1000;
+    loc_api_sim.stats.atl_open_requests++;
+    loc_api_sim_queue_server_request_locked(RPC_LOC_SERVER_REQUEST_OPEN, conn->handle, delay_ms);
+    return conn->handle;
+}
+
+/* Called with loc_api_sim.lock held */
+static loc_api_sim_atl_conn* loc_api_sim_atl_find_locked(rpc_loc_server_connection_handle conn_handle)
+{
+    uint32 i;
+
+    for (i = 0; i < LOC_API_SIM_MAX_ATL_CONNS; i++)
+    {
+        if (conn_handle != 0 && loc_api_sim.atl_conns[i].handle == conn_handle)
+        {
+            return &loc_api_sim.atl_conns[i];
+        }
+    }
+    return NULL;
+}
+
+static void loc_api_sim_queue_status_locked(rpc_loc_engine_state_e_type engine_state)
+{
+    rpc_loc_event_payload_u_type payload;
+    rpc_loc_status_event_s_type *status_ptr;
+
+    memset(&payload, 0, sizeof(payload));
+    status_ptr = &payload.rpc_loc_event_payload_u_type_u.status_report;
+    status_ptr->event = RPC_LOC_STATUS_EVENT_ENGINE_STATE;
+    status_ptr->payload.disc = RPC_LOC_STATUS_EVENT_ENGINE_STATE;
+    status_ptr->payload.rpc_loc_status_event_payload_u_type_u.engine_state = engine_state;
+
+    loc_api_sim_queue_event_locked(RPC_LOC_EVENT_STATUS_REPORT, &payload, 0);
+}
+
+/*=====================================================================
+     In-memory callback transport
+======================================================================*/
+
+static bool_t loc_api_sim_svc_getargs(SVCXPRT *xprt, xdrproc_t xdr_args, void *args_ptr)
+{
+    XDR xdrs;
+    bool_t ok;
+
+    xdrmem_create(&xdrs, loc_api_sim_cb_buf, loc_api_sim_cb_len, XDR_DECODE);
+    ok = (*xdr_args)(&xdrs, args_ptr);
+    xdr_destroy(&xdrs);
+    return ok;
+}
+
+static bool_t loc_api_sim_svc_freeargs(SVCXPRT *xprt, xdrproc_t xdr_args, void *args_ptr)
+{
+    xdr_free(xdr_args, (char*) args_ptr);
+    return TRUE;
+}
+
+static bool_t loc_api_sim_svc_reply(SVCXPRT *xprt, struct rpc_msg *msg)
+{
+    if (msg->rm_reply.rp_stat != MSG_ACCEPTED ||
+        msg->rm_reply.rp_acpt.ar_stat != SUCCESS)
+    {
+        LOGE("loc_api_sim_svc_reply: callback rejected");
+    }
+    return TRUE;
+}
+
+static bool_t loc_api_sim_svc_recv(SVCXPRT *xprt, struct rpc_msg *msg)
+{
+    return FALSE;
+}
+
+static enum xprt_stat loc_api_sim_svc_stat(SVCXPRT *xprt)
+{
+    return XPRT_IDLE;
+}
+
+static void loc_api_sim_svc_destroy(SVCXPRT *xprt)
+{
+}
+
+/* Delivers one event through loc_apicbprog_0x00010001, simulator thread only */
+static void loc_api_sim_deliver(rpc_loc_event_mask_type loc_event,
+        rpc_loc_event_payload_u_type *loc_event_payload)
+{
+    rpc_loc_event_cb_f_type_args args;
+    struct svc_req req;
+    XDR xdrs;
+    bool_t ok;
+    uint64_t start_us, elapsed_us;
+
+    loc_event_payload->disc = loc_event;
+    args.cb_id = loc_api_sim.cb_id;
+    args.loc_handle = LOC_API_SIM_CLIENT_HANDLE;
+    args.loc_event = loc_event;
+    args.loc_event_payload = loc_event_payload;
+
+    xdrmem_create(&xdrs, loc_api_sim_cb_buf, sizeof(loc_api_sim_cb_buf), XDR_ENCODE);
+    ok = xdr_rpc_loc_event_cb_f_type_args(&xdrs, &args);
+    loc_api_sim_cb_len = xdr_getpos(&xdrs);
+    xdr_destroy(&xdrs);
+    if (!ok)
+    {
+        LOGE("loc_api_sim_deliver: cannot encode event 0x%llx", loc_event);
+        return;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.rq_prog = LOC_APICBPROG;
+    req.rq_vers = LOC_APICBVERS_0001;
+    req.rq_proc = rpc_loc_event_cb_f_type;
+    req.rq_xprt = &loc_api_sim_xprt;
+
+    start_us = loc_api_sim_now_us();
+    loc_apicbprog_0x00010001(&req, &loc_api_sim_xprt);
+    elapsed_us = loc_api_sim_now_us() - start_us;
+
+    pthread_mutex_lock(&loc_api_sim.lock);
+    switch (loc_event)
+    {
+        case RPC_LOC_EVENT_PARSED_POSITION_REPORT:
+            loc_api_sim.stats.positions_sent++;
+            break;
+        case RPC_LOC_EVENT_SATELLITE_REPORT:
+            loc_api_sim.stats.sv_reports_sent++;
+            break;
+        case RPC_LOC_EVENT_NMEA_POSITION_REPORT:
+            loc_api_sim.stats.nmea_reports_sent++;
+            break;
+        case RPC_LOC_EVENT_IOCTL_REPORT:
+            loc_api_sim.stats.ioctl_reports_sent++;
+            break;
+        default:
+            loc_api_sim.stats.other_events_sent++;
+            break;
+    }
+    loc_api_sim.stats.callback_count++;
+    loc_api_sim.stats.callback_us_total += elapsed_us;
+    if (elapsed_us > loc_api_sim.stats.callback_us_max)
+    {
+        loc_api_sim.stats.callback_us_max = elapsed_us;
+    }
+    pthread_mutex_unlock(&loc_api_sim.lock);
+}
+
+/*=====================================================================
+     Scripted report streams
+======================================================================*/
+
+static void loc_api_sim_send_position(uint32 fix_count)
+{
+    rpc_loc_event_payload_u_type payload;
+    rpc_loc_parsed_position_s_type *pos_ptr;
+
+    memset(&payload, 0, sizeof(payload));
+    pos_ptr = &payload.rpc_loc_event_payload_u_type_u.parsed_location_report;
+    pos_ptr->valid_mask = RPC_LOC_POS_VALID_SESSION_STATUS |
+                          RPC_LOC_POS_VALID_TIMESTAMP_UTC |
+                          RPC_LOC_POS_VALID_LATITUDE |
+                          RPC_LOC_POS_VALID_LONGITUDE |
+                          RPC_LOC_POS_VALID_ALTITUDE_WRT_ELLIPSOID |
+                          RPC_LOC_POS_VALID_SPEED_HORIZONTAL |
+                          RPC_LOC_POS_VALID_SPEED_VERTICAL |
+                          RPC_LOC_POS_VALID_HEADING |
+                          RPC_LOC_POS_VALID_HOR_UNC_CIRCULAR;
+    pos_ptr->session_status = RPC_LOC_SESS_STATUS_SUCCESS;
+    // Monotonic send time, lets the receiver measure delivery latency
+    pos_ptr->timestamp_utc = loc_api_sim_now_us();
+    pos_ptr->latitude = 37.3910 + fix_count * 0.00001;
+    pos_ptr->longitude = -122.0861;
+    pos_ptr->altitude_wrt_ellipsoid = 32.0;
+    pos_ptr->speed_horizontal = 1.2;
+    pos_ptr->speed_vertical = 0.0;
+    pos_ptr->heading = 90.0;
+    pos_ptr->hor_unc_circular = 8.0;
+
+    loc_api_sim_deliver(RPC_LOC_EVENT_PARSED_POSITION_REPORT, &payload);
+}
+
+static void loc_api_sim_send_sv(int sv_count, int no_eph_every)
+{
+    static rpc_loc_sv_info_s_type sv_list[RPC_LOC_API_MAX_SV_COUNT];
+    rpc_loc_event_payload_u_type payload;
+    rpc_loc_gnss_info_s_type *gnss_ptr;
+    int i;
+
+    if (sv_count > RPC_LOC_API_MAX_SV_COUNT)
+    {
+        sv_count = RPC_LOC_API_MAX_SV_COUNT;
+    }
+
+    for (i = 0; i < sv_count; i++)
+    {
+        sv_list[i].valid_mask = RPC_LOC_SV_INFO_VALID_SYSTEM |
+                                RPC_LOC_SV_INFO_VALID_PRN |
+                                RPC_LOC_SV_INFO_VALID_PROCESS_STATUS |
+                                RPC_LOC_SV_INFO_VALID_HAS_EPH |
+                                RPC_LOC_SV_INFO_VALID_HAS_ALM |
+                                RPC_LOC_SV_INFO_VALID_ELEVATION |
+                                RPC_LOC_SV_INFO_VALID_AZIMUTH |
+                                RPC_LOC_SV_INFO_VALID_SNR;
+        sv_list[i].system = RPC_LOC_SV_SYSTEM_GPS;
+        sv_list[i].prn = (i % 32) + 1;
+        sv_list[i].health_status = 1;
+        sv_list[i].process_status = (i % 3) ? RPC_LOC_SV_STATUS_TRACK : RPC_LOC_SV_STATUS_SEARCH;
+        sv_list[i].has_eph = no_eph_every == 0 || (i % no_eph_every) != no_eph_every - 1;
+        sv_list[i].has_alm = 1;
+        sv_list[i].elevation = 10.0 + (i * 7) % 80;
+        sv_list[i].azimuth = (i * 37) % 360;
+        sv_list[i].snr = 20.0 + (i * 3) % 25;
+    }
+
+    memset(&payload, 0, sizeof(payload));
+    gnss_ptr = &payload.rpc_loc_event_payload_u_type_u.gnss_report;
+    gnss_ptr->valid_mask = RPC_LOC_GNSS_INFO_VALID_SV_COUNT | RPC_LOC_GNSS_INFO_VALID_SV_LIST;
+    gnss_ptr->sv_count = sv_count;
+    gnss_ptr->sv_list.sv_list_len = sv_count;
+    gnss_ptr->sv_list.sv_list_val = sv_list;
+
+    loc_api_sim_deliver(RPC_LOC_EVENT_SATELLITE_REPORT, &payload);
+}
+
+static void loc_api_sim_send_nmea(int nmea_length)
+{
+    static char nmea[RPC_LOC_API_MAX_NMEA_STRING_LENGTH];
+    rpc_loc_event_payload_u_type payload;
+    rpc_loc_nmea_report_s_type *nmea_ptr;
+    int sentence_len = strlen(LOC_API_SIM_NMEA_SENTENCE);
+    int i;
+
+    if (nmea_length > RPC_LOC_API_MAX_NMEA_STRING_LENGTH)
+    {
+        nmea_length = RPC_LOC_API_MAX_NMEA_STRING_LENGTH;
+    }
+    for (i = 0; i < nmea_length; i++)
+    {
+        nmea[i] = LOC_API_SIM_NMEA_SENTENCE[i % sentence_len];
+    }
+
+    memset(&payload, 0, sizeof(payload));
+    nmea_ptr = &payload.rpc_loc_event_payload_u_type_u.nmea_report;
+    nmea_ptr->length = nmea_length;
+    nmea_ptr->nmea_sentences.nmea_sentences_len = nmea_length;
+    nmea_ptr->nmea_sentences.nmea_sentences_val = nmea;
+
+    loc_api_sim_deliver(RPC_LOC_EVENT_NMEA_POSITION_REPORT, &payload);
+}
+
+/* Returns TRUE if the stream is due, and schedules its next report */
+static int loc_api_sim_stream_due(uint64_t *next_us, int interval_ms, uint64_t now_us)
+{
+    if (interval_ms <= 0 || *next_us == 0 || *next_us > now_us)
+    {
+        return FALSE;
+    }
+    *next_us += (uint64_t) interval_ms * 1000;
+    return TRUE;
+}
+
+static void loc_api_sim_next_due(uint64_t *deadline_us, uint64_t next_us, int interval_ms)
+{
+    if (interval_ms > 0 && next_us != 0 && (*deadline_us == 0 || next_us < *deadline_us))
+    {
+        *deadline_us = next_us;
+    }
+}
+
+static void* loc_api_sim_thread_proc(void *arg)
+{
+    loc_api_sim_event *event;
+    loc_api_sim_config_s_type *config = &loc_api_sim.config;
+    uint64_t now_us, deadline_us;
+    struct timespec ts;
+    int deliver;
+
+    LOGD("loc_api_sim_thread_proc: started");
+
+    pthread_mutex_lock(&loc_api_sim.lock);
+    while (!loc_api_sim.thread_need_exit)
+    {
+        now_us = loc_api_sim_now_us();
+
+        event = loc_api_sim.events;
+        if (event != NULL && event->due_us <= now_us)
+        {
+            loc_api_sim.events = event->next;
+            deliver = loc_api_sim.client_open && (loc_api_sim.event_mask & event->loc_event);
+            pthread_mutex_unlock(&loc_api_sim.lock);
+
+            if (deliver)
+            {
+                loc_api_sim_deliver(event->loc_event, &event->loc_event_payload);
+            }
+            loc_api_sim_free_event(event);
+
+            pthread_mutex_lock(&loc_api_sim.lock);
+            continue;
+        }
+
+        if (loc_api_sim.fix_active && loc_api_sim.client_open)
+        {
+            if (loc_api_sim_stream_due(&loc_api_sim.next_position_us, config->position_interval_ms, now_us))
+            {
+                deliver = (loc_api_sim.event_mask & RPC_LOC_EVENT_PARSED_POSITION_REPORT) != 0;
+                uint32 fix_count = loc_api_sim.fix_count++;
+                pthread_mutex_unlock(&loc_api_sim.lock);
+                if (deliver) loc_api_sim_send_position(fix_count);
+                pthread_mutex_lock(&loc_api_sim.lock);
+                continue;
+            }
+
+            if (loc_api_sim_stream_due(&loc_api_sim.next_sv_us, config->sv_interval_ms, now_us))
+            {
+                deliver = (loc_api_sim.event_mask & RPC_LOC_EVENT_SATELLITE_REPORT) != 0;
+                int sv_count = config->sv_count;
+                int no_eph_every = config->sv_no_eph_every;
+                pthread_mutex_unlock(&loc_api_sim.lock);
+                if (deliver) loc_api_sim_send_sv(sv_count, no_eph_every);
+                pthread_mutex_lock(&loc_api_sim.lock);
+                continue;
+            }
+
+            if (loc_api_sim_stream_due(&loc_api_sim.next_nmea_us, config->nmea_interval_ms, now_us))
+            {
+                deliver = (loc_api_sim.event_mask & RPC_LOC_EVENT_NMEA_POSITION_REPORT) != 0;
+                int nmea_length = config->nmea_length;
+                pthread_mutex_unlock(&loc_api_sim.lock);
+                if (deliver) loc_api_sim_send_nmea(nmea_length);
+                pthread_mutex_lock(&loc_api_sim.lock);
+                continue;
+            }
+        }
+
+        // Nothing due, sleep until the next report or a new event
+        deadline_us = loc_api_sim.events != NULL ? loc_api_sim.events->due_us : 0;
+        if (loc_api_sim.fix_active && loc_api_sim.client_open)
+        {
+            loc_api_sim_next_due(&deadline_us, loc_api_sim.next_position_us, config->position_interval_ms);
+            loc_api_sim_next_due(&deadline_us, loc_api_sim.next_sv_us, config->sv_interval_ms);
+            loc_api_sim_next_due(&deadline_us, loc_api_sim.next_nmea_us, config->nmea_interval_ms);
+        }
+
+        if (deadline_us == 0)
+        {
+            pthread_cond_wait(&loc_api_sim.cond, &loc_api_sim.lock);
+        }
+        else
+        {
+            ts.tv_sec  = deadline_us / 1000000;
+            ts.tv_nsec = (deadline_us % 1000000) * 1000;
+            pthread_cond_timedwait(&loc_api_sim.cond, &loc_api_sim.lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&loc_api_sim.lock);
+
+    LOGD("loc_api_sim_thread_proc: exiting");
+    return NULL;
+}
+
+/*=====================================================================
+     LOC_APIPROG server procedures
+======================================================================*/
+
+bool_t rpc_loc_api_null_0x00010001_svc(void *argp, void *result, struct svc_req *req)
+{
+    return 1;
+}
+
+bool_t rpc_loc_api_rpc_glue_code_info_remote_0x00010001_svc(void *argp,
+        rpc_loc_api_rpc_glue_code_info_remote_rets *result, struct svc_req *req)
+{
+    memset(result, 0, sizeof(*result));
+    return 1;
+}
+
+bool_t rpc_loc_open_0x00010001_svc(rpc_loc_open_args *argp, rpc_loc_open_rets *result,
+        struct svc_req *req)
+{
+    pthread_mutex_lock(&loc_api_sim.lock);
+    if (loc_api_sim.client_open)
+    {
+        LOGE("rpc_loc_open: simulator supports one client only");
+        result->loc_open_result = RPC_LOC_CLIENT_HANDLE_INVALID;
+    }
+    else
+    {
+        loc_api_sim.client_open = TRUE;
+        loc_api_sim.event_mask = argp->event_reg_mask;
+        loc_api_sim.cb_id = argp->event_callback;
+        loc_api_sim.fix_active = FALSE;
+        result->loc_open_result = LOC_API_SIM_CLIENT_HANDLE;
+    }
+    pthread_mutex_unlock(&loc_api_sim.lock);
+
+    LOGD("rpc_loc_open: mask = 0x%llx, handle = %ld", argp->event_reg_mask, result->loc_open_result);
+    return 1;
+}
+
+bool_t rpc_loc_close_0x00010001_svc(rpc_loc_close_args *argp, rpc_loc_close_rets *result,
+        struct svc_req *req)
+{
+    pthread_mutex_lock(&loc_api_sim.lock);
+    if (!loc_api_sim.client_open || argp->handle != LOC_API_SIM_CLIENT_HANDLE)
+    {
+        result->loc_close_result = RPC_LOC_API_INVALID_HANDLE;
+    }
+    else
+    {
+        loc_api_sim.client_open = FALSE;
+        loc_api_sim.fix_active = FALSE;
+        result->loc_close_result = RPC_LOC_API_SUCCESS;
+    }
+    pthread_mutex_unlock(&loc_api_sim.lock);
+    return 1;
+}
+
+bool_t rpc_loc_start_fix_0x00010001_svc(rpc_loc_start_fix_args *argp, rpc_loc_start_fix_rets *result,
+        struct svc_req *req)
+{
+    loc_api_sim_config_s_type *config = &loc_api_sim.config;
+    uint64_t now_us;
+
+    pthread_mutex_lock(&loc_api_sim.lock);
+    if (!loc_api_sim.client_open || argp->handle != LOC_API_SIM_CLIENT_HANDLE)
+    {
+        result->loc_start_fix_result = RPC_LOC_API_INVALID_HANDLE;
+    }
+    else
+    {
+        if (!loc_api_sim.fix_active)
+        {
+            // First reports one interval after the session starts
+            now_us = loc_api_sim_now_us();
+            loc_api_sim.fix_active = TRUE;
+            loc_api_sim.session_id++;
+            loc_api_sim.next_position_us = now_us + (uint64_t) config->position_interval_ms * 1000;
+            loc_api_sim.next_sv_us = now_us + (uint64_t) config->sv_interval_ms * 1000;
+            loc_api_sim.next_nmea_us = now_us + (uint64_t) config->nmea_interval_ms * 1000;
+            loc_api_sim_queue_status_locked(RPC_LOC_ENGINE_STATE_ON);
+            if (config->standalone_ttff_ms > 0)
+            {
+                loc_api_sim.next_position_us = now_us + (uint64_t) config->standalone_ttff_ms * 1000;
+            }
+            if (config->agps_ttff_ms > 0 &&
+                (loc_api_sim.oper_mode == RPC_LOC_OPER_MODE_MSB || loc_api_sim.oper_mode == RPC_LOC_OPER_MODE_MSA ||
+                 loc_api_sim.oper_mode == RPC_LOC_OPER_MODE_SPEED_OPTIMAL ||
+                 loc_api_sim.oper_mode == RPC_LOC_OPER_MODE_ACCURACY_OPTIMAL))
+            {
+                // No fix until the SUPL connection is open, or refused
+                loc_api_sim.next_position_us = 0;
+                loc_api_sim_atl_open_locked(TRUE, 0);
+                if (config->atl_ni_delay_ms > 0)
+                {
+                    loc_api_sim_atl_open_locked(FALSE, config->atl_ni_delay_ms);
+                }
+            }
+        }
+        result->loc_start_fix_result = RPC_LOC_API_SUCCESS;
+    }
+    pthread_mutex_unlock(&loc_api_sim.lock);
+    return 1;
+}
+
+bool_t rpc_loc_stop_fix_0x00010001_svc(rpc_loc_stop_fix_args *argp, rpc_loc_stop_fix_rets *result,
+        struct svc_req *req)
+{
+    pthread_mutex_lock(&loc_api_sim.lock);
+    if (!loc_api_sim.client_open || argp->handle != LOC_API_SIM_CLIENT_HANDLE)
+    {
+        result->loc_stop_fix_result = RPC_LOC_API_INVALID_HANDLE;
+    }
+    else
+    {
+        if (loc_api_sim.fix_active)
+        {
+            loc_api_sim.fix_active = FALSE;
+            loc_api_sim_queue_status_locked(RPC_LOC_ENGINE_STATE_OFF);
+        }
+        result->loc_stop_fix_result = RPC_LOC_API_SUCCESS;
+    }
+    pthread_mutex_unlock(&loc_api_sim.lock);
+    return 1;
+}
+
+typedef struct
+{
+    uint32                         session_id;
+    rpc_loc_server_connection_handle conn_handle;
+    char                           url[64];
+} loc_api_sim_slp_session;
+
+/* Connects to url ("a.b.c.d:port") and waits for its first byte, returns TRUE if it came in time */
+static int loc_api_sim_slp_reach(const char *url, int timeout_ms)
+{
+    char host[64];
+    char *colon_ptr;
+    struct sockaddr_in sa;
+    struct pollfd pfd;
+    uint64_t deadline_us = loc_api_sim_now_us() + (uint64_t) timeout_ms * 1000;
+    int fd, error = 0, ok = FALSE;
+    socklen_t len = sizeof(error);
+    char byte;
+
+    snprintf(host, sizeof(host), "%s", url);
+    colon_ptr = strrchr(host, ':');
+    if (colon_ptr == NULL)
+    {
+        return FALSE;
+    }
+    *colon_ptr = 0;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(atoi(colon_ptr + 1));
+    if (inet_pton(AF_INET, host, &sa.sin_addr) != 1 || (fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    {
+        return FALSE;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    pfd.fd = fd;
+    if (connect(fd, (struct sockaddr *) &sa, sizeof(sa)) == 0 || errno == EINPROGRESS)
+    {
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, timeout_ms) == 1 &&
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0)
+        {
+            pfd.events = POLLIN;
+            timeout_ms = (int) (((int64_t) deadline_us - (int64_t) loc_api_sim_now_us()) / 1000);
+            ok = timeout_ms > 0 && poll(&pfd, 1, timeout_ms) == 1 && recv(fd, &byte, 1, 0) == 1;
+        }
+    }
+    close(fd);
+
+    return ok;
+}
+
+/* Runs the SUPL exchange of a session, a detached thread per session */
+static void* loc_api_sim_slp_thread(void *arg)
+{
+    loc_api_sim_slp_session *session = (loc_api_sim_slp_session*) arg;
+    loc_api_sim_config_s_type *config = &loc_api_sim.config;
+    rpc_loc_event_payload_u_type payload;
+    rpc_loc_parsed_position_s_type *pos_ptr;
+    int ok;
+
+    ok = loc_api_sim_slp_reach(session->url, config->slp_timeout_ms);
+
+    pthread_mutex_lock(&loc_api_sim.lock);
+    if (ok)
+    {
+        loc_api_sim.stats.slp_sessions++;
+    }
+    else
+    {
+        loc_api_sim.stats.slp_failures++;
+    }
+    if (loc_api_sim.fix_active && loc_api_sim.session_id == session->session_id)
+    {
+        if (ok)
+        {
+            loc_api_sim.next_position_us = loc_api_sim_now_us() + (uint64_t) config->agps_ttff_ms * 1000;
+        }
+        else
+        {
+            // The assisted session fails, the modem goes on standalone
+            memset(&payload, 0, sizeof(payload));
+            pos_ptr = &payload.rpc_loc_event_payload_u_type_u.parsed_location_report;
+            pos_ptr->valid_mask = RPC_LOC_POS_VALID_SESSION_STATUS;
+            pos_ptr->session_status = RPC_LOC_SESS_STATUS_GENERAL_FAILURE;
+            loc_api_sim_queue_event_locked(RPC_LOC_EVENT_PARSED_POSITION_REPORT, &payload, 0);
+            loc_api_sim.next_position_us = loc_api_sim_now_us() + (uint64_t) config->position_interval_ms * 1000;
+        }
+    }
+    loc_api_sim_queue_server_request_locked(RPC_LOC_SERVER_REQUEST_CLOSE, session->conn_handle,
+                                            ok ? config->agps_ttff_ms + 10 : 0);
+    pthread_mutex_unlock(&loc_api_sim.lock);
+
+    free(session);
+    return NULL;
+}
+
+/* Takes an open or close status of the SUPL connection, returns the ioctl status */
+static int32 loc_api_sim_atl_status(rpc_loc_ioctl_e_type ioctl_type, const rpc_loc_ioctl_data_u_type *data_ptr)
+{
+    loc_api_sim_config_s_type *config = &loc_api_sim.config;
+    const rpc_loc_server_open_status_s_type *open_ptr;
+    loc_api_sim_atl_conn *conn;
+    loc_api_sim_slp_session *session;
+    pthread_attr_t attr;
+    pthread_t thread;
+    uint32 i, open_count;
+    int32 status = config->ioctl_status;
+    uint64_t now_us = loc_api_sim_now_us();
+
+    if (data_ptr == NULL)
+    {
+        return status;
+    }
+
+    pthread_mutex_lock(&loc_api_sim.lock);
+    if (ioctl_type == RPC_LOC_IOCTL_INFORM_SERVER_CLOSE_STATUS)
+    {
+        conn = loc_api_sim_atl_find_locked(data_ptr->rpc_loc_ioctl_data_u_type_u.conn_close_status.conn_handle);
+        if (conn == NULL || conn->requested)
+        {
+            loc_api_sim.stats.atl_stale_reports++;
+        }
+        else
+        {
+            loc_api_sim.stats.atl_close_reports++;
+            conn->handle = 0;
+        }
+    }
+    else if ((conn = loc_api_sim_atl_find_locked(
+                data_ptr->rpc_loc_ioctl_data_u_type_u.conn_open_status.conn_handle)) == NULL ||
+             !conn->requested)
+    {
+        loc_api_sim.stats.atl_stale_reports++;
+    }
+    else
+    {
+        open_ptr = &data_ptr->rpc_loc_ioctl_data_u_type_u.conn_open_status;
+        if (now_us < conn->request_us + (uint64_t) config->atl_ready_ms * 1000)
+        {
+            // The ATL module is not ready for it yet
+            loc_api_sim.stats.atl_open_refused++;
+            status = RPC_LOC_API_GENERAL_FAILURE;
+        }
+        else
+        {
+            loc_api_sim.stats.atl_open_reports++;
+            conn->requested = FALSE;
+            if (conn->handle == loc_api_sim.ni_conn_handle)
+            {
+                loc_api_sim.stats.ni_open_us = now_us - loc_api_sim.ni_response_us;
+                loc_api_sim.ni_conn_handle = 0;
+            }
+            if (open_ptr->open_status != RPC_LOC_SERVER_OPEN_SUCCESS)
+            {
+                conn->handle = 0;
+                if (loc_api_sim.fix_active && conn->fix_session)
+                {
+                    loc_api_sim.next_position_us = now_us + (uint64_t) config->position_interval_ms * 1000;
+                }
+            }
+            else
+            {
+                for (i = 0, open_count = 0; i < LOC_API_SIM_MAX_ATL_CONNS; i++)
+                {
+                    if (loc_api_sim.atl_conns[i].handle != 0 && !loc_api_sim.atl_conns[i].requested)
+                    {
+                        open_count++;
+                    }
+                }
+                if (open_count > loc_api_sim.stats.atl_conns_max)
+                {
+                    loc_api_sim.stats.atl_conns_max = open_count;
+                }
+                // Assisted session, then the connection is given back
+                if (loc_api_sim.fix_active && conn->fix_session && config->slp_timeout_ms > 0 &&
+                    (session = (loc_api_sim_slp_session*) malloc(sizeof(*session))) != NULL)
+                {
+                    session->session_id = loc_api_sim.session_id;
+                    session->conn_handle = conn->handle;
+                    snprintf(session->url, sizeof(session->url), "%s", loc_api_sim.stats.slp_server);
+                    pthread_attr_init(&attr);
+                    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+                    if (pthread_create(&thread, &attr, loc_api_sim_slp_thread, session) != 0)
+                    {
+                        free(session);
+                    }
+                    pthread_attr_destroy(&attr);
+                }
+                else
+                {
+                    if (loc_api_sim.fix_active && conn->fix_session)
+                    {
+                        loc_api_sim.next_position_us = now_us + (uint64_t) config->agps_ttff_ms * 1000;
+                    }
+                    loc_api_sim_queue_server_request_locked(RPC_LOC_SERVER_REQUEST_CLOSE, conn->handle,
+                                                            config->agps_ttff_ms + 10);
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&loc_api_sim.lock);
+
+    return status;
+}
+
+/* Takes the user's answer to an NI request, a SUPL NI session that may go
+   ahead asks for its connection at once */
+static void loc_api_sim_ni_response(const rpc_loc_user_verify_s_type *verify_ptr)
+{
+    const rpc_loc_ni_event_s_type *ni_ptr = &verify_ptr->ni_event_pass_back;
+    int go_ahead;
+
+    go_ahead = ni_ptr->event == RPC_LOC_NI_EVENT_SUPL_NOTIFY_VERIFY_REQ &&
+               (verify_ptr->user_resp == RPC_LOC_NI_LCS_NOTIFY_VERIFY_ACCEPT ||
+                (verify_ptr->user_resp == RPC_LOC_NI_LCS_NOTIFY_VERIFY_NORESP &&
+                 ni_ptr->payload.rpc_loc_ni_event_payload_u_type_u.supl_req.notification_priv_type ==
+                 RPC_LOC_NI_USER_NOTIFY_VERIFY_ALLOW_NO_RESP));
+
+    pthread_mutex_lock(&loc_api_sim.lock);
+    loc_api_sim.stats.ni_responses++;
+    if (go_ahead)
+    {
+        loc_api_sim.stats.ni_accepted++;
+        loc_api_sim.ni_response_us = loc_api_sim_now_us();
+        loc_api_sim.ni_conn_handle = loc_api_sim_atl_open_locked(FALSE, 0);
+    }
+    pthread_mutex_unlock(&loc_api_sim.lock);
+}
+
+/* Checks one XTRA part against the advertised limits and the parts before it,
+   returns FALSE if the file being injected is broken */
+static int loc_api_sim_inject_xtra_part(const rpc_loc_predicted_orbits_data_s_type *orbits_ptr)
+{
+    int ret_val = TRUE;
+
+    pthread_mutex_lock(&loc_api_sim.lock);
+    if (orbits_ptr->part == 1)
+    {
+        loc_api_sim.xtra_next_part = 1;
+        loc_api_sim.xtra_total_size = orbits_ptr->total_size;
+        loc_api_sim.xtra_size = 0;
+        loc_api_sim.xtra_failed = orbits_ptr->total_size > loc_api_sim.config.xtra_max_file_size;
+    }
+    if (orbits_ptr->part != loc_api_sim.xtra_next_part ||
+        orbits_ptr->part_len > loc_api_sim.config.xtra_max_part_size ||
+        orbits_ptr->part_len != orbits_ptr->data_ptr.data_ptr_len)
+    {
+        loc_api_sim.xtra_failed = TRUE;
+    }
+    loc_api_sim.xtra_next_part = orbits_ptr->part + 1;
+    loc_api_sim.xtra_size += orbits_ptr->data_ptr.data_ptr_len;
+    loc_api_sim.stats.xtra_parts_received++;
+    loc_api_sim.stats.xtra_bytes_received += orbits_ptr->data_ptr.data_ptr_len;
+
+    if (orbits_ptr->part == orbits_ptr->total_parts)
+    {
+        if (loc_api_sim.xtra_size != loc_api_sim.xtra_total_size)
+        {
+            loc_api_sim.xtra_failed = TRUE;
+        }
+        if (loc_api_sim.xtra_failed)
+        {
+            LOGE("loc_api_sim: broken XTRA file, %u of %u bytes", loc_api_sim.xtra_size,
+                 loc_api_sim.xtra_total_size);
+            ret_val = FALSE;
+        }
+        else
+        {
+            loc_api_sim.stats.xtra_files_received++;
+            loc_api_sim.xtra_inject_time = time(NULL);
+        }
+        loc_api_sim.xtra_next_part = 0;
+    }
+    pthread_mutex_unlock(&loc_api_sim.lock);
+
+    return ret_val;
+}
+
+bool_t rpc_loc_ioctl_0x00010001_svc(rpc_loc_ioctl_args *argp, rpc_loc_ioctl_rets *result,
+        struct svc_req *req)
+{
+    static char empty_server[] = "";
+    rpc_loc_event_payload_u_type payload;
+    rpc_loc_ioctl_callback_s_type *cb_ptr;
+    rpc_loc_predicted_orbits_data_source_s_type *source_ptr;
+    rpc_loc_predicted_orbits_data_s_type *orbits_ptr;
+    rpc_loc_predicted_orbits_data_validity_report_s_type *validity_ptr;
+    rpc_loc_server_info_s_type *server_ptr;
+    int send_report = TRUE;
+    int i;
+
+    memset(&payload, 0, sizeof(payload));
+    cb_ptr = &payload.rpc_loc_event_payload_u_type_u.ioctl_report;
+    cb_ptr->type = argp->ioctl_type;
+    cb_ptr->status = loc_api_sim.config.ioctl_status;
+    cb_ptr->data.disc = argp->ioctl_type;
+
+    switch (argp->ioctl_type)
+    {
+        case RPC_LOC_IOCTL_GET_API_VERSION:
+            cb_ptr->data.rpc_loc_ioctl_callback_data_u_type_u.api_version.major = RPC_LOC_API_MAJOR_VERSION_NUMBER;
+            cb_ptr->data.rpc_loc_ioctl_callback_data_u_type_u.api_version.minor = RPC_LOC_API_MINOR_VERSION_NUMBER;
+            break;
+
+        case RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_SOURCE:
+            source_ptr = &cb_ptr->data.rpc_loc_ioctl_callback_data_u_type_u.predicted_orbits_data_source;
+            source_ptr->max_file_size = loc_api_sim.config.xtra_max_file_size;
+            source_ptr->max_part_size = loc_api_sim.config.xtra_max_part_size;
+            for (i = 0; i < 3; i++)
+            {
+                source_ptr->servers[i] = loc_api_sim.config.xtra_servers[i] != NULL ?
+                        (char*) loc_api_sim.config.xtra_servers[i] : empty_server;
+            }
+            break;
+
+        case RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_VALIDITY:
+            validity_ptr = &cb_ptr->data.rpc_loc_ioctl_callback_data_u_type_u.predicted_orbits_data_validity;
+            pthread_mutex_lock(&loc_api_sim.lock);
+            if (loc_api_sim.xtra_inject_time != 0)
+            {
+                validity_ptr->start_time_utc = loc_api_sim.xtra_inject_time;
+                validity_ptr->valid_duration_hrs = loc_api_sim.config.xtra_valid_hours;
+            }
+            pthread_mutex_unlock(&loc_api_sim.lock);
+            break;
+
+        case RPC_LOC_IOCTL_SET_FIX_CRITERIA:
+            if (argp->ioctl_data != NULL)
+            {
+                pthread_mutex_lock(&loc_api_sim.lock);
+                loc_api_sim.oper_mode = argp->ioctl_data->rpc_loc_ioctl_data_u_type_u.fix_criteria.preferred_operation_mode;
+                pthread_mutex_unlock(&loc_api_sim.lock);
+            }
+            break;
+
+        case RPC_LOC_IOCTL_INFORM_SERVER_OPEN_STATUS:
+        case RPC_LOC_IOCTL_INFORM_SERVER_CLOSE_STATUS:
+            cb_ptr->status = loc_api_sim_atl_status(argp->ioctl_type, argp->ioctl_data);
+            break;
+
+        case RPC_LOC_IOCTL_INFORM_NI_USER_RESPONSE:
+            if (argp->ioctl_data != NULL)
+            {
+                loc_api_sim_ni_response(&argp->ioctl_data->rpc_loc_ioctl_data_u_type_u.user_verify_resp);
+            }
+            break;
+
+        case RPC_LOC_IOCTL_SET_UMTS_SLP_SERVER_ADDR:
+            if (argp->ioctl_data == NULL)
+            {
+                break;
+            }
+            server_ptr = &argp->ioctl_data->rpc_loc_ioctl_data_u_type_u.server_addr;
+            if (server_ptr->addr_type == RPC_LOC_SERVER_ADDR_URL)
+            {
+                pthread_mutex_lock(&loc_api_sim.lock);
+                loc_api_sim.stats.slp_servers_set++;
+                snprintf(loc_api_sim.stats.slp_server, sizeof(loc_api_sim.stats.slp_server), "%.*s",
+                         (int) server_ptr->addr_info.rpc_loc_server_addr_u_type_u.url.addr.addr_len,
+                         server_ptr->addr_info.rpc_loc_server_addr_u_type_u.url.addr.addr_val);
+                pthread_mutex_unlock(&loc_api_sim.lock);
+            }
+            break;
+
+        case RPC_LOC_IOCTL_INJECT_PREDICTED_ORBITS_DATA:
+            if (argp->ioctl_data == NULL)
+            {
+                break;
+            }
+            // The modem only reports back after the last part
+            orbits_ptr = &argp->ioctl_data->rpc_loc_ioctl_data_u_type_u.predicted_orbits_data;
+            if (orbits_ptr->part < orbits_ptr->total_parts)
+            {
+                send_report = FALSE;
+            }
+            if (loc_api_sim_inject_xtra_part(orbits_ptr) == FALSE)
+            {
+                cb_ptr->status = RPC_LOC_API_GENERAL_FAILURE;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    pthread_mutex_lock(&loc_api_sim.lock);
+    loc_api_sim.stats.ioctls_received++;
+    if (!loc_api_sim.client_open || argp->handle != LOC_API_SIM_CLIENT_HANDLE)
+    {
+        result->loc_ioctl_result = RPC_LOC_API_INVALID_HANDLE;
+    }
+    else
+    {
+        if (send_report)
+        {
+            loc_api_sim_queue_event_locked(RPC_LOC_EVENT_IOCTL_REPORT, &payload,
+                    loc_api_sim.config.ioctl_delay_ms);
+        }
+        result->loc_ioctl_result = RPC_LOC_API_SUCCESS;
+    }
+    pthread_mutex_unlock(&loc_api_sim.lock);
+
+    LOGD("rpc_loc_ioctl: type = %d, result = %ld", argp->ioctl_type, result->loc_ioctl_result);
+    return 1;
+}
+
+/*=====================================================================
+     In-memory client transport
+======================================================================*/
+
+static enum clnt_stat loc_api_sim_clnt_call(CLIENT *clnt, u_int proc,
+        xdrproc_t xdr_args, void *args_ptr, xdrproc_t xdr_results, void *results_ptr,
+        struct timeval timeout)
+{
+    union {
+        rpc_loc_open_args rpc_loc_open_0x00010001_arg;
+        rpc_loc_close_args rpc_loc_close_0x00010001_arg;
+        rpc_loc_start_fix_args rpc_loc_start_fix_0x00010001_arg;
+        rpc_loc_stop_fix_args rpc_loc_stop_fix_0x00010001_arg;
+        rpc_loc_ioctl_args rpc_loc_ioctl_0x00010001_arg;
+    } argument;
+    union {
+        rpc_loc_api_rpc_glue_code_info_remote_rets rpc_loc_api_rpc_glue_code_info_remote_0x00010001_res;
+        rpc_loc_open_rets rpc_loc_open_0x00010001_res;
+        rpc_loc_close_rets rpc_loc_close_0x00010001_res;
+        rpc_loc_start_fix_rets rpc_loc_start_fix_0x00010001_res;
+        rpc_loc_stop_fix_rets rpc_loc_stop_fix_0x00010001_res;
+        rpc_loc_ioctl_rets rpc_loc_ioctl_0x00010001_res;
+    } result;
+    xdrproc_t _xdr_argument, _xdr_result;
+    bool_t (*local)(char *, void *, struct svc_req *);
+    struct svc_req req;
+    enum clnt_stat stat = RPC_SUCCESS;
+    XDR xdrs;
+    u_int len;
+    bool_t ok;
+
+    switch (proc) {
+    case rpc_loc_api_null:
+        _xdr_argument = (xdrproc_t) xdr_void;
+        _xdr_result = (xdrproc_t) xdr_void;
+        local = (bool_t (*) (char *, void *,  struct svc_req *))rpc_loc_api_null_0x00010001_svc;
+        break;
+    case rpc_loc_api_rpc_glue_code_info_remote:
+        _xdr_argument = (xdrproc_t) xdr_void;
+        _xdr_result = (xdrproc_t) xdr_rpc_loc_api_rpc_glue_code_info_remote_rets;
+        local = (bool_t (*) (char *, void *,  struct svc_req *))rpc_loc_api_rpc_glue_code_info_remote_0x00010001_svc;
+        break;
+    case rpc_loc_open:
+        _xdr_argument = (xdrproc_t) xdr_rpc_loc_open_args;
+        _xdr_result = (xdrproc_t) xdr_rpc_loc_open_rets;
+        local = (bool_t (*) (char *, void *,  struct svc_req *))rpc_loc_open_0x00010001_svc;
+        break;
+    case rpc_loc_close:
+        _xdr_argument = (xdrproc_t) xdr_rpc_loc_close_args;
+        _xdr_result = (xdrproc_t) xdr_rpc_loc_close_rets;
+        local = (bool_t (*) (char *, void *,  struct svc_req *))rpc_loc_close_0x00010001_svc;
+        break;
+    case rpc_loc_start_fix:
+        _xdr_argument = (xdrproc_t) xdr_rpc_loc_start_fix_args;
+        _xdr_result = (xdrproc_t) xdr_rpc_loc_start_fix_rets;
+        local = (bool_t (*) (char *, void *,  struct svc_req *))rpc_loc_start_fix_0x00010001_svc;
+        break;
+    case rpc_loc_stop_fix:
+        _xdr_argument = (xdrproc_t) xdr_rpc_loc_stop_fix_args;
+        _xdr_result = (xdrproc_t) xdr_rpc_loc_stop_fix_rets;
+        local = (bool_t (*) (char *, void *,  struct svc_req *))rpc_loc_stop_fix_0x00010001_svc;
+        break;
+    case rpc_loc_ioctl:
+        _xdr_argument = (xdrproc_t) xdr_rpc_loc_ioctl_args;
+        _xdr_result = (xdrproc_t) xdr_rpc_loc_ioctl_rets;
+        local = (bool_t (*) (char *, void *,  struct svc_req *))rpc_loc_ioctl_0x00010001_svc;
+        break;
+    default:
+        return RPC_PROCUNAVAIL;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.rq_prog = LOC_APIPROG;
+    req.rq_vers = LOC_APIVERS_0001;
+    req.rq_proc = proc;
+
+    pthread_mutex_lock(&loc_api_sim_call_lock);
+
+    // The server is not registered with the RPC router yet
+    if (loc_api_sim.config.server_ready_ms > 0 &&
+        loc_api_sim_now_us() < loc_api_sim.config_time_us + loc_api_sim.config.server_ready_ms * 1000ULL)
+    {
+        pthread_mutex_lock(&loc_api_sim.lock);
+        loc_api_sim.stats.calls_refused++;
+        pthread_mutex_unlock(&loc_api_sim.lock);
+        stat = RPC_PROGUNAVAIL;
+        goto done;
+    }
+
+    // Cost of the round trip through the RPC router
+    if (loc_api_sim.config.rpc_call_us > 0)
+    {
+        usleep(loc_api_sim.config.rpc_call_us);
+    }
+
+    // Client side: encode the call
+    xdrmem_create(&xdrs, loc_api_sim_call_buf, sizeof(loc_api_sim_call_buf), XDR_ENCODE);
+    ok = (*xdr_args)(&xdrs, args_ptr);
+    len = xdr_getpos(&xdrs);
+    xdr_destroy(&xdrs);
+    if (!ok)
+    {
+        stat = RPC_CANTENCODEARGS;
+        goto done;
+    }
+
+    // Modem side: decode, run the procedure, encode the reply
+    memset(&argument, 0, sizeof(argument));
+    memset(&result, 0, sizeof(result));
+    xdrmem_create(&xdrs, loc_api_sim_call_buf, len, XDR_DECODE);
+    ok = (*_xdr_argument)(&xdrs, &argument);
+    xdr_destroy(&xdrs);
+    if (!ok)
+    {
+        xdr_free(_xdr_argument, (char*) &argument);
+        stat = RPC_CANTDECODEARGS;
+        goto done;
+    }
+
+    ok = (*local)((char *)&argument, (void *)&result, &req);
+    xdr_free(_xdr_argument, (char*) &argument);
+    if (!ok)
+    {
+        stat = RPC_SYSTEMERROR;
+        goto done;
+    }
+
+    xdrmem_create(&xdrs, loc_api_sim_call_buf, sizeof(loc_api_sim_call_buf), XDR_ENCODE);
+    ok = (*_xdr_result)(&xdrs, &result);
+    len = xdr_getpos(&xdrs);
+    xdr_destroy(&xdrs);
+    if (!ok)
+    {
+        stat = RPC_CANTENCODEARGS;
+        goto done;
+    }
+
+    // Client side: decode the reply
+    xdrmem_create(&xdrs, loc_api_sim_call_buf, len, XDR_DECODE);
+    ok = (*xdr_results)(&xdrs, results_ptr);
+    xdr_destroy(&xdrs);
+    if (!ok)
+    {
+        stat = RPC_CANTDECODERES;
+    }
+
+done:
+    pthread_mutex_unlock(&loc_api_sim_call_lock);
+    return stat;
+}
+
+static void loc_api_sim_clnt_abort(CLIENT *clnt)
+{
+}
+
+static void loc_api_sim_clnt_geterr(CLIENT *clnt, struct rpc_err *err)
+{
+    memset(err, 0, sizeof(*err));
+}
+
+static bool_t loc_api_sim_clnt_freeres(CLIENT *clnt, xdrproc_t xdr_results, void *results_ptr)
+{
+    xdr_free(xdr_results, (char*) results_ptr);
+    return TRUE;
+}
+
+static void loc_api_sim_clnt_destroy(CLIENT *clnt)
+{
+}
+
+static bool_t loc_api_sim_clnt_control(CLIENT *clnt, u_int request, void *info)
+{
+    return FALSE;
+}
+
+/*===========================================================================
+FUNCTION loc_api_sim_clnt_create
+
+DESCRIPTION
+   Returns the client handle of the simulated LOC_APIPROG server. The
+   clnt_ops/xp_ops member types differ slightly between RPC
+   implementations, hence the __typeof__ casts.
+
+RETURN VALUE
+   CLIENT pointer, never NULL
+===========================================================================*/
+CLIENT* loc_api_sim_clnt_create(void)
+{
+    loc_api_sim_clnt_ops.cl_call    = (__typeof__(loc_api_sim_clnt_ops.cl_call))    loc_api_sim_clnt_call;
+    loc_api_sim_clnt_ops.cl_abort   = (__typeof__(loc_api_sim_clnt_ops.cl_abort))   loc_api_sim_clnt_abort;
+    loc_api_sim_clnt_ops.cl_geterr  = (__typeof__(loc_api_sim_clnt_ops.cl_geterr))  loc_api_sim_clnt_geterr;
+    loc_api_sim_clnt_ops.cl_freeres = (__typeof__(loc_api_sim_clnt_ops.cl_freeres)) loc_api_sim_clnt_freeres;
+    loc_api_sim_clnt_ops.cl_destroy = (__typeof__(loc_api_sim_clnt_ops.cl_destroy)) loc_api_sim_clnt_destroy;
+    loc_api_sim_clnt_ops.cl_control = (__typeof__(loc_api_sim_clnt_ops.cl_control)) loc_api_sim_clnt_control;
+
+    memset(&loc_api_sim_clnt, 0, sizeof(loc_api_sim_clnt));
+    loc_api_sim_clnt.cl_ops = &loc_api_sim_clnt_ops;
+
+    return &loc_api_sim_clnt;
+}
+
+/*===========================================================================
+FUNCTION loc_apicb_app_init
+
+DESCRIPTION
+   Host replacement of the router based callback server registration,
+   starts the simulator thread.
+
+RETURN VALUE
+   0 for success, -1 for failure
+===========================================================================*/
+int loc_apicb_app_init(void)
+{
+    pthread_condattr_t attr;
+
+    loc_api_sim_xp_ops.xp_recv     = (__typeof__(loc_api_sim_xp_ops.xp_recv))     loc_api_sim_svc_recv;
+    loc_api_sim_xp_ops.xp_stat     = (__typeof__(loc_api_sim_xp_ops.xp_stat))     loc_api_sim_svc_stat;
+    loc_api_sim_xp_ops.xp_getargs  = (__typeof__(loc_api_sim_xp_ops.xp_getargs))  loc_api_sim_svc_getargs;
+    loc_api_sim_xp_ops.xp_reply    = (__typeof__(loc_api_sim_xp_ops.xp_reply))    loc_api_sim_svc_reply;
+    loc_api_sim_xp_ops.xp_freeargs = (__typeof__(loc_api_sim_xp_ops.xp_freeargs)) loc_api_sim_svc_freeargs;
+    loc_api_sim_xp_ops.xp_destroy  = (__typeof__(loc_api_sim_xp_ops.xp_destroy))  loc_api_sim_svc_destroy;
+
+    memset(&loc_api_sim_xprt, 0, sizeof(loc_api_sim_xprt));
+    loc_api_sim_xprt.xp_ops = &loc_api_sim_xp_ops;
+
+    pthread_mutex_lock(&loc_api_sim.lock);
+    if (!loc_api_sim.cond_initialized)
+    {
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&loc_api_sim.cond, &attr);
+        pthread_condattr_destroy(&attr);
+        loc_api_sim.cond_initialized = TRUE;
+    }
+
+    if (!loc_api_sim.thread_running)
+    {
+        loc_api_sim.thread_need_exit = FALSE;
+        if (pthread_create(&loc_api_sim.thread, NULL, loc_api_sim_thread_proc, NULL) != 0)
+        {
+            pthread_mutex_unlock(&loc_api_sim.lock);
+            return -1;
+        }
+        loc_api_sim.thread_running = TRUE;
+    }
+    pthread_mutex_unlock(&loc_api_sim.lock);
+
+    return 0;
+}
+
+void loc_apicb_app_deinit(void)
+{
+    loc_api_sim_event *event;
+
+    pthread_mutex_lock(&loc_api_sim.lock);
+    if (!loc_api_sim.thread_running)
+    {
+        pthread_mutex_unlock(&loc_api_sim.lock);
+        return;
+    }
+    loc_api_sim.thread_need_exit = TRUE;
+    pthread_cond_signal(&loc_api_sim.cond);
+    pthread_mutex_unlock(&loc_api_sim.lock);
+
+    pthread_join(loc_api_sim.thread, NULL);
+
+    pthread_mutex_lock(&loc_api_sim.lock);
+    loc_api_sim.thread_running = FALSE;
+    loc_api_sim.client_open = FALSE;
+    loc_api_sim.fix_active = FALSE;
+    while (loc_api_sim.events != NULL)
+    {
+        event = loc_api_sim.events;
+        loc_api_sim.events = event->next;
+        loc_api_sim_free_event(event);
+    }
+    pthread_mutex_unlock(&loc_api_sim.lock);
+}
+
+/*=====================================================================
+     Simulator control
+======================================================================*/
+
+void loc_api_sim_get_default_config(loc_api_sim_config_s_type *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->position_interval_ms = 1000;
+    config->sv_interval_ms       = 1000;
+    config->nmea_interval_ms     = 1000;
+    config->sv_count             = 12;
+    config->sv_no_eph_every      = 4;
+    config->nmea_length          = 512;
+    config->ioctl_delay_ms       = 20;
+    config->ioctl_status         = RPC_LOC_API_SUCCESS;
+    config->xtra_max_file_size   = 100 * 1024;
+    config->xtra_max_part_size   = 8 * 1024;
+    config->xtra_valid_hours     = 7 * 24;
+}
+
+void loc_api_sim_set_config(const loc_api_sim_config_s_type *config)
+{
+    pthread_mutex_lock(&loc_api_sim.lock);
+    loc_api_sim.config = *config;
+    loc_api_sim.config_time_us = loc_api_sim_now_us();
+    if (loc_api_sim.cond_initialized)
+    {
+        pthread_cond_signal(&loc_api_sim.cond);
+    }
+    pthread_mutex_unlock(&loc_api_sim.lock);
+}
+
+int loc_api_sim_post_event(
+      rpc_loc_event_mask_type               loc_event,
+      const rpc_loc_event_payload_u_type*   loc_event_payload,
+      int                                   delay_ms
+)
+{
+    int rc;
+
+    pthread_mutex_lock(&loc_api_sim.lock);
+    rc = loc_api_sim_queue_event_locked(loc_event, loc_event_payload, delay_ms);
+    pthread_mutex_unlock(&loc_api_sim.lock);
+
+    return rc;
+}
+
+void loc_api_sim_get_stats(loc_api_sim_stats_s_type *stats)
+{
+    pthread_mutex_lock(&loc_api_sim.lock);
+    *stats = loc_api_sim.stats;
+    pthread_mutex_unlock(&loc_api_sim.lock);
+}
+
+void loc_api_sim_reset_stats(void)
+{
+    pthread_mutex_lock(&loc_api_sim.lock);
+    memset(&loc_api_sim.stats, 0, sizeof(loc_api_sim.stats));
+    pthread_mutex_unlock(&loc_api_sim.lock);
+}
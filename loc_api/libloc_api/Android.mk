@@ -21,13 +21,21 @@ LOCAL_STATIC_LIBRARIES:= \
 LOCAL_SHARED_LIBRARIES := \
     librpc \
     libutils \
-    libcutils
+    libcutils \
+    libz
 
 LOCAL_SRC_FILES += \
     loc_eng.cpp \
     loc_eng_ioctl.cpp \
     loc_eng_xtra.cpp \
-    loc_eng_ni.cpp
+    loc_eng_xtra_download.cpp \
+    loc_eng_coverage.cpp \
+    loc_eng_dns.cpp \
+    loc_eng_slp.cpp \
+    loc_eng_atl.cpp \
+    loc_eng_mode.cpp \
+    loc_eng_ni.cpp \
+    loc_eng_queue.cpp
 
 LOCAL_CFLAGS += \
     -fno-short-enums 
@@ -36,10 +44,72 @@ LOCAL_C_INCLUDES:= \
 	$(TARGET_OUT_HEADERS)/libloc_api-rpc \
 	$(TARGET_OUT_HEADERS)/libloc_api-rpc/rpc_inc \
 	$(TARGET_OUT_HEADERS)/libcommondefs-rpc/inc \
-	$(TARGET_OUT_HEADERS)/librpc
+	$(TARGET_OUT_HEADERS)/librpc \
+	external/zlib
 
 LOCAL_PRELINK_MODULE := false
 include $(BUILD_SHARED_LIBRARY)
 
+# Host build against the modem simulator in libloc_api-rpc
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libloc_api
+
+LOCAL_SRC_FILES += \
+    loc_eng.cpp \
+    loc_eng_ioctl.cpp \
+    loc_eng_xtra.cpp \
+    loc_eng_xtra_download.cpp \
+    loc_eng_coverage.cpp \
+    loc_eng_dns.cpp \
+    loc_eng_slp.cpp \
+    loc_eng_atl.cpp \
+    loc_eng_mode.cpp \
+    loc_eng_ni.cpp \
+    loc_eng_queue.cpp
+
+LOCAL_CFLAGS += \
+    -fno-short-enums \
+    -include rpc_inc/loc_api_sim.h \
+    -DLOC_API_HOST_SIM
+
+LOCAL_C_INCLUDES:= \
+	$(LOCAL_PATH)/../libloc_api-rpc \
+	$(LOCAL_PATH)/../libloc_api-rpc/rpc_inc \
+	hardware/libhardware_legacy/include \
+	external/zlib
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+# Benchmark driver, runs the HAL against the modem simulator
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := loc_eng_bench
+
+LOCAL_SRC_FILES := \
+    loc_eng_bench.cpp
+
+LOCAL_STATIC_LIBRARIES := \
+    libloc_api \
+    libloc_api-rpc \
+    libutils \
+    libcutils \
+    libz
+
+LOCAL_CFLAGS += \
+    -fno-short-enums \
+    -include rpc_inc/loc_api_sim.h \
+    -DLOC_API_HOST_SIM
+
+LOCAL_C_INCLUDES:= \
+	$(LOCAL_PATH)/../libloc_api-rpc \
+	$(LOCAL_PATH)/../libloc_api-rpc/rpc_inc \
+	hardware/libhardware_legacy/include \
+	external/zlib
+
+LOCAL_LDLIBS += -lpthread -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
+
 endif # not BUILD_TINY_ANDROID
 
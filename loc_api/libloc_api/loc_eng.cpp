@@ -39,6 +39,7 @@ $Author: $
 #include <ctype.h>
 #include <math.h>
 #include <pthread.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 
@@ -48,7 +49,10 @@ $Author: $
 
 #include <hardware_legacy/gps.h>
 #include <cutils/properties.h>
+#include <cutils/memory.h>
+#ifdef HAVE_ANDROID_OS
 #include <cutils/sched_policy.h>
+#endif
 #include <utils/SystemClock.h>
 
 #include <loc_eng.h>
@@ -68,6 +72,7 @@ static int  loc_eng_init(GpsCallbacks* callbacks);
 static int  loc_eng_start();
 static int  loc_eng_stop();
 static int  loc_eng_set_position_mode(GpsPositionMode mode, int fix_frequency);
+static void loc_eng_set_fix_criteria(rpc_loc_operation_mode_e_type oper_mode);
 static void loc_eng_cleanup();
 static int  loc_eng_inject_time(GpsUtcTime time, int64_t timeReference, int uncertainty);
 static int  loc_eng_inject_location(double latitude, double longitude, float accuracy);
@@ -92,11 +97,13 @@ static void loc_eng_report_nmea (const rpc_loc_nmea_report_s_type *nmea_report_p
 static void loc_eng_process_conn_request (const rpc_loc_server_request_s_type *server_request_ptr);
 
 static void* loc_eng_process_deferred_action (void* arg);
-static void loc_eng_process_atl_deferred_action (boolean data_connection_succeeded,
-        boolean data_connection_closed);
 static void loc_eng_delete_aiding_data_deferred_action (void);
 static int loc_eng_set_gps_lock(rpc_loc_lock_e_type lock_type);
+static void loc_eng_ioctl_result_cb(loc_eng_ioctl_handle_type ioctl_handle,
+                                    const rpc_loc_ioctl_callback_s_type *cb_data_ptr,
+                                    void *user_data);
 static int set_agps_server();
+static boolean loc_eng_startup_wait_for_server();
 
 // Defines the GpsInterface in gps.h
 static const GpsInterface sLocEngInterface =
@@ -198,11 +205,11 @@ static int loc_eng_init(GpsCallbacks* callbacks)
                                     RPC_LOC_EVENT_NMEA_POSITION_REPORT |
                                     RPC_LOC_EVENT_NI_NOTIFY_VERIFY_REQUEST;
 
-    loc_eng_data.work_queue = NULL;
+    char propBuf[PROPERTY_VALUE_MAX];
+    property_get("gps.queue.shed_depth", propBuf, "0");
+    loc_eng_queue_init (&loc_eng_data.work_queue, atoi(propBuf));
     loc_eng_data.last_fix_time = 0;
 
-    pthread_mutex_init (&(loc_eng_data.deferred_action_mutex), NULL);
-    pthread_cond_init  (&(loc_eng_data.deferred_action_cond) , NULL);
     loc_eng_data.deferred_action_thread_need_exit = FALSE;
  
     memset (loc_eng_data.apn_name, 0, sizeof (loc_eng_data.apn_name));
@@ -211,29 +218,49 @@ static int loc_eng_init(GpsCallbacks* callbacks)
     loc_eng_data.engine_status = GPS_STATUS_ENGINE_ON;
 
     // XTRA module data initialization
-    loc_eng_data.xtra_module_data.download_request_cb = NULL;
-    loc_eng_data.xtra_module_data.download_request_pending = FALSE;
-    pthread_mutex_init(&loc_eng_data.xtra_module_data.xtra_mutex, NULL);
+    loc_eng_xtra_module_init (&loc_eng_data.xtra_module_data);
+    loc_eng_xtra_download_init (&loc_eng_data.xtra_download_data);
+
+    // Ephemeris coverage tracker initialization
+    loc_eng_coverage_init (&loc_eng_data.coverage_data);
 
     // IOCTL module data initialization
-    loc_eng_data.ioctl_data.cb_is_selected  = FALSE;
-    loc_eng_data.ioctl_data.cb_is_waiting   = FALSE;
-    loc_eng_data.ioctl_data.client_handle   = RPC_LOC_CLIENT_HANDLE_INVALID;
-    memset (&(loc_eng_data.ioctl_data.cb_payload),
-            0,
-            sizeof (rpc_loc_ioctl_callback_s_type));
+    loc_eng_ioctl_init (&loc_eng_data.ioctl_data);
 
-    pthread_mutex_init (&(loc_eng_data.ioctl_data.cb_data_mutex), NULL);
-    pthread_cond_init(&loc_eng_data.ioctl_data.cb_arrived_cond, NULL);
+    // ATL handshake, sends the connection status to the modem
+    loc_eng_atl_init (&loc_eng_data.atl_data);
+
+    // Operation mode of each session
+    loc_eng_mode_init ();
 
     loc_eng_data.deferred_action_thread = NULL;
+    loc_eng_data.deferred_action_thread_ready = FALSE;
+    pthread_mutex_init (&loc_eng_data.deferred_action_mutex, NULL);
+    loc_eng_ioctl_cond_init (&loc_eng_data.deferred_action_cond);
     pthread_create (&(loc_eng_data.deferred_action_thread),
                     NULL,
                     loc_eng_process_deferred_action,
                     NULL);
-    sleep(2);
-    // Start the LOC api RPC service
-    loc_api_glue_init ();
+
+    // Wait for the deferred action thread before events can be queued for it
+    struct timespec deadline;
+    loc_eng_ioctl_deadline (LOC_ENG_STARTUP_THREAD_TIMEOUT, &deadline);
+    pthread_mutex_lock (&loc_eng_data.deferred_action_mutex);
+    while (!loc_eng_data.deferred_action_thread_ready)
+    {
+        if (loc_eng_ioctl_cond_timedwait (&loc_eng_data.deferred_action_cond,
+                                          &loc_eng_data.deferred_action_mutex,
+                                          &deadline) == ETIMEDOUT)
+        {
+            LOGE("loc_eng_init: deferred action thread not running after %d ms",
+                 LOC_ENG_STARTUP_THREAD_TIMEOUT);
+            break;
+        }
+    }
+    pthread_mutex_unlock (&loc_eng_data.deferred_action_mutex);
+
+    // Start the LOC api RPC service once the server answers
+    loc_eng_startup_wait_for_server ();
     // open client
     loc_eng_data.client_handle = loc_open (event, loc_event_cb);
     //disable GPS lock
@@ -243,6 +270,73 @@ static int loc_eng_init(GpsCallbacks* callbacks)
     return 0;
 }
 
+/*===========================================================================
+FUNCTION    loc_eng_startup_wait_for_server
+
+DESCRIPTION
+   Creates the RPC client and pings the loc api server until it answers,
+   waiting LOC_ENG_STARTUP_PING_DELAY after the first failed ping and twice
+   as long after each next one, up to LOC_ENG_STARTUP_PING_MAX_DELAY. Gives
+   up after LOC_ENG_STARTUP_TIMEOUT, loc_open then fails as it would have.
+
+DEPENDENCIES
+   None
+
+RETURN VALUE
+   TRUE if the server answered
+
+SIDE EFFECTS
+   Sets startup_pings and startup_msec
+
+===========================================================================*/
+static boolean loc_eng_startup_wait_for_server()
+{
+    int64_t start_time = android::elapsedRealtime();
+    int delay_msec = LOC_ENG_STARTUP_PING_DELAY;
+    boolean ready = FALSE;
+
+    while (1)
+    {
+        loc_eng_data.startup_pings++;
+        if (loc_api_glue_init () == 1 && loc_api_null () != RPC_LOC_API_RPC_FAILURE)
+        {
+            ready = TRUE;
+            break;
+        }
+
+        int64_t elapsed = android::elapsedRealtime() - start_time;
+        if (elapsed >= LOC_ENG_STARTUP_TIMEOUT)
+        {
+            break;
+        }
+        if (delay_msec > LOC_ENG_STARTUP_TIMEOUT - elapsed)
+        {
+            delay_msec = (int) (LOC_ENG_STARTUP_TIMEOUT - elapsed);
+        }
+        usleep (delay_msec * 1000);
+
+        delay_msec *= 2;
+        if (delay_msec > LOC_ENG_STARTUP_PING_MAX_DELAY)
+        {
+            delay_msec = LOC_ENG_STARTUP_PING_MAX_DELAY;
+        }
+    }
+
+    loc_eng_data.startup_msec = android::elapsedRealtime() - start_time;
+    if (ready)
+    {
+        LOGD("loc_eng_startup_wait_for_server: server up after %d pings, %d ms",
+             loc_eng_data.startup_pings, (int) loc_eng_data.startup_msec);
+    }
+    else
+    {
+        LOGE("loc_eng_startup_wait_for_server: no answer after %d pings, %d ms",
+             loc_eng_data.startup_pings, (int) loc_eng_data.startup_msec);
+    }
+
+    return ready;
+}
+
 /*===========================================================================
 FUNCTION    loc_eng_cleanup
 
@@ -261,43 +355,32 @@ SIDE EFFECTS
 ===========================================================================*/
 static void loc_eng_cleanup()
 {
-
-    work_item *work;
-
     if (loc_eng_data.deferred_action_thread)
     {
         /* Terminate deferred action working thread */
-        pthread_mutex_lock (&loc_eng_data.deferred_action_mutex);
         loc_eng_data.deferred_action_thread_need_exit = TRUE;
-        pthread_cond_signal  (&loc_eng_data.deferred_action_cond);
-        pthread_mutex_unlock (&loc_eng_data.deferred_action_mutex);
+        loc_eng_queue_wakeup (&loc_eng_data.work_queue);
 
         void* ignoredValue;
         pthread_join(loc_eng_data.deferred_action_thread, &ignoredValue);
         loc_eng_data.deferred_action_thread = NULL;
     }
+    pthread_cond_destroy (&loc_eng_data.deferred_action_cond);
+    pthread_mutex_destroy (&loc_eng_data.deferred_action_mutex);
+
+    // Stop the XTRA download and injection while the client is still open
+    loc_eng_xtra_download_deinit (&loc_eng_data.xtra_download_data);
+    loc_eng_xtra_module_deinit (&loc_eng_data.xtra_module_data);
+    loc_eng_coverage_deinit (&loc_eng_data.coverage_data);
+    loc_eng_atl_deinit (&loc_eng_data.atl_data);
 
     // clean up
     (void) loc_close (loc_eng_data.client_handle);
 
-    // lock the queue
-    pthread_mutex_lock(&loc_eng_data.deferred_action_mutex);
-    // free any remaining work items
-    while(loc_eng_data.work_queue) {
-        work = loc_eng_data.work_queue;
-        loc_eng_data.work_queue = work->next;
-        free(work);
-    }
-    // unlock the queue
-    pthread_mutex_unlock(&loc_eng_data.deferred_action_mutex);
-
-    pthread_mutex_destroy (&loc_eng_data.xtra_module_data.xtra_mutex);
-
-    pthread_mutex_destroy (&loc_eng_data.deferred_action_mutex);
-    pthread_cond_destroy  (&loc_eng_data.deferred_action_cond);
+    // drop any remaining work items
+    loc_eng_queue_deinit (&loc_eng_data.work_queue);
 
-    pthread_mutex_destroy (&loc_eng_data.ioctl_data.cb_data_mutex);
-    pthread_cond_destroy  (&loc_eng_data.ioctl_data.cb_arrived_cond);
+    loc_eng_ioctl_deinit (&loc_eng_data.ioctl_data);
 
     // RPC glue code
     loc_api_glue_deinit();
@@ -325,13 +408,22 @@ SIDE EFFECTS
 static int loc_eng_start()
 {
     int ret_val;
+    rpc_loc_operation_mode_e_type oper_mode;
     LOGD("loc_eng_start");
 
-    if (loc_eng_data.position_mode != GPS_POSITION_MODE_STANDALONE &&
+    // Once the framework set its criteria, the session may run in another mode
+    oper_mode = loc_eng_mode_session_start (loc_eng_data.position_mode);
+    if (loc_eng_data.oper_mode != 0 && oper_mode != loc_eng_data.oper_mode)
+    {
+        loc_eng_set_fix_criteria (oper_mode);
+    }
+
+    if (loc_eng_data.oper_mode != RPC_LOC_OPER_MODE_STANDALONE &&
             loc_eng_data.agps_server_host[0] != 0 &&
             loc_eng_data.agps_server_port != 0) {
         int result = set_agps_server();
         LOGD("loc_eng_start: set_agps_server returned = %d", result);
+        loc_eng_slp_session_start ();
     }
 
     ret_val = loc_start_fix (loc_eng_data.client_handle);
@@ -367,6 +459,7 @@ static int loc_eng_stop()
 
     LOGD("loc_eng_stop");
 
+    loc_eng_mode_session_stop ();
     ret_val = loc_stop_fix (loc_eng_data.client_handle);
     if (ret_val != RPC_LOC_API_SUCCESS)
     {
@@ -389,7 +482,7 @@ static int loc_eng_stop()
 static int loc_eng_set_gps_lock(rpc_loc_lock_e_type lock_type)
 {
     rpc_loc_ioctl_data_u_type    ioctl_data;
-    boolean                      ret_val;
+    loc_eng_ioctl_handle_type    ioctl_handle;
 
     LOGD("loc_eng_set_gps_lock: client = %ld, lock_type = %d",
             loc_eng_data.client_handle, lock_type);
@@ -397,13 +490,14 @@ static int loc_eng_set_gps_lock(rpc_loc_lock_e_type lock_type)
     ioctl_data.rpc_loc_ioctl_data_u_type_u.engine_lock = lock_type;
     ioctl_data.disc = RPC_LOC_IOCTL_SET_ENGINE_LOCK;
 
-    ret_val = loc_eng_ioctl (loc_eng_data.client_handle,
-                            RPC_LOC_IOCTL_SET_ENGINE_LOCK,
-                            &ioctl_data,
-                            LOC_IOCTL_DEFAULT_TIMEOUT,
-                            NULL /* No output information is expected*/);
+    ioctl_handle = loc_eng_ioctl_async (loc_eng_data.client_handle,
+                                        RPC_LOC_IOCTL_SET_ENGINE_LOCK,
+                                        &ioctl_data,
+                                        LOC_IOCTL_DEFAULT_TIMEOUT,
+                                        loc_eng_ioctl_result_cb,
+                                        (void*) "loc_eng_set_gps_lock");
 
-    if (ret_val != TRUE)
+    if (ioctl_handle == LOC_ENG_IOCTL_HANDLE_INVALID)
     {
         LOGD("loc_eng_set_gps_lock: failed");
     }
@@ -411,6 +505,35 @@ static int loc_eng_set_gps_lock(rpc_loc_lock_e_type lock_type)
     return 0;
 }
 
+/*===========================================================================
+FUNCTION    loc_eng_ioctl_result_cb
+
+DESCRIPTION
+   Completion callback of the ioctls the GpsInterface entry points send
+   without waiting, logs the ioctls that failed. user_data is the name of
+   the entry point.
+
+DEPENDENCIES
+   None
+
+RETURN VALUE
+   None
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_ioctl_result_cb(loc_eng_ioctl_handle_type ioctl_handle,
+                                    const rpc_loc_ioctl_callback_s_type *cb_data_ptr,
+                                    void *user_data)
+{
+    if (cb_data_ptr->status != RPC_LOC_API_SUCCESS)
+    {
+        LOGE("%s: ioctl %d failed, status = %d", (const char*) user_data,
+                cb_data_ptr->type, (int) cb_data_ptr->status);
+    }
+}
+
 /*===========================================================================
 FUNCTION    loc_eng_set_position_mode
 
@@ -429,49 +552,75 @@ SIDE EFFECTS
 ===========================================================================*/
 static int loc_eng_set_position_mode(GpsPositionMode mode, int fix_frequency)
 {
-    rpc_loc_ioctl_data_u_type    ioctl_data;
-    rpc_loc_fix_criteria_s_type *fix_criteria_ptr;
-    boolean                      ret_val;
-
     LOGD("loc_eng_set_position_mode: client = %ld, interval = %d, mode = %d",
             loc_eng_data.client_handle, fix_frequency, mode);
 
     loc_eng_data.position_mode = mode;
-    ioctl_data.disc = RPC_LOC_IOCTL_SET_FIX_CRITERIA;
-
-    fix_criteria_ptr = &(ioctl_data.rpc_loc_ioctl_data_u_type_u.fix_criteria);
-    fix_criteria_ptr->valid_mask = RPC_LOC_FIX_CRIT_VALID_MIN_INTERVAL |
-                                   RPC_LOC_FIX_CRIT_VALID_PREFERRED_OPERATION_MODE |
-                                   RPC_LOC_FIX_CRIT_VALID_RECURRENCE_TYPE;
-    fix_criteria_ptr->min_interval = fix_frequency * 1000; // Translate to ms
-    fix_criteria_ptr->recurrence_type = RPC_LOC_PERIODIC_FIX;
+    loc_eng_data.fix_frequency = fix_frequency;
 
     if (mode == GPS_POSITION_MODE_MS_BASED)
     {
-        fix_criteria_ptr->preferred_operation_mode = RPC_LOC_OPER_MODE_MSB;
+        loc_eng_set_fix_criteria (RPC_LOC_OPER_MODE_MSB);
     }
     else if (mode == GPS_POSITION_MODE_MS_ASSISTED)
     {
-        fix_criteria_ptr->preferred_operation_mode = RPC_LOC_OPER_MODE_MSA;
+        loc_eng_set_fix_criteria (RPC_LOC_OPER_MODE_MSA);
     }
     // Default: standalone
     else
     {
-        fix_criteria_ptr->preferred_operation_mode = RPC_LOC_OPER_MODE_STANDALONE;
+        loc_eng_set_fix_criteria (RPC_LOC_OPER_MODE_STANDALONE);
     }
 
-    ret_val = loc_eng_ioctl(loc_eng_data.client_handle,
-                            RPC_LOC_IOCTL_SET_FIX_CRITERIA,
-                            &ioctl_data,
-                            LOC_IOCTL_DEFAULT_TIMEOUT,
-                            NULL /* No output information is expected*/);
+    return 0;
+}
 
-    if (ret_val != TRUE)
+/*===========================================================================
+FUNCTION    loc_eng_set_fix_criteria
+
+DESCRIPTION
+   Sends the fix frequency of the framework with an operation mode. The
+   ioctl is sent before this returns, so a loc_start_fix after it runs in
+   the new mode.
+
+DEPENDENCIES
+   None
+
+RETURN VALUE
+   None
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_set_fix_criteria(rpc_loc_operation_mode_e_type oper_mode)
+{
+    rpc_loc_ioctl_data_u_type    ioctl_data;
+    rpc_loc_fix_criteria_s_type *fix_criteria_ptr;
+    loc_eng_ioctl_handle_type    ioctl_handle;
+
+    loc_eng_data.oper_mode = oper_mode;
+    ioctl_data.disc = RPC_LOC_IOCTL_SET_FIX_CRITERIA;
+
+    fix_criteria_ptr = &(ioctl_data.rpc_loc_ioctl_data_u_type_u.fix_criteria);
+    fix_criteria_ptr->valid_mask = RPC_LOC_FIX_CRIT_VALID_MIN_INTERVAL |
+                                   RPC_LOC_FIX_CRIT_VALID_PREFERRED_OPERATION_MODE |
+                                   RPC_LOC_FIX_CRIT_VALID_RECURRENCE_TYPE;
+    fix_criteria_ptr->min_interval = loc_eng_data.fix_frequency * 1000; // Translate to ms
+    fix_criteria_ptr->recurrence_type = RPC_LOC_PERIODIC_FIX;
+    fix_criteria_ptr->preferred_operation_mode = oper_mode;
+
+    ioctl_handle = loc_eng_ioctl_async (loc_eng_data.client_handle,
+                                        RPC_LOC_IOCTL_SET_FIX_CRITERIA,
+                                        &ioctl_data,
+                                        LOC_IOCTL_DEFAULT_TIMEOUT,
+                                        loc_eng_ioctl_result_cb,
+                                        (void*) "loc_eng_set_position_mode");
+
+    if (ioctl_handle == LOC_ENG_IOCTL_HANDLE_INVALID)
     {
-        LOGD("loc_eng_set_position_mode: failed");
+        LOGD("loc_eng_set_fix_criteria: failed");
     }
-
-    return 0;
 }
 
 /*===========================================================================
@@ -494,7 +643,7 @@ static int loc_eng_inject_time (GpsUtcTime time, int64_t timeReference, int unce
 {
     rpc_loc_ioctl_data_u_type       ioctl_data;
     rpc_loc_assist_data_time_s_type *time_info_ptr;
-    boolean                          ret_val;
+    loc_eng_ioctl_handle_type       ioctl_handle;
 
     LOGD("loc_eng_inject_time: uncertainty = %d", uncertainty);
 
@@ -505,13 +654,14 @@ static int loc_eng_inject_time (GpsUtcTime time, int64_t timeReference, int unce
     time_info_ptr->time_utc += (int64_t)(android::elapsedRealtime() - timeReference);
     time_info_ptr->uncertainty = uncertainty; // Uncertainty in ms
 
-    ret_val = loc_eng_ioctl (loc_eng_data.client_handle,
-                             RPC_LOC_IOCTL_INJECT_UTC_TIME,
-                             &ioctl_data,
-                             LOC_IOCTL_DEFAULT_TIMEOUT,
-                             NULL /* No output information is expected*/);
+    ioctl_handle = loc_eng_ioctl_async (loc_eng_data.client_handle,
+                                        RPC_LOC_IOCTL_INJECT_UTC_TIME,
+                                        &ioctl_data,
+                                        LOC_IOCTL_DEFAULT_TIMEOUT,
+                                        loc_eng_ioctl_result_cb,
+                                        (void*) "loc_eng_inject_time");
 
-    if (ret_val != TRUE)
+    if (ioctl_handle == LOC_ENG_IOCTL_HANDLE_INVALID)
     {
         LOGD("loc_eng_inject_time: failed");
     }
@@ -521,7 +671,7 @@ static int loc_eng_inject_time (GpsUtcTime time, int64_t timeReference, int unce
 
 static int loc_eng_inject_location (double latitude, double longitude, float accuracy)
 {
-    boolean                         ret_val;
+    loc_eng_ioctl_handle_type       ioctl_handle;
     rpc_loc_ioctl_data_u_type       ioctl_data;
     rpc_loc_assist_data_pos_s_type *pos_info_ptr;
 
@@ -539,10 +689,11 @@ static int loc_eng_inject_location (double latitude, double longitude, float acc
     pos_info_ptr->longitude = longitude;
     pos_info_ptr->hor_unc_circular = accuracy;
 
-    ret_val = loc_eng_ioctl (loc_eng_data.client_handle, RPC_LOC_IOCTL_INJECT_POSITION,
-                             &ioctl_data, LOC_IOCTL_DEFAULT_TIMEOUT, NULL);
+    ioctl_handle = loc_eng_ioctl_async (loc_eng_data.client_handle, RPC_LOC_IOCTL_INJECT_POSITION,
+                                        &ioctl_data, LOC_IOCTL_DEFAULT_TIMEOUT,
+                                        loc_eng_ioctl_result_cb, (void*) "loc_eng_inject_location");
 
-    if (ret_val != TRUE) {
+    if (ioctl_handle == LOC_ENG_IOCTL_HANDLE_INVALID) {
         LOGD("loc_eng_inject_location: failed");
     }
 
@@ -724,29 +875,21 @@ static int32 loc_event_cb(
     const rpc_loc_event_payload_u_type*  loc_event_payload
     )
 {
-
-    work_item *work, *queue;
-
     LOGV("loc_event_cb: client = %ld, loc_event = 0x%llx", client_handle, loc_event);
     if (client_handle == loc_eng_data.client_handle)
     {
-        // create work queue item
-        work = (work_item*)malloc(sizeof(work_item));
-        work->next = NULL;
-        work->loc_event = loc_event;
-        memcpy(&work->loc_event_payload, loc_event_payload, sizeof(*loc_event_payload));
-        // lock the queue
-        pthread_mutex_lock(&loc_eng_data.deferred_action_mutex);
-        // add item to end of queue
-        if (!loc_eng_data.work_queue) loc_eng_data.work_queue = work;
-        else {
-            queue = loc_eng_data.work_queue;
-            while(queue->next) queue = queue->next;
-            queue->next = work;
+        if (loc_event == RPC_LOC_EVENT_IOCTL_REPORT)
+        {
+            // Complete the waiting loc_eng_ioctl right here, its round trip
+            // must not depend on the reports queued ahead of it
+            (void) loc_eng_ioctl_process_cb (client_handle,
+                                &(loc_event_payload->rpc_loc_event_payload_u_type_u.ioctl_report));
+        }
+        else
+        {
+            // hand the event to the deferred action thread
+            (void) loc_eng_queue_put (&loc_eng_data.work_queue, loc_event, loc_event_payload);
         }
-        // signal deferred action thread
-        pthread_cond_signal  (&loc_eng_data.deferred_action_cond);
-        pthread_mutex_unlock (&loc_eng_data.deferred_action_mutex);
     }
     else
     {
@@ -832,10 +975,29 @@ static void loc_eng_report_position (const rpc_loc_parsed_position_s_type *locat
                 LOGV("loc_eng_report_position: fire callback");
                 loc_eng_data.location_cb (&location);
             }
+
+            // First fix of an assisted session scores its SUPL server
+            loc_eng_slp_session_fix ();
+            loc_eng_mode_session_fix ();
         }
         else
         {
             LOGV("loc_eng_report_position: ignore position report when session status = %d (2 means GENERAL_FAILURE)", location_report_ptr->session_status);
+
+            if (location_report_ptr->session_status == RPC_LOC_SESS_STATUS_GENERAL_FAILURE ||
+                location_report_ptr->session_status == RPC_LOC_SESS_STATUS_TIMEOUT)
+            {
+                loc_eng_mode_session_failed ();
+            }
+
+            // The SUPL server may be at fault, the next session uses another one
+            if ((location_report_ptr->session_status == RPC_LOC_SESS_STATUS_GENERAL_FAILURE ||
+                 location_report_ptr->session_status == RPC_LOC_SESS_STATUS_TIMEOUT) &&
+                loc_eng_data.oper_mode != RPC_LOC_OPER_MODE_STANDALONE &&
+                loc_eng_slp_session_failed () == TRUE)
+            {
+                set_agps_server ();
+            }
         }
     }
     else
@@ -864,6 +1026,7 @@ static void loc_eng_report_sv (const rpc_loc_gnss_info_s_type *gnss_report_ptr)
 {
     GpsSvStatus     SvStatus;
     int             num_svs_max, i;
+    uint32          visible_mask = 0, eph_known_mask = 0, alm_known_mask = 0;
     const rpc_loc_sv_info_s_type *sv_info_ptr;
 
     LOGV("loc_eng_report_sv: valid_mask = 0x%lx, num of sv = %d",
@@ -897,6 +1060,20 @@ static void loc_eng_report_sv (const rpc_loc_gnss_info_s_type *gnss_report_ptr)
                 {
                     SvStatus.sv_list[SvStatus.num_svs].prn = sv_info_ptr->prn;
 
+                    // Feed the coverage tracker, it also needs to know which flags were given
+                    if (sv_info_ptr->prn >= 1 && sv_info_ptr->prn <= LOC_ENG_COVERAGE_MAX_PRN)
+                    {
+                        visible_mask |= (1U << (sv_info_ptr->prn-1));
+                        if (sv_info_ptr->valid_mask & RPC_LOC_SV_INFO_VALID_HAS_EPH)
+                        {
+                            eph_known_mask |= (1U << (sv_info_ptr->prn-1));
+                        }
+                        if (sv_info_ptr->valid_mask & RPC_LOC_SV_INFO_VALID_HAS_ALM)
+                        {
+                            alm_known_mask |= (1U << (sv_info_ptr->prn-1));
+                        }
+                    }
+
                     // We only have the data field to report gps eph and alm mask
                     if ((sv_info_ptr->valid_mask & RPC_LOC_SV_INFO_VALID_HAS_EPH) &&
                         (sv_info_ptr->has_eph == 1))
@@ -956,6 +1133,9 @@ static void loc_eng_report_sv (const rpc_loc_gnss_info_s_type *gnss_report_ptr)
         }
     }
 
+    loc_eng_coverage_update (visible_mask, eph_known_mask, SvStatus.ephemeris_mask,
+                             alm_known_mask, SvStatus.almanac_mask);
+
     // hack to work around fact that device does not report which sats are used in the fix
     // some apps don't accept the fix if it they think it came from enough sats
     if ((SvStatus.used_in_fix_mask == 0) && (android::elapsedRealtime() < loc_eng_data.last_fix_time + 10000)) {
@@ -1055,16 +1235,30 @@ static void loc_eng_process_conn_request (const rpc_loc_server_request_s_type *s
     LOGD("loc_eng_process_conn_request: get loc event location server request, event=%d, conn_handle=%lu",
         server_request_ptr->event, server_request_ptr->payload.rpc_loc_server_request_u_type_u.open_req.conn_handle);
 
-    // This implemenation is based on the fact that modem now at any time has only one data connection for AGPS at any given time
+    const rpc_loc_server_open_req_s_type *open_req_ptr;
+
+    // The modem may keep several connections at once, loc_eng_atl tracks them by handle
+    // and asks the framework for the data connection they share only when it changes
     if (server_request_ptr->event == RPC_LOC_SERVER_REQUEST_OPEN)
     {
-        loc_eng_data.conn_handle = server_request_ptr->payload.rpc_loc_server_request_u_type_u.open_req.conn_handle;
-        loc_eng_data.agps_status = GPS_REQUEST_AGPS_DATA_CONN;
+        open_req_ptr = &(server_request_ptr->payload.rpc_loc_server_request_u_type_u.open_req);
+        if (loc_eng_coverage_agps_needed () == FALSE)
+        {
+            // Every visible SV has a fresh ephemeris, the modem goes on without the server
+            loc_eng_atl_open_decline (open_req_ptr->conn_handle, open_req_ptr->protocol);
+            return;
+        }
+        if (loc_eng_atl_open_request (open_req_ptr->conn_handle, open_req_ptr->protocol) == TRUE)
+        {
+            loc_eng_data.agps_status = GPS_REQUEST_AGPS_DATA_CONN;
+        }
     }
     else if (server_request_ptr->event == RPC_LOC_SERVER_REQUEST_CLOSE)
     {
-        loc_eng_data.conn_handle = server_request_ptr->payload.rpc_loc_server_request_u_type_u.close_req.conn_handle;
-        loc_eng_data.agps_status = GPS_RELEASE_AGPS_DATA_CONN;
+        if (loc_eng_atl_close_request (server_request_ptr->payload.rpc_loc_server_request_u_type_u.close_req.conn_handle) == TRUE)
+        {
+            loc_eng_data.agps_status = GPS_RELEASE_AGPS_DATA_CONN;
+        }
     }
 }
 
@@ -1109,14 +1303,14 @@ static int loc_eng_agps_data_conn_open(const char* apn)
         loc_eng_data.apn_name[apn_len] = '\0';
     }
 
-    loc_eng_process_atl_deferred_action(TRUE, FALSE);
+    loc_eng_atl_report_open (TRUE);
     return 0;
 }
 
 static int loc_eng_agps_data_conn_closed()
 {
     LOGD("loc_eng_agps_data_conn_closed");
-    loc_eng_process_atl_deferred_action(FALSE, TRUE);
+    loc_eng_atl_report_closed ();
     return 0;
 }
 
@@ -1124,38 +1318,62 @@ static int loc_eng_agps_data_conn_failed()
 {
     LOGD("loc_eng_agps_data_conn_failed");
 
-    loc_eng_process_atl_deferred_action(FALSE, FALSE);
+    loc_eng_atl_report_open (FALSE);
     return 0;
 }
 
+/*===========================================================================
+FUNCTION    set_agps_server
+
+DESCRIPTION
+   Passes the SUPL server address to the modem. The best server probed by
+   loc_eng_slp is taken, before the first probes the framework's server.
+   The framework's server gets the first address cached by loc_eng_dns, the
+   next one once a session with it failed. Names are resolved in the
+   background, this never waits for the resolver.
+
+DEPENDENCIES
+   loc_eng_agps_set_server
+
+RETURN VALUE
+   0: success, -1 if no address is known yet or the ioctl failed
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
 static int set_agps_server()
 {
     rpc_loc_ioctl_data_u_type       ioctl_data;
     rpc_loc_server_info_s_type      *server_info_ptr;
     boolean                         ret_val;
-    uint16                          port_temp;
-    char                            url[24];
+    // dotted quad, colon and port
+    char                            url[sizeof ("255.255.255.255:65535")];
     int                             len;
+    uint32                          addr;
+    int                             port;
     unsigned char                   *b_ptr;
 
     if (loc_eng_data.agps_server_host[0] == 0 || loc_eng_data.agps_server_port == 0)
         return -1;
 
-    if (loc_eng_data.agps_server_address == 0) {
-        struct hostent* he = gethostbyname(loc_eng_data.agps_server_host);
-        if (he)
-            loc_eng_data.agps_server_address = *(uint32_t *)he->h_addr_list[0];
-    }
-    if (loc_eng_data.agps_server_address == 0)
+    if (loc_eng_slp_select (&addr, &port) == FALSE)
+    {
+        LOGD("set_agps_server: %s not resolved yet", loc_eng_data.agps_server_host);
         return -1;
+    }
 
-    b_ptr = (unsigned char*) (&loc_eng_data.agps_server_address);
+    b_ptr = (unsigned char*) (&addr);
     memset(url, 0, sizeof(url));
-    snprintf(url, sizeof(url) - 1, "%d.%d.%d.%d:%d",
+    len = snprintf(url, sizeof(url), "%d.%d.%d.%d:%d",
             (*(b_ptr + 0)  & 0x000000ff), (*(b_ptr+1) & 0x000000ff),
             (*(b_ptr + 2)  & 0x000000ff), (*(b_ptr+3) & 0x000000ff),
-            (loc_eng_data.agps_server_port & (0x0000ffff)));
-    len = strlen (url);
+            (port & (0x0000ffff)));
+    if (len < 0 || len >= (int) sizeof(url))
+    {
+        LOGE("set_agps_server: server address truncated");
+        return -1;
+    }
 
     server_info_ptr = &(ioctl_data.rpc_loc_ioctl_data_u_type_u.server_addr);
     ioctl_data.disc = RPC_LOC_IOCTL_SET_UMTS_SLP_SERVER_ADDR;
@@ -1192,8 +1410,14 @@ static int loc_eng_agps_set_server(AGpsType type, const char* hostname, int port
     if (type != AGPS_TYPE_SUPL)
         return -1;
 
-    strncpy(loc_eng_data.agps_server_host, hostname, sizeof(loc_eng_data.agps_server_host) - 1);
+    strlcpy(loc_eng_data.agps_server_host, hostname, sizeof(loc_eng_data.agps_server_host));
     loc_eng_data.agps_server_port = port;
+
+    // Resolve and probe now, loc_eng_start only takes the cached address
+    char propBuf[PROPERTY_VALUE_MAX];
+    property_get("gps.supl.servers", propBuf, "");
+    loc_eng_dns_set_server(loc_eng_data.agps_server_host);
+    loc_eng_slp_set_servers(loc_eng_data.agps_server_host, port, propBuf);
     return 0;
 }
 
@@ -1246,74 +1470,6 @@ static void loc_eng_delete_aiding_data_deferred_action (void)
     LOGD("loc_eng_delete_aiding_data_deferred_action: loc_eng_ioctl for aiding data deletion returned %d, 1 for success", ret_val);
 }
 
-/*===========================================================================
-FUNCTION    loc_eng_process_atl_deferred_action
-
-DESCRIPTION
-   This is used to inform the location engine of the processing status for
-   data connection open/close request.
-
-DEPENDENCIES
-   None
-
-RETURN VALUE
-   RPC_LOC_API_SUCCESS
-
-SIDE EFFECTS
-   N/A
-
-===========================================================================*/
-static void loc_eng_process_atl_deferred_action (boolean data_connection_succeeded,
-        boolean data_connection_closed)
-{
-    rpc_loc_server_open_status_s_type  *conn_open_status_ptr;
-    rpc_loc_server_close_status_s_type *conn_close_status_ptr;
-    rpc_loc_ioctl_data_u_type           ioctl_data;
-    boolean                             ret_val;
-
-    LOGV("loc_eng_process_atl_deferred_action: agps_status = %d", loc_eng_data.agps_status);
-
-    memset (&ioctl_data, 0, sizeof (rpc_loc_ioctl_data_u_type));
- 
-    if (data_connection_closed)
-    {
-        ioctl_data.disc = RPC_LOC_IOCTL_INFORM_SERVER_CLOSE_STATUS;
-        conn_close_status_ptr = &(ioctl_data.rpc_loc_ioctl_data_u_type_u.conn_close_status);
-        conn_close_status_ptr->conn_handle = loc_eng_data.conn_handle;
-        conn_close_status_ptr->close_status = RPC_LOC_SERVER_CLOSE_SUCCESS;
-    }
-    else
-    {
-        ioctl_data.disc = RPC_LOC_IOCTL_INFORM_SERVER_OPEN_STATUS;
-        conn_open_status_ptr = &ioctl_data.rpc_loc_ioctl_data_u_type_u.conn_open_status;
-        conn_open_status_ptr->conn_handle = loc_eng_data.conn_handle;
-        if (data_connection_succeeded)
-        {
-            conn_open_status_ptr->open_status = RPC_LOC_SERVER_OPEN_SUCCESS;
-            // Both buffer are of the same maximum size, and the source is null terminated
-            // strcpy (&(ioctl_data.rpc_loc_ioctl_data_u_type_u.conn_open_status.apn_name), &(loc_eng_data.apn_name));
-            conn_open_status_ptr->apn_name = loc_eng_data.apn_name;
-            // Delay this so that PDSM ATL module will behave properly
-            sleep (1);
-            LOGD("loc_eng_process_atl_deferred_action: loc_eng_ioctl for ATL with apn_name = %s", conn_open_status_ptr->apn_name);
-        }
-        else // data_connection_failed
-        {
-            conn_open_status_ptr->open_status = RPC_LOC_SERVER_OPEN_FAIL;
-        }
-        // Delay this so that PDSM ATL module will behave properly
-        sleep (1);
-    }
-
-    ret_val = loc_eng_ioctl (loc_eng_data.client_handle,
-                             ioctl_data.disc,
-                             &ioctl_data,
-                             LOC_IOCTL_DEFAULT_TIMEOUT,
-                             NULL);
-
-    LOGD("loc_eng_process_atl_deferred_action: loc_eng_ioctl for ATL returned %d (1 for success)", ret_val);
-}
-
 /*===========================================================================
 FUNCTION    loc_eng_process_loc_event
 
@@ -1362,29 +1518,18 @@ static void loc_eng_process_loc_event (rpc_loc_event_mask_type loc_event,
                 RPC_LOC_ASSIST_DATA_PREDICTED_ORBITS_REQ)
         {
             LOGD("loc_eng_process_loc_event: xtra download requst");
-
-            pthread_mutex_lock(&loc_eng_data.xtra_module_data.xtra_mutex);
-            // Call Registered callback
-            if (loc_eng_data.xtra_module_data.download_request_cb != NULL) {
-                loc_eng_data.xtra_module_data.download_request_cb();
-            } else {
-                LOGD("loc_eng_process_loc_event: no xtra callback, will download when callback registered");
-                loc_eng_data.xtra_module_data.download_request_pending = TRUE;
-            }
-            pthread_mutex_unlock(&loc_eng_data.xtra_module_data.xtra_mutex);
+            loc_eng_xtra_request_download ();
         }
     }
 
-    if (loc_event & RPC_LOC_EVENT_IOCTL_REPORT)
+    if (loc_event & RPC_LOC_EVENT_LOCATION_SERVER_REQUEST)
     {
-        // Process the received RPC_LOC_EVENT_IOCTL_REPORT
-        (void) loc_eng_ioctl_process_cb (loc_eng_data.client_handle,
-                                &(loc_event_payload->rpc_loc_event_payload_u_type_u.ioctl_report));
+        loc_eng_process_conn_request (&(loc_event_payload->rpc_loc_event_payload_u_type_u.loc_server_request));
     }
 
-    if (loc_event & RPC_LOC_EVENT_LOCATION_SERVER_REQUEST)
+    if (loc_event & RPC_LOC_EVENT_NI_NOTIFY_VERIFY_REQUEST)
     {
-        loc_eng_process_conn_request (&(loc_event_payload->rpc_loc_event_payload_u_type_u.loc_server_request));
+        loc_eng_coverage_ni_request ();
     }
 
     loc_eng_ni_callback(loc_event, loc_event_payload);
@@ -1428,54 +1573,46 @@ static void* loc_eng_process_deferred_action (void* arg)
 
     LOGD("loc_eng_process_deferred_action: started");
 
+#ifdef HAVE_ANDROID_OS
     // make sure we do not run in background scheduling group
     set_sched_policy(gettid(), SP_FOREGROUND);
+#endif
+
+    // Let loc_eng_init go on
+    pthread_mutex_lock (&loc_eng_data.deferred_action_mutex);
+    loc_eng_data.deferred_action_thread_ready = TRUE;
+    pthread_cond_signal (&loc_eng_data.deferred_action_cond);
+    pthread_mutex_unlock (&loc_eng_data.deferred_action_mutex);
 
     while (1) {
 
         if (loc_eng_data.deferred_action_thread_need_exit == TRUE) break;
 
-        // lock the queue
-        pthread_mutex_lock(&loc_eng_data.deferred_action_mutex);
-
-        if (loc_eng_data.work_queue) {
-            LOGD("loc_eng_process_deferred_action: processing existing work");
-        } else {
-            LOGD("loc_eng_process_deferred_action: waiting for work");
-            pthread_cond_wait(&loc_eng_data.deferred_action_cond,
-                              &loc_eng_data.deferred_action_mutex);
-            LOGD("loc_eng_process_deferred_action: processing new work");
-        }
-
-        // get head of queue
-        work = loc_eng_data.work_queue;
+        // get head of queue, waits if the queue is empty
+        work = loc_eng_queue_wait (&loc_eng_data.work_queue);
 
         // we can be notified without work (e.g. thread shutdown)
         if (!work) {
-            pthread_mutex_unlock(&loc_eng_data.deferred_action_mutex);
             continue;
         }
 
-        // remove first item from queue
-        loc_eng_data.work_queue = work->next;
-        // unlock the queue
-        pthread_mutex_unlock(&loc_eng_data.deferred_action_mutex);
-
-        // save current agps_status
+        // save current agps_status, an event that asks the framework again sets it again
         last_agps_status = loc_eng_data.agps_status;
+        loc_eng_data.agps_status = 0;
 
         if (work->loc_event != 0) {
             //this may set loc_eng_data.agps_status.status
             loc_eng_process_loc_event(work->loc_event, &work->loc_event_payload);
         }
 
-        // dispose of work item
-        free(work);
+        // give the slot back to loc_event_cb
+        loc_eng_queue_release (&loc_eng_data.work_queue);
 
-        // callback if status has changed after this event
-        if (loc_eng_data.agps_status != 0 &&
-            loc_eng_data.agps_status != last_agps_status &&
-            loc_eng_data.agps_status_cb) {
+        // callback if this event set the status, loc_eng_atl only does so when the framework has to act
+        if (loc_eng_data.agps_status == 0) {
+            loc_eng_data.agps_status = last_agps_status;
+        }
+        else if (loc_eng_data.agps_status_cb) {
 
             LOGD("loc_eng_process_deferred_action: calling agps_status_cb(0x%x)", loc_eng_data.agps_status);
 
@@ -45,18 +45,26 @@ typedef unsigned char boolean;
 #define FALSE 0
 #endif
 
+#include <loc_eng_queue.h>
 #include <loc_eng_ioctl.h>
 #include <loc_eng_xtra.h>
+#include <loc_eng_xtra_download.h>
+#include <loc_eng_coverage.h>
+#include <loc_eng_dns.h>
+#include <loc_eng_slp.h>
+#include <loc_eng_atl.h>
+#include <loc_eng_mode.h>
 #include <hardware_legacy/gps_ni.h>
 
 #define LOC_IOCTL_DEFAULT_TIMEOUT 1000 // 1000 milli-seconds
 
-typedef struct work_item work_item;
-struct work_item {
-    work_item                      *next;
-    rpc_loc_event_mask_type         loc_event;
-    rpc_loc_event_payload_u_type    loc_event_payload;
-};
+// Startup: time the deferred action thread has to come up, then the RPC
+// server is pinged with a delay doubling from the first to the max one
+// until it answers or the timeout runs out
+#define LOC_ENG_STARTUP_THREAD_TIMEOUT  1000  // msec
+#define LOC_ENG_STARTUP_PING_DELAY      10    // msec
+#define LOC_ENG_STARTUP_PING_MAX_DELAY  500   // msec
+#define LOC_ENG_STARTUP_TIMEOUT         5000  // msec
 
 // Module data
 typedef struct
@@ -72,16 +80,20 @@ typedef struct
     int                            agps_status;
 
     loc_eng_xtra_data_s_type       xtra_module_data;
+    loc_eng_xtra_download_data_s_type xtra_download_data;
+    loc_eng_coverage_data_s_type   coverage_data;
+    loc_eng_atl_data_s_type        atl_data;
 
     loc_eng_ioctl_data_s_type      ioctl_data;
 
     // TBD:
-    char                           agps_server_host[256];
+    char                           agps_server_host[LOC_ENG_DNS_MAX_HOST_LEN];
     int                            agps_server_port;
-    uint32                         agps_server_address;
     char                           apn_name[100];
     int                            position_mode;
-    rpc_loc_server_connection_handle  conn_handle;
+    int                            fix_frequency;
+    // Operation mode last sent in SET_FIX_CRITERIA, see loc_eng_mode
+    rpc_loc_operation_mode_e_type  oper_mode;
 
     // GPS engine status
     GpsStatusValue                 engine_status;
@@ -93,13 +105,17 @@ typedef struct
     pthread_t                      deferred_action_thread;
     // Signal deferred action thread to exit
     boolean                        deferred_action_thread_need_exit;
-    // Mutex used by deferred action thread
+    // Set by the deferred action thread once it runs, loc_eng_init waits for it
     pthread_mutex_t                deferred_action_mutex;
-    // Condition variable used by deferred action thread
     pthread_cond_t                 deferred_action_cond;
+    boolean                        deferred_action_thread_ready;
+
+    // Pings the RPC server took to answer at startup, and the time until it did
+    int                            startup_pings;
+    int64_t                        startup_msec;
 
     // work queue for event callback
-    work_item                     *work_queue;
+    loc_eng_queue_data_s_type      work_queue;
 
     // used for workaround for lack of sats in fix info
     int64_t                        last_fix_time;
@@ -0,0 +1,1047 @@
+/******************************************************************************
+  @file:  loc_eng_atl.cpp
+  @brief:
+
+  DESCRIPTION
+    This file implements the ATL handshake. Every connection of the modem
+    has an entry of its own, the framework is asked for the data connection
+    once however many connections share it. The status of each connection
+    is sent to the modem from a thread of its own once the modem can take
+    it, and sent again while the modem refuses it, so neither the framework
+    nor the deferred action thread waits on the modem.
+
+  INITIALIZATION AND SEQUENCING REQUIREMENTS
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+         Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer. 
+
+         Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution. 
+
+         Neither the name of the QUALCOMM USA, INC.  nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  -----------------------------------------------------------------------------
+
+******************************************************************************/
+
+/*=====================================================================
+$Header: $
+$DateTime: $
+$Author: $
+======================================================================*/
+#define LOG_NDEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <rpc/rpc.h>
+#include <loc_api_rpc_glue.h>
+
+#include <hardware_legacy/gps.h>
+#include <cutils/properties.h>
+
+#include <loc_eng.h>
+
+#define LOG_TAG "lib_locapi"
+#include <utils/Log.h>
+
+// comment this out to enable logging
+// #undef LOGD
+// #define LOGD(...) {}
+
+static void* loc_eng_atl_thread (void* arg);
+static boolean loc_eng_atl_in_flight (loc_eng_atl_data_s_type *atl_ptr);
+static void loc_eng_atl_release_data_conn (loc_eng_atl_data_s_type *atl_ptr);
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_init
+
+DESCRIPTION
+   Initializes the ATL handshake and starts its thread.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_atl_init (loc_eng_atl_data_s_type *atl_ptr)
+{
+    char propBuf[PROPERTY_VALUE_MAX];
+    char defBuf[16];
+
+    memset (atl_ptr, 0, sizeof (loc_eng_atl_data_s_type));
+    pthread_mutex_init (&atl_ptr->lock, NULL);
+    loc_eng_ioctl_cond_init (&atl_ptr->cond);
+    atl_ptr->data_conn = LOC_ENG_ATL_DATA_CONN_DOWN;
+
+    snprintf (defBuf, sizeof (defBuf), "%d", LOC_ENG_ATL_SETTLE_TIME);
+    property_get ("gps.atl.settle_ms", propBuf, defBuf);
+    atl_ptr->settle_msec = atoi (propBuf);
+
+    snprintf (defBuf, sizeof (defBuf), "%d", LOC_ENG_ATL_LINGER_TIME);
+    property_get ("gps.atl.linger_ms", propBuf, defBuf);
+    atl_ptr->linger_msec = atoi (propBuf);
+
+    atl_ptr->thread_need_exit = FALSE;
+    pthread_create (&atl_ptr->thread, NULL, loc_eng_atl_thread, atl_ptr);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_deinit
+
+DESCRIPTION
+   Stops the ATL thread. A status still on its way to the modem is waited
+   for, the ioctl timeout bounds the wait. A lingering or pre-opened data
+   connection is released.
+
+DEPENDENCIES
+   Before the ioctl module is released
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_atl_deinit (loc_eng_atl_data_s_type *atl_ptr)
+{
+    pthread_mutex_lock (&atl_ptr->lock);
+    atl_ptr->thread_need_exit = TRUE;
+    pthread_cond_signal (&atl_ptr->cond);
+    pthread_mutex_unlock (&atl_ptr->lock);
+    pthread_join (atl_ptr->thread, NULL);
+
+    pthread_mutex_lock (&atl_ptr->lock);
+    while (loc_eng_atl_in_flight (atl_ptr) == TRUE)
+    {
+        pthread_cond_wait (&atl_ptr->cond, &atl_ptr->lock);
+    }
+    if (atl_ptr->linger_active == TRUE || atl_ptr->preopen_active == TRUE)
+    {
+        atl_ptr->linger_active = FALSE;
+        atl_ptr->preopen_active = FALSE;
+        loc_eng_atl_release_data_conn (atl_ptr);
+    }
+    pthread_mutex_unlock (&atl_ptr->lock);
+
+    pthread_cond_destroy (&atl_ptr->cond);
+    pthread_mutex_destroy (&atl_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_in_flight
+
+DESCRIPTION
+   Whether a status of any connection is on its way to the modem. Called
+   with the lock held.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if a status is on its way
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_atl_in_flight (loc_eng_atl_data_s_type *atl_ptr)
+{
+    int i;
+
+    for (i = 0; i < LOC_ENG_ATL_MAX_CONNS; i++)
+    {
+        if (atl_ptr->conns[i].report_in_flight == TRUE)
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_get_conn
+
+DESCRIPTION
+   Finds the entry of a connection, or takes a free one for it. Called with
+   the lock held.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   The entry, NULL if the table is full
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static loc_eng_atl_conn_s_type* loc_eng_atl_get_conn (loc_eng_atl_data_s_type *atl_ptr,
+                                                      rpc_loc_server_connection_handle conn_handle)
+{
+    loc_eng_atl_conn_s_type *free_ptr = NULL;
+    uint32 in_use = 0;
+    int i;
+
+    for (i = 0; i < LOC_ENG_ATL_MAX_CONNS; i++)
+    {
+        if (atl_ptr->conns[i].in_use == TRUE)
+        {
+            if (atl_ptr->conns[i].conn_handle == conn_handle)
+            {
+                return &atl_ptr->conns[i];
+            }
+            in_use++;
+        }
+        // An entry still waiting for the modem's answer is not reused
+        else if (free_ptr == NULL && atl_ptr->conns[i].report_in_flight == FALSE)
+        {
+            free_ptr = &atl_ptr->conns[i];
+        }
+    }
+
+    if (free_ptr == NULL)
+    {
+        LOGE("loc_eng_atl_get_conn: no room for connection %lu", (unsigned long) conn_handle);
+        atl_ptr->conns_dropped++;
+        return NULL;
+    }
+
+    memset (free_ptr, 0, sizeof (loc_eng_atl_conn_s_type));
+    free_ptr->in_use = TRUE;
+    free_ptr->conn_handle = conn_handle;
+    free_ptr->state = LOC_ENG_ATL_STATE_IDLE;
+    if (in_use + 1 > atl_ptr->conns_max)
+    {
+        atl_ptr->conns_max = in_use + 1;
+    }
+    return free_ptr;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_conns_active
+
+DESCRIPTION
+   Whether a connection other than conn_ptr still needs the data
+   connection. Called with the lock held.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if another connection is open or asked for
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_atl_conns_active (loc_eng_atl_data_s_type *atl_ptr,
+                                         const loc_eng_atl_conn_s_type *conn_ptr)
+{
+    int i;
+
+    for (i = 0; i < LOC_ENG_ATL_MAX_CONNS; i++)
+    {
+        if (&atl_ptr->conns[i] != conn_ptr && atl_ptr->conns[i].in_use == TRUE &&
+            (atl_ptr->conns[i].state == LOC_ENG_ATL_STATE_OPEN_REQUESTED ||
+             atl_ptr->conns[i].state == LOC_ENG_ATL_STATE_OPEN))
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_queue_report
+
+DESCRIPTION
+   Hands the status of a connection to the ATL thread. An open status waits
+   until the modem has had settle_msec since its request, other statuses go
+   out at once. Called with the lock held.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_atl_queue_report (loc_eng_atl_data_s_type *atl_ptr, loc_eng_atl_conn_s_type *conn_ptr,
+                                      rpc_loc_ioctl_e_type report_type, boolean success)
+{
+    long nsec;
+
+    conn_ptr->report_pending = TRUE;
+    conn_ptr->report_type = report_type;
+    conn_ptr->report_success = success;
+    conn_ptr->attempts = 0;
+
+    if (report_type == RPC_LOC_IOCTL_INFORM_SERVER_OPEN_STATUS)
+    {
+        nsec = conn_ptr->request_time.tv_nsec + (atl_ptr->settle_msec % 1000) * 1000000L;
+        conn_ptr->report_time.tv_sec = conn_ptr->request_time.tv_sec + atl_ptr->settle_msec / 1000 + nsec / 1000000000L;
+        conn_ptr->report_time.tv_nsec = nsec % 1000000000L;
+    }
+    else
+    {
+        clock_gettime (CLOCK_MONOTONIC, &conn_ptr->report_time);
+    }
+    pthread_cond_signal (&atl_ptr->cond);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_before
+
+DESCRIPTION
+   Compares two CLOCK_MONOTONIC times.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if a is before b
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_atl_before (const struct timespec *a_ptr, const struct timespec *b_ptr)
+{
+    return (a_ptr->tv_sec < b_ptr->tv_sec ||
+            (a_ptr->tv_sec == b_ptr->tv_sec && a_ptr->tv_nsec < b_ptr->tv_nsec)) ? TRUE : FALSE;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_release_data_conn
+
+DESCRIPTION
+   Asks the framework to take the data connection down. Called with the
+   lock held, so that the request cannot overtake a later one for the
+   data connection from the deferred action thread.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_atl_release_data_conn (loc_eng_atl_data_s_type *atl_ptr)
+{
+    AGpsStatus status;
+
+    if (atl_ptr->data_conn != LOC_ENG_ATL_DATA_CONN_UP ||
+        loc_eng_atl_conns_active (atl_ptr, NULL) == TRUE)
+    {
+        return;
+    }
+
+    atl_ptr->data_conn = LOC_ENG_ATL_DATA_CONN_CLOSING;
+    if (loc_eng_data.agps_status_cb != NULL)
+    {
+        LOGD("loc_eng_atl_release_data_conn: calling agps_status_cb(0x%x)", GPS_RELEASE_AGPS_DATA_CONN);
+        status.status = GPS_RELEASE_AGPS_DATA_CONN;
+        status.type = AGPS_TYPE_SUPL;
+        loc_eng_data.agps_status_cb (&status);
+    }
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_data_conn_unused
+
+DESCRIPTION
+   The data connection may have no user left. It is kept for keep_msec,
+   or released at once for 0.
+
+DEPENDENCIES
+   Called with the lock held
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_atl_data_conn_unused (loc_eng_atl_data_s_type *atl_ptr, uint32 keep_msec)
+{
+    if (atl_ptr->data_conn != LOC_ENG_ATL_DATA_CONN_UP ||
+        atl_ptr->preopen_active == TRUE ||
+        loc_eng_atl_conns_active (atl_ptr, NULL) == TRUE)
+    {
+        return;
+    }
+
+    if (keep_msec > 0)
+    {
+        atl_ptr->linger_active = TRUE;
+        loc_eng_ioctl_deadline (keep_msec, &atl_ptr->linger_time);
+        pthread_cond_signal (&atl_ptr->cond);
+    }
+    else
+    {
+        atl_ptr->linger_active = FALSE;
+        loc_eng_atl_release_data_conn (atl_ptr);
+    }
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_open_request
+
+DESCRIPTION
+   The modem asks for a connection. A connection that finds the data
+   connection up, lingering included, is answered at once, the framework is
+   only asked when the data connection is down or going down.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if the framework has to bring the data connection up
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+boolean loc_eng_atl_open_request (rpc_loc_server_connection_handle conn_handle,
+                                  rpc_loc_server_protocol_e_type protocol)
+{
+    loc_eng_atl_data_s_type *atl_ptr = &(loc_eng_data.atl_data);
+    loc_eng_atl_conn_s_type *conn_ptr;
+    boolean ask_framework = FALSE;
+
+    pthread_mutex_lock (&atl_ptr->lock);
+    conn_ptr = loc_eng_atl_get_conn (atl_ptr, conn_handle);
+    if (conn_ptr != NULL)
+    {
+        conn_ptr->protocol = protocol;
+        conn_ptr->state = LOC_ENG_ATL_STATE_OPEN_REQUESTED;
+        clock_gettime (CLOCK_MONOTONIC, &conn_ptr->request_time);
+        conn_ptr->report_pending = FALSE;
+        if (atl_ptr->preopen_active == TRUE)
+        {
+            // The connection takes the pre-opened data connection over
+            atl_ptr->preopen_active = FALSE;
+            atl_ptr->preopens_used++;
+        }
+
+        switch (atl_ptr->data_conn)
+        {
+        case LOC_ENG_ATL_DATA_CONN_UP:
+            if (atl_ptr->linger_active == TRUE)
+            {
+                atl_ptr->linger_active = FALSE;
+                atl_ptr->warm_opens++;
+            }
+            loc_eng_atl_queue_report (atl_ptr, conn_ptr, RPC_LOC_IOCTL_INFORM_SERVER_OPEN_STATUS, TRUE);
+            break;
+        case LOC_ENG_ATL_DATA_CONN_OPENING:
+            break;
+        default:
+            atl_ptr->data_conn = LOC_ENG_ATL_DATA_CONN_OPENING;
+            ask_framework = TRUE;
+            break;
+        }
+        LOGD("loc_eng_atl_open_request: connection %lu, protocol %d, data connection %d",
+             (unsigned long) conn_handle, protocol, atl_ptr->data_conn);
+    }
+    pthread_mutex_unlock (&atl_ptr->lock);
+
+    return ask_framework;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_open_decline
+
+DESCRIPTION
+   Answers an open request of the modem with a failure, the framework is not
+   asked for the data connection.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_atl_open_decline (rpc_loc_server_connection_handle conn_handle,
+                               rpc_loc_server_protocol_e_type protocol)
+{
+    loc_eng_atl_data_s_type *atl_ptr = &(loc_eng_data.atl_data);
+    loc_eng_atl_conn_s_type *conn_ptr;
+
+    pthread_mutex_lock (&atl_ptr->lock);
+    conn_ptr = loc_eng_atl_get_conn (atl_ptr, conn_handle);
+    if (conn_ptr != NULL)
+    {
+        conn_ptr->protocol = protocol;
+        conn_ptr->state = LOC_ENG_ATL_STATE_OPEN_REQUESTED;
+        clock_gettime (CLOCK_MONOTONIC, &conn_ptr->request_time);
+        loc_eng_atl_queue_report (atl_ptr, conn_ptr, RPC_LOC_IOCTL_INFORM_SERVER_OPEN_STATUS, FALSE);
+        atl_ptr->opens_declined++;
+    }
+    pthread_mutex_unlock (&atl_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_close_request
+
+DESCRIPTION
+   The modem gives a connection back. The data connection is only taken
+   down with the last connection using it, and after linger_msec without a
+   new one. The others are answered at once.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if the framework has to take the data connection down
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+boolean loc_eng_atl_close_request (rpc_loc_server_connection_handle conn_handle)
+{
+    loc_eng_atl_data_s_type *atl_ptr = &(loc_eng_data.atl_data);
+    loc_eng_atl_conn_s_type *conn_ptr;
+    boolean ask_framework = FALSE;
+
+    pthread_mutex_lock (&atl_ptr->lock);
+    conn_ptr = loc_eng_atl_get_conn (atl_ptr, conn_handle);
+    if (conn_ptr != NULL)
+    {
+        conn_ptr->state = LOC_ENG_ATL_STATE_CLOSE_REQUESTED;
+        conn_ptr->report_pending = FALSE;
+
+        if (atl_ptr->data_conn == LOC_ENG_ATL_DATA_CONN_UP &&
+            loc_eng_atl_conns_active (atl_ptr, conn_ptr) == FALSE &&
+            atl_ptr->linger_msec > 0)
+        {
+            // The modem is done with it, the data connection stays up for a while
+            loc_eng_atl_queue_report (atl_ptr, conn_ptr, RPC_LOC_IOCTL_INFORM_SERVER_CLOSE_STATUS, TRUE);
+            atl_ptr->linger_active = TRUE;
+            loc_eng_ioctl_deadline (atl_ptr->linger_msec, &atl_ptr->linger_time);
+        }
+        else if (atl_ptr->data_conn == LOC_ENG_ATL_DATA_CONN_UP &&
+                 loc_eng_atl_conns_active (atl_ptr, conn_ptr) == FALSE)
+        {
+            atl_ptr->data_conn = LOC_ENG_ATL_DATA_CONN_CLOSING;
+            ask_framework = TRUE;
+        }
+        else if (atl_ptr->data_conn != LOC_ENG_ATL_DATA_CONN_CLOSING)
+        {
+            // Others still use the data connection, or there is none
+            loc_eng_atl_queue_report (atl_ptr, conn_ptr, RPC_LOC_IOCTL_INFORM_SERVER_CLOSE_STATUS, TRUE);
+        }
+        LOGD("loc_eng_atl_close_request: connection %lu, data connection %d",
+             (unsigned long) conn_handle, atl_ptr->data_conn);
+    }
+    pthread_mutex_unlock (&atl_ptr->lock);
+
+    return ask_framework;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_report_open
+
+DESCRIPTION
+   The framework brought the data connection up, or failed to. Every
+   connection waiting for it is answered.
+
+DEPENDENCIES
+   loc_eng_data.apn_name holds the APN of an open connection
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_atl_report_open (boolean success)
+{
+    loc_eng_atl_data_s_type *atl_ptr = &(loc_eng_data.atl_data);
+    boolean answered = FALSE;
+    int i;
+
+    pthread_mutex_lock (&atl_ptr->lock);
+    atl_ptr->data_conn = (success == TRUE) ? LOC_ENG_ATL_DATA_CONN_UP : LOC_ENG_ATL_DATA_CONN_DOWN;
+    for (i = 0; i < LOC_ENG_ATL_MAX_CONNS; i++)
+    {
+        if (atl_ptr->conns[i].in_use == TRUE &&
+            atl_ptr->conns[i].state == LOC_ENG_ATL_STATE_OPEN_REQUESTED &&
+            atl_ptr->conns[i].report_pending == FALSE)
+        {
+            loc_eng_atl_queue_report (atl_ptr, &atl_ptr->conns[i], RPC_LOC_IOCTL_INFORM_SERVER_OPEN_STATUS, success);
+            answered = TRUE;
+        }
+    }
+    if (answered == FALSE)
+    {
+        LOGD("loc_eng_atl_report_open: no connection waits for the data connection");
+    }
+    if (success == TRUE)
+    {
+        // A pre-open may have ended while the data connection came up
+        loc_eng_atl_data_conn_unused (atl_ptr, atl_ptr->preopen_keep_msec);
+    }
+    atl_ptr->preopen_keep_msec = 0;
+    pthread_mutex_unlock (&atl_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_report_closed
+
+DESCRIPTION
+   The framework took the data connection down. Every connection given back
+   meanwhile is answered.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_atl_report_closed (void)
+{
+    loc_eng_atl_data_s_type *atl_ptr = &(loc_eng_data.atl_data);
+    int i;
+
+    pthread_mutex_lock (&atl_ptr->lock);
+    // A connection asked for meanwhile has the framework bring it up again
+    if (atl_ptr->data_conn != LOC_ENG_ATL_DATA_CONN_OPENING)
+    {
+        atl_ptr->data_conn = LOC_ENG_ATL_DATA_CONN_DOWN;
+    }
+    for (i = 0; i < LOC_ENG_ATL_MAX_CONNS; i++)
+    {
+        if (atl_ptr->conns[i].in_use == TRUE &&
+            atl_ptr->conns[i].state == LOC_ENG_ATL_STATE_CLOSE_REQUESTED &&
+            atl_ptr->conns[i].report_pending == FALSE)
+        {
+            loc_eng_atl_queue_report (atl_ptr, &atl_ptr->conns[i], RPC_LOC_IOCTL_INFORM_SERVER_CLOSE_STATUS, TRUE);
+        }
+    }
+    pthread_mutex_unlock (&atl_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_preopen
+
+DESCRIPTION
+   Asks the framework for the data connection ahead of a connection of the
+   modem. Until loc_eng_atl_preopen_done or the modem's open request, the
+   data connection is held as if a connection used it.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_atl_preopen (void)
+{
+    loc_eng_atl_data_s_type *atl_ptr = &(loc_eng_data.atl_data);
+    AGpsStatus status;
+
+    pthread_mutex_lock (&atl_ptr->lock);
+    if (atl_ptr->preopen_active == FALSE && loc_eng_data.agps_status_cb != NULL)
+    {
+        atl_ptr->preopen_active = TRUE;
+        atl_ptr->preopen_keep_msec = 0;
+        atl_ptr->preopens++;
+
+        switch (atl_ptr->data_conn)
+        {
+        case LOC_ENG_ATL_DATA_CONN_UP:
+            // Held until the pre-open ends
+            atl_ptr->linger_active = FALSE;
+            break;
+        case LOC_ENG_ATL_DATA_CONN_OPENING:
+            break;
+        default:
+            // Asked for with the lock held, like the release by the ATL thread
+            atl_ptr->data_conn = LOC_ENG_ATL_DATA_CONN_OPENING;
+            LOGD("loc_eng_atl_preopen: calling agps_status_cb(0x%x)", GPS_REQUEST_AGPS_DATA_CONN);
+            status.status = GPS_REQUEST_AGPS_DATA_CONN;
+            status.type = AGPS_TYPE_SUPL;
+            loc_eng_data.agps_status_cb (&status);
+            break;
+        }
+    }
+    pthread_mutex_unlock (&atl_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_preopen_done
+
+DESCRIPTION
+   Ends a pre-open. If accepted, the modem is about to ask for its
+   connection and the data connection is kept for a while, otherwise it is
+   released as soon as it is up and unused.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_atl_preopen_done (boolean accepted)
+{
+    loc_eng_atl_data_s_type *atl_ptr = &(loc_eng_data.atl_data);
+    uint32 keep_msec = 0;
+
+    pthread_mutex_lock (&atl_ptr->lock);
+    if (atl_ptr->preopen_active == TRUE)
+    {
+        atl_ptr->preopen_active = FALSE;
+        if (accepted == TRUE)
+        {
+            keep_msec = (atl_ptr->linger_msec > LOC_ENG_ATL_PREOPEN_HOLD) ?
+                        atl_ptr->linger_msec : LOC_ENG_ATL_PREOPEN_HOLD;
+        }
+        else
+        {
+            atl_ptr->preopens_released++;
+        }
+        LOGD("loc_eng_atl_preopen_done: accepted %d, data connection %d", accepted, atl_ptr->data_conn);
+        if (atl_ptr->data_conn == LOC_ENG_ATL_DATA_CONN_OPENING)
+        {
+            // Applied by loc_eng_atl_report_open
+            atl_ptr->preopen_keep_msec = keep_msec;
+        }
+        else
+        {
+            loc_eng_atl_data_conn_unused (atl_ptr, keep_msec);
+        }
+    }
+    pthread_mutex_unlock (&atl_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_report_done
+
+DESCRIPTION
+   Moves a connection on once the modem took its status, the entry is freed
+   with the connection. A status refused by the modem, or one loc_ioctl
+   could not send, is sent again after a growing delay, up to
+   LOC_ENG_ATL_MAX_ATTEMPTS times. Called with the lock held.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_atl_report_done (loc_eng_atl_data_s_type *atl_ptr, loc_eng_atl_conn_s_type *conn_ptr,
+                                     rpc_loc_ioctl_e_type report_type, boolean sent, boolean taken)
+{
+    struct timespec now;
+
+    conn_ptr->report_in_flight = FALSE;
+    pthread_cond_signal (&atl_ptr->cond);
+
+    // The connection moved on meanwhile, a newer status is due
+    if (conn_ptr->in_use == FALSE || conn_ptr->report_pending == TRUE ||
+        (report_type == RPC_LOC_IOCTL_INFORM_SERVER_OPEN_STATUS && conn_ptr->state != LOC_ENG_ATL_STATE_OPEN_REQUESTED) ||
+        (report_type == RPC_LOC_IOCTL_INFORM_SERVER_CLOSE_STATUS && conn_ptr->state != LOC_ENG_ATL_STATE_CLOSE_REQUESTED))
+    {
+        return;
+    }
+
+    if (taken == TRUE)
+    {
+        atl_ptr->reports_sent++;
+        if (report_type == RPC_LOC_IOCTL_INFORM_SERVER_OPEN_STATUS && conn_ptr->report_success == TRUE)
+        {
+            clock_gettime (CLOCK_MONOTONIC, &now);
+            atl_ptr->last_open_msec = (now.tv_sec - conn_ptr->request_time.tv_sec) * 1000 +
+                                      (now.tv_nsec - conn_ptr->request_time.tv_nsec) / 1000000;
+            conn_ptr->state = LOC_ENG_ATL_STATE_OPEN;
+            LOGD("loc_eng_atl_report_done: connection %lu open %u ms after the request",
+                 (unsigned long) conn_ptr->conn_handle, atl_ptr->last_open_msec);
+        }
+        else
+        {
+            conn_ptr->state = LOC_ENG_ATL_STATE_IDLE;
+            conn_ptr->in_use = FALSE;
+        }
+        return;
+    }
+
+    if (sent == TRUE)
+    {
+        atl_ptr->reports_refused++;
+    }
+    else
+    {
+        atl_ptr->reports_failed++;
+    }
+    if (conn_ptr->attempts < LOC_ENG_ATL_MAX_ATTEMPTS && atl_ptr->thread_need_exit == FALSE)
+    {
+        LOGD("loc_eng_atl_report_done: modem not ready for connection %lu, attempt %u",
+             (unsigned long) conn_ptr->conn_handle, conn_ptr->attempts);
+        conn_ptr->report_pending = TRUE;
+        loc_eng_ioctl_deadline (LOC_ENG_ATL_RETRY_DELAY << (conn_ptr->attempts - 1), &conn_ptr->report_time);
+    }
+    else
+    {
+        LOGE("loc_eng_atl_report_done: modem did not take the status for connection %lu",
+             (unsigned long) conn_ptr->conn_handle);
+        conn_ptr->state = LOC_ENG_ATL_STATE_IDLE;
+        conn_ptr->in_use = FALSE;
+    }
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_report_cb
+
+DESCRIPTION
+   Completion of RPC_LOC_IOCTL_INFORM_SERVER_OPEN_STATUS or
+   RPC_LOC_IOCTL_INFORM_SERVER_CLOSE_STATUS of one connection.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_atl_report_cb (loc_eng_ioctl_handle_type ioctl_handle,
+                                   const rpc_loc_ioctl_callback_s_type *cb_data_ptr,
+                                   void *user_data)
+{
+    loc_eng_atl_data_s_type *atl_ptr = &(loc_eng_data.atl_data);
+    loc_eng_atl_conn_s_type *conn_ptr = (loc_eng_atl_conn_s_type *) user_data;
+
+    pthread_mutex_lock (&atl_ptr->lock);
+    loc_eng_atl_report_done (atl_ptr, conn_ptr, conn_ptr->flight_type, TRUE,
+                             cb_data_ptr != NULL && cb_data_ptr->status == RPC_LOC_API_SUCCESS);
+    pthread_mutex_unlock (&atl_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_next_report
+
+DESCRIPTION
+   Finds the connection whose status is due first. A status waits while
+   one of its type is on its way: the ioctl module has one slot per ioctl
+   type and the modem's report does not name the connection. Called with
+   the lock held.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   The connection, NULL if no status can be sent
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static loc_eng_atl_conn_s_type* loc_eng_atl_next_report (loc_eng_atl_data_s_type *atl_ptr)
+{
+    loc_eng_atl_conn_s_type *next_ptr = NULL;
+    loc_eng_atl_conn_s_type *conn_ptr;
+    boolean open_busy = FALSE, close_busy = FALSE;
+    int i;
+
+    for (i = 0; i < LOC_ENG_ATL_MAX_CONNS; i++)
+    {
+        conn_ptr = &atl_ptr->conns[i];
+        if (conn_ptr->report_in_flight == TRUE)
+        {
+            if (conn_ptr->flight_type == RPC_LOC_IOCTL_INFORM_SERVER_OPEN_STATUS)
+            {
+                open_busy = TRUE;
+            }
+            else
+            {
+                close_busy = TRUE;
+            }
+        }
+    }
+
+    for (i = 0; i < LOC_ENG_ATL_MAX_CONNS; i++)
+    {
+        conn_ptr = &atl_ptr->conns[i];
+        if (conn_ptr->in_use == FALSE || conn_ptr->report_pending == FALSE ||
+            conn_ptr->report_in_flight == TRUE)
+        {
+            continue;
+        }
+        // Sent once loc_eng_atl_report_done wakes the thread
+        if ((conn_ptr->report_type == RPC_LOC_IOCTL_INFORM_SERVER_OPEN_STATUS && open_busy == TRUE) ||
+            (conn_ptr->report_type == RPC_LOC_IOCTL_INFORM_SERVER_CLOSE_STATUS && close_busy == TRUE))
+        {
+            continue;
+        }
+        if (next_ptr == NULL ||
+            conn_ptr->report_time.tv_sec < next_ptr->report_time.tv_sec ||
+            (conn_ptr->report_time.tv_sec == next_ptr->report_time.tv_sec &&
+             conn_ptr->report_time.tv_nsec < next_ptr->report_time.tv_nsec))
+        {
+            next_ptr = conn_ptr;
+        }
+    }
+    return next_ptr;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_atl_thread
+
+DESCRIPTION
+   Sends the status of each connection when it is due, without waiting
+   for the modem to take it. An open and a close status can be on their
+   way side by side, a second status of the same type is held back until
+   the first one completes, see loc_eng_atl_next_report. Releases the data
+   connection when its linger runs out.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   NULL
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void* loc_eng_atl_thread (void* arg)
+{
+    loc_eng_atl_data_s_type *atl_ptr = (loc_eng_atl_data_s_type *) arg;
+    loc_eng_atl_conn_s_type *conn_ptr;
+    rpc_loc_ioctl_data_u_type ioctl_data;
+    rpc_loc_server_open_status_s_type *conn_open_status_ptr;
+    rpc_loc_server_close_status_s_type *conn_close_status_ptr;
+    struct timespec now;
+    const struct timespec *wake_ptr;
+
+    pthread_mutex_lock (&atl_ptr->lock);
+    while (atl_ptr->thread_need_exit == FALSE)
+    {
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        if (atl_ptr->linger_active == TRUE && loc_eng_atl_before (&now, &atl_ptr->linger_time) == FALSE)
+        {
+            LOGD("loc_eng_atl_thread: no connection for %u ms, releasing the data connection", atl_ptr->linger_msec);
+            atl_ptr->linger_active = FALSE;
+            atl_ptr->lingers_expired++;
+            loc_eng_atl_release_data_conn (atl_ptr);
+            continue;
+        }
+
+        conn_ptr = loc_eng_atl_next_report (atl_ptr);
+        if (conn_ptr == NULL || loc_eng_atl_before (&now, &conn_ptr->report_time) == TRUE)
+        {
+            // Until the next status or the end of the linger, whichever comes first
+            wake_ptr = (conn_ptr != NULL) ? &conn_ptr->report_time : NULL;
+            if (atl_ptr->linger_active == TRUE &&
+                (wake_ptr == NULL || loc_eng_atl_before (&atl_ptr->linger_time, wake_ptr) == TRUE))
+            {
+                wake_ptr = &atl_ptr->linger_time;
+            }
+            if (wake_ptr == NULL)
+            {
+                pthread_cond_wait (&atl_ptr->cond, &atl_ptr->lock);
+            }
+            else
+            {
+                loc_eng_ioctl_cond_timedwait (&atl_ptr->cond, &atl_ptr->lock, wake_ptr);
+            }
+            continue;
+        }
+
+        memset (&ioctl_data, 0, sizeof (rpc_loc_ioctl_data_u_type));
+        ioctl_data.disc = conn_ptr->report_type;
+        if (conn_ptr->report_type == RPC_LOC_IOCTL_INFORM_SERVER_CLOSE_STATUS)
+        {
+            conn_close_status_ptr = &(ioctl_data.rpc_loc_ioctl_data_u_type_u.conn_close_status);
+            conn_close_status_ptr->conn_handle = conn_ptr->conn_handle;
+            conn_close_status_ptr->close_status = RPC_LOC_SERVER_CLOSE_SUCCESS;
+        }
+        else
+        {
+            conn_open_status_ptr = &(ioctl_data.rpc_loc_ioctl_data_u_type_u.conn_open_status);
+            conn_open_status_ptr->conn_handle = conn_ptr->conn_handle;
+            if (conn_ptr->report_success == TRUE)
+            {
+                conn_open_status_ptr->open_status = RPC_LOC_SERVER_OPEN_SUCCESS;
+                conn_open_status_ptr->apn_name = loc_eng_data.apn_name;
+            }
+            else
+            {
+                conn_open_status_ptr->open_status = RPC_LOC_SERVER_OPEN_FAIL;
+                // xdr_string cannot encode a NULL APN
+                conn_open_status_ptr->apn_name = (char*) "";
+            }
+        }
+        conn_ptr->report_pending = FALSE;
+        conn_ptr->report_in_flight = TRUE;
+        conn_ptr->flight_type = conn_ptr->report_type;
+        conn_ptr->attempts++;
+        pthread_mutex_unlock (&atl_ptr->lock);
+
+        LOGD("loc_eng_atl_thread: sending ioctl %d for connection %lu",
+             ioctl_data.disc, (unsigned long) conn_ptr->conn_handle);
+        if (loc_eng_ioctl_async (loc_eng_data.client_handle,
+                                 ioctl_data.disc,
+                                 &ioctl_data,
+                                 LOC_IOCTL_DEFAULT_TIMEOUT,
+                                 loc_eng_atl_report_cb,
+                                 conn_ptr) == LOC_ENG_IOCTL_HANDLE_INVALID)
+        {
+            pthread_mutex_lock (&atl_ptr->lock);
+            loc_eng_atl_report_done (atl_ptr, conn_ptr, (rpc_loc_ioctl_e_type) ioctl_data.disc, FALSE, FALSE);
+            continue;
+        }
+        pthread_mutex_lock (&atl_ptr->lock);
+    }
+    pthread_mutex_unlock (&atl_ptr->lock);
+
+    return NULL;
+}
@@ -0,0 +1,164 @@
+/******************************************************************************
+  @file:  loc_eng_atl.h
+  @brief:
+
+  DESCRIPTION
+    This file defines the ATL (AGPS transport layer) handshake. It keeps the
+    modem's SUPL connections in a table keyed by connection handle, follows
+    the framework's data connection they share, and reports the status of
+    each connection to the modem as soon as the modem takes it.
+
+  INITIALIZATION AND SEQUENCING REQUIREMENTS
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+         Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer. 
+
+         Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution. 
+
+         Neither the name of the QUALCOMM USA, INC.  nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  -----------------------------------------------------------------------------
+
+******************************************************************************/
+
+/*=====================================================================
+$Header: $
+$DateTime: $
+$Author: $
+======================================================================*/
+
+#ifndef LOC_ENG_ATL_H
+#define LOC_ENG_ATL_H
+
+// Connections the modem may keep at once, e.g. an NI session next to the
+// user's session
+#define LOC_ENG_ATL_MAX_CONNS            4
+
+// An open status is not sent sooner than this after the modem's request,
+// gps.atl.settle_ms overrides it
+#define LOC_ENG_ATL_SETTLE_TIME          100    // msec
+// A status the modem refuses is sent again after this delay, doubled on each
+// attempt
+#define LOC_ENG_ATL_RETRY_DELAY          100    // msec
+#define LOC_ENG_ATL_MAX_ATTEMPTS         5
+// The data connection is kept up this long after the last connection of the
+// modem closed, a connection asked for meanwhile is answered at once.
+// gps.atl.linger_ms overrides it, 0 releases it at once.
+#define LOC_ENG_ATL_LINGER_TIME          10000  // msec
+// A data connection brought up ahead of an NI session is kept at least this
+// long after the user accepted it, for the modem to ask for its connection
+#define LOC_ENG_ATL_PREOPEN_HOLD         5000   // msec
+
+// State of one connection of the modem
+typedef enum
+{
+    LOC_ENG_ATL_STATE_IDLE,
+    // The modem asked for the connection, it waits for the data connection
+    LOC_ENG_ATL_STATE_OPEN_REQUESTED,
+    LOC_ENG_ATL_STATE_OPEN,
+    // The modem gave the connection back
+    LOC_ENG_ATL_STATE_CLOSE_REQUESTED
+} loc_eng_atl_state_e_type;
+
+// The framework's data connection, shared by all connections of the modem
+typedef enum
+{
+    LOC_ENG_ATL_DATA_CONN_DOWN,
+    LOC_ENG_ATL_DATA_CONN_OPENING,
+    LOC_ENG_ATL_DATA_CONN_UP,
+    LOC_ENG_ATL_DATA_CONN_CLOSING
+} loc_eng_atl_data_conn_e_type;
+
+typedef struct
+{
+    boolean                        in_use;
+    rpc_loc_server_connection_handle conn_handle;
+    rpc_loc_server_protocol_e_type protocol;
+    loc_eng_atl_state_e_type       state;
+    // CLOCK_MONOTONIC, when the modem asked for the connection
+    struct timespec                request_time;
+
+    // Status to send to the modem, not before report_time
+    boolean                        report_pending;
+    boolean                        report_in_flight;
+    rpc_loc_ioctl_e_type           report_type;
+    // Type of the status on its way, report_type may have moved on meanwhile
+    rpc_loc_ioctl_e_type           flight_type;
+    boolean                        report_success;
+    struct timespec                report_time;
+    uint32                         attempts;
+} loc_eng_atl_conn_s_type;
+
+// Module data
+typedef struct
+{
+    pthread_mutex_t                lock;
+    pthread_cond_t                 cond;
+    pthread_t                      thread;
+    boolean                        thread_need_exit;
+
+    loc_eng_atl_conn_s_type        conns[LOC_ENG_ATL_MAX_CONNS];
+    loc_eng_atl_data_conn_e_type   data_conn;
+    uint32                         settle_msec;
+    uint32                         linger_msec;
+    // The data connection is up without a connection using it, it is
+    // released at linger_time
+    boolean                        linger_active;
+    struct timespec                linger_time;
+    // The data connection is wanted ahead of a connection of the modem,
+    // see loc_eng_atl_preopen
+    boolean                        preopen_active;
+    // How long to keep the data connection once it is up, if a pre-open
+    // ended while it came up
+    uint32                         preopen_keep_msec;
+
+    // Statuses the modem took, refused, and loc_ioctl could not send at all
+    uint32                         reports_sent;
+    uint32                         reports_refused;
+    uint32                         reports_failed;
+    // Open requests answered with a failure, see loc_eng_atl_open_decline
+    uint32                         opens_declined;
+    // From the modem's request to the open status it took, in msec
+    uint32                         last_open_msec;
+    // Most connections kept at once, requests that found the table full
+    uint32                         conns_max;
+    uint32                         conns_dropped;
+    // Opens answered from a lingering data connection, lingers run out
+    uint32                         warm_opens;
+    uint32                         lingers_expired;
+    // Pre-opens, those the modem's connection took over, those released unused
+    uint32                         preopens;
+    uint32                         preopens_used;
+    uint32                         preopens_released;
+} loc_eng_atl_data_s_type;
+
+extern void loc_eng_atl_init (loc_eng_atl_data_s_type *atl_ptr);
+extern void loc_eng_atl_deinit (loc_eng_atl_data_s_type *atl_ptr);
+
+// RPC_LOC_EVENT_LOCATION_SERVER_REQUEST of the modem, TRUE when the framework
+// has to bring the data connection up or take it down
+extern boolean loc_eng_atl_open_request (rpc_loc_server_connection_handle conn_handle,
+                                         rpc_loc_server_protocol_e_type protocol);
+extern boolean loc_eng_atl_close_request (rpc_loc_server_connection_handle conn_handle);
+// Answers an open request with a failure, without the framework
+extern void loc_eng_atl_open_decline (rpc_loc_server_connection_handle conn_handle,
+                                      rpc_loc_server_protocol_e_type protocol);
+
+// Answers of the framework, they never block
+extern void loc_eng_atl_report_open (boolean success);
+extern void loc_eng_atl_report_closed (void);
+
+// Brings the data connection up before the modem asks for it, e.g. while the
+// user is asked about an NI session. Ended by loc_eng_atl_preopen_done or by
+// the modem's open request.
+extern void loc_eng_atl_preopen (void);
+extern void loc_eng_atl_preopen_done (boolean accepted);
+
+#endif // LOC_ENG_ATL_H
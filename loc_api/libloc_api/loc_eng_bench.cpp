@@ -0,0 +1,1438 @@
+/******************************************************************************
+  @file:  loc_eng_bench.cpp
+  @brief:  Host benchmark driver for libloc_api
+
+  DESCRIPTION
+     Runs the GPS HAL on the host against the LOC_APIPROG simulator of
+     libloc_api-rpc and reports event throughput, position delivery latency
+     and how long the RPC callback thread is held by the HAL.
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+  -----------------------------------------------------------------------------
+ ******************************************************************************/
+
+/*=====================================================================
+                        EDIT HISTORY FOR MODULE
+
+  This section contains comments describing changes made to the module.
+  Notice that changes are listed in reverse chronological order.
+
+when       who      what, where, why
+--------   ---      -------------------------------------------------------
+10/17/26            Initial version
+
+======================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+
+#include <hardware_legacy/gps.h>
+
+#include "rpc_inc/loc_api_sim.h"
+#include "loc_api_rpc_glue.h"
+#include <loc_eng.h>
+#include <loc_eng_ni.h>
+
+typedef struct
+{
+    pthread_mutex_t     lock;
+    uint32_t            locations;
+    uint32_t            sv_reports;
+    uint32_t            nmea_reports;
+    uint32_t            nmea_corrupt;    // NMEA that is not what the simulator sent
+    int                 nmea_length;
+    uint32_t            status_reports;
+    uint64_t            latency_us_total;
+    uint64_t            latency_us_max;
+    uint64_t            first_fix_us;
+    int                 cb_delay_us;     // emulated framework cost per callback
+} bench_data_s_type;
+
+static bench_data_s_type bench = { PTHREAD_MUTEX_INITIALIZER };
+
+static void bench_framework_delay()
+{
+    if (bench.cb_delay_us > 0)
+    {
+        usleep(bench.cb_delay_us);
+    }
+}
+
+static void bench_location_cb(GpsLocation* location)
+{
+    // The simulator stamps positions with its monotonic send time
+    uint64_t latency_us = loc_api_sim_now_us() - (uint64_t) location->timestamp;
+
+    pthread_mutex_lock(&bench.lock);
+    bench.locations++;
+    if (bench.first_fix_us == 0)
+    {
+        bench.first_fix_us = loc_api_sim_now_us();
+    }
+    bench.latency_us_total += latency_us;
+    if (latency_us > bench.latency_us_max)
+    {
+        bench.latency_us_max = latency_us;
+    }
+    pthread_mutex_unlock(&bench.lock);
+
+    bench_framework_delay();
+}
+
+static void bench_status_cb(GpsStatus* status)
+{
+    pthread_mutex_lock(&bench.lock);
+    bench.status_reports++;
+    pthread_mutex_unlock(&bench.lock);
+}
+
+static void bench_sv_status_cb(GpsSvStatus* sv_info)
+{
+    pthread_mutex_lock(&bench.lock);
+    bench.sv_reports++;
+    pthread_mutex_unlock(&bench.lock);
+
+    bench_framework_delay();
+}
+
+static void bench_nmea_cb(GpsUtcTime timestamp, const char* nmea, int length)
+{
+    boolean corrupt = length != bench.nmea_length || strncmp(nmea, "$GPGGA,", 7) != 0;
+
+    pthread_mutex_lock(&bench.lock);
+    bench.nmea_reports++;
+    if (corrupt)
+    {
+        bench.nmea_corrupt++;
+    }
+    pthread_mutex_unlock(&bench.lock);
+
+    bench_framework_delay();
+}
+
+// Query ioctls sent back to back, one after the other or all in flight
+static const rpc_loc_ioctl_e_type bench_ioctls[] =
+{
+    RPC_LOC_IOCTL_GET_API_VERSION,
+    RPC_LOC_IOCTL_GET_ENGINE_LOCK,
+    RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_SOURCE,
+};
+#define BENCH_IOCTL_COUNT  (sizeof(bench_ioctls) / sizeof(bench_ioctls[0]))
+
+// HAL downloads run against the local servers
+#define BENCH_HTTP_ROUNDS  4
+
+static uint64_t bench_sequential_ioctls()
+{
+    rpc_loc_ioctl_data_u_type ioctl_data;
+    uint64_t t0 = loc_api_sim_now_us();
+    unsigned i;
+
+    for (i = 0; i < BENCH_IOCTL_COUNT; i++)
+    {
+        ioctl_data.disc = bench_ioctls[i];
+        loc_eng_ioctl(loc_eng_data.client_handle, bench_ioctls[i], &ioctl_data,
+                      LOC_IOCTL_DEFAULT_TIMEOUT, NULL);
+    }
+
+    return loc_api_sim_now_us() - t0;
+}
+
+static uint64_t bench_pipelined_ioctls()
+{
+    rpc_loc_ioctl_data_u_type ioctl_data;
+    loc_eng_ioctl_handle_type handles[BENCH_IOCTL_COUNT];
+    uint64_t t0 = loc_api_sim_now_us();
+    unsigned i;
+
+    for (i = 0; i < BENCH_IOCTL_COUNT; i++)
+    {
+        ioctl_data.disc = bench_ioctls[i];
+        handles[i] = loc_eng_ioctl_async(loc_eng_data.client_handle, bench_ioctls[i], &ioctl_data,
+                                         LOC_IOCTL_DEFAULT_TIMEOUT, NULL, NULL);
+    }
+    for (i = 0; i < BENCH_IOCTL_COUNT; i++)
+    {
+        loc_eng_ioctl_wait(handles[i], NULL);
+    }
+
+    return loc_api_sim_now_us() - t0;
+}
+
+static uint32_t bench_xtra_download_requests;
+
+static pthread_cond_t bench_xtra_cond = PTHREAD_COND_INITIALIZER;
+
+static void bench_xtra_download_request_cb()
+{
+    pthread_mutex_lock(&bench.lock);
+    bench_xtra_download_requests++;
+    pthread_cond_signal(&bench_xtra_cond);
+    pthread_mutex_unlock(&bench.lock);
+}
+
+// Posts count XTRA download requests of the modem and waits for them
+static void bench_post_xtra_requests(int count)
+{
+    rpc_loc_event_payload_u_type payload;
+    int i;
+
+    memset(&payload, 0, sizeof(payload));
+    payload.disc = RPC_LOC_EVENT_ASSISTANCE_DATA_REQUEST;
+    payload.rpc_loc_event_payload_u_type_u.assist_data_request.event = RPC_LOC_ASSIST_DATA_PREDICTED_ORBITS_REQ;
+    for (i = 0; i < count; i++)
+    {
+        loc_api_sim_post_event(RPC_LOC_EVENT_ASSISTANCE_DATA_REQUEST, &payload, i);
+    }
+    usleep(count * 1000 + 200000);
+}
+
+static uint32_t bench_agps_conn_requests;
+static uint32_t bench_agps_conn_releases;
+
+// Stand-in for the framework side of AGPS, brings the data connection up
+// and down as the HAL asks
+typedef struct
+{
+    const AGpsInterface* agps;
+    pthread_t           thread;
+    pthread_cond_t      cond;
+    int                 status;          // request to answer, 0 if none
+    int                 need_exit;
+    int                 conn_up_ms;      // time the data connection takes to come up
+} bench_agps_s_type;
+
+static bench_agps_s_type bench_agps = { NULL, 0, PTHREAD_COND_INITIALIZER };
+
+static void bench_agps_status_cb(AGpsStatus* status)
+{
+    pthread_mutex_lock(&bench.lock);
+    if (status->status == GPS_REQUEST_AGPS_DATA_CONN)
+    {
+        bench_agps_conn_requests++;
+    }
+    else if (status->status == GPS_RELEASE_AGPS_DATA_CONN)
+    {
+        bench_agps_conn_releases++;
+    }
+    bench_agps.status = status->status;
+    pthread_cond_signal(&bench_agps.cond);
+    pthread_mutex_unlock(&bench.lock);
+}
+
+static void* bench_agps_thread(void* arg)
+{
+    int status;
+
+    pthread_mutex_lock(&bench.lock);
+    while (!bench_agps.need_exit)
+    {
+        if (bench_agps.status == 0)
+        {
+            pthread_cond_wait(&bench_agps.cond, &bench.lock);
+            continue;
+        }
+        status = bench_agps.status;
+        bench_agps.status = 0;
+        pthread_mutex_unlock(&bench.lock);
+
+        if (status == GPS_REQUEST_AGPS_DATA_CONN)
+        {
+            usleep(bench_agps.conn_up_ms * 1000);
+            bench_agps.agps->data_conn_open("bench.apn");
+        }
+        else if (status == GPS_RELEASE_AGPS_DATA_CONN)
+        {
+            bench_agps.agps->data_conn_closed();
+        }
+
+        pthread_mutex_lock(&bench.lock);
+    }
+    pthread_mutex_unlock(&bench.lock);
+
+    return NULL;
+}
+
+// Posts a SUPL connection request of the modem and waits for it
+static void bench_post_server_open(void)
+{
+    rpc_loc_event_payload_u_type payload;
+
+    memset(&payload, 0, sizeof(payload));
+    payload.disc = RPC_LOC_EVENT_LOCATION_SERVER_REQUEST;
+    payload.rpc_loc_event_payload_u_type_u.loc_server_request.event = RPC_LOC_SERVER_REQUEST_OPEN;
+    payload.rpc_loc_event_payload_u_type_u.loc_server_request.payload.disc = RPC_LOC_SERVER_REQUEST_OPEN;
+    payload.rpc_loc_event_payload_u_type_u.loc_server_request.payload.rpc_loc_server_request_u_type_u.open_req.conn_handle = 1;
+    loc_api_sim_post_event(RPC_LOC_EVENT_LOCATION_SERVER_REQUEST, &payload, 0);
+    // A skipped session is answered after the ATL delay
+    usleep(1500000);
+}
+
+static loc_eng_xtra_inject_status_e_type bench_xtra_status;
+static uint32_t bench_xtra_progress_reports;
+
+static void bench_xtra_status_cb(loc_eng_xtra_inject_status_e_type status,
+                                 uint32 bytes_injected, uint32 total_size)
+{
+    pthread_mutex_lock(&bench.lock);
+    bench_xtra_status = status;
+    if (status == LOC_ENG_XTRA_INJECT_IN_PROGRESS)
+    {
+        bench_xtra_progress_reports++;
+    }
+    pthread_cond_signal(&bench_xtra_cond);
+    pthread_mutex_unlock(&bench.lock);
+}
+
+// Generated XTRA file, a different seed gives a different file
+static char* bench_make_xtra(int xtra_size, int seed)
+{
+    char* xtra_data = (char*) malloc(xtra_size);
+    int i;
+
+    for (i = 0; i < xtra_size; i++)
+    {
+        xtra_data[i] = (char) (0x5A ^ seed ^ i);
+    }
+    return xtra_data;
+}
+
+static loc_eng_xtra_inject_status_e_type bench_wait_xtra()
+{
+    loc_eng_xtra_inject_status_e_type status;
+
+    pthread_mutex_lock(&bench.lock);
+    while (bench_xtra_status == LOC_ENG_XTRA_INJECT_IN_PROGRESS)
+    {
+        pthread_cond_wait(&bench_xtra_cond, &bench.lock);
+    }
+    status = bench_xtra_status;
+    pthread_mutex_unlock(&bench.lock);
+
+    return status;
+}
+
+// Requests an XTRA download and waits for the injection, or for the request
+// to fall back to the framework, which never injects anything here
+static loc_eng_xtra_inject_status_e_type bench_hal_download_xtra()
+{
+    loc_eng_xtra_inject_status_e_type status;
+    uint32_t requests;
+
+    pthread_mutex_lock(&bench.lock);
+    bench_xtra_status = LOC_ENG_XTRA_INJECT_IN_PROGRESS;
+    requests = bench_xtra_download_requests;
+    pthread_mutex_unlock(&bench.lock);
+
+    loc_eng_xtra_request_download();
+
+    pthread_mutex_lock(&bench.lock);
+    while (bench_xtra_status == LOC_ENG_XTRA_INJECT_IN_PROGRESS && bench_xtra_download_requests == requests)
+    {
+        pthread_cond_wait(&bench_xtra_cond, &bench.lock);
+    }
+    status = bench_xtra_status == LOC_ENG_XTRA_INJECT_IN_PROGRESS ? LOC_ENG_XTRA_INJECT_FAILED : bench_xtra_status;
+    pthread_mutex_unlock(&bench.lock);
+
+    return status;
+}
+
+// Local HTTP stand-in for an XTRA server. Modes: 'o' serves the file after
+// delay_ms, 'e' answers 503, 't' breaks off halfway through the body, 'x'
+// refuses connections.
+typedef struct
+{
+    int         listen_fd;
+    int         port;
+    int         delay_ms;
+    char        mode;
+    const char* body;
+    int         body_len;
+    uint32_t    requests;
+    pthread_t   thread;
+    char        url[64];
+} bench_http_server;
+
+static void* bench_http_thread(void* arg)
+{
+    bench_http_server* server = (bench_http_server*) arg;
+    char request[2048], header[256];
+    int fd, len, n, header_len;
+
+    while ((fd = accept(server->listen_fd, NULL, NULL)) >= 0)
+    {
+        server->requests++;
+        for (len = 0; len < (int) sizeof(request) - 1; len += n)
+        {
+            n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+            if (n <= 0)
+            {
+                break;
+            }
+            request[len + n] = '\0';
+            if (strstr(request, "\r\n\r\n") != NULL)
+            {
+                break;
+            }
+        }
+        usleep(server->delay_ms * 1000);
+        if (server->mode == 'e')
+        {
+            header_len = snprintf(header, sizeof(header), "HTTP/1.0 503 Service Unavailable\r\n\r\n");
+            send(fd, header, header_len, MSG_NOSIGNAL);
+        }
+        else
+        {
+            header_len = snprintf(header, sizeof(header),
+                                  "HTTP/1.0 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                                  "Content-Length: %d\r\n\r\n", server->body_len);
+            send(fd, header, header_len, MSG_NOSIGNAL);
+            send(fd, server->body, server->mode == 't' ? server->body_len / 2 : server->body_len, MSG_NOSIGNAL);
+        }
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static void bench_http_start(bench_http_server* server, char mode, int delay_ms, const char* body, int body_len)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+
+    memset(server, 0, sizeof(*server));
+    server->mode = mode;
+    server->delay_ms = delay_ms;
+    server->body = body;
+    server->body_len = body_len;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    bind(server->listen_fd, (struct sockaddr*) &addr, sizeof(addr));
+    getsockname(server->listen_fd, (struct sockaddr*) &addr, &addr_len);
+    server->port = ntohs(addr.sin_port);
+    snprintf(server->url, sizeof(server->url), "http://127.0.0.1:%d/xtra.bin", server->port);
+
+    if (mode == 'x')
+    {
+        // Nothing listens on the port
+        close(server->listen_fd);
+        server->listen_fd = -1;
+        return;
+    }
+    listen(server->listen_fd, 8);
+    pthread_create(&server->thread, NULL, bench_http_thread, server);
+}
+
+static void bench_http_stop(bench_http_server* server)
+{
+    if (server->listen_fd >= 0)
+    {
+        shutdown(server->listen_fd, SHUT_RDWR);
+        pthread_join(server->thread, NULL);
+        close(server->listen_fd);
+    }
+}
+
+// Local TCP stand-in for a SUPL server. Modes: 'o' sends one byte delay_ms
+// after each connect, 'e' hangs up at once, 'x' refuses connections.
+typedef struct
+{
+    int         listen_fd;
+    int         port;
+    int         delay_ms;
+    char        mode;
+    uint32_t    connects;
+    pthread_t   thread;
+} bench_slp_server;
+
+// SUPL sessions run against the local servers
+#define BENCH_SLP_MAX_SERVERS  LOC_ENG_SLP_MAX_SERVERS
+#define BENCH_SLP_ROUNDS       4
+#define BENCH_WARM_MAX_ROUNDS  16
+#define BENCH_MODE_MAX_ROUNDS  64
+
+typedef struct
+{
+    bench_slp_server* server;
+    int               fd;
+} bench_slp_conn;
+
+static void* bench_slp_conn_thread(void* arg)
+{
+    bench_slp_conn* conn = (bench_slp_conn*) arg;
+
+    if (conn->server->mode == 'o')
+    {
+        usleep(conn->server->delay_ms * 1000);
+        send(conn->fd, "S", 1, MSG_NOSIGNAL);
+    }
+    close(conn->fd);
+    free(conn);
+    return NULL;
+}
+
+static void* bench_slp_thread(void* arg)
+{
+    bench_slp_server* server = (bench_slp_server*) arg;
+    bench_slp_conn* conn;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int fd;
+
+    // A probe connect must not hold up the session behind it
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    while ((fd = accept(server->listen_fd, NULL, NULL)) >= 0)
+    {
+        server->connects++;
+        conn = (bench_slp_conn*) malloc(sizeof(*conn));
+        conn->server = server;
+        conn->fd = fd;
+        pthread_create(&thread, &attr, bench_slp_conn_thread, conn);
+    }
+    pthread_attr_destroy(&attr);
+
+    return NULL;
+}
+
+static void bench_slp_start(bench_slp_server* server, char mode, int delay_ms)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+
+    memset(server, 0, sizeof(*server));
+    server->mode = mode;
+    server->delay_ms = delay_ms;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    bind(server->listen_fd, (struct sockaddr*) &addr, sizeof(addr));
+    getsockname(server->listen_fd, (struct sockaddr*) &addr, &addr_len);
+    server->port = ntohs(addr.sin_port);
+
+    if (mode == 'x')
+    {
+        // Nothing listens on the port
+        close(server->listen_fd);
+        server->listen_fd = -1;
+        return;
+    }
+    listen(server->listen_fd, 8);
+    pthread_create(&server->thread, NULL, bench_slp_thread, server);
+}
+
+static void bench_slp_stop(bench_slp_server* server)
+{
+    if (server->listen_fd >= 0)
+    {
+        shutdown(server->listen_fd, SHUT_RDWR);
+        pthread_join(server->thread, NULL);
+        close(server->listen_fd);
+    }
+}
+
+static int bench_ni_notif_id = -1;
+
+static void bench_ni_notify_cb(GpsNiNotification* notification)
+{
+    pthread_mutex_lock(&bench.lock);
+    bench_ni_notif_id = notification->notification_id;
+    pthread_mutex_unlock(&bench.lock);
+}
+
+// Posts a SUPL NI request of the given privacy type, the user answers it
+// respond_ms after the notification
+static void bench_ni_session(const GpsNiInterface* ni, int respond_ms, GpsUserResponseType response,
+                             rpc_loc_ni_notify_verify_e_type priv_type)
+{
+    rpc_loc_event_payload_u_type payload;
+    rpc_loc_ni_event_s_type* ni_req;
+    uint64_t t0;
+    int notif_id = -1;
+
+    memset(&payload, 0, sizeof(payload));
+    payload.disc = RPC_LOC_EVENT_NI_NOTIFY_VERIFY_REQUEST;
+    ni_req = &payload.rpc_loc_event_payload_u_type_u.ni_request;
+    ni_req->event = RPC_LOC_NI_EVENT_SUPL_NOTIFY_VERIFY_REQ;
+    ni_req->payload.disc = RPC_LOC_NI_EVENT_SUPL_NOTIFY_VERIFY_REQ;
+    ni_req->payload.rpc_loc_ni_event_payload_u_type_u.supl_req.notification_priv_type = priv_type;
+
+    pthread_mutex_lock(&bench.lock);
+    bench_ni_notif_id = -1;
+    pthread_mutex_unlock(&bench.lock);
+    loc_api_sim_post_event(RPC_LOC_EVENT_NI_NOTIFY_VERIFY_REQUEST, &payload, 0);
+
+    t0 = loc_api_sim_now_us();
+    while (notif_id == -1 && loc_api_sim_now_us() - t0 < 2000000)
+    {
+        usleep(1000);
+        pthread_mutex_lock(&bench.lock);
+        notif_id = bench_ni_notif_id;
+        pthread_mutex_unlock(&bench.lock);
+    }
+    usleep(respond_ms * 1000);
+    ni->respond(notif_id, response);
+    // Let the session's connection open and close
+    usleep(1000000);
+}
+
+static const char* bench_oper_mode_name(rpc_loc_operation_mode_e_type oper_mode)
+{
+    switch (oper_mode)
+    {
+        case RPC_LOC_OPER_MODE_MSB:              return "ms-based";
+        case RPC_LOC_OPER_MODE_MSA:              return "ms-assisted";
+        case RPC_LOC_OPER_MODE_STANDALONE:       return "standalone";
+        case RPC_LOC_OPER_MODE_SPEED_OPTIMAL:    return "speed optimal";
+        case RPC_LOC_OPER_MODE_ACCURACY_OPTIMAL: return "accuracy optimal";
+        default:                                 return "other";
+    }
+}
+
+// Runs one assisted session up to its first fix and waits gap_ms after it,
+// returns the time to the fix or 0
+static uint64_t bench_assisted_session(const GpsInterface* gps, int gap_ms)
+{
+    uint64_t t0, ttff_us = 0;
+
+    pthread_mutex_lock(&bench.lock);
+    bench.first_fix_us = 0;
+    pthread_mutex_unlock(&bench.lock);
+
+    t0 = loc_api_sim_now_us();
+    gps->start();
+    while (loc_api_sim_now_us() - t0 < 5000000)
+    {
+        pthread_mutex_lock(&bench.lock);
+        if (bench.first_fix_us != 0)
+        {
+            ttff_us = bench.first_fix_us - t0;
+        }
+        pthread_mutex_unlock(&bench.lock);
+        if (ttff_us != 0)
+        {
+            break;
+        }
+        usleep(1000);
+    }
+    gps->stop();
+    usleep(gap_ms * 1000);
+
+    return ttff_us;
+}
+
+// Runs one assisted session against the -P servers, server_index is set to
+// the one the modem was pointed to
+static uint64_t bench_slp_session(const GpsInterface* gps, int* server_index,
+                                  const bench_slp_server servers[], int server_count)
+{
+    loc_api_sim_stats_s_type stats;
+    uint64_t ttff_us;
+    const char* port_ptr;
+    int i;
+
+    // Let the SUPL connection close before the next session
+    ttff_us = bench_assisted_session(gps, 300);
+
+    loc_api_sim_get_stats(&stats);
+    port_ptr = strrchr(stats.slp_server, ':');
+    *server_index = -1;
+    for (i = 0; port_ptr != NULL && i < server_count; i++)
+    {
+        if (servers[i].port == atoi(port_ptr + 1))
+        {
+            *server_index = i;
+        }
+    }
+    return ttff_us;
+}
+
+// gzip compresses xtra_data in place, returns the compressed size
+static int bench_gzip_xtra(char* xtra_data, int xtra_size)
+{
+    z_stream stream;
+    char* out = (char*) malloc(xtra_size);
+    int out_size = 0;
+
+    memset(&stream, 0, sizeof(stream));
+    deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+    stream.next_in = (Bytef*) xtra_data;
+    stream.avail_in = xtra_size;
+    stream.next_out = (Bytef*) out;
+    stream.avail_out = xtra_size;
+    if (deflate(&stream, Z_FINISH) == Z_STREAM_END)
+    {
+        out_size = stream.total_out;
+        memcpy(xtra_data, out, out_size);
+    }
+    deflateEnd(&stream);
+    free(out);
+
+    return out_size;
+}
+
+// Downloads an XTRA file in chunks taking chunk_us each, then injects it
+// whole, or streams each chunk into the injection as it arrives. The file is
+// gzip compressed first if gzip is set.
+static uint64_t bench_download_xtra(const GpsXtraInterface* xtra, int xtra_size, int chunk, int chunk_us,
+                                    int streamed, int gzip, loc_eng_xtra_inject_status_e_type* status)
+{
+    char* xtra_data = bench_make_xtra(xtra_size, streamed ? 2 : 1);
+    uint64_t t0;
+    int offset, ret;
+
+    if (gzip)
+    {
+        xtra_size = bench_gzip_xtra(xtra_data, xtra_size);
+    }
+    t0 = loc_api_sim_now_us();
+
+    bench_xtra_status = LOC_ENG_XTRA_INJECT_IN_PROGRESS;
+    ret = streamed ? loc_eng_xtra_stream_begin(xtra_size) : 0;
+    for (offset = 0; ret == 0 && offset < xtra_size; offset += chunk)
+    {
+        usleep(chunk_us);
+        if (streamed)
+        {
+            ret = loc_eng_xtra_stream_append(xtra_data + offset, offset + chunk < xtra_size ? chunk : xtra_size - offset);
+        }
+    }
+    if (ret == 0)
+    {
+        ret = streamed ? loc_eng_xtra_stream_finish() : xtra->inject_xtra_data(xtra_data, xtra_size);
+    }
+    *status = ret == 0 ? bench_wait_xtra() : LOC_ENG_XTRA_INJECT_FAILED;
+    free(xtra_data);
+
+    return loc_api_sim_now_us() - t0;
+}
+
+// Injects the XTRA file, or xtra_size generated bytes, and waits until it
+// went in. The generated file is gzip compressed first if compressed_size
+// is given.
+static int bench_inject_xtra(const GpsXtraInterface* xtra, const char* xtra_path, int xtra_size,
+                             uint64_t* call_us, int* compressed_size)
+{
+    char* xtra_data;
+    uint64_t t0;
+    int ret, size = xtra_size;
+
+    bench_xtra_status = LOC_ENG_XTRA_INJECT_IN_PROGRESS;
+    if (xtra_path != NULL)
+    {
+        t0 = loc_api_sim_now_us();
+        ret = loc_eng_xtra_inject_file(xtra_path);
+        *call_us = loc_api_sim_now_us() - t0;
+    }
+    else
+    {
+        xtra_data = bench_make_xtra(xtra_size, 0);
+        if (compressed_size != NULL)
+        {
+            size = *compressed_size = bench_gzip_xtra(xtra_data, xtra_size);
+        }
+        t0 = loc_api_sim_now_us();
+        ret = xtra->inject_xtra_data(xtra_data, size);
+        *call_us = loc_api_sim_now_us() - t0;
+        free(xtra_data);
+    }
+
+    if (ret == 0)
+    {
+        bench_wait_xtra();
+    }
+
+    return ret;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -t sec    duration of the fix session (default 5)\n"
+            "  -p msec   position report interval (default 1000)\n"
+            "  -s msec   satellite report interval (default 1000)\n"
+            "  -n msec   NMEA report interval (default 1000)\n"
+            "  -v count  SVs per satellite report (default 12)\n"
+            "  -E n      every nth SV is reported without ephemeris, 0 for none (default 4),\n"
+            "            -E 0 -m 1 -a 300 -M 2: the SVs are known from the earlier sessions and the\n"
+            "            HAL declines the SUPL connection of the main one\n"
+            "  -l bytes  NMEA bytes per report (default 512)\n"
+            "  -d msec   ioctl report delay (default 20)\n"
+            "  -r usec   time every RPC call takes (default 0)\n"
+            "  -c usec   emulated framework time per callback (default 0)\n"
+            "  -m mode   GPS_POSITION_MODE_xxx (default standalone)\n"
+            "  -x bytes  inject an XTRA file of this size (default none)\n"
+            "  -f path   inject this XTRA file, mapped instead of read (default none)\n"
+            "  -X bytes  XTRA part size advertised by the modem (default 8192)\n"
+            "  -S bytes  also download the XTRA file in chunks of this size, then stream it (default none)\n"
+            "  -N usec   download time of each chunk (default 10000)\n"
+            "  -z        gzip the generated XTRA file before injecting it, and the -S one\n"
+            "  -U list   download the XTRA file in the HAL from up to 3 local servers, e.g. o200,o50,x:\n"
+            "            o<msec> serves after a delay, e answers 503, t breaks off, x refuses\n"
+            "  -D        inject the XTRA file a second time, it must be skipped\n"
+            "  -H path   file keeping the hash of the last XTRA file (default /tmp/loc_eng_bench_xtra_hash)\n"
+            "  -A count  XTRA download requests posted before and after the injection (default 0)\n"
+            "  -C count  XTRA download requests and a SUPL request posted during the session (default 0)\n"
+            "  -G host   SUPL server set at startup, use with -m 1 (default none); with -P the name of the\n"
+            "            first server, e.g. one with a dead address before 127.0.0.1 in /etc/hosts\n"
+            "  -a msec   AGPS sessions (-m 1 or 2) open a SUPL connection and fix this long after (default 0)\n"
+            "  -b msec   time the AGPS data connection takes to come up (default 100)\n"
+            "  -R msec   the modem refuses an open status sooner than this after its request (default 0)\n"
+            "  -i msec   an NI SUPL session asks for a connection of its own this long after the session's (default none)\n"
+            "  -P list   run assisted sessions against up to 4 local SUPL servers, the first one set by the\n"
+            "            framework, the others configured, e.g. e,o300,o50: o<msec> answers after a delay,\n"
+            "            e hangs up, x refuses; use with -m 1 -a\n"
+            "  -B count  run this many assisted sessions 1 s apart before the main one, use with -m 1 -a\n"
+            "  -L msec   keep the data connection up this long after the last connection closed (default HAL's)\n"
+            "  -V msec   post a SUPL NI request and accept it this long after the notification (default none)\n"
+            "  -W        deny the -V request instead\n"
+            "  -Y        make the -V request one that needs an answer, and let it time out instead\n"
+            "  -y        bring the data connection up while the -V request waits for the user\n"
+            "  -M count  run this many sessions with the adaptive mode selector before the main one (default 0)\n"
+            "  -T msec   sessions without SUPL fix this long after the start (default one position interval)\n"
+            "  -O path   file the mode selector logs its decisions and outcomes to (default none)\n"
+            "  -w msec   the modem's RPC server comes up this long after the HAL is started (default 0)\n",
+            name);
+}
+
+static double ms(uint64_t us)
+{
+    return us / 1000.0;
+}
+
+int main(int argc, char** argv)
+{
+    loc_api_sim_config_s_type config;
+    loc_api_sim_stats_s_type stats;
+    GpsCallbacks callbacks;
+    const GpsInterface* gps;
+    int duration = 5, mode = GPS_POSITION_MODE_STANDALONE;
+    int xtra_size = 0, xtra_ret = 0, xtra_requests = 0, xtra_duplicate = 0;
+    int xtra_chunk = 0, xtra_chunk_us = 10000, xtra_gzip = 0, xtra_gzip_size = 0;
+    const char* xtra_servers = NULL;
+    bench_http_server http_servers[LOC_ENG_XTRA_MAX_SERVERS];
+    int http_server_count = 0, http_body_len = 0, http_rounds = 0;
+    char* http_body = NULL;
+    uint64_t http_us[BENCH_HTTP_ROUNDS];
+    int http_server_used[BENCH_HTTP_ROUNDS];
+    loc_eng_xtra_inject_status_e_type http_status[BENCH_HTTP_ROUNDS];
+    uint64_t xtra_serial_us = 0, xtra_stream_us = 0;
+    uint32_t xtra_stream_bytes = 0;
+    loc_eng_xtra_inject_status_e_type xtra_serial_status = LOC_ENG_XTRA_INJECT_FAILED;
+    loc_eng_xtra_inject_status_e_type xtra_stream_status = LOC_ENG_XTRA_INJECT_FAILED;
+    uint32_t xtra_requests_before = 0, xtra_parts = 0, xtra_files = 0, xtra_bytes = 0;
+    int coverage_requests = 0;
+    uint32_t coverage_xtra_requests = 0, coverage_agps_requests = 0;
+    uint32_t coverage_visible = 0, coverage_eph = 0;
+    AGpsCallbacks agps_callbacks = { bench_agps_status_cb };
+    const AGpsInterface* agps;
+    const char* supl_host = NULL;
+    const char* slp_list = NULL;
+    bench_slp_server slp_servers[BENCH_SLP_MAX_SERVERS];
+    int slp_server_count = 0, slp_server_used[BENCH_SLP_ROUNDS];
+    uint64_t slp_ttff_us[BENCH_SLP_ROUNDS];
+    int warm_rounds = 0, linger_ms = -1;
+    uint64_t warm_ttff_us[BENCH_WARM_MAX_ROUNDS];
+    uint32_t warm_conn_requests[BENCH_WARM_MAX_ROUNDS];
+    int ni_respond_ms = -1, ni_deny = 0, ni_noresp = 0, ni_preopen = 0;
+    uint32_t ni_conn_requests = 0, ni_conn_releases = 0;
+    const GpsNiInterface* ni;
+    int mode_rounds = 0;
+    const char* mode_log = NULL;
+    uint64_t mode_ttff_us[BENCH_MODE_MAX_ROUNDS], mode_ttff_total = 0;
+    rpc_loc_operation_mode_e_type mode_used[BENCH_MODE_MAX_ROUNDS];
+    int mode_fixes = 0;
+    GpsNiCallbacks ni_callbacks = { bench_ni_notify_cb };
+    char slp_config[BENCH_SLP_MAX_SERVERS * 24];
+    uint64_t supl_set_us = 0;
+    const char* xtra_path = NULL;
+    loc_eng_xtra_inject_status_e_type xtra_status = LOC_ENG_XTRA_INJECT_FAILED;
+    const char* xtra_hash_path = "/tmp/loc_eng_bench_xtra_hash";
+    struct stat xtra_stat;
+    const GpsXtraInterface* xtra;
+    GpsXtraCallbacks xtra_callbacks = { bench_xtra_download_request_cb };
+    uint64_t start_time_us = 0;
+    uint32_t startup_calls_refused = 0;
+    uint64_t t0, init_us, first_callback_us = 0, mode_us, busy_mode_us, start_us, stop_us, drain_us, cleanup_us;
+    uint64_t sequential_us, pipelined_us, xtra_us = 0, xtra_call_us = 0, xtra_dup_us = 0;
+    const loc_eng_ioctl_slot_s_type* query_slot;
+    uint32_t query_timeout_ms, query_samples;
+    // The queue counters are kept after cleanup, until the next init
+    const loc_eng_queue_data_s_type& queue = loc_eng_data.work_queue;
+    int opt, i;
+
+    loc_api_sim_get_default_config(&config);
+    bench_agps.conn_up_ms = 100;
+
+    while ((opt = getopt(argc, argv, "t:p:s:n:v:E:l:d:r:c:m:x:f:X:S:N:zU:DH:A:C:G:a:b:R:i:P:B:L:V:WYyM:T:O:w:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 't': duration = atoi(optarg); break;
+            case 'p': config.position_interval_ms = atoi(optarg); break;
+            case 's': config.sv_interval_ms = atoi(optarg); break;
+            case 'n': config.nmea_interval_ms = atoi(optarg); break;
+            case 'v': config.sv_count = atoi(optarg); break;
+            case 'E': config.sv_no_eph_every = atoi(optarg); break;
+            case 'l': config.nmea_length = atoi(optarg); break;
+            case 'd': config.ioctl_delay_ms = atoi(optarg); break;
+            case 'r': config.rpc_call_us = atoi(optarg); break;
+            case 'c': bench.cb_delay_us = atoi(optarg); break;
+            case 'm': mode = atoi(optarg); break;
+            case 'x': xtra_size = atoi(optarg); break;
+            case 'f': xtra_path = optarg; break;
+            case 'X': config.xtra_max_part_size = atoi(optarg); break;
+            case 'S': xtra_chunk = atoi(optarg); break;
+            case 'N': xtra_chunk_us = atoi(optarg); break;
+            case 'z': xtra_gzip = 1; break;
+            case 'U': xtra_servers = optarg; break;
+            case 'D': xtra_duplicate = 1; break;
+            case 'H': xtra_hash_path = optarg; break;
+            case 'A': xtra_requests = atoi(optarg); break;
+            case 'C': coverage_requests = atoi(optarg); break;
+            case 'G': supl_host = optarg; break;
+            case 'a': config.agps_ttff_ms = atoi(optarg); break;
+            case 'b': bench_agps.conn_up_ms = atoi(optarg); break;
+            case 'R': config.atl_ready_ms = atoi(optarg); break;
+            case 'i': config.atl_ni_delay_ms = atoi(optarg); break;
+            case 'P': slp_list = optarg; break;
+            case 'B': warm_rounds = atoi(optarg); break;
+            case 'L': linger_ms = atoi(optarg); break;
+            case 'V': ni_respond_ms = atoi(optarg); break;
+            case 'W': ni_deny = 1; break;
+            case 'Y': ni_noresp = 1; break;
+            case 'y': ni_preopen = 1; break;
+            case 'M': mode_rounds = atoi(optarg); break;
+            case 'T': config.standalone_ttff_ms = atoi(optarg); break;
+            case 'O': mode_log = optarg; break;
+            case 'w': config.server_ready_ms = atoi(optarg); break;
+            default:  usage(argv[0]); return 1;
+        }
+    }
+
+    if (xtra_servers != NULL)
+    {
+        http_body_len = xtra_size > 0 ? xtra_size : 60000;
+        http_body = bench_make_xtra(http_body_len, 3);
+        if (xtra_gzip)
+        {
+            http_body_len = bench_gzip_xtra(http_body, http_body_len);
+        }
+        for (const char* p = xtra_servers; *p != '\0' && http_server_count < LOC_ENG_XTRA_MAX_SERVERS; )
+        {
+            bench_http_server* server = &http_servers[http_server_count];
+            bench_http_start(server, p[0], atoi(p + 1), http_body, http_body_len);
+            config.xtra_servers[http_server_count++] = server->url;
+            p = strchr(p, ',');
+            if (p == NULL)
+            {
+                break;
+            }
+            p++;
+        }
+        // Every round has to download again
+        config.xtra_valid_hours = 0;
+    }
+
+    if (slp_list != NULL)
+    {
+        for (const char* p = slp_list; *p != '\0' && slp_server_count < BENCH_SLP_MAX_SERVERS; )
+        {
+            bench_slp_start(&slp_servers[slp_server_count++], p[0], atoi(p + 1));
+            p = strchr(p, ',');
+            if (p == NULL)
+            {
+                break;
+            }
+            p++;
+        }
+        // The modem reaches the server it was pointed to, or the session fails
+        config.slp_timeout_ms = 2000;
+    }
+
+    loc_api_sim_set_config(&config);
+    loc_eng_xtra_set_hash_file(xtra_hash_path);
+    bench.nmea_length = config.nmea_length;
+
+    gps = gps_get_hardware_interface();
+    if (gps == NULL)
+    {
+        fprintf(stderr, "no GPS interface\n");
+        return 1;
+    }
+
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.location_cb = bench_location_cb;
+    callbacks.status_cb = bench_status_cb;
+    callbacks.sv_status_cb = bench_sv_status_cb;
+    callbacks.nmea_cb = bench_nmea_cb;
+
+    loc_api_sim_reset_stats();
+    t0 = loc_api_sim_now_us();
+    if (gps->init(&callbacks) != 0)
+    {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    init_us = loc_api_sim_now_us() - t0;
+    // The first modem callback is the report of the engine lock ioctl sent by init
+    while (loc_api_sim_now_us() - t0 < 10000000)
+    {
+        loc_api_sim_get_stats(&stats);
+        if (stats.callback_count > 0)
+        {
+            first_callback_us = loc_api_sim_now_us() - t0;
+            startup_calls_refused = stats.calls_refused;
+            break;
+        }
+        usleep(1000);
+    }
+
+    t0 = loc_api_sim_now_us();
+    gps->set_position_mode(mode, 1);
+    mode_us = loc_api_sim_now_us() - t0;
+    if (linger_ms >= 0)
+    {
+        // gps.atl.linger_ms on a device
+        loc_eng_data.atl_data.linger_msec = linger_ms;
+    }
+    if (warm_rounds > BENCH_WARM_MAX_ROUNDS)
+    {
+        warm_rounds = BENCH_WARM_MAX_ROUNDS;
+    }
+    if (mode_rounds > BENCH_MODE_MAX_ROUNDS)
+    {
+        mode_rounds = BENCH_MODE_MAX_ROUNDS;
+    }
+
+    loc_api_sim_reset_stats();
+
+    xtra = (const GpsXtraInterface*) gps->get_extension(GPS_XTRA_INTERFACE);
+    xtra->init(&xtra_callbacks);
+    agps = (const AGpsInterface*) gps->get_extension(AGPS_INTERFACE);
+    agps->init(&agps_callbacks);
+    bench_agps.agps = agps;
+    pthread_create(&bench_agps.thread, NULL, bench_agps_thread, NULL);
+    if (supl_host != NULL)
+    {
+        t0 = loc_api_sim_now_us();
+        agps->set_server(AGPS_TYPE_SUPL, supl_host, slp_server_count > 0 ? slp_servers[0].port : 7275);
+        supl_set_us = loc_api_sim_now_us() - t0;
+        // The framework sets the server long before the first session
+        while (loc_eng_dns_data.resolving && loc_api_sim_now_us() - t0 < 5000000)
+        {
+            usleep(1000);
+        }
+    }
+    if (slp_server_count > 0)
+    {
+        // The others come from gps.supl.servers on a device
+        slp_config[0] = '\0';
+        for (i = 1; i < slp_server_count; i++)
+        {
+            snprintf(slp_config + strlen(slp_config), sizeof(slp_config) - strlen(slp_config),
+                     "%s127.0.0.1:%d", i > 1 ? "," : "", slp_servers[i].port);
+        }
+        agps->set_server(AGPS_TYPE_SUPL, supl_host != NULL ? supl_host : "127.0.0.1", slp_servers[0].port);
+        loc_eng_slp_set_servers(supl_host != NULL ? supl_host : "127.0.0.1", slp_servers[0].port, slp_config);
+        t0 = loc_api_sim_now_us();
+        while (loc_eng_slp_data.probing && loc_api_sim_now_us() - t0 < 5000000)
+        {
+            usleep(1000);
+        }
+        for (i = 0; i < BENCH_SLP_ROUNDS; i++)
+        {
+            slp_ttff_us[i] = bench_slp_session(gps, &slp_server_used[i], slp_servers, slp_server_count);
+        }
+    }
+    if (ni_respond_ms >= 0)
+    {
+        ni = (const GpsNiInterface*) gps->get_extension(GPS_NI_INTERFACE);
+        ni->init(&ni_callbacks);
+        // gps.ni.preopen on a device
+        loc_eng_ni_data.preopen = ni_preopen;
+        ni_conn_requests = bench_agps_conn_requests;
+        ni_conn_releases = bench_agps_conn_releases;
+        if (ni_noresp)
+        {
+            bench_ni_session(ni, ni_respond_ms, GPS_NI_RESPONSE_NORESP,
+                             RPC_LOC_NI_USER_NOTIFY_VERIFY_NOT_ALLOW_NO_RESP);
+        }
+        else
+        {
+            bench_ni_session(ni, ni_respond_ms, ni_deny ? GPS_NI_RESPONSE_DENY : GPS_NI_RESPONSE_ACCEPT,
+                             RPC_LOC_NI_USER_NOTIFY_VERIFY_ALLOW_NO_RESP);
+        }
+        ni_conn_requests = bench_agps_conn_requests - ni_conn_requests;
+        ni_conn_releases = bench_agps_conn_releases - ni_conn_releases;
+    }
+    for (i = 0; i < warm_rounds; i++)
+    {
+        warm_conn_requests[i] = bench_agps_conn_requests;
+        warm_ttff_us[i] = bench_assisted_session(gps, 1000);
+        warm_conn_requests[i] = bench_agps_conn_requests - warm_conn_requests[i];
+    }
+    if (mode_rounds > 0)
+    {
+        // gps.mode.adaptive and gps.mode.log_file on a device
+        loc_eng_mode_data.adaptive = TRUE;
+        if (mode_log != NULL)
+        {
+            snprintf(loc_eng_mode_data.log_path, sizeof(loc_eng_mode_data.log_path), "%s", mode_log);
+        }
+        for (i = 0; i < mode_rounds; i++)
+        {
+            mode_ttff_us[i] = bench_assisted_session(gps, 300);
+            mode_used[i] = loc_eng_data.oper_mode;
+        }
+        loc_eng_mode_data.adaptive = FALSE;
+        // Back to the framework's mode for the main session
+        gps->set_position_mode(mode, 1);
+    }
+    if (xtra_requests > 0)
+    {
+        bench_post_xtra_requests(xtra_requests);
+        xtra_requests_before = bench_xtra_download_requests;
+    }
+    if (xtra_path != NULL && stat(xtra_path, &xtra_stat) == 0)
+    {
+        xtra_size = xtra_stat.st_size;
+    }
+    if (xtra_size > 0)
+    {
+        loc_eng_xtra_set_inject_status_cb(bench_xtra_status_cb);
+        t0 = loc_api_sim_now_us();
+        xtra_ret = bench_inject_xtra(xtra, xtra_path, xtra_size, &xtra_call_us,
+                                     xtra_gzip ? &xtra_gzip_size : NULL);
+        xtra_us = loc_api_sim_now_us() - t0;
+        loc_api_sim_get_stats(&stats);
+        xtra_parts = stats.xtra_parts_received;
+        xtra_files = stats.xtra_files_received;
+        xtra_bytes = stats.xtra_bytes_received;
+        xtra_status = bench_xtra_status;
+        if (xtra_duplicate && xtra_ret == 0)
+        {
+            t0 = loc_api_sim_now_us();
+            bench_inject_xtra(xtra, xtra_path, xtra_size, &xtra_call_us, xtra_gzip ? &xtra_gzip_size : NULL);
+            xtra_dup_us = loc_api_sim_now_us() - t0;
+        }
+        if (xtra_chunk > 0)
+        {
+            xtra_serial_us = bench_download_xtra(xtra, xtra_size, xtra_chunk, xtra_chunk_us, 0, xtra_gzip,
+                                                 &xtra_serial_status);
+            loc_api_sim_get_stats(&stats);
+            xtra_stream_bytes = stats.xtra_bytes_received;
+            xtra_stream_us = bench_download_xtra(xtra, xtra_size, xtra_chunk, xtra_chunk_us, 1, xtra_gzip,
+                                                 &xtra_stream_status);
+            loc_api_sim_get_stats(&stats);
+            xtra_stream_bytes = stats.xtra_bytes_received - xtra_stream_bytes;
+        }
+    }
+    if (xtra_requests > 0)
+    {
+        // The modem now has fresh data, these must not reach the framework
+        bench_post_xtra_requests(xtra_requests);
+    }
+
+    if (http_server_count > 0)
+    {
+        loc_eng_xtra_set_inject_status_cb(bench_xtra_status_cb);
+        loc_eng_xtra_download_enable(TRUE);
+        // Once the framework is asked, the HAL waits for its file
+        for (i = 0; i < BENCH_HTTP_ROUNDS && (i == 0 || http_status[i - 1] == LOC_ENG_XTRA_INJECT_DONE); i++)
+        {
+            t0 = loc_api_sim_now_us();
+            http_status[i] = bench_hal_download_xtra();
+            http_us[i] = loc_api_sim_now_us() - t0;
+            http_server_used[i] = loc_eng_data.xtra_download_data.last_server;
+            http_rounds++;
+        }
+    }
+
+    t0 = loc_api_sim_now_us();
+    bench.first_fix_us = 0;
+    gps->start();
+    start_us = loc_api_sim_now_us() - t0;
+    start_time_us = t0;
+
+    // An ioctl round trip while the reports are flowing
+    usleep(duration * 500000);
+    t0 = loc_api_sim_now_us();
+    gps->set_position_mode(mode, 1);
+    busy_mode_us = loc_api_sim_now_us() - t0;
+
+    // The second round runs with the timeouts learned in the first one
+    for (i = 0; i < 2; i++)
+    {
+        sequential_us = bench_sequential_ioctls();
+        pipelined_us = bench_pipelined_ioctls();
+    }
+    query_slot = &loc_eng_data.ioctl_data.slots[RPC_LOC_IOCTL_GET_API_VERSION - 1];
+    query_timeout_ms = query_slot->adaptive_timeout_msec;
+    query_samples = query_slot->rtt_count;
+
+    // The satellite reports have been flowing for a while now
+    if (coverage_requests > 0)
+    {
+        const loc_eng_coverage_data_s_type& coverage = loc_eng_data.coverage_data;
+
+        for (i = 0; i < LOC_ENG_COVERAGE_MAX_PRN; i++)
+        {
+            if (coverage.visible_mask & (1 << i))
+            {
+                coverage_visible++;
+                coverage_eph += coverage.svs[i].eph_time != 0;
+            }
+        }
+        coverage_xtra_requests = bench_xtra_download_requests;
+        bench_post_xtra_requests(coverage_requests);
+        coverage_xtra_requests = bench_xtra_download_requests - coverage_xtra_requests;
+        bench_post_server_open();
+        coverage_agps_requests = bench_agps_conn_requests;
+    }
+    usleep(duration * 500000);
+
+    t0 = loc_api_sim_now_us();
+    gps->stop();
+    stop_us = loc_api_sim_now_us() - t0;
+
+    // Wait for the deferred action thread to work off its queue
+    t0 = loc_api_sim_now_us();
+    while (loc_eng_data.work_queue.head != loc_eng_data.work_queue.tail &&
+           loc_api_sim_now_us() - t0 < 5000000)
+    {
+        usleep(1000);
+    }
+    loc_api_sim_get_stats(&stats);
+    drain_us = loc_api_sim_now_us() - t0;
+
+    pthread_mutex_lock(&bench.lock);
+    bench_agps.need_exit = 1;
+    pthread_cond_signal(&bench_agps.cond);
+    pthread_mutex_unlock(&bench.lock);
+    pthread_join(bench_agps.thread, NULL);
+
+    t0 = loc_api_sim_now_us();
+    gps->cleanup();
+    cleanup_us = loc_api_sim_now_us() - t0;
+
+    for (i = 0; i < http_server_count; i++)
+    {
+        bench_http_stop(&http_servers[i]);
+    }
+    free(http_body);
+    for (i = 0; i < slp_server_count; i++)
+    {
+        bench_slp_stop(&slp_servers[i]);
+    }
+
+    printf("init:                 %10.3f ms\n", ms(init_us));
+    if (first_callback_us != 0)
+    {
+        printf("init to 1st callback: %10.3f ms, %d pings, %u calls refused\n",
+               ms(first_callback_us), loc_eng_data.startup_pings, startup_calls_refused);
+    }
+    else
+    {
+        printf("init to 1st callback:       none\n");
+    }
+    printf("set_position_mode:    %10.3f ms\n", ms(mode_us));
+    printf("start:                %10.3f ms\n", ms(start_us));
+    if (bench.first_fix_us != 0)
+    {
+        printf("time to first fix:    %10.3f ms\n", ms(bench.first_fix_us - start_time_us));
+    }
+    else
+    {
+        printf("time to first fix:          none\n");
+    }
+    if (stats.atl_open_requests > 0)
+    {
+        printf("supl connections:     %10u asked, %u open/fail reports taken, %u refused, %u close reports\n",
+               stats.atl_open_requests, stats.atl_open_reports, stats.atl_open_refused, stats.atl_close_reports);
+        printf("supl connections:     %10u at once, %u statuses for no such connection, %u data connection requests\n",
+               stats.atl_conns_max, stats.atl_stale_reports, bench_agps_conn_requests);
+        printf("supl statuses:        %10u taken, %u refused by the modem, %u not sent, %u opens declined\n",
+               loc_eng_data.atl_data.reports_sent, loc_eng_data.atl_data.reports_refused,
+               loc_eng_data.atl_data.reports_failed, loc_eng_data.atl_data.opens_declined);
+    }
+    printf("set_position_mode:    %10.3f ms during the session\n", ms(busy_mode_us));
+    printf("sequential ioctls:    %10.3f ms for %u queries\n", ms(sequential_us), (unsigned) BENCH_IOCTL_COUNT);
+    printf("pipelined ioctls:     %10.3f ms for %u queries\n", ms(pipelined_us), (unsigned) BENCH_IOCTL_COUNT);
+    printf("query ioctl timeout:  %10u ms from %u round trips\n", query_timeout_ms, query_samples);
+    printf("stop:                 %10.3f ms\n", ms(stop_us));
+    printf("drain:                %10.3f ms\n", ms(drain_us));
+    printf("cleanup:              %10.3f ms\n", ms(cleanup_us));
+    if (xtra_size > 0)
+    {
+        printf("xtra injection:       %10.3f ms for %d bytes in %u parts, %s\n", ms(xtra_us), xtra_size,
+               xtra_parts,
+               xtra_ret == 0 && xtra_status == LOC_ENG_XTRA_INJECT_DONE && xtra_files == 1 ?
+               "ok" : "FAILED");
+        printf("xtra hand-over:       %10.3f ms in %s, %u progress reports\n", ms(xtra_call_us),
+               xtra_path != NULL ? "loc_eng_xtra_inject_file" : "inject_xtra_data",
+               bench_xtra_progress_reports);
+        if (xtra_gzip)
+        {
+            printf("xtra compressed:      %10d bytes gzip, %u bytes into the modem\n", xtra_gzip_size, xtra_bytes);
+        }
+        if (xtra_chunk > 0)
+        {
+            printf("xtra download+inject: %10.3f ms, %s\n", ms(xtra_serial_us),
+                   xtra_serial_status == LOC_ENG_XTRA_INJECT_DONE ? "ok" : "FAILED");
+            printf("xtra streamed:        %10.3f ms, %s, %u bytes into the modem\n", ms(xtra_stream_us),
+                   xtra_stream_status == LOC_ENG_XTRA_INJECT_DONE ? "ok" : "FAILED", xtra_stream_bytes);
+        }
+        if (xtra_duplicate)
+        {
+            printf("xtra duplicate:       %10.3f ms, %s\n", ms(xtra_dup_us),
+                   loc_eng_data.xtra_module_data.inject_skipped == 1 ? "skipped" : "INJECTED");
+        }
+    }
+    for (i = 0; i < http_server_count; i++)
+    {
+        const loc_eng_xtra_server_s_type* server_ptr = &loc_eng_data.xtra_download_data.servers[i];
+        printf("xtra server %d (%c%-4d): %10u ms latency, %u ok, %u failed, %u requests\n", i,
+               http_servers[i].mode, http_servers[i].delay_ms, server_ptr->latency_msec,
+               server_ptr->successes, server_ptr->failures, http_servers[i].requests);
+    }
+    for (i = 0; i < http_rounds; i++)
+    {
+        printf("xtra hal download %d:  %10.3f ms from server %d, %s\n", i, ms(http_us[i]), http_server_used[i],
+               http_status[i] == LOC_ENG_XTRA_INJECT_DONE ? "ok" : "framework asked");
+    }
+    if (supl_host != NULL)
+    {
+        printf("supl set_server:      %10.3f ms, %d addresses after a %u ms lookup, %u failed lookups, "
+               "%u address failovers\n", ms(supl_set_us), loc_eng_dns_data.addr_count,
+               loc_eng_dns_data.last_lookup_msec, loc_eng_dns_data.failures, loc_eng_dns_data.rotations);
+        printf("supl server in modem: %10u times, %s\n", stats.slp_servers_set,
+               stats.slp_server[0] != 0 ? stats.slp_server : "never set");
+    }
+    for (i = 0; i < slp_server_count; i++)
+    {
+        const loc_eng_slp_server_s_type* server_ptr = &loc_eng_slp_data.servers[i];
+        printf("supl server %d (%c%-4d): %10u ms connect, %u ms sessions, %u failed, %s\n", i,
+               slp_servers[i].mode, slp_servers[i].delay_ms, server_ptr->connect_msec, server_ptr->session_msec,
+               server_ptr->failures, server_ptr->reachable ? "reachable" : "unreachable");
+    }
+    for (i = 0; slp_server_count > 0 && i < BENCH_SLP_ROUNDS; i++)
+    {
+        if (slp_ttff_us[i] != 0)
+        {
+            printf("supl session %d:       %10.3f ms to first fix, server %d\n", i, ms(slp_ttff_us[i]),
+                   slp_server_used[i]);
+        }
+        else
+        {
+            printf("supl session %d:             no fix, server %d\n", i, slp_server_used[i]);
+        }
+    }
+    if (slp_server_count > 0)
+    {
+        printf("supl failover:        %10u failovers, %u sessions reached the server, %u failed\n",
+               loc_eng_slp_data.failovers, stats.slp_sessions, stats.slp_failures);
+    }
+    for (i = 0; i < warm_rounds; i++)
+    {
+        if (warm_ttff_us[i] != 0)
+        {
+            printf("assisted session %d:   %10.3f ms to first fix, %u data connection requests\n", i,
+                   ms(warm_ttff_us[i]), warm_conn_requests[i]);
+        }
+        else
+        {
+            printf("assisted session %d:         no fix, %u data connection requests\n", i, warm_conn_requests[i]);
+        }
+    }
+    if (warm_rounds > 0)
+    {
+        printf("data connection:      %10u opens answered warm, %u lingers ran out\n",
+               loc_eng_data.atl_data.warm_opens, loc_eng_data.atl_data.lingers_expired);
+    }
+    for (i = 0; i < mode_rounds; i++)
+    {
+        if (mode_ttff_us[i] != 0)
+        {
+            printf("adaptive session %d:   %10.3f ms to first fix, %s\n", i, ms(mode_ttff_us[i]),
+                   bench_oper_mode_name(mode_used[i]));
+        }
+        else
+        {
+            printf("adaptive session %d:         no fix, %s\n", i, bench_oper_mode_name(mode_used[i]));
+        }
+        // The second half, after the selector tried every mode
+        if (i >= mode_rounds / 2)
+        {
+            mode_ttff_total += mode_ttff_us[i] != 0 ? mode_ttff_us[i] : 5000000;
+            mode_fixes++;
+        }
+    }
+    if (mode_fixes > 0)
+    {
+        printf("adaptive sessions:    %10.3f ms to first fix on average in the second half, %u explored, %u fastest\n",
+               ms(mode_ttff_total / mode_fixes), loc_eng_mode_data.explored, loc_eng_mode_data.exploited);
+    }
+    if (ni_respond_ms >= 0)
+    {
+        if (!ni_deny && !ni_noresp)
+        {
+            printf("ni session:           %10.3f ms from the answer to the SUPL connection\n", ms(stats.ni_open_us));
+        }
+        printf("ni session:           %10u data connection requests, %u releases\n", ni_conn_requests,
+               ni_conn_releases);
+        printf("ni pre-open:          %10u pre-opens, %u taken over, %u released unused\n",
+               loc_eng_data.atl_data.preopens, loc_eng_data.atl_data.preopens_used,
+               loc_eng_data.atl_data.preopens_released);
+    }
+    if (coverage_requests > 0)
+    {
+        printf("coverage:             %10u SVs visible, %u with ephemeris\n", coverage_visible, coverage_eph);
+        printf("xtra during session:  %10u / %d requests forwarded, %u skipped\n", coverage_xtra_requests,
+               coverage_requests, loc_eng_data.coverage_data.xtra_skipped);
+        printf("supl during session:  %10u data connection requests, %u skipped\n", coverage_agps_requests,
+               loc_eng_data.coverage_data.agps_skipped);
+    }
+    if (xtra_requests > 0)
+    {
+        printf("xtra downloads:       %10u / %u requested before, %u / %u after the injection\n",
+               xtra_requests_before, xtra_requests,
+               bench_xtra_download_requests - xtra_requests_before, xtra_requests);
+    }
+    printf("ioctls:               %10u\n", stats.ioctls_received);
+    printf("positions sent/recv:  %10u / %u\n", stats.positions_sent, bench.locations);
+    printf("sv reports sent/recv: %10u / %u\n", stats.sv_reports_sent, bench.sv_reports);
+    printf("nmea sent/recv:       %10u / %u (%u corrupt)\n", stats.nmea_reports_sent,
+           bench.nmea_reports, bench.nmea_corrupt);
+    printf("position latency:     %10.3f ms avg, %.3f ms max\n",
+           bench.locations ? ms(bench.latency_us_total / bench.locations) : 0.0,
+           ms(bench.latency_us_max));
+    printf("rpc callback time:    %10.3f ms avg, %.3f ms max (%u callbacks)\n",
+           stats.callback_count ? ms(stats.callback_us_total / stats.callback_count) : 0.0,
+           ms(stats.callback_us_max), stats.callback_count);
+    printf("work queue:           %10u of %u slots high water mark, %u dropped, %u truncated\n",
+           queue.high_water_mark, LOC_ENG_QUEUE_SIZE, queue.overflow_count, queue.truncated_count);
+    printf("shed nmea/sv:         %10u / %u from depth %u\n",
+           queue.nmea_shed_count, queue.sv_shed_count, queue.shed_depth);
+    printf("coalesced nmea/sv:    %10u / %u\n",
+           queue.nmea_coalesced_count, queue.sv_coalesced_count);
+
+    return 0;
+}
@@ -0,0 +1,312 @@
+/******************************************************************************
+  @file:  loc_eng_coverage.cpp
+  @brief:
+
+  DESCRIPTION
+    This file implements the ephemeris coverage tracker. While every visible
+    SV has a fresh ephemeris the receiver tracks without help, and XTRA
+    downloads and SUPL sessions only cost data and modem wakeups.
+
+  INITIALIZATION AND SEQUENCING REQUIREMENTS
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+         Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer. 
+
+         Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution. 
+
+         Neither the name of the QUALCOMM USA, INC.  nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  -----------------------------------------------------------------------------
+
+******************************************************************************/
+
+/*=====================================================================
+$Header: $
+$DateTime: $
+$Author: $
+======================================================================*/
+#define LOG_NDEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <rpc/rpc.h>
+#include <loc_api_rpc_glue.h>
+
+#include <hardware_legacy/gps.h>
+#include <cutils/properties.h>
+#include <utils/SystemClock.h>
+
+#include <loc_eng.h>
+
+#define LOG_TAG "lib_locapi"
+#include <utils/Log.h>
+
+// comment this out to enable logging
+// #undef LOGD
+// #define LOGD(...) {}
+
+/*===========================================================================
+FUNCTION    loc_eng_coverage_init
+
+DESCRIPTION
+   Initializes the coverage tracker, nothing is covered until the first
+   satellite report.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_coverage_init (loc_eng_coverage_data_s_type *coverage_ptr)
+{
+    char propBuf[PROPERTY_VALUE_MAX];
+
+    memset (coverage_ptr, 0, sizeof (loc_eng_coverage_data_s_type));
+    pthread_mutex_init (&coverage_ptr->lock, NULL);
+
+    property_get ("gps.coverage.skip_assist", propBuf, "1");
+    coverage_ptr->skip_assist = atoi (propBuf) != 0 ? TRUE : FALSE;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_coverage_deinit
+
+DESCRIPTION
+   Releases the coverage tracker. The counters are kept.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_coverage_deinit (loc_eng_coverage_data_s_type *coverage_ptr)
+{
+    pthread_mutex_destroy (&coverage_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_coverage_update
+
+DESCRIPTION
+   Takes the masks of a satellite report, bit (prn - 1) for each GPS SV.
+   The time of an SV reported with ephemeris or almanac is renewed, an SV
+   reported without it loses it. SVs that did not carry the flag keep
+   their age.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_coverage_update (uint32 visible_mask,
+                              uint32 eph_known_mask, uint32 eph_mask,
+                              uint32 alm_known_mask, uint32 alm_mask)
+{
+    loc_eng_coverage_data_s_type *coverage_ptr = &(loc_eng_data.coverage_data);
+    int64_t now = android::elapsedRealtime ();
+    int i;
+
+    pthread_mutex_lock (&coverage_ptr->lock);
+    for (i = 0; i < LOC_ENG_COVERAGE_MAX_PRN; i++)
+    {
+        if (eph_known_mask & (1U << i))
+        {
+            coverage_ptr->svs[i].eph_time = (eph_mask & (1U << i)) ? now : 0;
+        }
+        if (alm_known_mask & (1U << i))
+        {
+            coverage_ptr->svs[i].alm_time = (alm_mask & (1U << i)) ? now : 0;
+        }
+    }
+    coverage_ptr->visible_mask = visible_mask;
+    coverage_ptr->report_time = now;
+    pthread_mutex_unlock (&coverage_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_coverage_ni_request
+
+DESCRIPTION
+   Notes a network initiated request, its SUPL session must go through.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_coverage_ni_request (void)
+{
+    loc_eng_coverage_data_s_type *coverage_ptr = &(loc_eng_data.coverage_data);
+
+    pthread_mutex_lock (&coverage_ptr->lock);
+    coverage_ptr->ni_request_time = android::elapsedRealtime ();
+    pthread_mutex_unlock (&coverage_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_coverage_is_fresh
+
+DESCRIPTION
+   Checks that the receiver is tracking at least LOC_ENG_COVERAGE_MIN_SVS
+   SVs and holds a fresh ephemeris and almanac for every one it sees.
+   Called with the lock held.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if no assistance is needed
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_coverage_is_fresh (const loc_eng_coverage_data_s_type *coverage_ptr, int64_t now)
+{
+    int i, visible = 0;
+
+    if (coverage_ptr->report_time == 0 ||
+        now - coverage_ptr->report_time > LOC_ENG_COVERAGE_REPORT_MAX_AGE * 1000LL)
+    {
+        LOGD("loc_eng_coverage_is_fresh: not tracking");
+        return FALSE;
+    }
+
+    for (i = 0; i < LOC_ENG_COVERAGE_MAX_PRN; i++)
+    {
+        if ((coverage_ptr->visible_mask & (1U << i)) == 0)
+        {
+            continue;
+        }
+        if (coverage_ptr->svs[i].eph_time == 0 ||
+            now - coverage_ptr->svs[i].eph_time > LOC_ENG_COVERAGE_EPH_MAX_AGE * 1000LL ||
+            coverage_ptr->svs[i].alm_time == 0 ||
+            now - coverage_ptr->svs[i].alm_time > LOC_ENG_COVERAGE_ALM_MAX_AGE * 1000LL)
+        {
+            LOGD("loc_eng_coverage_is_fresh: no fresh ephemeris or almanac for prn %d", i + 1);
+            return FALSE;
+        }
+        visible++;
+    }
+
+    if (visible < LOC_ENG_COVERAGE_MIN_SVS)
+    {
+        LOGD("loc_eng_coverage_is_fresh: only %d SVs visible", visible);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_coverage_xtra_needed
+
+DESCRIPTION
+   Tells the XTRA path whether a download is worth its data.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   FALSE if the download can be skipped
+
+SIDE EFFECTS
+   Counts the skipped download
+
+===========================================================================*/
+boolean loc_eng_coverage_xtra_needed (void)
+{
+    loc_eng_coverage_data_s_type *coverage_ptr = &(loc_eng_data.coverage_data);
+    boolean needed = TRUE;
+
+    pthread_mutex_lock (&coverage_ptr->lock);
+    if (coverage_ptr->skip_assist == TRUE &&
+        loc_eng_coverage_is_fresh (coverage_ptr, android::elapsedRealtime ()) == TRUE)
+    {
+        LOGD("loc_eng_coverage_xtra_needed: ephemeris coverage is fresh, skipping xtra download");
+        coverage_ptr->xtra_skipped++;
+        needed = FALSE;
+    }
+    pthread_mutex_unlock (&coverage_ptr->lock);
+
+    return needed;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_coverage_agps_needed
+
+DESCRIPTION
+   Tells the AGPS path whether the modem's SUPL session is worth a data
+   connection. Only sessions sent to the modem as MS-based can go on
+   without the server. MS-assisted, speed and accuracy optimal sessions,
+   whether asked for by the framework or picked by loc_eng_mode, and
+   network initiated sessions are never skipped.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   FALSE if the session can be skipped
+
+SIDE EFFECTS
+   Counts the skipped session
+
+===========================================================================*/
+boolean loc_eng_coverage_agps_needed (void)
+{
+    loc_eng_coverage_data_s_type *coverage_ptr = &(loc_eng_data.coverage_data);
+    int64_t now = android::elapsedRealtime ();
+    boolean needed = TRUE;
+
+    // The mode last sent in the fix criteria, 0 before the first one
+    if (loc_eng_data.oper_mode != 0 ?
+        loc_eng_data.oper_mode != RPC_LOC_OPER_MODE_MSB :
+        loc_eng_data.position_mode == GPS_POSITION_MODE_MS_ASSISTED)
+    {
+        return TRUE;
+    }
+
+    pthread_mutex_lock (&coverage_ptr->lock);
+    if (coverage_ptr->skip_assist == TRUE &&
+        (coverage_ptr->ni_request_time == 0 ||
+         now - coverage_ptr->ni_request_time > LOC_ENG_COVERAGE_NI_HOLD * 1000LL) &&
+        loc_eng_coverage_is_fresh (coverage_ptr, now) == TRUE)
+    {
+        LOGD("loc_eng_coverage_agps_needed: ephemeris coverage is fresh, skipping supl session");
+        coverage_ptr->agps_skipped++;
+        needed = FALSE;
+    }
+    pthread_mutex_unlock (&coverage_ptr->lock);
+
+    return needed;
+}
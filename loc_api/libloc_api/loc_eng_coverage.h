@@ -0,0 +1,91 @@
+/******************************************************************************
+  @file:  loc_eng_coverage.h
+  @brief:
+
+  DESCRIPTION
+    This file defines the ephemeris coverage tracker. It keeps the age of
+    the ephemeris and almanac of every GPS SV from the satellite reports, so
+    the XTRA and AGPS paths can skip assistance the receiver does not need.
+
+  INITIALIZATION AND SEQUENCING REQUIREMENTS
+    Assistance is skipped unless the gps.coverage.skip_assist property is 0.
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+         Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer. 
+
+         Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution. 
+
+         Neither the name of the QUALCOMM USA, INC.  nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  -----------------------------------------------------------------------------
+
+******************************************************************************/
+
+/*=====================================================================
+$Header: $
+$DateTime: $
+$Author: $
+======================================================================*/
+
+#ifndef LOC_ENG_COVERAGE_H
+#define LOC_ENG_COVERAGE_H
+
+#define LOC_ENG_COVERAGE_MAX_PRN         32
+
+// A satellite report older than this means the receiver is not tracking
+#define LOC_ENG_COVERAGE_REPORT_MAX_AGE  10       // seconds
+// Time an ephemeris or almanac is trusted after it was last reported
+#define LOC_ENG_COVERAGE_EPH_MAX_AGE     7200     // seconds
+#define LOC_ENG_COVERAGE_ALM_MAX_AGE     604800   // seconds
+// Coverage is fresh with at least this many visible SVs, all of them
+// with ephemeris and almanac
+#define LOC_ENG_COVERAGE_MIN_SVS         4
+// The SUPL session of a network initiated request is never skipped
+#define LOC_ENG_COVERAGE_NI_HOLD         60       // seconds
+// A skipped XTRA download is asked for again after this long
+#define LOC_ENG_COVERAGE_RECHECK_TIME    1800     // seconds
+
+// Ages of one SV, elapsedRealtime() in msec, 0 if never reported
+typedef struct
+{
+    int64_t                        eph_time;
+    int64_t                        alm_time;
+} loc_eng_coverage_sv_s_type;
+
+// Module data
+typedef struct
+{
+    pthread_mutex_t                lock;
+    boolean                        skip_assist;
+
+    loc_eng_coverage_sv_s_type     svs[LOC_ENG_COVERAGE_MAX_PRN];
+    // GPS SVs of the last satellite report, bit (prn - 1)
+    uint32                         visible_mask;
+    int64_t                        report_time;
+    int64_t                        ni_request_time;
+
+    uint32                         xtra_skipped;
+    uint32                         agps_skipped;
+} loc_eng_coverage_data_s_type;
+
+extern void loc_eng_coverage_init (loc_eng_coverage_data_s_type *coverage_ptr);
+extern void loc_eng_coverage_deinit (loc_eng_coverage_data_s_type *coverage_ptr);
+
+// Masks of a satellite report, the known masks tell which SVs carried the flag
+extern void loc_eng_coverage_update (uint32 visible_mask,
+                                     uint32 eph_known_mask, uint32 eph_mask,
+                                     uint32 alm_known_mask, uint32 alm_mask);
+extern void loc_eng_coverage_ni_request (void);
+
+// FALSE if the assistance can be skipped, counted as skipped then
+extern boolean loc_eng_coverage_xtra_needed (void);
+extern boolean loc_eng_coverage_agps_needed (void);
+
+#endif // LOC_ENG_COVERAGE_H
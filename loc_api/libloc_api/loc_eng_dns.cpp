@@ -0,0 +1,361 @@
+/******************************************************************************
+  @file:  loc_eng_dns.cpp
+  @brief:
+
+  DESCRIPTION
+    This file implements the SUPL server name cache. Lookups run on a
+    detached worker thread, readers only ever copy the cached addresses.
+
+  INITIALIZATION AND SEQUENCING REQUIREMENTS
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+         Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer. 
+
+         Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution. 
+
+         Neither the name of the QUALCOMM USA, INC.  nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  -----------------------------------------------------------------------------
+
+******************************************************************************/
+
+/*=====================================================================
+$Header: $
+$DateTime: $
+$Author: $
+======================================================================*/
+#define LOG_NDEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <rpc/rpc.h>
+#include <loc_api_rpc_glue.h>
+
+#include <hardware_legacy/gps.h>
+#include <cutils/properties.h>
+#include <cutils/memory.h>
+
+#include <loc_eng.h>
+
+#define LOG_TAG "lib_locapi"
+#include <utils/Log.h>
+
+// comment this out to enable logging
+// #undef LOGD
+// #define LOGD(...) {}
+
+loc_eng_dns_data_s_type loc_eng_dns_data = { PTHREAD_MUTEX_INITIALIZER };
+
+/*===========================================================================
+FUNCTION    loc_eng_dns_set_expiry
+
+DESCRIPTION
+   Lets the cached addresses, or the last failure, expire in seconds.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_dns_set_expiry (loc_eng_dns_data_s_type *dns_ptr, uint32 seconds)
+{
+    clock_gettime (CLOCK_MONOTONIC, &dns_ptr->expiry_time);
+    dns_ptr->expiry_time.tv_sec += seconds;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_dns_lookup
+
+DESCRIPTION
+   Resolves host into its IPv4 addresses, blocking. Duplicates the
+   resolver returns for the different socket types are dropped.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   Number of addresses, 0 if the lookup failed
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+int loc_eng_dns_lookup (const char* host, uint32 addrs[], int max_count)
+{
+    struct addrinfo hints, *result_ptr, *ai_ptr;
+    uint32 addr;
+    int count = 0, i, error;
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    error = getaddrinfo (host, NULL, &hints, &result_ptr);
+    if (error != 0)
+    {
+        LOGE("loc_eng_dns_lookup: cannot resolve %s, error = %d", host, error);
+        return 0;
+    }
+
+    for (ai_ptr = result_ptr; ai_ptr != NULL && count < max_count; ai_ptr = ai_ptr->ai_next)
+    {
+        addr = ((struct sockaddr_in *) ai_ptr->ai_addr)->sin_addr.s_addr;
+        for (i = 0; i < count && addrs[i] != addr; i++);
+        if (i == count)
+        {
+            addrs[count++] = addr;
+        }
+    }
+    freeaddrinfo (result_ptr);
+
+    return count;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_dns_thread
+
+DESCRIPTION
+   Looks the server up and publishes the result. If the server changed
+   during the lookup, the new one is looked up before the thread ends.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   NULL
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void* loc_eng_dns_thread (void* arg)
+{
+    loc_eng_dns_data_s_type *dns_ptr = &loc_eng_dns_data;
+    char host[LOC_ENG_DNS_MAX_HOST_LEN];
+    uint32 addrs[LOC_ENG_DNS_MAX_ADDRS];
+    uint32 generation;
+    struct timespec start_time, end_time;
+    int count;
+
+    pthread_mutex_lock (&dns_ptr->lock);
+    do
+    {
+        strlcpy (host, dns_ptr->host, sizeof (host));
+        generation = dns_ptr->generation;
+        pthread_mutex_unlock (&dns_ptr->lock);
+
+        clock_gettime (CLOCK_MONOTONIC, &start_time);
+        count = loc_eng_dns_lookup (host, addrs, LOC_ENG_DNS_MAX_ADDRS);
+        clock_gettime (CLOCK_MONOTONIC, &end_time);
+
+        pthread_mutex_lock (&dns_ptr->lock);
+    } while (generation != dns_ptr->generation);
+
+    dns_ptr->lookups++;
+    dns_ptr->last_lookup_msec = (end_time.tv_sec - start_time.tv_sec) * 1000 +
+                                (end_time.tv_nsec - start_time.tv_nsec) / 1000000;
+    if (count > 0)
+    {
+        LOGD("loc_eng_dns_thread: %s has %d addresses, first 0x%08x, took %u ms",
+             host, count, ntohl (addrs[0]), dns_ptr->last_lookup_msec);
+        memcpy (dns_ptr->addrs, addrs, count * sizeof (addrs[0]));
+        dns_ptr->addr_count = count;
+        dns_ptr->failed_count = 0;
+        loc_eng_dns_set_expiry (dns_ptr, dns_ptr->ttl);
+    }
+    else
+    {
+        // Keep using the addresses from before
+        dns_ptr->failures++;
+        loc_eng_dns_set_expiry (dns_ptr, LOC_ENG_DNS_RETRY_TIME);
+    }
+    dns_ptr->resolving = FALSE;
+    pthread_mutex_unlock (&dns_ptr->lock);
+
+    return NULL;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_dns_start_lookup
+
+DESCRIPTION
+   Starts a lookup thread unless one is running. Called with the lock held.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_dns_start_lookup (loc_eng_dns_data_s_type *dns_ptr)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if (dns_ptr->resolving == TRUE)
+    {
+        return;
+    }
+
+    // Nobody waits for the thread, cleanup must not block on the resolver
+    pthread_attr_init (&attr);
+    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create (&thread, &attr, loc_eng_dns_thread, NULL) == 0)
+    {
+        dns_ptr->resolving = TRUE;
+    }
+    else
+    {
+        LOGE("loc_eng_dns_start_lookup: cannot start the lookup thread");
+    }
+    pthread_attr_destroy (&attr);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_dns_set_server
+
+DESCRIPTION
+   Sets the SUPL server name. A new name drops the cached addresses and is
+   looked up at once, the same name keeps them.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_dns_set_server (const char* host)
+{
+    loc_eng_dns_data_s_type *dns_ptr = &loc_eng_dns_data;
+    char propBuf[PROPERTY_VALUE_MAX];
+    char defBuf[16];
+
+    snprintf (defBuf, sizeof (defBuf), "%d", LOC_ENG_DNS_DEFAULT_TTL);
+    property_get ("gps.supl.dns_ttl", propBuf, defBuf);
+
+    pthread_mutex_lock (&dns_ptr->lock);
+    dns_ptr->ttl = atoi (propBuf) < LOC_ENG_DNS_MIN_TTL ? LOC_ENG_DNS_MIN_TTL : atoi (propBuf);
+    if (strcmp (dns_ptr->host, host) != 0)
+    {
+        strlcpy (dns_ptr->host, host, sizeof (dns_ptr->host));
+        dns_ptr->generation++;
+        dns_ptr->addr_count = 0;
+        dns_ptr->failed_count = 0;
+        loc_eng_dns_start_lookup (dns_ptr);
+    }
+    pthread_mutex_unlock (&dns_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_dns_get_addresses
+
+DESCRIPTION
+   Copies the cached addresses of the SUPL server. Expired addresses are
+   still returned, a new lookup is started in the background.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   Number of addresses copied, 0 if none are known yet
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+int loc_eng_dns_get_addresses (uint32 addrs[], int max_count)
+{
+    loc_eng_dns_data_s_type *dns_ptr = &loc_eng_dns_data;
+    struct timespec now;
+    int count;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock (&dns_ptr->lock);
+    count = dns_ptr->addr_count < max_count ? dns_ptr->addr_count : max_count;
+    memcpy (addrs, dns_ptr->addrs, count * sizeof (addrs[0]));
+    if (dns_ptr->host[0] != 0 && dns_ptr->resolving == FALSE &&
+        (now.tv_sec > dns_ptr->expiry_time.tv_sec ||
+         (now.tv_sec == dns_ptr->expiry_time.tv_sec && now.tv_nsec >= dns_ptr->expiry_time.tv_nsec)))
+    {
+        LOGD("loc_eng_dns_get_addresses: %s expired, looking it up again", dns_ptr->host);
+        if (count > 0)
+        {
+            dns_ptr->stale_hits++;
+        }
+        loc_eng_dns_start_lookup (dns_ptr);
+    }
+    pthread_mutex_unlock (&dns_ptr->lock);
+
+    return count;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_dns_address_failed
+
+DESCRIPTION
+   A session with the first cached address failed, it goes to the end of
+   the list and the next one is handed out. The order holds until the next
+   lookup.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if the address was first and one not failed since the lookup took
+   its place, FALSE if all of them failed
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+boolean loc_eng_dns_address_failed (uint32 addr)
+{
+    loc_eng_dns_data_s_type *dns_ptr = &loc_eng_dns_data;
+    boolean rotated = FALSE;
+
+    pthread_mutex_lock (&dns_ptr->lock);
+    if (dns_ptr->addr_count > 1 && dns_ptr->addrs[0] == addr &&
+        dns_ptr->failed_count < dns_ptr->addr_count)
+    {
+        memmove (&dns_ptr->addrs[0], &dns_ptr->addrs[1], (dns_ptr->addr_count - 1) * sizeof (addr));
+        dns_ptr->addrs[dns_ptr->addr_count - 1] = addr;
+        dns_ptr->failed_count++;
+        if (dns_ptr->failed_count < dns_ptr->addr_count)
+        {
+            LOGD("loc_eng_dns_address_failed: 0x%08x failed, next 0x%08x", ntohl (addr), ntohl (dns_ptr->addrs[0]));
+            dns_ptr->rotations++;
+            rotated = TRUE;
+        }
+    }
+    pthread_mutex_unlock (&dns_ptr->lock);
+
+    return rotated;
+}
@@ -0,0 +1,94 @@
+/******************************************************************************
+  @file:  loc_eng_dns.h
+  @brief:
+
+  DESCRIPTION
+    This file defines the SUPL server name cache. The name is resolved on a
+    worker thread as soon as the framework sets the server, so starting a
+    session never waits for the resolver. getaddrinfo does not expose the
+    record TTLs, the addresses are kept for the fixed gps.supl.dns_ttl
+    instead.
+
+  INITIALIZATION AND SEQUENCING REQUIREMENTS
+    The cache outlives loc_eng_init/loc_eng_cleanup, a lookup still running
+    at cleanup finishes on its own.
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+         Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer. 
+
+         Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution. 
+
+         Neither the name of the QUALCOMM USA, INC.  nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  -----------------------------------------------------------------------------
+
+******************************************************************************/
+
+/*=====================================================================
+$Header: $
+$DateTime: $
+$Author: $
+======================================================================*/
+
+#ifndef LOC_ENG_DNS_H
+#define LOC_ENG_DNS_H
+
+#define LOC_ENG_DNS_MAX_ADDRS            4
+#define LOC_ENG_DNS_MAX_HOST_LEN         256
+
+// The platform resolver does not report record TTLs, the addresses are kept
+// for gps.supl.dns_ttl seconds, then used while they are looked up again
+#define LOC_ENG_DNS_DEFAULT_TTL          300    // seconds
+#define LOC_ENG_DNS_MIN_TTL              30     // seconds
+// A failed lookup is not repeated for this long
+#define LOC_ENG_DNS_RETRY_TIME           30     // seconds
+
+typedef struct
+{
+    pthread_mutex_t                lock;
+    char                           host[LOC_ENG_DNS_MAX_HOST_LEN];
+    // Bumped whenever the server changes, a lookup of an older one is dropped
+    uint32                         generation;
+    boolean                        resolving;
+
+    // IPv4 addresses in network byte order, in resolver order until one
+    // fails a session
+    uint32                         addrs[LOC_ENG_DNS_MAX_ADDRS];
+    int                            addr_count;
+    // Addresses at the end of the list that failed since the lookup
+    int                            failed_count;
+    // CLOCK_MONOTONIC, when the addresses or the last failure expire
+    struct timespec                expiry_time;
+    uint32                         ttl;
+
+    uint32                         lookups;
+    uint32                         failures;
+    uint32                         stale_hits;
+    uint32                         rotations;
+    uint32                         last_lookup_msec;
+} loc_eng_dns_data_s_type;
+
+extern loc_eng_dns_data_s_type loc_eng_dns_data;
+
+// Sets the server name and starts resolving it
+extern void loc_eng_dns_set_server (const char* host);
+
+// Resolves host into its IPv4 addresses, blocking
+extern int loc_eng_dns_lookup (const char* host, uint32 addrs[], int max_count);
+
+// Copies the cached addresses without blocking, stale ones included.
+// Returns their count, 0 while the first lookup is running.
+extern int loc_eng_dns_get_addresses (uint32 addrs[], int max_count);
+
+// A session with addr failed, it goes to the end of the list. Returns TRUE
+// if an address not failed since the lookup took its place.
+extern boolean loc_eng_dns_address_failed (uint32 addr);
+
+#endif // LOC_ENG_DNS_H
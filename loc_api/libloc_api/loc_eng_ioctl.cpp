@@ -39,6 +39,7 @@ $Author: $
 #include <unistd.h>
 #include <ctype.h>
 #include <math.h>
+#include <time.h>
 #include <pthread.h>
 
 #include <rpc/rpc.h>
@@ -56,16 +57,408 @@ $Author: $
 #define LOGD(...) {}
 
 // Function declarations
-static boolean loc_eng_ioctl_setup_cb(
-    rpc_loc_client_handle_type    handle,
-    rpc_loc_ioctl_e_type          ioctl_type
+static loc_eng_ioctl_slot_s_type* loc_eng_ioctl_setup_cb(
+    rpc_loc_client_handle_type     handle,
+    rpc_loc_ioctl_e_type           ioctl_type,
+    int                            timeout_msec,
+    loc_eng_ioctl_complete_cb_type complete_cb,
+    void                          *user_data
 );
 
-static boolean loc_eng_ioctl_wait_cb(
-    int                            timeout_msec,  // Timeout in this number of msec
-    rpc_loc_ioctl_callback_s_type *cb_data_ptr    // Output parameter for IOCTL calls
+static boolean loc_eng_ioctl_release_cb(
+    loc_eng_ioctl_slot_s_type     *slot_ptr,
+    uint32                         generation,
+    boolean                        pending_only
 );
 
+static void* loc_eng_ioctl_timer_thread(void* arg);
+
+/*===========================================================================
+
+FUNCTION    loc_eng_ioctl_get_slot
+
+DESCRIPTION
+   Maps an ioctl type onto its pending ioctl slot.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   Index of the slot of ioctl_type
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static int loc_eng_ioctl_get_slot(
+    rpc_loc_ioctl_e_type          ioctl_type
+    )
+{
+    uint32 type = (uint32) ioctl_type;
+    int index = LOC_ENG_IOCTL_SLOT_COUNT - 1;
+
+    if (type >= RPC_LOC_IOCTL_GET_API_VERSION &&
+        type < RPC_LOC_IOCTL_GET_API_VERSION + LOC_ENG_IOCTL_API_SLOTS)
+    {
+        index = type - RPC_LOC_IOCTL_GET_API_VERSION;
+    }
+    else if (type >= RPC_LOC_IOCTL_SERVICE_START_INDEX &&
+             type < RPC_LOC_IOCTL_SERVICE_START_INDEX + LOC_ENG_IOCTL_SERVICE_SLOTS)
+    {
+        index = LOC_ENG_IOCTL_API_SLOTS + (type - RPC_LOC_IOCTL_SERVICE_START_INDEX);
+    }
+    else if (type >= RPC_LOC_IOCTL_NV_SETTINGS_START_INDEX &&
+             type < RPC_LOC_IOCTL_NV_SETTINGS_START_INDEX + LOC_ENG_IOCTL_NV_SLOTS)
+    {
+        index = LOC_ENG_IOCTL_API_SLOTS + LOC_ENG_IOCTL_SERVICE_SLOTS +
+                (type - RPC_LOC_IOCTL_NV_SETTINGS_START_INDEX);
+    }
+    else if (type >= RPC_LOC_IOCTL_PROPRIETARY_START_INDEX &&
+             type < RPC_LOC_IOCTL_PROPRIETARY_START_INDEX + LOC_ENG_IOCTL_PROPRIETARY_SLOTS)
+    {
+        index = LOC_ENG_IOCTL_API_SLOTS + LOC_ENG_IOCTL_SERVICE_SLOTS + LOC_ENG_IOCTL_NV_SLOTS +
+                (type - RPC_LOC_IOCTL_PROPRIETARY_START_INDEX);
+    }
+
+    return index;
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_ioctl_get_handle
+
+DESCRIPTION
+   Builds the handle of the ioctl currently owning a slot.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   ioctl handle
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static loc_eng_ioctl_handle_type loc_eng_ioctl_get_handle(
+    const loc_eng_ioctl_slot_s_type *slot_ptr,
+    uint32                           generation
+    )
+{
+    int index = slot_ptr - loc_eng_data.ioctl_data.slots;
+
+    return (loc_eng_ioctl_handle_type) (generation * LOC_ENG_IOCTL_SLOT_COUNT + index);
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_ioctl_deadline
+
+DESCRIPTION
+   Converts a relative timeout into an absolute CLOCK_MONOTONIC time, as
+   taken by loc_eng_ioctl_cond_timedwait. Setting the wall clock, like the
+   time injection does, has no effect on these deadlines.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_ioctl_deadline(
+    int                timeout_msec,
+    struct timespec   *deadline_ptr
+    )
+{
+    long nsec;
+
+    clock_gettime(CLOCK_MONOTONIC, deadline_ptr);
+    nsec = deadline_ptr->tv_nsec + (timeout_msec % 1000) * 1000000L;
+    deadline_ptr->tv_sec  += timeout_msec / 1000 + nsec / 1000000000L;
+    deadline_ptr->tv_nsec  = nsec % 1000000000L;
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_ioctl_elapsed_msec
+
+DESCRIPTION
+   Time passed since a CLOCK_MONOTONIC time.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   msec since since_ptr, negative if it is in the future
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static int32 loc_eng_ioctl_elapsed_msec(
+    const struct timespec *since_ptr
+    )
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int32) ((now.tv_sec - since_ptr->tv_sec) * 1000 +
+                    (now.tv_nsec - since_ptr->tv_nsec) / 1000000);
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_ioctl_cond_init
+
+DESCRIPTION
+   Initializes a condition that is waited on with CLOCK_MONOTONIC deadlines.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_ioctl_cond_init(
+    pthread_cond_t    *cond_ptr
+    )
+{
+#ifdef HAVE_PTHREAD_COND_TIMEDWAIT_MONOTONIC
+    pthread_cond_init (cond_ptr, NULL);
+#else
+    pthread_condattr_t attr;
+
+    pthread_condattr_init (&attr);
+    pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+    pthread_cond_init (cond_ptr, &attr);
+    pthread_condattr_destroy (&attr);
+#endif
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_ioctl_cond_timedwait
+
+DESCRIPTION
+   pthread_cond_timedwait with a deadline from loc_eng_ioctl_deadline.
+
+DEPENDENCIES
+   cond_ptr is initialized with loc_eng_ioctl_cond_init
+
+RETURN VALUE
+   0 if signalled, ETIMEDOUT if the deadline passed
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+int loc_eng_ioctl_cond_timedwait(
+    pthread_cond_t         *cond_ptr,
+    pthread_mutex_t        *mutex_ptr,
+    const struct timespec  *deadline_ptr
+    )
+{
+#ifdef HAVE_PTHREAD_COND_TIMEDWAIT_MONOTONIC
+    return pthread_cond_timedwait_monotonic (cond_ptr, mutex_ptr, deadline_ptr);
+#else
+    return pthread_cond_timedwait (cond_ptr, mutex_ptr, deadline_ptr);
+#endif
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_ioctl_percentile
+
+DESCRIPTION
+   Computes a percentile of a small set of samples.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   The sample at percent of the sorted samples
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static uint32 loc_eng_ioctl_percentile(
+    const uint32  *samples,
+    int            count,
+    int            percent
+    )
+{
+    uint32 sorted[LOC_ENG_IOCTL_RTT_SAMPLES];
+    uint32 value;
+    int i, j, rank;
+
+    // Insertion sort, there are at most LOC_ENG_IOCTL_RTT_SAMPLES
+    for (i = 0; i < count; i++)
+    {
+        value = samples[i];
+        for (j = i; j > 0 && sorted[j - 1] > value; j--)
+        {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = value;
+    }
+
+    rank = (count * percent + 99) / 100;
+
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_ioctl_record_rtt
+
+DESCRIPTION
+   Records the round trip time of an ioctl and updates the timeout of its
+   slot to a multiple of the recent round trip percentile. Called with
+   cb_data_mutex held.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_ioctl_record_rtt(
+    loc_eng_ioctl_slot_s_type     *slot_ptr,
+    uint32                         rtt_msec
+    )
+{
+    uint32 count, timeout_msec;
+
+    slot_ptr->rtt_msec[slot_ptr->rtt_count % LOC_ENG_IOCTL_RTT_SAMPLES] = rtt_msec;
+    slot_ptr->rtt_count++;
+
+    if (slot_ptr->rtt_count < LOC_ENG_IOCTL_RTT_MIN_SAMPLES)
+    {
+        return;
+    }
+
+    count = slot_ptr->rtt_count < LOC_ENG_IOCTL_RTT_SAMPLES ? slot_ptr->rtt_count : LOC_ENG_IOCTL_RTT_SAMPLES;
+    timeout_msec = LOC_ENG_IOCTL_RTT_MULTIPLIER *
+                   loc_eng_ioctl_percentile (slot_ptr->rtt_msec, count, LOC_ENG_IOCTL_RTT_PERCENTILE);
+
+    if (timeout_msec < LOC_ENG_IOCTL_MIN_TIMEOUT)
+    {
+        timeout_msec = LOC_ENG_IOCTL_MIN_TIMEOUT;
+    }
+    else if (timeout_msec > LOC_ENG_IOCTL_MAX_TIMEOUT)
+    {
+        timeout_msec = LOC_ENG_IOCTL_MAX_TIMEOUT;
+    }
+
+    if (timeout_msec != slot_ptr->adaptive_timeout_msec)
+    {
+        LOGV ("loc_eng_ioctl_record_rtt: ioctl %d rtt = %d ms, timeout %d -> %d ms\n",
+                slot_ptr->ioctl_type, rtt_msec, slot_ptr->adaptive_timeout_msec, timeout_msec);
+        slot_ptr->adaptive_timeout_msec = timeout_msec;
+    }
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_ioctl_init
+
+DESCRIPTION
+   Initializes the pending ioctl slots and starts the thread that times out
+   the async ioctls.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_ioctl_init(
+    loc_eng_ioctl_data_s_type *ioctl_cb_data_ptr
+    )
+{
+    int i;
+
+    for (i = 0; i < LOC_ENG_IOCTL_SLOT_COUNT; i++)
+    {
+        loc_eng_ioctl_slot_s_type *slot_ptr = &(ioctl_cb_data_ptr->slots[i]);
+
+        slot_ptr->cb_is_selected = FALSE;
+        slot_ptr->cb_is_waiting  = FALSE;
+        slot_ptr->cb_has_arrived = FALSE;
+        slot_ptr->client_handle  = RPC_LOC_CLIENT_HANDLE_INVALID;
+        slot_ptr->generation     = 0;
+        slot_ptr->complete_cb    = NULL;
+        memset (&(slot_ptr->cb_payload), 0, sizeof (rpc_loc_ioctl_callback_s_type));
+        slot_ptr->rtt_count      = 0;
+        slot_ptr->adaptive_timeout_msec = 0;
+        loc_eng_ioctl_cond_init (&(slot_ptr->cb_arrived_cond));
+    }
+
+    pthread_mutex_init (&(ioctl_cb_data_ptr->cb_data_mutex), NULL);
+    loc_eng_ioctl_cond_init (&(ioctl_cb_data_ptr->timer_cond));
+
+    ioctl_cb_data_ptr->timer_need_exit = FALSE;
+    pthread_create (&(ioctl_cb_data_ptr->timer_thread), NULL,
+                    loc_eng_ioctl_timer_thread, ioctl_cb_data_ptr);
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_ioctl_deinit
+
+DESCRIPTION
+   Stops the timer thread and releases the resources of the pending ioctl
+   slots. Completion callbacks still pending are dropped.
+
+DEPENDENCIES
+   No loc_eng_ioctl may be in progress.
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_ioctl_deinit(
+    loc_eng_ioctl_data_s_type *ioctl_cb_data_ptr
+    )
+{
+    int i;
+
+    pthread_mutex_lock (&(ioctl_cb_data_ptr->cb_data_mutex));
+    ioctl_cb_data_ptr->timer_need_exit = TRUE;
+    pthread_cond_signal (&(ioctl_cb_data_ptr->timer_cond));
+    pthread_mutex_unlock (&(ioctl_cb_data_ptr->cb_data_mutex));
+    pthread_join (ioctl_cb_data_ptr->timer_thread, NULL);
+
+    for (i = 0; i < LOC_ENG_IOCTL_SLOT_COUNT; i++)
+    {
+        pthread_cond_destroy (&(ioctl_cb_data_ptr->slots[i].cb_arrived_cond));
+    }
+
+    pthread_cond_destroy (&(ioctl_cb_data_ptr->timer_cond));
+    pthread_mutex_destroy (&(ioctl_cb_data_ptr->cb_data_mutex));
+}
+
 /*===========================================================================
 
 FUNCTION    loc_eng_ioctl
@@ -74,6 +467,9 @@ DESCRIPTION
    This function calls loc_ioctl and waits for the callback result before
    returning back to the user.
 
+   Ioctls of different types are in flight at the same time, a second ioctl
+   of a type already in progress waits for the first one to finish.
+
 DEPENDENCIES
    N/A
 
@@ -93,104 +489,275 @@ boolean loc_eng_ioctl(
     rpc_loc_ioctl_callback_s_type       *cb_data_ptr
     )
 {
-    boolean                    ret_val;
-    int                        rpc_ret_val;
-    loc_eng_ioctl_data_s_type *ioctl_cb_data_ptr;
+    loc_eng_ioctl_handle_type ioctl_handle;
 
     LOGV ("loc_eng_ioctl: client = %d, ioctl_type = %d, cb_data =0x%x\n", (int32) handle, ioctl_type, (uint32) cb_data_ptr);
 
+    ioctl_handle = loc_eng_ioctl_async (handle, ioctl_type, ioctl_data_ptr, timeout_msec, NULL, NULL);
+
+    if (ioctl_handle == LOC_ENG_IOCTL_HANDLE_INVALID)
+    {
+        return FALSE;
+    }
+
+    // Wait for the callback of loc_ioctl
+    return loc_eng_ioctl_wait (ioctl_handle, cb_data_ptr);
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_ioctl_async
+
+DESCRIPTION
+   This function calls loc_ioctl and returns without waiting for the
+   callback. The result is passed to complete_cb when the report arrives or
+   the ioctl times out. Without a complete_cb, the result is collected with
+   loc_eng_ioctl_wait.
+
+   timeout_msec is used until the round trip time of ioctl_type is known,
+   the timeout is then derived from it.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   Handle of the ioctl
+   LOC_ENG_IOCTL_HANDLE_INVALID  if the ioctl could not be sent, complete_cb
+                                 is not called. An ioctl that timed out
+                                 while loc_ioctl was still running has had
+                                 its complete_cb called, its handle is
+                                 returned instead.
+
+SIDE EFFECTS
+   Waits up to timeout_msec if an ioctl of the same type is in progress
+
+===========================================================================*/
+loc_eng_ioctl_handle_type loc_eng_ioctl_async(
+    rpc_loc_client_handle_type           handle,
+    rpc_loc_ioctl_e_type                 ioctl_type,
+    rpc_loc_ioctl_data_u_type*           ioctl_data_ptr,
+    uint32                               timeout_msec,
+    loc_eng_ioctl_complete_cb_type       complete_cb,
+    void                                *user_data
+    )
+{
+    int                        rpc_ret_val;
+    uint32                     generation;
+    loc_eng_ioctl_slot_s_type *slot_ptr;
+    loc_eng_ioctl_data_s_type *ioctl_cb_data_ptr;
+
     ioctl_cb_data_ptr = &(loc_eng_data.ioctl_data);
+
     // Select the callback we are waiting for
-    ret_val = loc_eng_ioctl_setup_cb (handle, ioctl_type);
+    slot_ptr = loc_eng_ioctl_setup_cb (handle, ioctl_type, timeout_msec, complete_cb, user_data);
 
-    if (ret_val == TRUE) 
+    if (slot_ptr == NULL)
     {
-        rpc_ret_val =  loc_ioctl (handle,
-                                    ioctl_type,
-                                    ioctl_data_ptr);
+        return LOC_ENG_IOCTL_HANDLE_INVALID;
+    }
 
-        LOGV ("loc_eng_ioctl: loc_ioctl returned %d \n", rpc_ret_val);
+    // The report may complete an async ioctl before loc_ioctl returns
+    generation = slot_ptr->generation;
 
-        if (rpc_ret_val == RPC_LOC_API_SUCCESS)
-        {
-            // Wait for the callback of loc_ioctl
-            ret_val = loc_eng_ioctl_wait_cb (timeout_msec, cb_data_ptr);
-        }
-        else
+    if (complete_cb != NULL)
+    {
+        // Let the timer thread pick up the new deadline
+        pthread_mutex_lock (&ioctl_cb_data_ptr->cb_data_mutex);
+        pthread_cond_signal (&ioctl_cb_data_ptr->timer_cond);
+        pthread_mutex_unlock (&ioctl_cb_data_ptr->cb_data_mutex);
+    }
+
+    rpc_ret_val =  loc_ioctl (handle,
+                                ioctl_type,
+                                ioctl_data_ptr);
+
+    LOGV ("loc_eng_ioctl_async: loc_ioctl returned %d \n", rpc_ret_val);
+
+    if (rpc_ret_val != RPC_LOC_API_SUCCESS)
+    {
+        LOGE ("loc_eng_ioctl_async: loc_ioctl %d failed, returned %d", ioctl_type, rpc_ret_val);
+        // If the timer thread already timed the ioctl out, complete_cb has
+        // run or is running, and the caller must not handle the failure again
+        if (loc_eng_ioctl_release_cb (slot_ptr, generation, TRUE) == TRUE)
         {
-            ret_val = FALSE;
+            return LOC_ENG_IOCTL_HANDLE_INVALID;
         }
     }
 
-    // Reset the state when we are done
-    pthread_mutex_lock(&ioctl_cb_data_ptr->cb_data_mutex);
-    ioctl_cb_data_ptr->cb_is_selected = FALSE;
-    ioctl_cb_data_ptr->cb_is_waiting  = FALSE;
-    ioctl_cb_data_ptr->cb_has_arrived = FALSE;
-    pthread_mutex_unlock(&ioctl_cb_data_ptr->cb_data_mutex);
-
-    return ret_val;
+    return loc_eng_ioctl_get_handle (slot_ptr, generation);
 }
 
-
 /*===========================================================================
 
 FUNCTION    loc_eng_ioctl_setup_cb
 
 DESCRIPTION
-   Selects which callback is going to be waited for
+   Selects which callback is going to be waited for. If an ioctl of the same
+   type is in progress, waits up to timeout_msec for it to finish.
 
 DEPENDENCIES
    N/A
 
 RETURN VALUE
-   TRUE                 if successful
-   FALSE                if failed
+   Pointer to the selected slot
+   NULL                 if failed
 
 SIDE EFFECTS
    N/A
 
 ===========================================================================*/
-static boolean loc_eng_ioctl_setup_cb(
-    rpc_loc_client_handle_type    handle,
-    rpc_loc_ioctl_e_type          ioctl_type
+static loc_eng_ioctl_slot_s_type* loc_eng_ioctl_setup_cb(
+    rpc_loc_client_handle_type     handle,
+    rpc_loc_ioctl_e_type           ioctl_type,
+    int                            timeout_msec,
+    loc_eng_ioctl_complete_cb_type complete_cb,
+    void                          *user_data
     )
 {
-    boolean ret_val;
+    loc_eng_ioctl_slot_s_type *slot_ptr;
     loc_eng_ioctl_data_s_type *ioctl_cb_data_ptr;
+    struct timespec deadline;
+    int rc = 0;
 
     ioctl_cb_data_ptr = &(loc_eng_data.ioctl_data);
+    slot_ptr = &(ioctl_cb_data_ptr->slots[loc_eng_ioctl_get_slot (ioctl_type)]);
 
     pthread_mutex_lock(&ioctl_cb_data_ptr->cb_data_mutex);
-    if (ioctl_cb_data_ptr->cb_is_selected == TRUE)
+    if (slot_ptr->cb_is_selected == TRUE)
     {
-        LOGE ("loc_eng_ioctl_setup_cb: ERROR, another ioctl in progress \n");
-        ret_val = FALSE;
+        LOGD ("loc_eng_ioctl_setup_cb: ioctl %d in progress, waiting \n", slot_ptr->ioctl_type);
+        loc_eng_ioctl_deadline (timeout_msec, &deadline);
+        while (slot_ptr->cb_is_selected == TRUE && rc == 0)
+        {
+            rc = loc_eng_ioctl_cond_timedwait(&slot_ptr->cb_arrived_cond,
+                                              &ioctl_cb_data_ptr->cb_data_mutex,
+                                              &deadline);
+        }
+    }
+
+    if (slot_ptr->cb_is_selected == TRUE)
+    {
+        LOGE ("loc_eng_ioctl_setup_cb: ERROR, ioctl %d still in progress \n", slot_ptr->ioctl_type);
+        slot_ptr = NULL;
     }
     else
     {
-        ioctl_cb_data_ptr->cb_is_selected = TRUE;
-        ioctl_cb_data_ptr->cb_is_waiting  = FALSE;
-        ioctl_cb_data_ptr->cb_has_arrived = FALSE;
-        ioctl_cb_data_ptr->client_handle  = handle;
-        ioctl_cb_data_ptr->ioctl_type     = ioctl_type;
-        memset (&(ioctl_cb_data_ptr->cb_payload), 0, sizeof (rpc_loc_ioctl_callback_s_type));
-        ret_val = TRUE;
+        slot_ptr->cb_is_selected = TRUE;
+        slot_ptr->cb_is_waiting  = FALSE;
+        slot_ptr->cb_has_arrived = FALSE;
+        slot_ptr->client_handle  = handle;
+        slot_ptr->ioctl_type     = ioctl_type;
+        slot_ptr->generation     = (slot_ptr->generation + 1) % LOC_ENG_IOCTL_MAX_GENERATION;
+        slot_ptr->complete_cb    = complete_cb;
+        slot_ptr->complete_user_data = user_data;
+        // Once the round trip time of this ioctl is known, it sets the timeout
+        if (slot_ptr->adaptive_timeout_msec != 0)
+        {
+            timeout_msec = slot_ptr->adaptive_timeout_msec;
+        }
+        slot_ptr->timeout_msec   = timeout_msec;
+        clock_gettime (CLOCK_MONOTONIC, &slot_ptr->send_time);
+        loc_eng_ioctl_deadline (timeout_msec, &slot_ptr->expire_time);
+        memset (&(slot_ptr->cb_payload), 0, sizeof (rpc_loc_ioctl_callback_s_type));
     }
     pthread_mutex_unlock(&ioctl_cb_data_ptr->cb_data_mutex);
 
-    return ret_val;
+    return slot_ptr;
 }
 
 /*===========================================================================
 
-FUNCTION    loc_eng_ioctl_wait_cb
+FUNCTION    loc_eng_ioctl_release_cb
 
 DESCRIPTION
-   Waits for a selected callback. The wait expires in timeout_msec.
+   Frees a slot selected by loc_eng_ioctl_setup_cb and wakes up the next
+   ioctl of the same type, if any. Nothing is done if the slot has been
+   selected again since generation, or, with pending_only, if its result
+   has already arrived and is being passed to the completion callback.
 
-   If the function is called before an existing wait has finished, it will
-   immediately return EBUSY.
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE                 if the slot was freed
+   FALSE                otherwise
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_ioctl_release_cb(
+    loc_eng_ioctl_slot_s_type     *slot_ptr,
+    uint32                         generation,
+    boolean                        pending_only
+    )
+{
+    loc_eng_ioctl_data_s_type *ioctl_cb_data_ptr = &(loc_eng_data.ioctl_data);
+    boolean released = FALSE;
+
+    pthread_mutex_lock(&ioctl_cb_data_ptr->cb_data_mutex);
+    if (slot_ptr->cb_is_selected == TRUE && slot_ptr->generation == generation &&
+        (pending_only == FALSE || slot_ptr->cb_has_arrived == FALSE))
+    {
+        released = TRUE;
+        slot_ptr->cb_is_selected = FALSE;
+        slot_ptr->cb_is_waiting  = FALSE;
+        slot_ptr->cb_has_arrived = FALSE;
+        slot_ptr->client_handle  = RPC_LOC_CLIENT_HANDLE_INVALID;
+        slot_ptr->complete_cb    = NULL;
+    }
+    pthread_mutex_unlock(&ioctl_cb_data_ptr->cb_data_mutex);
+
+    pthread_cond_broadcast (&slot_ptr->cb_arrived_cond);
+
+    return released;
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_ioctl_complete
+
+DESCRIPTION
+   Passes the result of an async ioctl to its completion callback and frees
+   the slot. Called without cb_data_mutex held, after cb_has_arrived has
+   been set by the caller.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_ioctl_complete(
+    loc_eng_ioctl_slot_s_type     *slot_ptr,
+    uint32                         generation,
+    loc_eng_ioctl_complete_cb_type complete_cb,
+    void                          *user_data
+    )
+{
+    LOGV ("loc_eng_ioctl_complete: ioctl = %d, status = %d\n",
+            slot_ptr->cb_payload.type, (int32) slot_ptr->cb_payload.status);
+
+    // The slot stays selected, nothing else touches the payload meanwhile
+    complete_cb (loc_eng_ioctl_get_handle (slot_ptr, generation),
+                 &(slot_ptr->cb_payload),
+                 user_data);
+
+    loc_eng_ioctl_release_cb (slot_ptr, generation, FALSE);
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_ioctl_wait
+
+DESCRIPTION
+   Waits for the result of an ioctl submitted by loc_eng_ioctl_async
+   without a completion callback. The wait expires at the deadline set by
+   loc_eng_ioctl_async.
 
 DEPENDENCIES
    N/A
@@ -200,105 +767,197 @@ RETURN VALUE
    FALSE                if failed
 
 SIDE EFFECTS
-   N/A
+   Frees the ioctl handle
 
 ===========================================================================*/
-boolean loc_eng_ioctl_wait_cb(
-    int                            timeout_msec,  // Timeout in this number of msec
+boolean loc_eng_ioctl_wait(
+    loc_eng_ioctl_handle_type      ioctl_handle,
     rpc_loc_ioctl_callback_s_type *cb_data_ptr
     )
 {
     boolean ret_val = FALSE; // the return value of this function
-    int rc;                  // return code from pthread calls
+    int rc = 0;              // return code from pthread calls
 
-    struct timeval present_time;
-    struct timespec expire_time;
     loc_eng_ioctl_data_s_type *ioctl_cb_data_ptr;
+    loc_eng_ioctl_slot_s_type *slot_ptr;
+    uint32 generation;
+
+    if (ioctl_handle < 0)
+    {
+        LOGE ("loc_eng_ioctl_wait: ERROR invalid handle %d \n", ioctl_handle);
+        return FALSE;
+    }
 
     ioctl_cb_data_ptr = &(loc_eng_data.ioctl_data);
+    slot_ptr = &(ioctl_cb_data_ptr->slots[ioctl_handle % LOC_ENG_IOCTL_SLOT_COUNT]);
+    generation = ioctl_handle / LOC_ENG_IOCTL_SLOT_COUNT;
 
     pthread_mutex_lock(&ioctl_cb_data_ptr->cb_data_mutex);
 
     do {
-        if (ioctl_cb_data_ptr->cb_is_selected == FALSE)
-        {
-            LOGE ("loc_eng_ioctl_wait_cb: ERROR called when cb_is_waiting is set to FALSE \n");
-            ret_val = FALSE;
-            break;
-        }
-
-        // Calculate absolute expire time
-        gettimeofday(&present_time, NULL);
-        expire_time.tv_sec  = present_time.tv_sec;
-        expire_time.tv_sec  +=  timeout_msec / 1000;
-        if ((present_time.tv_usec + timeout_msec) >= 1000)
+        if (slot_ptr->cb_is_selected == FALSE ||
+            slot_ptr->generation != generation ||
+            slot_ptr->complete_cb != NULL)
         {
-            expire_time.tv_sec += 1;
+            LOGE ("loc_eng_ioctl_wait: ERROR handle %d is not waitable \n", ioctl_handle);
+            pthread_mutex_unlock(&ioctl_cb_data_ptr->cb_data_mutex);
+            return FALSE;
         }
-        expire_time.tv_nsec = (present_time.tv_usec + timeout_msec) % 1000 * 1000;
 
         // Special case where callback is issued before loc_ioctl ever returns
-        if (ioctl_cb_data_ptr->cb_has_arrived == TRUE)
+        if (slot_ptr->cb_has_arrived == TRUE)
         {
-            LOGD ("loc_eng_ioctl_wait_cb: cb has arrived without waiting \n");
+            LOGD ("loc_eng_ioctl_wait: cb has arrived without waiting \n");
             ret_val = TRUE;
             break;
         }
-   
-        ioctl_cb_data_ptr->cb_is_waiting = TRUE;
-        // Wait for the callback until timeout expires
-        rc = pthread_cond_timedwait(&ioctl_cb_data_ptr->cb_arrived_cond,
-                                    &ioctl_cb_data_ptr->cb_data_mutex,
-                                    &expire_time);
-
-        if (rc == 0)
+
+        slot_ptr->cb_is_waiting = TRUE;
+        // Wait for the callback until timeout expires, the condition is
+        // shared with the callers queued up for this slot
+        while (slot_ptr->cb_has_arrived == FALSE && rc == 0)
+        {
+            rc = loc_eng_ioctl_cond_timedwait(&slot_ptr->cb_arrived_cond,
+                                              &ioctl_cb_data_ptr->cb_data_mutex,
+                                              &slot_ptr->expire_time);
+        }
+
+        if (slot_ptr->cb_has_arrived == TRUE)
         {
             ret_val = TRUE;
         }
         else
         {
-            LOGE("loc_eng_ioctl_wait_cb: timed out waiting for response!");
+            LOGE("loc_eng_ioctl_wait: ioctl %d timed out after %d ms!", slot_ptr->ioctl_type, slot_ptr->timeout_msec);
+            loc_eng_ioctl_record_rtt (slot_ptr, slot_ptr->timeout_msec);
             ret_val = FALSE;
         }
 
-        LOGV ("loc_eng_ioctl_wait_cb: pthread_cond_timedwait returned %d\n", rc);
+        LOGV ("loc_eng_ioctl_wait: loc_eng_ioctl_cond_timedwait returned %d\n", rc);
 
     } while (0);
 
     // Process the ioctl callback data when IOCTL is successful
     if (ret_val == TRUE)
     {
-        ioctl_cb_data_ptr = &(loc_eng_data.ioctl_data);
-        if (ioctl_cb_data_ptr->cb_payload.status == RPC_LOC_API_SUCCESS)
+        if (slot_ptr->cb_payload.status == RPC_LOC_API_SUCCESS)
         {
             ret_val = TRUE;
             if (cb_data_ptr != NULL)
             {
                 memcpy (cb_data_ptr,
-                        &(ioctl_cb_data_ptr->cb_payload),
+                        &(slot_ptr->cb_payload),
                         sizeof (rpc_loc_ioctl_callback_s_type));
             }
         }
         else
         {
-            LOGE ("loc_eng_ioctl_wait_cb: ioctl failed, returned %d", ioctl_cb_data_ptr->cb_payload.status);
+            LOGE ("loc_eng_ioctl_wait: ioctl failed, returned %d", (int) slot_ptr->cb_payload.status);
             ret_val = FALSE;
         }
     }
 
     pthread_mutex_unlock(&ioctl_cb_data_ptr->cb_data_mutex);
 
-    LOGV ("loc_eng_ioctl_wait_cb: returned %d\n", ret_val);
+    // Reset the state when we are done
+    loc_eng_ioctl_release_cb (slot_ptr, generation, FALSE);
+
+    LOGV ("loc_eng_ioctl_wait: returned %d\n", ret_val);
     return ret_val;
 }
 
 /*===========================================================================
 
+FUNCTION    loc_eng_ioctl_timer_thread
+
+DESCRIPTION
+   Completes the async ioctls whose report did not arrive in time with a
+   report of status RPC_LOC_API_TIMEOUT.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void* loc_eng_ioctl_timer_thread(void* arg)
+{
+    loc_eng_ioctl_data_s_type *ioctl_cb_data_ptr = (loc_eng_ioctl_data_s_type *) arg;
+    loc_eng_ioctl_slot_s_type *slot_ptr;
+    loc_eng_ioctl_slot_s_type *next_ptr;
+    loc_eng_ioctl_complete_cb_type complete_cb;
+    void *user_data;
+    uint32 generation;
+    int i;
+
+    pthread_mutex_lock(&ioctl_cb_data_ptr->cb_data_mutex);
+    while (ioctl_cb_data_ptr->timer_need_exit == FALSE)
+    {
+        // Find the async ioctl that expires first
+        next_ptr = NULL;
+        for (i = 0; i < LOC_ENG_IOCTL_SLOT_COUNT; i++)
+        {
+            slot_ptr = &(ioctl_cb_data_ptr->slots[i]);
+            if (slot_ptr->cb_is_selected == TRUE &&
+                slot_ptr->complete_cb != NULL &&
+                slot_ptr->cb_has_arrived == FALSE &&
+                (next_ptr == NULL ||
+                 slot_ptr->expire_time.tv_sec < next_ptr->expire_time.tv_sec ||
+                 (slot_ptr->expire_time.tv_sec == next_ptr->expire_time.tv_sec &&
+                  slot_ptr->expire_time.tv_nsec < next_ptr->expire_time.tv_nsec)))
+            {
+                next_ptr = slot_ptr;
+            }
+        }
+
+        if (next_ptr == NULL)
+        {
+            pthread_cond_wait (&ioctl_cb_data_ptr->timer_cond, &ioctl_cb_data_ptr->cb_data_mutex);
+        }
+        else if (loc_eng_ioctl_elapsed_msec (&next_ptr->expire_time) >= 0)
+        {
+            LOGE ("loc_eng_ioctl_timer_thread: ioctl %d timed out after %d ms \n",
+                    next_ptr->ioctl_type, next_ptr->timeout_msec);
+            loc_eng_ioctl_record_rtt (next_ptr, next_ptr->timeout_msec);
+
+            // Claim the slot, a late report is ignored from now on
+            next_ptr->cb_has_arrived = TRUE;
+            memset (&(next_ptr->cb_payload), 0, sizeof (rpc_loc_ioctl_callback_s_type));
+            next_ptr->cb_payload.type   = next_ptr->ioctl_type;
+            next_ptr->cb_payload.status = RPC_LOC_API_TIMEOUT;
+            complete_cb = next_ptr->complete_cb;
+            user_data   = next_ptr->complete_user_data;
+            generation  = next_ptr->generation;
+
+            pthread_mutex_unlock(&ioctl_cb_data_ptr->cb_data_mutex);
+            loc_eng_ioctl_complete (next_ptr, generation, complete_cb, user_data);
+            pthread_mutex_lock(&ioctl_cb_data_ptr->cb_data_mutex);
+        }
+        else
+        {
+            loc_eng_ioctl_cond_timedwait (&ioctl_cb_data_ptr->timer_cond,
+                                          &ioctl_cb_data_ptr->cb_data_mutex,
+                                          &next_ptr->expire_time);
+        }
+    }
+    pthread_mutex_unlock(&ioctl_cb_data_ptr->cb_data_mutex);
+
+    return NULL;
+}
+
+/*===========================================================================
+
 FUNCTION    loc_eng_ioctl_process_cb
 
 DESCRIPTION
    This function process the IOCTL callback, parameter specifies the client 
-   that receives the IOCTL callback.
+   that receives the IOCTL callback. The pending ioctl is looked up by the
+   type of the report. The completion callback of an async ioctl is called
+   from here.
 
 DEPENDENCIES
    N/A
@@ -318,42 +977,62 @@ boolean loc_eng_ioctl_process_cb (
 {
     boolean ret_val = FALSE; // the return value of this function
     loc_eng_ioctl_data_s_type *ioctl_cb_data_ptr;
+    loc_eng_ioctl_slot_s_type *slot_ptr;
+    loc_eng_ioctl_complete_cb_type complete_cb = NULL;
+    void *user_data = NULL;
+    uint32 generation = 0;
+
     ioctl_cb_data_ptr = &(loc_eng_data.ioctl_data);
+    slot_ptr = &(ioctl_cb_data_ptr->slots[loc_eng_ioctl_get_slot (cb_data_ptr->type)]);
 
     pthread_mutex_lock(&ioctl_cb_data_ptr->cb_data_mutex);
-    if (client_handle != ioctl_cb_data_ptr->client_handle)
+    if (slot_ptr->cb_is_selected == FALSE ||
+        slot_ptr->cb_has_arrived == TRUE ||
+        cb_data_ptr->type != slot_ptr->ioctl_type)
     {
-        LOGE ("loc_eng_ioctl_process_cb: client handle mismatch, received = %d, expected = %d \n",
-                (int32) client_handle, (int32) ioctl_cb_data_ptr->client_handle);
+        LOGE ("loc_eng_ioctl_process_cb: no ioctl %d in progress \n", cb_data_ptr->type);
         ret_val = FALSE;
     }
-    else if (cb_data_ptr->type != ioctl_cb_data_ptr->ioctl_type)
+    else if (client_handle != slot_ptr->client_handle)
     {
-        LOGE ("loc_eng_ioctl_process_cb: ioctl type mismatch, received = %d, expected = %d \n",
-                 cb_data_ptr->type, ioctl_cb_data_ptr->ioctl_type);
+        LOGE ("loc_eng_ioctl_process_cb: client handle mismatch, received = %d, expected = %d \n",
+                (int32) client_handle, (int32) slot_ptr->client_handle);
         ret_val = FALSE;
     }
     else // both matches
     {
-        memcpy (&(ioctl_cb_data_ptr->cb_payload),
-                cb_data_ptr,
-                sizeof (rpc_loc_ioctl_callback_s_type));
-
-        ioctl_cb_data_ptr->cb_has_arrived = TRUE;
+        // Called from the RPC callback, copy the data out of the RPC buffers
+        (void) loc_eng_copy_ioctl_callback (&(slot_ptr->cb_payload),
+                                            cb_data_ptr,
+                                            slot_ptr->cb_payload_arena,
+                                            sizeof (slot_ptr->cb_payload_arena));
+
+        slot_ptr->cb_has_arrived = TRUE;
+        loc_eng_ioctl_record_rtt (slot_ptr, loc_eng_ioctl_elapsed_msec (&slot_ptr->send_time));
+        complete_cb = slot_ptr->complete_cb;
+        user_data   = slot_ptr->complete_user_data;
+        generation  = slot_ptr->generation;
 
         LOGV ("loc_eng_ioctl_process_cb: callback arrived for client = %d, ioctl = %d, status = %d (%s)\n",
-                (int32) ioctl_cb_data_ptr->client_handle, ioctl_cb_data_ptr->ioctl_type,
-                (int32) ioctl_cb_data_ptr->cb_payload.status, ((int32) ioctl_cb_data_ptr->cb_payload.status ==0) ? "SUCCESS" : "FAILED");
+                (int32) slot_ptr->client_handle, slot_ptr->ioctl_type,
+                (int32) slot_ptr->cb_payload.status, ((int32) slot_ptr->cb_payload.status ==0) ? "SUCCESS" : "FAILED");
 
         ret_val = TRUE;
     }
 
     pthread_mutex_unlock(&ioctl_cb_data_ptr->cb_data_mutex);
 
-    // Signal the waiting thread that callback has arrived
     if (ret_val == TRUE)
     {
-        pthread_cond_signal (&ioctl_cb_data_ptr->cb_arrived_cond);
+        if (complete_cb != NULL)
+        {
+            loc_eng_ioctl_complete (slot_ptr, generation, complete_cb, user_data);
+        }
+        else
+        {
+            // Signal the waiting thread that callback has arrived
+            pthread_cond_broadcast (&slot_ptr->cb_arrived_cond);
+        }
     }
 
     return ret_val;
@@ -4,8 +4,8 @@
 
   DESCRIPTION
     This file defines the data structure used by any location client that 
-    waits for the ioctl particular event to occur. Any one IOCTL can be pending
-    at any time.
+    waits for the ioctl particular event to occur. One IOCTL of each type can
+    be pending at any time, ioctls of different types overlap.
 
   INITIALIZATION AND SEQUENCING REQUIREMENTS
 
@@ -36,10 +36,51 @@ $Author: $
 #ifndef LOC_ENG_IOCTL_H
 #define LOC_ENG_IOCTL_H
 
-// Module data
-typedef struct loc_eng_ioctl_data_s_type
+// Storage for the server names an ioctl report can carry
+#define LOC_ENG_IOCTL_ARENA_SIZE \
+    (RPC_LOC_API_MAX_NUM_PREDICTED_ORBITS_SERVERS * (RPC_LOC_API_MAX_SERVER_ADDR_LENGTH + 1 + LOC_ENG_ARENA_ALIGN))
+
+// Pending ioctl slots, one per rpc_loc_ioctl_e_type. The ioctl types come in
+// dense ranges, each range is mapped onto consecutive slots.
+#define LOC_ENG_IOCTL_API_SLOTS         (RPC_LOC_IOCTL_GET_FIX_CRITERIA - RPC_LOC_IOCTL_GET_API_VERSION + 1)
+#define LOC_ENG_IOCTL_SERVICE_SLOTS     (RPC_LOC_IOCTL_INFORM_SERVER_CLOSE_STATUS - RPC_LOC_IOCTL_SERVICE_START_INDEX + 1)
+#define LOC_ENG_IOCTL_NV_SLOTS          (RPC_LOC_IOCTL_GET_ON_DEMAND_LPM - RPC_LOC_IOCTL_NV_SETTINGS_START_INDEX + 1)
+#define LOC_ENG_IOCTL_PROPRIETARY_SLOTS (RPC_LOC_IOCTL_GET_CUSTOM_PDE_SERVER_ADDR - RPC_LOC_IOCTL_PROPRIETARY_START_INDEX + 1)
+// Third party ioctls all share the last slot
+#define LOC_ENG_IOCTL_SLOT_COUNT \
+    (LOC_ENG_IOCTL_API_SLOTS + LOC_ENG_IOCTL_SERVICE_SLOTS + LOC_ENG_IOCTL_NV_SLOTS + LOC_ENG_IOCTL_PROPRIETARY_SLOTS + 1)
+
+// Round trip times kept per slot to derive its timeout. Until enough samples
+// are in, the timeout passed by the caller is used. A timed out ioctl counts
+// as a sample of its timeout, so the timeout backs off up to the maximum.
+#define LOC_ENG_IOCTL_RTT_SAMPLES      16
+#define LOC_ENG_IOCTL_RTT_MIN_SAMPLES  4
+#define LOC_ENG_IOCTL_RTT_PERCENTILE   95
+#define LOC_ENG_IOCTL_RTT_MULTIPLIER   3
+#define LOC_ENG_IOCTL_MIN_TIMEOUT      200  // msec
+#define LOC_ENG_IOCTL_MAX_TIMEOUT      5000 // msec
+
+// Handle of an ioctl submitted with loc_eng_ioctl_async
+typedef int32 loc_eng_ioctl_handle_type;
+#define LOC_ENG_IOCTL_HANDLE_INVALID  (-1)
+// Slot generations are encoded in the handle next to the slot index
+#define LOC_ENG_IOCTL_MAX_GENERATION  (0x7FFFFFFF / LOC_ENG_IOCTL_SLOT_COUNT)
+
+// Completion callback of loc_eng_ioctl_async, called once with the ioctl
+// report, or with a report of status RPC_LOC_API_TIMEOUT. Runs on the RPC
+// callback thread or the ioctl timer thread, possibly before
+// loc_eng_ioctl_async has returned, and must not block.
+typedef void (*loc_eng_ioctl_complete_cb_type)
+(
+    loc_eng_ioctl_handle_type            ioctl_handle,
+    const rpc_loc_ioctl_callback_s_type *cb_data_ptr,
+    void                                *user_data
+);
+
+// One pending ioctl
+typedef struct
 {
-    // We are waiting for an ioctl callback
+    // A loc client owns this slot and waits for its ioctl callback
     boolean                       cb_is_selected;
     // The thread has been put in a wait state for an ioctl callback
     boolean                       cb_is_waiting;
@@ -49,14 +90,43 @@ typedef struct loc_eng_ioctl_data_s_type
     rpc_loc_ioctl_e_type          ioctl_type;
     // The IOCLT report has arrived for the waiting client
     boolean                       cb_has_arrived;
+    // Incremented each time the slot is selected, part of the ioctl handle
+    uint32                        generation;
+    // Completion callback of an async ioctl, NULL if a thread waits for it
+    loc_eng_ioctl_complete_cb_type complete_cb;
+    void                         *complete_user_data;
+    // CLOCK_MONOTONIC time the ioctl was sent and times out
+    struct timespec               send_time;
+    struct timespec               expire_time;
+    // Timeout the ioctl was sent with
+    uint32                        timeout_msec;
+    // Recent round trip times in msec, rtt_count is the total recorded
+    uint32                        rtt_msec[LOC_ENG_IOCTL_RTT_SAMPLES];
+    uint32                        rtt_count;
+    // Timeout derived from rtt_msec, 0 until there are enough samples
+    uint32                        adaptive_timeout_msec;
     // The payload for the RPC_LOC_EVENT_IOCTL_REPORT
     rpc_loc_ioctl_callback_s_type cb_payload;
+    // Server names pointed to by cb_payload
+    char                          cb_payload_arena[LOC_ENG_IOCTL_ARENA_SIZE];
+    // Signalled when the callback arrives or the slot is released
+    pthread_cond_t                cb_arrived_cond;
+} loc_eng_ioctl_slot_s_type;
+
+// Module data
+typedef struct loc_eng_ioctl_data_s_type
+{
+    loc_eng_ioctl_slot_s_type     slots[LOC_ENG_IOCTL_SLOT_COUNT];
     // Mutex to access this data structure
     pthread_mutex_t               cb_data_mutex;
-    // LOC ioctl callback arrived mutex
-    pthread_cond_t                cb_arrived_cond;
+    // Times out the async ioctls that have a completion callback
+    pthread_t                     timer_thread;
+    pthread_cond_t                timer_cond;
+    boolean                       timer_need_exit;
 } loc_eng_ioctl_data_s_type;
 
+extern void loc_eng_ioctl_init (loc_eng_ioctl_data_s_type *ioctl_cb_data_ptr);
+extern void loc_eng_ioctl_deinit (loc_eng_ioctl_data_s_type *ioctl_cb_data_ptr);
 
 extern boolean loc_eng_ioctl
 (
@@ -67,6 +137,32 @@ extern boolean loc_eng_ioctl
     rpc_loc_ioctl_callback_s_type       *cb_data_ptr
 );
 
+// Submits an ioctl without waiting for its report. With a complete_cb the
+// result is delivered to it, otherwise loc_eng_ioctl_wait must be called
+// exactly once with the returned handle.
+extern loc_eng_ioctl_handle_type loc_eng_ioctl_async
+(
+    rpc_loc_client_handle_type           handle,
+    rpc_loc_ioctl_e_type                 ioctl_type,
+    rpc_loc_ioctl_data_u_type*           ioctl_data_ptr,
+    uint32                               timeout_msec,
+    loc_eng_ioctl_complete_cb_type       complete_cb,
+    void                                *user_data
+);
+
+extern boolean loc_eng_ioctl_wait
+(
+    loc_eng_ioctl_handle_type            ioctl_handle,
+    rpc_loc_ioctl_callback_s_type       *cb_data_ptr
+);
+
+// Conditions waited on with CLOCK_MONOTONIC deadlines, also used by the
+// other modules that time out on their own
+extern void loc_eng_ioctl_cond_init (pthread_cond_t *cond_ptr);
+extern int loc_eng_ioctl_cond_timedwait (pthread_cond_t *cond_ptr, pthread_mutex_t *mutex_ptr,
+                                         const struct timespec *deadline_ptr);
+extern void loc_eng_ioctl_deadline (int timeout_msec, struct timespec *deadline_ptr);
+
 extern boolean loc_eng_ioctl_process_cb 
 (
     rpc_loc_client_handle_type           client_handle,
@@ -0,0 +1,474 @@
+/******************************************************************************
+  @file:  loc_eng_mode.cpp
+  @brief:
+
+  DESCRIPTION
+    This file implements the positioning mode selector. Which operation mode
+    fixes first depends on the network and on what the receiver already
+    knows, so the selector learns it per condition from the sessions' own
+    outcomes instead of taking the framework's mode as is.
+
+  INITIALIZATION AND SEQUENCING REQUIREMENTS
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+         Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer. 
+
+         Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution. 
+
+         Neither the name of the QUALCOMM USA, INC.  nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  -----------------------------------------------------------------------------
+
+******************************************************************************/
+
+/*=====================================================================
+$Header: $
+$DateTime: $
+$Author: $
+======================================================================*/
+#define LOG_NDEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <rpc/rpc.h>
+#include <loc_api_rpc_glue.h>
+
+#include <hardware_legacy/gps.h>
+#include <cutils/properties.h>
+#include <utils/SystemClock.h>
+
+#include <loc_eng.h>
+
+#define LOG_TAG "lib_locapi"
+#include <utils/Log.h>
+
+// comment this out to enable logging
+// #undef LOGD
+// #define LOGD(...) {}
+
+loc_eng_mode_data_s_type loc_eng_mode_data = { PTHREAD_MUTEX_INITIALIZER };
+
+// Candidates in the order untried ones are tried in, after the framework's
+static const rpc_loc_operation_mode_e_type loc_eng_mode_candidates[LOC_ENG_MODE_MAX_CANDIDATES] =
+{
+    RPC_LOC_OPER_MODE_MSB,
+    RPC_LOC_OPER_MODE_MSA,
+    RPC_LOC_OPER_MODE_STANDALONE,
+    RPC_LOC_OPER_MODE_SPEED_OPTIMAL,
+    RPC_LOC_OPER_MODE_ACCURACY_OPTIMAL
+};
+
+static const char* const loc_eng_mode_names[LOC_ENG_MODE_MAX_CANDIDATES] =
+{
+    "msb",
+    "msa",
+    "standalone",
+    "speed_optimal",
+    "accuracy_optimal"
+};
+
+#define LOC_ENG_MODE_CANDIDATE_MSB         0
+#define LOC_ENG_MODE_CANDIDATE_MSA         1
+#define LOC_ENG_MODE_CANDIDATE_STANDALONE  2
+
+/*===========================================================================
+FUNCTION    loc_eng_mode_init
+
+DESCRIPTION
+   Reads the configuration of the selector. The outcomes so far are kept.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_mode_init (void)
+{
+    loc_eng_mode_data_s_type *mode_ptr = &loc_eng_mode_data;
+    char propBuf[PROPERTY_VALUE_MAX];
+
+    pthread_mutex_lock (&mode_ptr->lock);
+    property_get ("gps.mode.adaptive", propBuf, "0");
+    mode_ptr->adaptive = atoi (propBuf) != 0 ? TRUE : FALSE;
+
+    property_get ("gps.mode.log_file", propBuf, "");
+    snprintf (mode_ptr->log_path, sizeof (mode_ptr->log_path), "%s", propBuf);
+    mode_ptr->session_active = FALSE;
+    pthread_mutex_unlock (&mode_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_mode_log
+
+DESCRIPTION
+   Logs a decision or an outcome, one key=value line each for offline
+   tuning. The line is appended to log_path as well, after the
+   elapsedRealtime() in msec.
+
+DEPENDENCIES
+   Called with the lock held
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_mode_log (loc_eng_mode_data_s_type *mode_ptr, const char *format, ...)
+{
+    char line[192];
+    va_list args;
+    FILE *file;
+
+    va_start (args, format);
+    vsnprintf (line, sizeof (line), format, args);
+    va_end (args);
+
+    LOGI("loc_eng_mode: %s", line);
+    if (mode_ptr->log_path[0] != '\0')
+    {
+        file = fopen (mode_ptr->log_path, "a");
+        if (file != NULL)
+        {
+            fprintf (file, "%lld %s\n", (long long) android::elapsedRealtime (), line);
+            fclose (file);
+        }
+    }
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_mode_context
+
+DESCRIPTION
+   Sums up the conditions a session starts in: whether a data connection
+   can be had and is up already, whether the XTRA data is fresh, and
+   whether the last fix is recent enough for a hot start.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   LOC_ENG_MODE_CONTEXT
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static int loc_eng_mode_context (int *atl_ptr, boolean *xtra_fresh_ptr, boolean *fix_recent_ptr)
+{
+    loc_eng_xtra_data_s_type *xtra_ptr = &(loc_eng_data.xtra_module_data);
+    loc_eng_atl_data_s_type *atl_data_ptr = &(loc_eng_data.atl_data);
+
+    *atl_ptr = LOC_ENG_MODE_ATL_NONE;
+    if (loc_eng_data.agps_status_cb != NULL && loc_eng_data.agps_server_host[0] != 0)
+    {
+        pthread_mutex_lock (&atl_data_ptr->lock);
+        *atl_ptr = (atl_data_ptr->data_conn == LOC_ENG_ATL_DATA_CONN_UP) ?
+                   LOC_ENG_MODE_ATL_WARM : LOC_ENG_MODE_ATL_COLD;
+        pthread_mutex_unlock (&atl_data_ptr->lock);
+    }
+
+    pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+    *xtra_fresh_ptr = (xtra_ptr->refresh_time_utc > time (NULL)) ? TRUE : FALSE;
+    pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+
+    *fix_recent_ptr = (loc_eng_data.last_fix_time != 0 &&
+                       android::elapsedRealtime () - loc_eng_data.last_fix_time <
+                       (int64_t) LOC_ENG_MODE_RECENT_FIX_AGE * 1000) ? TRUE : FALSE;
+
+    return LOC_ENG_MODE_CONTEXT (*atl_ptr, *xtra_fresh_ptr, *fix_recent_ptr);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_mode_pick
+
+DESCRIPTION
+   Picks the candidate for a session in context. Each candidate is tried
+   LOC_ENG_MODE_MIN_TRIES times first, the framework's before the others.
+   Then the one with the shortest expected time to fix is taken, a failure
+   counting LOC_ENG_MODE_FAILURE_COST, except every
+   LOC_ENG_MODE_EXPLORE_INTERVAL sessions, when the candidate tried least
+   recently is taken.
+
+DEPENDENCIES
+   Called with the lock held
+
+RETURN VALUE
+   Index into loc_eng_mode_candidates
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static int loc_eng_mode_pick (loc_eng_mode_data_s_type *mode_ptr, int context, int preferred,
+                              const char **reason_ptr)
+{
+    const loc_eng_mode_stats_s_type *stats = mode_ptr->stats[context];
+    uint32 cost, best_cost = 0;
+    int i, best = preferred;
+
+    *reason_ptr = "explore";
+    mode_ptr->explored++;
+    if (stats[preferred].tries < LOC_ENG_MODE_MIN_TRIES)
+    {
+        return preferred;
+    }
+    for (i = 0; i < LOC_ENG_MODE_MAX_CANDIDATES; i++)
+    {
+        if (stats[i].tries < LOC_ENG_MODE_MIN_TRIES)
+        {
+            return i;
+        }
+    }
+
+    if (mode_ptr->sessions % LOC_ENG_MODE_EXPLORE_INTERVAL == 0)
+    {
+        for (i = 0; i < LOC_ENG_MODE_MAX_CANDIDATES; i++)
+        {
+            if (stats[i].last_session < stats[best].last_session)
+            {
+                best = i;
+            }
+        }
+        return best;
+    }
+
+    mode_ptr->explored--;
+    mode_ptr->exploited++;
+    *reason_ptr = "fastest";
+    for (i = 0; i < LOC_ENG_MODE_MAX_CANDIDATES; i++)
+    {
+        cost = stats[i].ttff_avg_msec + stats[i].failure_avg * (LOC_ENG_MODE_FAILURE_COST / 1000);
+        if (i == 0 || cost < best_cost)
+        {
+            best = i;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_mode_session_start
+
+DESCRIPTION
+   Picks the operation mode of a session. The framework's mode is kept
+   unless the selector is enabled and the network may be used; without a
+   data connection to be had the session runs standalone.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   RPC_LOC_OPER_MODE_xxx
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+rpc_loc_operation_mode_e_type loc_eng_mode_session_start (int position_mode)
+{
+    loc_eng_mode_data_s_type *mode_ptr = &loc_eng_mode_data;
+    int context, atl, preferred, candidate;
+    boolean xtra_fresh, fix_recent;
+    const char *reason;
+
+    if (position_mode == GPS_POSITION_MODE_MS_BASED)
+    {
+        preferred = LOC_ENG_MODE_CANDIDATE_MSB;
+    }
+    else if (position_mode == GPS_POSITION_MODE_MS_ASSISTED)
+    {
+        preferred = LOC_ENG_MODE_CANDIDATE_MSA;
+    }
+    else
+    {
+        preferred = LOC_ENG_MODE_CANDIDATE_STANDALONE;
+    }
+    context = loc_eng_mode_context (&atl, &xtra_fresh, &fix_recent);
+
+    pthread_mutex_lock (&mode_ptr->lock);
+    mode_ptr->sessions++;
+    if (mode_ptr->adaptive == FALSE || preferred == LOC_ENG_MODE_CANDIDATE_STANDALONE)
+    {
+        candidate = preferred;
+        reason = "framework";
+    }
+    else if (atl == LOC_ENG_MODE_ATL_NONE)
+    {
+        candidate = LOC_ENG_MODE_CANDIDATE_STANDALONE;
+        reason = "no_atl";
+    }
+    else
+    {
+        candidate = loc_eng_mode_pick (mode_ptr, context, preferred, &reason);
+    }
+
+    mode_ptr->session_active = TRUE;
+    mode_ptr->session_start = android::elapsedRealtime ();
+    mode_ptr->session_context = context;
+    mode_ptr->session_candidate = candidate;
+    mode_ptr->stats[context][candidate].last_session = mode_ptr->sessions;
+
+    loc_eng_mode_log (mode_ptr, "decision session=%u context=%d atl=%d xtra_fresh=%d fix_recent=%d mode=%s reason=%s",
+                      mode_ptr->sessions, context, atl, xtra_fresh, fix_recent,
+                      loc_eng_mode_names[candidate], reason);
+    pthread_mutex_unlock (&mode_ptr->lock);
+
+    return loc_eng_mode_candidates[candidate];
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_mode_outcome
+
+DESCRIPTION
+   Records how the running session ended and ends it.
+
+DEPENDENCIES
+   Called with the lock held, while a session is active
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_mode_outcome (loc_eng_mode_data_s_type *mode_ptr, boolean fixed, const char *result)
+{
+    loc_eng_mode_stats_s_type *stats_ptr =
+        &mode_ptr->stats[mode_ptr->session_context][mode_ptr->session_candidate];
+    uint32 msec = (uint32) (android::elapsedRealtime () - mode_ptr->session_start);
+    uint32 failure = (fixed == TRUE) ? 0 : 1000;
+
+    if (fixed == TRUE)
+    {
+        stats_ptr->ttff_avg_msec = (stats_ptr->fixes == 0) ? msec : (stats_ptr->ttff_avg_msec * 3 + msec) / 4;
+        stats_ptr->fixes++;
+    }
+    else
+    {
+        stats_ptr->failures++;
+    }
+    stats_ptr->failure_avg = (stats_ptr->tries == 0) ? failure : (stats_ptr->failure_avg * 3 + failure) / 4;
+    stats_ptr->tries++;
+
+    loc_eng_mode_log (mode_ptr, "outcome session=%u context=%d mode=%s result=%s msec=%u",
+                      mode_ptr->sessions, mode_ptr->session_context,
+                      loc_eng_mode_names[mode_ptr->session_candidate], result, msec);
+    mode_ptr->session_active = FALSE;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_mode_session_fix
+
+DESCRIPTION
+   A position report came in, the first one of a session is its time to
+   first fix.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_mode_session_fix (void)
+{
+    loc_eng_mode_data_s_type *mode_ptr = &loc_eng_mode_data;
+
+    pthread_mutex_lock (&mode_ptr->lock);
+    if (mode_ptr->session_active == TRUE)
+    {
+        loc_eng_mode_outcome (mode_ptr, TRUE, "fix");
+    }
+    pthread_mutex_unlock (&mode_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_mode_session_failed
+
+DESCRIPTION
+   The modem reported a failed session before the first fix.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_mode_session_failed (void)
+{
+    loc_eng_mode_data_s_type *mode_ptr = &loc_eng_mode_data;
+
+    pthread_mutex_lock (&mode_ptr->lock);
+    if (mode_ptr->session_active == TRUE)
+    {
+        loc_eng_mode_outcome (mode_ptr, FALSE, "failure");
+    }
+    pthread_mutex_unlock (&mode_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_mode_session_stop
+
+DESCRIPTION
+   The framework stopped the session. Without a fix it failed if it ran
+   LOC_ENG_MODE_MIN_FAILURE_TIME, a shorter one says nothing about the mode.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_mode_session_stop (void)
+{
+    loc_eng_mode_data_s_type *mode_ptr = &loc_eng_mode_data;
+
+    pthread_mutex_lock (&mode_ptr->lock);
+    if (mode_ptr->session_active == TRUE)
+    {
+        if (android::elapsedRealtime () - mode_ptr->session_start >= LOC_ENG_MODE_MIN_FAILURE_TIME)
+        {
+            loc_eng_mode_outcome (mode_ptr, FALSE, "no_fix");
+        }
+        else
+        {
+            loc_eng_mode_log (mode_ptr, "outcome session=%u context=%d mode=%s result=dropped",
+                              mode_ptr->sessions, mode_ptr->session_context,
+                              loc_eng_mode_names[mode_ptr->session_candidate]);
+            mode_ptr->session_active = FALSE;
+        }
+    }
+    pthread_mutex_unlock (&mode_ptr->lock);
+}
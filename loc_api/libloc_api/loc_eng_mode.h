@@ -0,0 +1,115 @@
+/******************************************************************************
+  @file:  loc_eng_mode.h
+  @brief:
+
+  DESCRIPTION
+    This file defines the positioning mode selector. It keeps the time to
+    first fix and the failure rate of every operation mode under the
+    conditions of the session, ATL availability, XTRA freshness and the age
+    of the last fix, and picks the mode of each session from them.
+
+  INITIALIZATION AND SEQUENCING REQUIREMENTS
+    The framework's mode is used as is unless the gps.mode.adaptive
+    property is 1. A standalone mode from the framework is always kept.
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+         Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer. 
+
+         Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution. 
+
+         Neither the name of the QUALCOMM USA, INC.  nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  -----------------------------------------------------------------------------
+
+******************************************************************************/
+
+/*=====================================================================
+$Header: $
+$DateTime: $
+$Author: $
+======================================================================*/
+
+#ifndef LOC_ENG_MODE_H
+#define LOC_ENG_MODE_H
+
+// Modes the selector picks from when the network may be used
+#define LOC_ENG_MODE_MAX_CANDIDATES      5
+// Every candidate is tried this often under each condition before the
+// fastest one is picked
+#define LOC_ENG_MODE_MIN_TRIES           2
+// One session in this many tries the candidate left alone longest, so a
+// mode that got faster is found again
+#define LOC_ENG_MODE_EXPLORE_INTERVAL    16
+// Cost of a failed session when comparing modes
+#define LOC_ENG_MODE_FAILURE_COST        60000    // msec
+// A session stopped without fix counts as failed if it ran this long,
+// shorter ones are dropped
+#define LOC_ENG_MODE_MIN_FAILURE_TIME    30000    // msec
+// A fix younger than this makes for a hot start
+#define LOC_ENG_MODE_RECENT_FIX_AGE      7200     // seconds
+#define LOC_ENG_MODE_MAX_PATH            128
+
+// Conditions of a session, see loc_eng_mode_context
+#define LOC_ENG_MODE_ATL_NONE            0        // no data connection to be had
+#define LOC_ENG_MODE_ATL_COLD            1        // the data connection has to come up
+#define LOC_ENG_MODE_ATL_WARM            2        // the data connection is up
+#define LOC_ENG_MODE_CONTEXT(atl, xtra_fresh, fix_recent) \
+                                         ((atl) * 4 + ((xtra_fresh) ? 2 : 0) + ((fix_recent) ? 1 : 0))
+#define LOC_ENG_MODE_MAX_CONTEXTS        12
+
+// Outcomes of one mode under one condition. The averages are moving ones,
+// each session weighs 1/4, so the choice follows changes in the network.
+typedef struct
+{
+    uint32                         tries;
+    uint32                         fixes;
+    uint32                         failures;
+    uint32                         ttff_avg_msec;
+    // Of the last sessions, how many failed, in 1/1000
+    uint32                         failure_avg;
+    // Session number it was last tried at
+    uint32                         last_session;
+} loc_eng_mode_stats_s_type;
+
+// Module data, the outcomes are kept for the life of the process
+typedef struct
+{
+    pthread_mutex_t                lock;
+    boolean                        adaptive;
+    // Decisions and outcomes are appended to it as well, "" for none
+    char                           log_path[LOC_ENG_MODE_MAX_PATH];
+
+    loc_eng_mode_stats_s_type      stats[LOC_ENG_MODE_MAX_CONTEXTS][LOC_ENG_MODE_MAX_CANDIDATES];
+    uint32                         sessions;
+
+    // The session running, its mode and conditions
+    boolean                        session_active;
+    int64_t                        session_start;
+    int                            session_context;
+    int                            session_candidate;
+
+    uint32                         explored;
+    uint32                         exploited;
+} loc_eng_mode_data_s_type;
+
+extern loc_eng_mode_data_s_type loc_eng_mode_data;
+
+// Reads the configuration, called by loc_eng_init
+extern void loc_eng_mode_init (void);
+
+// Picks the operation mode of the session starting, position_mode is the
+// framework's GPS_POSITION_MODE_xxx
+extern rpc_loc_operation_mode_e_type loc_eng_mode_session_start (int position_mode);
+// Outcomes of the session, the first one counts
+extern void loc_eng_mode_session_fix (void);
+extern void loc_eng_mode_session_failed (void);
+extern void loc_eng_mode_session_stop (void);
+
+#endif // LOC_ENG_MODE_H
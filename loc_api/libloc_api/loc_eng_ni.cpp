@@ -38,6 +38,8 @@ $Id:
 #include <time.h>
 
 #include <hardware_legacy/gps.h>
+#include <cutils/properties.h>
+#include <cutils/memory.h>
 
 #include <rpc/rpc.h>
 #include <loc_api_rpc_glue.h>
@@ -124,6 +126,7 @@ static void loc_ni_respond(rpc_loc_ni_user_resp_e_type resp,
 
     rpc_loc_ioctl_data_u_type data;
     rpc_loc_ioctl_callback_s_type callback_payload;
+    boolean accepted;
 
     memcpy(&data.rpc_loc_ioctl_data_u_type_u.user_verify_resp.ni_event_pass_back,
             request_pass_back, sizeof (rpc_loc_ni_event_s_type));
@@ -136,6 +139,16 @@ static void loc_ni_respond(rpc_loc_ni_user_resp_e_type resp,
             LOC_IOCTL_DEFAULT_TIMEOUT,
             &callback_payload
     );
+
+    /* A pre-opened data connection is kept for the session, or released */
+    if (request_pass_back->event == RPC_LOC_NI_EVENT_SUPL_NOTIFY_VERIFY_REQ)
+    {
+        accepted = (resp == RPC_LOC_NI_LCS_NOTIFY_VERIFY_ACCEPT ||
+                    (resp == RPC_LOC_NI_LCS_NOTIFY_VERIFY_NORESP &&
+                     request_pass_back->payload.rpc_loc_ni_event_payload_u_type_u.supl_req.notification_priv_type ==
+                     RPC_LOC_NI_USER_NOTIFY_VERIFY_ALLOW_NO_RESP)) ? TRUE : FALSE;
+        loc_eng_atl_preopen_done(accepted);
+    }
 }
 
 /*===========================================================================
@@ -276,8 +289,13 @@ static void loc_ni_request_handler(const char *msg, const rpc_loc_ni_event_s_typ
 
         pthread_mutex_lock(&loc_eng_ni_data.loc_ni_lock);
 
-        /* Save request */
-        memcpy(&loc_eng_ni_data.loc_ni_request, ni_req, sizeof loc_eng_ni_data.loc_ni_request);
+        /* Save request, with its strings, for the response */
+        if (!loc_eng_copy_ni_event(&loc_eng_ni_data.loc_ni_request, ni_req,
+                                   loc_eng_ni_data.loc_ni_request_arena,
+                                   sizeof loc_eng_ni_data.loc_ni_request_arena))
+        {
+            LOGE("loc_ni_request_handler: NI request strings truncated");
+        }
 
         /* Set up NI response waiting */
         loc_eng_ni_data.notif_in_progress = TRUE;
@@ -383,6 +401,15 @@ static void loc_ni_request_handler(const char *msg, const rpc_loc_ni_event_s_typ
                 // Set default_response & notify_flags
                 loc_ni_fill_notif_verify_type(&notif, ni_req->payload.rpc_loc_ni_event_payload_u_type_u.supl_req.notification_priv_type);
 
+                // Bring the data connection up while the user decides, it is released if the
+                // user denies or, unless no response means yes, does not answer in time
+                if (loc_eng_ni_data.preopen &&
+                    (supl_req->notification_priv_type == RPC_LOC_NI_USER_NOTIFY_VERIFY_ALLOW_NO_RESP ||
+                     supl_req->notification_priv_type == RPC_LOC_NI_USER_NOTIFY_VERIFY_NOT_ALLOW_NO_RESP))
+                {
+                    loc_eng_atl_preopen();
+                }
+
                 break;
 
             default:
@@ -583,6 +610,10 @@ void loc_eng_ni_init(GpsNiCallbacks *callbacks)
     loc_eng_ni_data.current_notif_id = -1;
     loc_eng_ni_data.response_time_left = 0;
 
+    char propBuf[PROPERTY_VALUE_MAX];
+    property_get("gps.ni.preopen", propBuf, "0");
+    loc_eng_ni_data.preopen = atoi(propBuf) != 0 ? TRUE : FALSE;
+
     srand(time(NULL));
     loc_eng_data.ni_notify_cb = callbacks->notify_cb;
 }
@@ -33,6 +33,12 @@ $Id:
 
 #define LOC_NI_NO_RESPONSE_TIME            20                      /* secs */
 
+/* Storage for the strings of a saved NI request, large enough for a SUPL request */
+#define LOC_ENG_NI_ARENA_SIZE              (RPC_LOC_API_MAX_SERVER_ADDR_LENGTH + \
+                                            RPC_LOC_NI_MAX_REQUESTOR_ID_LENGTH + \
+                                            RPC_LOC_NI_MAX_CLIENT_NAME_LENGTH + \
+                                            3 * LOC_ENG_ARENA_ALIGN)
+
 extern const GpsNiInterface sLocEngNiInterface;
 
 typedef struct {
@@ -41,9 +47,13 @@ typedef struct {
     int                     response_time_left;       /* examine time for NI response */
     boolean                 notif_in_progress;        /* NI notification/verification in progress */
     rpc_loc_ni_event_s_type loc_ni_request;
+    char                    loc_ni_request_arena[LOC_ENG_NI_ARENA_SIZE]; /* strings of loc_ni_request */
     int                     current_notif_id;         /* ID to check against response */
+    boolean                 preopen;                  /* bring the SUPL data connection up while the user decides */
 } loc_eng_ni_data_s_type;
 
+extern loc_eng_ni_data_s_type loc_eng_ni_data;
+
 // Functions for sLocEngNiInterface
 extern void loc_eng_ni_init(GpsNiCallbacks *callbacks);
 extern void loc_eng_ni_respond(int notif_id, GpsUserResponseType user_response);
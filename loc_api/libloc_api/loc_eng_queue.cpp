@@ -0,0 +1,848 @@
+/******************************************************************************
+  @file:  loc_eng_queue.cpp
+  @brief:
+
+  DESCRIPTION
+    This file implements the single producer, single consumer event queue
+    used between loc_event_cb and the deferred action thread, and the deep
+    copy of event payloads out of the RPC decoded memory, which is freed as
+    soon as loc_event_cb returns.
+
+  INITIALIZATION AND SEQUENCING REQUIREMENTS
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+         Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer. 
+
+         Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution. 
+
+         Neither the name of the QUALCOMM USA, INC.  nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  -----------------------------------------------------------------------------
+
+******************************************************************************/
+
+/*=====================================================================
+$Header: $
+$DateTime: $
+$Author: $
+======================================================================*/
+//#define LOG_NDEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <rpc/rpc.h>
+#include <loc_api_rpc_glue.h>
+
+#include <hardware_legacy/gps.h>
+
+#include <loc_eng.h>
+
+#define LOG_TAG "lib_locapi"
+#include <utils/Log.h>
+
+// comment this out to enable logging
+#undef LOGD
+#define LOGD(...) {}
+
+#define LOC_ENG_QUEUE_MASK (LOC_ENG_QUEUE_SIZE - 1)
+
+// Full barrier, orders the slot contents against the ring indexes
+#define LOC_ENG_QUEUE_BARRIER() __sync_synchronize()
+
+// Bump allocator over a caller owned buffer
+typedef struct
+{
+    char                         *buf;
+    uint32                        size;
+    uint32                        used;
+    // Some data did not fit and was dropped
+    boolean                       truncated;
+} loc_eng_arena_s_type;
+
+// Replaces strings that did not fit, XDR cannot encode a NULL string
+static char loc_eng_empty_string[] = "";
+
+/*===========================================================================
+
+FUNCTION    loc_eng_queue_init
+
+DESCRIPTION
+   Initializes an empty queue. Satellite and NMEA reports are shed once
+   shed_depth events are queued, 0 selects LOC_ENG_QUEUE_SHED_DEPTH.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   None
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_queue_init (loc_eng_queue_data_s_type *queue_ptr, uint32 shed_depth)
+{
+    if (shed_depth == 0 || shed_depth > LOC_ENG_QUEUE_SIZE)
+    {
+        shed_depth = LOC_ENG_QUEUE_SHED_DEPTH;
+    }
+
+    queue_ptr->head = 0;
+    queue_ptr->tail = 0;
+    queue_ptr->consumer_waiting = FALSE;
+    queue_ptr->wakeup_pending = FALSE;
+    queue_ptr->high_water_mark = 0;
+    queue_ptr->overflow_count = 0;
+    queue_ptr->truncated_count = 0;
+    queue_ptr->shed_depth = shed_depth;
+    queue_ptr->nmea_shed_count = 0;
+    queue_ptr->sv_shed_count = 0;
+    queue_ptr->nmea_coalesced_count = 0;
+    queue_ptr->sv_coalesced_count = 0;
+
+    pthread_mutex_init (&queue_ptr->mutex, NULL);
+    pthread_cond_init (&queue_ptr->not_empty_cond, NULL);
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_queue_deinit
+
+DESCRIPTION
+   Releases the queue resources, the producer and the consumer must have
+   stopped. Events still queued are discarded.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   None
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_queue_deinit (loc_eng_queue_data_s_type *queue_ptr)
+{
+    LOGD ("loc_eng_queue_deinit: high water mark = %u, overflows = %u, truncated = %u, discarded = %u\n",
+          queue_ptr->high_water_mark, queue_ptr->overflow_count,
+          queue_ptr->truncated_count, queue_ptr->tail - queue_ptr->head);
+    LOGD ("loc_eng_queue_deinit: shed nmea = %u, sv = %u, coalesced nmea = %u, sv = %u\n",
+          queue_ptr->nmea_shed_count, queue_ptr->sv_shed_count,
+          queue_ptr->nmea_coalesced_count, queue_ptr->sv_coalesced_count);
+
+    queue_ptr->head = queue_ptr->tail;
+
+    pthread_mutex_destroy (&queue_ptr->mutex);
+    pthread_cond_destroy (&queue_ptr->not_empty_cond);
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_queue_shed
+
+DESCRIPTION
+   Load shedding policy, applied by the producer before queueing an event.
+   NMEA reports go first, then satellite reports. Position, status, ioctl,
+   NI and server requests are always queued while there is a free slot.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE                 if the event must be dropped
+   FALSE                otherwise
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_queue_shed (
+    loc_eng_queue_data_s_type           *queue_ptr,
+    rpc_loc_event_mask_type              loc_event,
+    uint32                               depth
+    )
+{
+    uint32 shed_depth = queue_ptr->shed_depth;
+
+    if (loc_event == RPC_LOC_EVENT_NMEA_POSITION_REPORT && depth >= shed_depth)
+    {
+        queue_ptr->nmea_shed_count++;
+        return TRUE;
+    }
+
+    if (loc_event == RPC_LOC_EVENT_SATELLITE_REPORT &&
+        depth >= shed_depth + (LOC_ENG_QUEUE_SIZE - shed_depth) / 2)
+    {
+        queue_ptr->sv_shed_count++;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_queue_nmea_key_len
+
+DESCRIPTION
+   Length of the part of an NMEA report that tells its sentence: the
+   address field, e.g. $GPGGA, and for GSV the message count and number
+   too, as every message of a GSV cycle carries other satellites.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   Number of leading characters to compare, 0 if the report has none
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static uint32 loc_eng_queue_nmea_key_len (const rpc_loc_nmea_report_s_type *nmea_ptr)
+{
+    const char *sentences = nmea_ptr->nmea_sentences.nmea_sentences_val;
+    uint32 len = nmea_ptr->nmea_sentences.nmea_sentences_len;
+    uint32 fields = 1, index;
+
+    if (sentences == NULL || len == 0)
+    {
+        return 0;
+    }
+
+    // $GPGSV,<count>,<number>,...
+    if (len >= 6 && strncmp (sentences + 3, "GSV", 3) == 0)
+    {
+        fields = 3;
+    }
+
+    for (index = 0; index < len; index++)
+    {
+        if (sentences[index] == '\r' || sentences[index] == '\n')
+        {
+            break;
+        }
+        if (sentences[index] == ',' && --fields == 0)
+        {
+            break;
+        }
+    }
+
+    return index;
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_queue_is_superseded
+
+DESCRIPTION
+   Checks if a newer report of the same type is queued behind the head
+   event. Only satellite and NMEA reports are coalesced. A satellite report
+   is a full snapshot, the newest one replaces all older ones. An NMEA
+   report is only replaced by one starting with the same sentence, see
+   loc_eng_queue_nmea_key_len, so that no sentence type is lost.
+
+DEPENDENCIES
+   The head slot must have been published
+
+RETURN VALUE
+   TRUE                 if the head event can be skipped
+   FALSE                otherwise
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_queue_is_superseded (loc_eng_queue_data_s_type *queue_ptr, uint32 tail)
+{
+    uint32 head = queue_ptr->head;
+    rpc_loc_event_mask_type loc_event = queue_ptr->slots[head & LOC_ENG_QUEUE_MASK].loc_event;
+    const rpc_loc_nmea_report_s_type *nmea_ptr = NULL;
+    uint32 key_len = 0;
+    uint32 index;
+
+    if (loc_event != RPC_LOC_EVENT_SATELLITE_REPORT &&
+        loc_event != RPC_LOC_EVENT_NMEA_POSITION_REPORT)
+    {
+        return FALSE;
+    }
+
+    if (loc_event == RPC_LOC_EVENT_NMEA_POSITION_REPORT)
+    {
+        nmea_ptr = &queue_ptr->slots[head & LOC_ENG_QUEUE_MASK].loc_event_payload.
+                        rpc_loc_event_payload_u_type_u.nmea_report;
+        key_len = loc_eng_queue_nmea_key_len (nmea_ptr);
+        if (key_len == 0)
+        {
+            return FALSE;
+        }
+    }
+
+    for (index = head + 1; index != tail; index++)
+    {
+        const work_item *newer = &queue_ptr->slots[index & LOC_ENG_QUEUE_MASK];
+
+        if (newer->loc_event != loc_event)
+        {
+            continue;
+        }
+        if (nmea_ptr != NULL)
+        {
+            const rpc_loc_nmea_report_s_type *newer_nmea_ptr =
+                &newer->loc_event_payload.rpc_loc_event_payload_u_type_u.nmea_report;
+
+            if (loc_eng_queue_nmea_key_len (newer_nmea_ptr) != key_len ||
+                memcmp (newer_nmea_ptr->nmea_sentences.nmea_sentences_val,
+                        nmea_ptr->nmea_sentences.nmea_sentences_val, key_len) != 0)
+            {
+                continue;
+            }
+        }
+
+        if (loc_event == RPC_LOC_EVENT_SATELLITE_REPORT)
+        {
+            queue_ptr->sv_coalesced_count++;
+        }
+        else
+        {
+            queue_ptr->nmea_coalesced_count++;
+        }
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_queue_put
+
+DESCRIPTION
+   Copies an event into the next free slot. Must only be called from the
+   RPC callback thread. The mutex is only taken to wake the deferred action
+   thread when it is sleeping on an empty queue.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE                 if the event was queued
+   FALSE                if the event was shed or all slots are in use
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+boolean loc_eng_queue_put (
+    loc_eng_queue_data_s_type           *queue_ptr,
+    rpc_loc_event_mask_type              loc_event,
+    const rpc_loc_event_payload_u_type  *loc_event_payload
+    )
+{
+    uint32 tail = queue_ptr->tail;
+    uint32 depth = tail - queue_ptr->head;
+    work_item *work;
+
+    if (loc_eng_queue_shed (queue_ptr, loc_event, depth))
+    {
+        LOGV ("loc_eng_queue_put: depth %u, event 0x%llx shed\n", depth, loc_event);
+        return FALSE;
+    }
+
+    if (depth >= LOC_ENG_QUEUE_SIZE)
+    {
+        queue_ptr->overflow_count++;
+        LOGE ("loc_eng_queue_put: queue full, event 0x%llx dropped\n", loc_event);
+        return FALSE;
+    }
+
+    work = &queue_ptr->slots[tail & LOC_ENG_QUEUE_MASK];
+    work->loc_event = loc_event;
+    if (!loc_eng_copy_event_payload (&work->loc_event_payload, loc_event_payload,
+                                     work->arena, sizeof (work->arena)))
+    {
+        queue_ptr->truncated_count++;
+        LOGE ("loc_eng_queue_put: event 0x%llx truncated\n", loc_event);
+    }
+
+    // Publish the slot
+    LOC_ENG_QUEUE_BARRIER();
+    queue_ptr->tail = tail + 1;
+
+    if (depth + 1 > queue_ptr->high_water_mark)
+    {
+        queue_ptr->high_water_mark = depth + 1;
+    }
+
+    // Pairs with the barrier in loc_eng_queue_wait: either the consumer sees
+    // the new tail or we see it waiting
+    LOC_ENG_QUEUE_BARRIER();
+    if (queue_ptr->consumer_waiting)
+    {
+        pthread_mutex_lock (&queue_ptr->mutex);
+        pthread_cond_signal (&queue_ptr->not_empty_cond);
+        pthread_mutex_unlock (&queue_ptr->mutex);
+    }
+
+    return TRUE;
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_queue_wait
+
+DESCRIPTION
+   Waits until the queue has an event and returns the oldest one, skipping
+   satellite and NMEA reports that have a newer one queued. The slot stays
+   owned by the caller until loc_eng_queue_release is called. Must only be
+   called from the deferred action thread.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   Pointer to the oldest event
+   NULL                 if woken up by loc_eng_queue_wakeup with no event
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+work_item* loc_eng_queue_wait (loc_eng_queue_data_s_type *queue_ptr)
+{
+    uint32 tail;
+
+    if (queue_ptr->tail == queue_ptr->head)
+    {
+        pthread_mutex_lock (&queue_ptr->mutex);
+        queue_ptr->consumer_waiting = TRUE;
+        LOC_ENG_QUEUE_BARRIER();
+        while (queue_ptr->tail == queue_ptr->head && !queue_ptr->wakeup_pending)
+        {
+            LOGD ("loc_eng_queue_wait: waiting for work\n");
+            pthread_cond_wait (&queue_ptr->not_empty_cond, &queue_ptr->mutex);
+        }
+        queue_ptr->consumer_waiting = FALSE;
+        queue_ptr->wakeup_pending = FALSE;
+        pthread_mutex_unlock (&queue_ptr->mutex);
+    }
+
+    tail = queue_ptr->tail;
+    if (tail == queue_ptr->head)
+    {
+        return NULL;
+    }
+
+    // Read the slots only after seeing the tail that published them
+    LOC_ENG_QUEUE_BARRIER();
+
+    // Latest wins, the newer report is still queued so this never empties the queue
+    while (loc_eng_queue_is_superseded (queue_ptr, tail))
+    {
+        loc_eng_queue_release (queue_ptr);
+    }
+
+    return &queue_ptr->slots[queue_ptr->head & LOC_ENG_QUEUE_MASK];
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_queue_release
+
+DESCRIPTION
+   Gives the slot returned by loc_eng_queue_wait back to the producer.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   None
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_queue_release (loc_eng_queue_data_s_type *queue_ptr)
+{
+    // Done with the slot before the producer may reuse it
+    LOC_ENG_QUEUE_BARRIER();
+    queue_ptr->head = queue_ptr->head + 1;
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_queue_wakeup
+
+DESCRIPTION
+   Makes a pending or the next loc_eng_queue_wait return even if the queue
+   is empty, e.g. to let the deferred action thread exit.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   None
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_queue_wakeup (loc_eng_queue_data_s_type *queue_ptr)
+{
+    pthread_mutex_lock (&queue_ptr->mutex);
+    queue_ptr->wakeup_pending = TRUE;
+    pthread_cond_signal (&queue_ptr->not_empty_cond);
+    pthread_mutex_unlock (&queue_ptr->mutex);
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_arena_copy
+
+DESCRIPTION
+   Copies len bytes into the arena.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   Pointer to the copy
+   NULL                 if there is nothing to copy or it does not fit
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void* loc_eng_arena_copy (loc_eng_arena_s_type *arena_ptr, const void *src, uint32 len)
+{
+    uintptr_t start, end;
+    char *copy;
+
+    if (src == NULL || len == 0)
+    {
+        return NULL;
+    }
+
+    start = (uintptr_t) (arena_ptr->buf + arena_ptr->used);
+    start = (start + LOC_ENG_ARENA_ALIGN - 1) & ~((uintptr_t) LOC_ENG_ARENA_ALIGN - 1);
+    end = (uintptr_t) (arena_ptr->buf + arena_ptr->size);
+    if (start > end || len > end - start)
+    {
+        arena_ptr->truncated = TRUE;
+        return NULL;
+    }
+
+    copy = (char*) start;
+    memcpy (copy, src, len);
+    arena_ptr->used = (copy + len) - arena_ptr->buf;
+    return copy;
+}
+
+// Counted byte array, dropped if it does not fit
+static void loc_eng_arena_copy_bytes (loc_eng_arena_s_type *arena_ptr, char **val_ptr, u_int *len_ptr)
+{
+    *val_ptr = (char*) loc_eng_arena_copy (arena_ptr, *val_ptr, *len_ptr);
+    if (*val_ptr == NULL)
+    {
+        *len_ptr = 0;
+    }
+}
+
+// NUL terminated string, replaced by "" if it does not fit
+static void loc_eng_arena_copy_string (loc_eng_arena_s_type *arena_ptr, char **str_ptr)
+{
+    char *copy = NULL;
+
+    if (*str_ptr != NULL)
+    {
+        copy = (char*) loc_eng_arena_copy (arena_ptr, *str_ptr, strlen (*str_ptr) + 1);
+    }
+    *str_ptr = (copy != NULL) ? copy : loc_eng_empty_string;
+}
+
+static void loc_eng_arena_copy_server_info (loc_eng_arena_s_type *arena_ptr,
+                                            rpc_loc_server_info_s_type *server_ptr)
+{
+    if (server_ptr->addr_info.disc == RPC_LOC_SERVER_ADDR_URL)
+    {
+        loc_eng_arena_copy_bytes (arena_ptr,
+                &server_ptr->addr_info.rpc_loc_server_addr_u_type_u.url.addr.addr_val,
+                &server_ptr->addr_info.rpc_loc_server_addr_u_type_u.url.addr.addr_len);
+    }
+}
+
+static void loc_eng_arena_copy_ni_event (loc_eng_arena_s_type *arena_ptr,
+                                         rpc_loc_ni_event_s_type *ni_ptr)
+{
+    rpc_loc_ni_supl_notify_verify_req_s_type *supl_req;
+    rpc_loc_ni_umts_cp_notify_verify_req_s_type *umts_cp_req;
+
+    switch (ni_ptr->payload.disc)
+    {
+        case RPC_LOC_NI_EVENT_SUPL_NOTIFY_VERIFY_REQ:
+            supl_req = &ni_ptr->payload.rpc_loc_ni_event_payload_u_type_u.supl_req;
+            loc_eng_arena_copy_server_info (arena_ptr, &supl_req->supl_slp_session_id.slp_address);
+            loc_eng_arena_copy_bytes (arena_ptr,
+                    &supl_req->requestor_id.requestor_id_string.requestor_id_string_val,
+                    &supl_req->requestor_id.requestor_id_string.requestor_id_string_len);
+            loc_eng_arena_copy_bytes (arena_ptr,
+                    &supl_req->client_name.client_name_string.client_name_string_val,
+                    &supl_req->client_name.client_name_string.client_name_string_len);
+            break;
+
+        case RPC_LOC_NI_EVENT_UMTS_CP_NOTIFY_VERIFY_REQ:
+            umts_cp_req = &ni_ptr->payload.rpc_loc_ni_event_payload_u_type_u.umts_cp_req;
+            loc_eng_arena_copy_bytes (arena_ptr,
+                    &umts_cp_req->notification_text.notification_text_val,
+                    &umts_cp_req->notification_text.notification_text_len);
+            loc_eng_arena_copy_bytes (arena_ptr,
+                    &umts_cp_req->ext_client_address_data.ext_client_address.ext_client_address_val,
+                    &umts_cp_req->ext_client_address_data.ext_client_address.ext_client_address_len);
+            loc_eng_arena_copy_bytes (arena_ptr,
+                    &umts_cp_req->requestor_id.requestor_id_string.requestor_id_string_val,
+                    &umts_cp_req->requestor_id.requestor_id_string.requestor_id_string_len);
+            loc_eng_arena_copy_bytes (arena_ptr,
+                    &umts_cp_req->codeword_string.lcs_codeword_string.lcs_codeword_string_val,
+                    &umts_cp_req->codeword_string.lcs_codeword_string.lcs_codeword_string_len);
+            break;
+
+        default:
+            // VX requests have no variable length data
+            break;
+    }
+}
+
+static void loc_eng_arena_copy_ioctl_callback (loc_eng_arena_s_type *arena_ptr,
+                                               rpc_loc_ioctl_callback_s_type *ioctl_ptr)
+{
+    char **servers;
+    int i;
+
+    switch (ioctl_ptr->data.disc)
+    {
+        case RPC_LOC_IOCTL_GET_CDMA_PDE_SERVER_ADDR:
+        case RPC_LOC_IOCTL_GET_CDMA_MPC_SERVER_ADDR:
+        case RPC_LOC_IOCTL_GET_UMTS_SLP_SERVER_ADDR:
+            loc_eng_arena_copy_server_info (arena_ptr,
+                    &ioctl_ptr->data.rpc_loc_ioctl_callback_data_u_type_u.server_addr);
+            break;
+
+        case RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_SOURCE:
+            servers = ioctl_ptr->data.rpc_loc_ioctl_callback_data_u_type_u.predicted_orbits_data_source.servers;
+            for (i = 0; i < RPC_LOC_API_MAX_NUM_PREDICTED_ORBITS_SERVERS; i++)
+            {
+                loc_eng_arena_copy_string (arena_ptr, &servers[i]);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_copy_event_payload
+
+DESCRIPTION
+   Copies the active arm of an event payload, selected by its disc, and
+   moves the variable length data it points to into the arena. The copy
+   does not reference the source in any way once this returns.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE                 if everything was copied
+   FALSE                if some variable length data did not fit the arena
+                        and was dropped from the copy
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+boolean loc_eng_copy_event_payload (
+    rpc_loc_event_payload_u_type        *dst_ptr,
+    const rpc_loc_event_payload_u_type  *src_ptr,
+    char                                *arena,
+    uint32                               arena_size
+    )
+{
+    loc_eng_arena_s_type arena_data = { arena, arena_size, 0, FALSE };
+    loc_eng_arena_s_type *arena_ptr = &arena_data;
+    rpc_loc_gnss_info_s_type *gnss_ptr;
+    rpc_loc_nmea_report_s_type *nmea_ptr;
+    rpc_loc_assist_data_request_s_type *assist_ptr;
+    rpc_loc_reserved_payload_s_type *reserved_ptr;
+    char **servers;
+    int i;
+
+    dst_ptr->disc = src_ptr->disc;
+
+    switch (src_ptr->disc)
+    {
+        case RPC_LOC_EVENT_PARSED_POSITION_REPORT:
+            dst_ptr->rpc_loc_event_payload_u_type_u.parsed_location_report =
+                src_ptr->rpc_loc_event_payload_u_type_u.parsed_location_report;
+            break;
+
+        case RPC_LOC_EVENT_SATELLITE_REPORT:
+            gnss_ptr = &dst_ptr->rpc_loc_event_payload_u_type_u.gnss_report;
+            *gnss_ptr = src_ptr->rpc_loc_event_payload_u_type_u.gnss_report;
+            gnss_ptr->sv_list.sv_list_val = (rpc_loc_sv_info_s_type*)
+                loc_eng_arena_copy (arena_ptr, gnss_ptr->sv_list.sv_list_val,
+                                    gnss_ptr->sv_list.sv_list_len * sizeof (rpc_loc_sv_info_s_type));
+            if (gnss_ptr->sv_list.sv_list_val == NULL)
+            {
+                gnss_ptr->sv_list.sv_list_len = 0;
+            }
+            break;
+
+        case RPC_LOC_EVENT_NMEA_POSITION_REPORT:
+            nmea_ptr = &dst_ptr->rpc_loc_event_payload_u_type_u.nmea_report;
+            *nmea_ptr = src_ptr->rpc_loc_event_payload_u_type_u.nmea_report;
+            loc_eng_arena_copy_bytes (arena_ptr,
+                    &nmea_ptr->nmea_sentences.nmea_sentences_val,
+                    &nmea_ptr->nmea_sentences.nmea_sentences_len);
+            break;
+
+        case RPC_LOC_EVENT_NI_NOTIFY_VERIFY_REQUEST:
+            dst_ptr->rpc_loc_event_payload_u_type_u.ni_request =
+                src_ptr->rpc_loc_event_payload_u_type_u.ni_request;
+            loc_eng_arena_copy_ni_event (arena_ptr, &dst_ptr->rpc_loc_event_payload_u_type_u.ni_request);
+            break;
+
+        case RPC_LOC_EVENT_ASSISTANCE_DATA_REQUEST:
+            assist_ptr = &dst_ptr->rpc_loc_event_payload_u_type_u.assist_data_request;
+            *assist_ptr = src_ptr->rpc_loc_event_payload_u_type_u.assist_data_request;
+            servers = NULL;
+            if (assist_ptr->payload.disc == RPC_LOC_ASSIST_DATA_TIME_REQ)
+            {
+                servers = assist_ptr->payload.rpc_loc_assist_data_request_payload_u_type_u.time_download.servers;
+            }
+            else if (assist_ptr->payload.disc == RPC_LOC_ASSIST_DATA_PREDICTED_ORBITS_REQ)
+            {
+                servers = assist_ptr->payload.rpc_loc_assist_data_request_payload_u_type_u.data_download.servers;
+            }
+            for (i = 0; servers != NULL && i < RPC_LOC_API_MAX_NUM_PREDICTED_ORBITS_SERVERS; i++)
+            {
+                loc_eng_arena_copy_string (arena_ptr, &servers[i]);
+            }
+            break;
+
+        case RPC_LOC_EVENT_LOCATION_SERVER_REQUEST:
+            dst_ptr->rpc_loc_event_payload_u_type_u.loc_server_request =
+                src_ptr->rpc_loc_event_payload_u_type_u.loc_server_request;
+            break;
+
+        case RPC_LOC_EVENT_IOCTL_REPORT:
+            dst_ptr->rpc_loc_event_payload_u_type_u.ioctl_report =
+                src_ptr->rpc_loc_event_payload_u_type_u.ioctl_report;
+            loc_eng_arena_copy_ioctl_callback (arena_ptr, &dst_ptr->rpc_loc_event_payload_u_type_u.ioctl_report);
+            break;
+
+        case RPC_LOC_EVENT_STATUS_REPORT:
+            dst_ptr->rpc_loc_event_payload_u_type_u.status_report =
+                src_ptr->rpc_loc_event_payload_u_type_u.status_report;
+            break;
+
+        case RPC_LOC_EVENT_RESERVED:
+            reserved_ptr = &dst_ptr->rpc_loc_event_payload_u_type_u.reserved;
+            *reserved_ptr = src_ptr->rpc_loc_event_payload_u_type_u.reserved;
+            loc_eng_arena_copy_bytes (arena_ptr, &reserved_ptr->data.data_val, &reserved_ptr->data.data_len);
+            break;
+
+        default:
+            // No payload was decoded for other events
+            break;
+    }
+
+    return !arena_ptr->truncated;
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_copy_ni_event
+
+DESCRIPTION
+   Same as loc_eng_copy_event_payload, for an NI request that has to be
+   kept until the user responds.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE                 if everything was copied
+   FALSE                if some strings did not fit the arena and were
+                        dropped from the copy
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+boolean loc_eng_copy_ni_event (
+    rpc_loc_ni_event_s_type             *dst_ptr,
+    const rpc_loc_ni_event_s_type       *src_ptr,
+    char                                *arena,
+    uint32                               arena_size
+    )
+{
+    loc_eng_arena_s_type arena_data = { arena, arena_size, 0, FALSE };
+
+    if (dst_ptr != src_ptr)
+    {
+        *dst_ptr = *src_ptr;
+    }
+    loc_eng_arena_copy_ni_event (&arena_data, dst_ptr);
+
+    return !arena_data.truncated;
+}
+
+/*===========================================================================
+
+FUNCTION    loc_eng_copy_ioctl_callback
+
+DESCRIPTION
+   Same as loc_eng_copy_event_payload, for an ioctl report handed to the
+   thread waiting in loc_eng_ioctl.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE                 if everything was copied
+   FALSE                if some server names did not fit the arena and
+                        were dropped from the copy
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+boolean loc_eng_copy_ioctl_callback (
+    rpc_loc_ioctl_callback_s_type       *dst_ptr,
+    const rpc_loc_ioctl_callback_s_type *src_ptr,
+    char                                *arena,
+    uint32                               arena_size
+    )
+{
+    loc_eng_arena_s_type arena_data = { arena, arena_size, 0, FALSE };
+
+    if (dst_ptr != src_ptr)
+    {
+        *dst_ptr = *src_ptr;
+    }
+    loc_eng_arena_copy_ioctl_callback (&arena_data, dst_ptr);
+
+    return !arena_data.truncated;
+}
@@ -0,0 +1,140 @@
+/******************************************************************************
+  @file:  loc_eng_queue.h
+  @brief:
+
+  DESCRIPTION
+    This file defines the event queue between the RPC callback thread
+    (loc_event_cb) and the deferred action thread. The queue is a fixed ring
+    of event slots with a single producer and a single consumer, so events
+    are queued without allocation and without taking a lock while the
+    deferred action thread is busy.
+
+  INITIALIZATION AND SEQUENCING REQUIREMENTS
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+         Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer. 
+
+         Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution. 
+
+         Neither the name of the QUALCOMM USA, INC.  nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  -----------------------------------------------------------------------------
+
+******************************************************************************/
+
+/*=====================================================================
+$Header: $
+$DateTime: $
+$Author: $
+======================================================================*/
+
+#ifndef LOC_ENG_QUEUE_H
+#define LOC_ENG_QUEUE_H
+
+// Number of event slots, must be a power of 2
+#define LOC_ENG_QUEUE_SIZE 64
+
+// Default queue depth from which satellite and NMEA reports are shed,
+// overridden by the gps.queue.shed_depth property
+#define LOC_ENG_QUEUE_SHED_DEPTH (LOC_ENG_QUEUE_SIZE / 2)
+
+// Alignment of the variable length data copied into an arena
+#define LOC_ENG_ARENA_ALIGN 8
+
+// Per slot storage for the variable length parts of an event payload. The
+// largest bounded one is a full satellite list, NMEA, NI strings and server
+// names all fit in it.
+#define LOC_ENG_QUEUE_ARENA_SIZE \
+    (RPC_LOC_API_MAX_SV_COUNT * sizeof (rpc_loc_sv_info_s_type) + LOC_ENG_ARENA_ALIGN)
+
+typedef struct work_item work_item;
+struct work_item {
+    rpc_loc_event_mask_type         loc_event;
+    // Pointers in the payload point into arena, never into RPC memory
+    rpc_loc_event_payload_u_type    loc_event_payload;
+    char                            arena[LOC_ENG_QUEUE_ARENA_SIZE];
+};
+
+// Module data
+typedef struct loc_eng_queue_data_s_type
+{
+    // Preallocated event slots
+    work_item                     slots[LOC_ENG_QUEUE_SIZE];
+    // Free running read index, only written by the deferred action thread
+    volatile uint32               head;
+    // Free running write index, only written by the RPC callback thread
+    volatile uint32               tail;
+    // The deferred action thread is about to sleep on not_empty_cond
+    volatile boolean              consumer_waiting;
+    // Set by loc_eng_queue_wakeup, makes loc_eng_queue_wait return
+    boolean                       wakeup_pending;
+    // Largest number of events queued at once
+    volatile uint32               high_water_mark;
+    // Events dropped because all slots were in use
+    volatile uint32               overflow_count;
+    // Events queued with variable length data that did not fit the arena
+    volatile uint32               truncated_count;
+    // NMEA reports are shed from this depth on, satellite reports half way
+    // between it and a full queue. Other events are never shed.
+    uint32                        shed_depth;
+    // Reports not queued because of the depth
+    volatile uint32               nmea_shed_count;
+    volatile uint32               sv_shed_count;
+    // Queued reports skipped because a newer one of the same type was queued,
+    // for NMEA one starting with the same sentence
+    volatile uint32               nmea_coalesced_count;
+    volatile uint32               sv_coalesced_count;
+    // Only used to put the deferred action thread to sleep
+    pthread_mutex_t               mutex;
+    pthread_cond_t                not_empty_cond;
+} loc_eng_queue_data_s_type;
+
+extern void loc_eng_queue_init (loc_eng_queue_data_s_type *queue_ptr, uint32 shed_depth);
+
+extern void loc_eng_queue_deinit (loc_eng_queue_data_s_type *queue_ptr);
+
+extern boolean loc_eng_queue_put
+(
+    loc_eng_queue_data_s_type           *queue_ptr,
+    rpc_loc_event_mask_type              loc_event,
+    const rpc_loc_event_payload_u_type  *loc_event_payload
+);
+
+extern work_item* loc_eng_queue_wait (loc_eng_queue_data_s_type *queue_ptr);
+
+extern void loc_eng_queue_release (loc_eng_queue_data_s_type *queue_ptr);
+
+extern void loc_eng_queue_wakeup (loc_eng_queue_data_s_type *queue_ptr);
+
+extern boolean loc_eng_copy_event_payload
+(
+    rpc_loc_event_payload_u_type        *dst_ptr,
+    const rpc_loc_event_payload_u_type  *src_ptr,
+    char                                *arena,
+    uint32                               arena_size
+);
+
+extern boolean loc_eng_copy_ni_event
+(
+    rpc_loc_ni_event_s_type             *dst_ptr,
+    const rpc_loc_ni_event_s_type       *src_ptr,
+    char                                *arena,
+    uint32                               arena_size
+);
+
+extern boolean loc_eng_copy_ioctl_callback
+(
+    rpc_loc_ioctl_callback_s_type       *dst_ptr,
+    const rpc_loc_ioctl_callback_s_type *src_ptr,
+    char                                *arena,
+    uint32                               arena_size
+);
+
+#endif // LOC_ENG_QUEUE_H
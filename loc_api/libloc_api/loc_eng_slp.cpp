@@ -0,0 +1,704 @@
+/******************************************************************************
+  @file:  loc_eng_slp.cpp
+  @brief:
+
+  DESCRIPTION
+    This file implements the SUPL server selection. Probes run on a
+    detached worker thread, one non-blocking connect per server side by
+    side. Sessions only read the scores.
+
+  INITIALIZATION AND SEQUENCING REQUIREMENTS
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+         Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer. 
+
+         Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution. 
+
+         Neither the name of the QUALCOMM USA, INC.  nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  -----------------------------------------------------------------------------
+
+******************************************************************************/
+
+/*=====================================================================
+$Header: $
+$DateTime: $
+$Author: $
+======================================================================*/
+#define LOG_NDEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <rpc/rpc.h>
+#include <loc_api_rpc_glue.h>
+
+#include <hardware_legacy/gps.h>
+#include <cutils/properties.h>
+#include <cutils/memory.h>
+
+#include <loc_eng.h>
+
+#define LOG_TAG "lib_locapi"
+#include <utils/Log.h>
+
+// comment this out to enable logging
+// #undef LOGD
+// #define LOGD(...) {}
+
+loc_eng_slp_data_s_type loc_eng_slp_data = { PTHREAD_MUTEX_INITIALIZER };
+
+/*===========================================================================
+FUNCTION    loc_eng_slp_msec_since
+
+DESCRIPTION
+   Milliseconds from a CLOCK_MONOTONIC time until now.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   Elapsed msec
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static uint32 loc_eng_slp_msec_since (const struct timespec *start_ptr)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start_ptr->tv_sec) * 1000 + (now.tv_nsec - start_ptr->tv_nsec) / 1000000;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_slp_probe
+
+DESCRIPTION
+   Resolves the servers and times a TCP connect to each of them, all
+   connects run at the same time. The framework's server takes the address
+   cached by loc_eng_dns. Blocking, for at most LOC_ENG_SLP_PROBE_TIMEOUT
+   after the lookups.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A, addrs, reachable and connect_msec of the servers are filled in
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_slp_probe (loc_eng_slp_server_s_type servers[], int count)
+{
+    struct pollfd fds[LOC_ENG_SLP_MAX_SERVERS];
+    int index[LOC_ENG_SLP_MAX_SERVERS];
+    struct sockaddr_in sa;
+    struct timespec start_time;
+    int fd_count = 0, pending, i, error;
+    uint32 elapsed;
+    socklen_t len;
+
+    for (i = 0; i < count; i++)
+    {
+        servers[i].reachable = FALSE;
+        // Looked up here only while the cache has nothing yet
+        if (servers[i].from_dns == TRUE && loc_eng_dns_get_addresses (&servers[i].addr, 1) == 1)
+        {
+            continue;
+        }
+        if (loc_eng_dns_lookup (servers[i].host, &servers[i].addr, 1) == 0)
+        {
+            servers[i].addr = 0;
+        }
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &start_time);
+    for (i = 0; i < count; i++)
+    {
+        if (servers[i].addr == 0)
+        {
+            continue;
+        }
+
+        memset (&sa, 0, sizeof (sa));
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = servers[i].addr;
+        sa.sin_port = htons (servers[i].port);
+
+        fds[fd_count].fd = socket (AF_INET, SOCK_STREAM, 0);
+        if (fds[fd_count].fd < 0)
+        {
+            continue;
+        }
+        fcntl (fds[fd_count].fd, F_SETFL, fcntl (fds[fd_count].fd, F_GETFL, 0) | O_NONBLOCK);
+        if (connect (fds[fd_count].fd, (struct sockaddr *) &sa, sizeof (sa)) == 0)
+        {
+            servers[i].reachable = TRUE;
+            servers[i].connect_msec = 0;
+            close (fds[fd_count].fd);
+            continue;
+        }
+        if (errno != EINPROGRESS)
+        {
+            close (fds[fd_count].fd);
+            continue;
+        }
+        fds[fd_count].events = POLLOUT;
+        fds[fd_count].revents = 0;
+        index[fd_count++] = i;
+    }
+
+    for (pending = fd_count; pending > 0; )
+    {
+        elapsed = loc_eng_slp_msec_since (&start_time);
+        if (elapsed >= LOC_ENG_SLP_PROBE_TIMEOUT ||
+            poll (fds, fd_count, LOC_ENG_SLP_PROBE_TIMEOUT - elapsed) <= 0)
+        {
+            break;
+        }
+
+        elapsed = loc_eng_slp_msec_since (&start_time);
+        for (i = 0; i < fd_count; i++)
+        {
+            if (fds[i].fd < 0 || fds[i].revents == 0)
+            {
+                continue;
+            }
+            error = 0;
+            len = sizeof (error);
+            getsockopt (fds[i].fd, SOL_SOCKET, SO_ERROR, &error, &len);
+            servers[index[i]].reachable = (error == 0) ? TRUE : FALSE;
+            servers[index[i]].connect_msec = elapsed;
+            close (fds[i].fd);
+            // poll skips negative descriptors
+            fds[i].fd = -1;
+            pending--;
+        }
+    }
+
+    for (i = 0; i < fd_count; i++)
+    {
+        if (fds[i].fd >= 0)
+        {
+            close (fds[i].fd);
+        }
+    }
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_slp_thread
+
+DESCRIPTION
+   Probes the servers and publishes the result. If the list changed during
+   the probes, the new one is probed before the thread ends, as is the next
+   address of the framework's server if its first one was unreachable.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   NULL
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void* loc_eng_slp_thread (void* arg)
+{
+    loc_eng_slp_data_s_type *slp_ptr = &loc_eng_slp_data;
+    loc_eng_slp_server_s_type servers[LOC_ENG_SLP_MAX_SERVERS];
+    uint32 generation;
+    int count, i;
+    boolean next_addr;
+
+    pthread_mutex_lock (&slp_ptr->lock);
+    do
+    {
+        count = slp_ptr->server_count;
+        memcpy (servers, slp_ptr->servers, sizeof (servers));
+        generation = slp_ptr->generation;
+        pthread_mutex_unlock (&slp_ptr->lock);
+
+        loc_eng_slp_probe (servers, count);
+        next_addr = (count > 0 && servers[0].from_dns == TRUE && servers[0].reachable == FALSE &&
+                     servers[0].addr != 0 && loc_eng_dns_address_failed (servers[0].addr) == TRUE) ? TRUE : FALSE;
+
+        pthread_mutex_lock (&slp_ptr->lock);
+    } while (generation != slp_ptr->generation || next_addr == TRUE);
+
+    // Only the probe results, the session scores moved on meanwhile
+    for (i = 0; i < count; i++)
+    {
+        slp_ptr->servers[i].addr = servers[i].addr;
+        slp_ptr->servers[i].reachable = servers[i].reachable;
+        slp_ptr->servers[i].connect_msec = servers[i].connect_msec;
+        LOGD("loc_eng_slp_thread: %s:%d %s, connect %u ms", servers[i].host, servers[i].port,
+             servers[i].reachable ? "reachable" : "unreachable", servers[i].connect_msec);
+    }
+    slp_ptr->probe_rounds++;
+    clock_gettime (CLOCK_MONOTONIC, &slp_ptr->probe_time);
+    slp_ptr->probing = FALSE;
+    pthread_mutex_unlock (&slp_ptr->lock);
+
+    return NULL;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_slp_start_probe
+
+DESCRIPTION
+   Starts a probe thread unless one is running. Called with the lock held.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_slp_start_probe (loc_eng_slp_data_s_type *slp_ptr)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if (slp_ptr->probing == TRUE)
+    {
+        return;
+    }
+
+    // Nobody waits for the thread, cleanup must not block on the probes
+    pthread_attr_init (&attr);
+    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create (&thread, &attr, loc_eng_slp_thread, NULL) == 0)
+    {
+        slp_ptr->probing = TRUE;
+    }
+    else
+    {
+        LOGE("loc_eng_slp_start_probe: cannot start the probe thread");
+    }
+    pthread_attr_destroy (&attr);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_slp_add_server
+
+DESCRIPTION
+   Appends a server to the list unless it is there already or the list is
+   full. Called with the lock held.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_slp_add_server (loc_eng_slp_data_s_type *slp_ptr, const char* host, int port)
+{
+    loc_eng_slp_server_s_type *server_ptr;
+    int i;
+
+    if (host[0] == 0 || port <= 0 || port > 0xffff)
+    {
+        LOGE("loc_eng_slp_add_server: ignoring %s:%d", host, port);
+        return;
+    }
+    for (i = 0; i < slp_ptr->server_count; i++)
+    {
+        if (strcmp (slp_ptr->servers[i].host, host) == 0 && slp_ptr->servers[i].port == port)
+        {
+            return;
+        }
+    }
+    if (slp_ptr->server_count == LOC_ENG_SLP_MAX_SERVERS)
+    {
+        LOGE("loc_eng_slp_add_server: no room for %s:%d", host, port);
+        return;
+    }
+
+    server_ptr = &slp_ptr->servers[slp_ptr->server_count++];
+    memset (server_ptr, 0, sizeof (loc_eng_slp_server_s_type));
+    strlcpy (server_ptr->host, host, sizeof (server_ptr->host));
+    server_ptr->port = port;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_slp_set_servers
+
+DESCRIPTION
+   Sets the servers to choose from, the framework's server first, then the
+   entries of list in their order. A changed list drops all scores and is
+   probed at once.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_slp_set_servers (const char* host, int port, const char* list)
+{
+    loc_eng_slp_data_s_type *slp_ptr = &loc_eng_slp_data;
+    loc_eng_slp_server_s_type old_servers[LOC_ENG_SLP_MAX_SERVERS];
+    char entry[LOC_ENG_DNS_MAX_HOST_LEN + 8];
+    const char *end_ptr;
+    char *colon_ptr;
+    size_t len;
+    int old_count, i;
+    boolean changed;
+
+    pthread_mutex_lock (&slp_ptr->lock);
+    old_count = slp_ptr->server_count;
+    memcpy (old_servers, slp_ptr->servers, sizeof (old_servers));
+
+    slp_ptr->server_count = 0;
+    loc_eng_slp_add_server (slp_ptr, host, port);
+    if (slp_ptr->server_count == 1)
+    {
+        slp_ptr->servers[0].from_dns = TRUE;
+    }
+    while (list != NULL && *list != 0)
+    {
+        end_ptr = strchr (list, ',');
+        len = (end_ptr != NULL) ? (size_t) (end_ptr - list) : strlen (list);
+        if (len < sizeof (entry))
+        {
+            memcpy (entry, list, len);
+            entry[len] = 0;
+            colon_ptr = strrchr (entry, ':');
+            if (colon_ptr != NULL)
+            {
+                *colon_ptr = 0;
+                loc_eng_slp_add_server (slp_ptr, entry, atoi (colon_ptr + 1));
+            }
+        }
+        list = (end_ptr != NULL) ? end_ptr + 1 : NULL;
+    }
+
+    changed = (slp_ptr->server_count != old_count) ? TRUE : FALSE;
+    for (i = 0; i < old_count && changed == FALSE; i++)
+    {
+        if (strcmp (slp_ptr->servers[i].host, old_servers[i].host) != 0 ||
+            slp_ptr->servers[i].port != old_servers[i].port)
+        {
+            changed = TRUE;
+        }
+    }
+
+    if (changed == TRUE)
+    {
+        slp_ptr->generation++;
+        slp_ptr->current = -1;
+        slp_ptr->session_active = FALSE;
+        memset (&slp_ptr->probe_time, 0, sizeof (slp_ptr->probe_time));
+        loc_eng_slp_start_probe (slp_ptr);
+    }
+    else
+    {
+        // Same list, keep the scores
+        memcpy (slp_ptr->servers, old_servers, sizeof (old_servers));
+    }
+    pthread_mutex_unlock (&slp_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_slp_score
+
+DESCRIPTION
+   Expected session time with a server, lower is better. A server not used
+   yet is estimated from its connect time.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   Score in msec
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static uint32 loc_eng_slp_score (const loc_eng_slp_server_s_type *server_ptr)
+{
+    if (server_ptr->session_msec != 0)
+    {
+        return server_ptr->session_msec;
+    }
+    return server_ptr->connect_msec * LOC_ENG_SLP_ROUND_TRIPS;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_slp_pick
+
+DESCRIPTION
+   Picks the reachable server with the lowest score, servers on hold only
+   if all reachable ones are. Ties go to the earlier server in the list.
+   Called with the lock held.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   Index of the server, -1 if none is reachable
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static int loc_eng_slp_pick (loc_eng_slp_data_s_type *slp_ptr)
+{
+    loc_eng_slp_server_s_type *server_ptr;
+    struct timespec now;
+    int best = -1, best_held = -1, i;
+    boolean held;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    for (i = 0; i < slp_ptr->server_count; i++)
+    {
+        server_ptr = &slp_ptr->servers[i];
+        if (server_ptr->reachable == FALSE)
+        {
+            continue;
+        }
+        held = (now.tv_sec < server_ptr->hold_time.tv_sec) ? TRUE : FALSE;
+        if (held == FALSE &&
+            (best < 0 || loc_eng_slp_score (server_ptr) < loc_eng_slp_score (&slp_ptr->servers[best])))
+        {
+            best = i;
+        }
+        else if (held == TRUE &&
+                 (best_held < 0 || server_ptr->hold_time.tv_sec < slp_ptr->servers[best_held].hold_time.tv_sec))
+        {
+            // The one released soonest
+            best_held = i;
+        }
+    }
+
+    return (best >= 0) ? best : best_held;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_slp_select
+
+DESCRIPTION
+   Picks the server to point the modem to from the last probes, and starts
+   new probes in the background once they are old. The framework's server
+   gets the address loc_eng_dns hands out now, one that changed since the
+   probes is probed again. Before any server was probed reachable, the
+   framework's server is taken unprobed.
+
+DEPENDENCIES
+   loc_eng_slp_set_servers
+
+RETURN VALUE
+   TRUE with the address and port of the server, FALSE if no address is
+   known yet
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+boolean loc_eng_slp_select (uint32* addr_ptr, int* port_ptr)
+{
+    loc_eng_slp_data_s_type *slp_ptr = &loc_eng_slp_data;
+    struct timespec now;
+    uint32 addr;
+    int best;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock (&slp_ptr->lock);
+    if (slp_ptr->server_count > 0 && slp_ptr->probe_time.tv_sec != 0 &&
+        now.tv_sec - slp_ptr->probe_time.tv_sec >= LOC_ENG_SLP_PROBE_INTERVAL)
+    {
+        loc_eng_slp_start_probe (slp_ptr);
+    }
+
+    // A new lookup or a failed address moved the framework's server
+    if (slp_ptr->server_count > 0 && slp_ptr->servers[0].from_dns == TRUE &&
+        loc_eng_dns_get_addresses (&addr, 1) == 1 && addr != slp_ptr->servers[0].addr)
+    {
+        LOGD("loc_eng_slp_select: %s moved to 0x%08x", slp_ptr->servers[0].host, ntohl (addr));
+        slp_ptr->servers[0].addr = addr;
+        loc_eng_slp_start_probe (slp_ptr);
+    }
+
+    best = loc_eng_slp_pick (slp_ptr);
+    if (best < 0 && slp_ptr->server_count > 0 && slp_ptr->servers[0].from_dns == TRUE &&
+        slp_ptr->servers[0].addr != 0)
+    {
+        best = 0;
+    }
+    if (best >= 0)
+    {
+        if (best != slp_ptr->current)
+        {
+            LOGD("loc_eng_slp_select: %s:%d, score %u ms", slp_ptr->servers[best].host,
+                 slp_ptr->servers[best].port, loc_eng_slp_score (&slp_ptr->servers[best]));
+            slp_ptr->switches++;
+        }
+        slp_ptr->current_addr = slp_ptr->servers[best].addr;
+        *addr_ptr = slp_ptr->servers[best].addr;
+        *port_ptr = slp_ptr->servers[best].port;
+    }
+    slp_ptr->current = best;
+    pthread_mutex_unlock (&slp_ptr->lock);
+
+    return (best >= 0) ? TRUE : FALSE;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_slp_session_start
+
+DESCRIPTION
+   A session starts with the server picked last, the time to its first fix
+   is measured from now.
+
+DEPENDENCIES
+   loc_eng_slp_select
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_slp_session_start (void)
+{
+    loc_eng_slp_data_s_type *slp_ptr = &loc_eng_slp_data;
+
+    pthread_mutex_lock (&slp_ptr->lock);
+    slp_ptr->session_active = (slp_ptr->current >= 0) ? TRUE : FALSE;
+    clock_gettime (CLOCK_MONOTONIC, &slp_ptr->session_start);
+    pthread_mutex_unlock (&slp_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_slp_session_fix
+
+DESCRIPTION
+   The session got its first fix, its time scores the server it used.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_slp_session_fix (void)
+{
+    loc_eng_slp_data_s_type *slp_ptr = &loc_eng_slp_data;
+    loc_eng_slp_server_s_type *server_ptr;
+    uint32 msec;
+
+    pthread_mutex_lock (&slp_ptr->lock);
+    if (slp_ptr->session_active == TRUE && slp_ptr->current >= 0)
+    {
+        server_ptr = &slp_ptr->servers[slp_ptr->current];
+        msec = loc_eng_slp_msec_since (&slp_ptr->session_start);
+        if (msec == 0)
+        {
+            msec = 1;
+        }
+        // Weighs the last session as much as all earlier ones
+        server_ptr->session_msec = (server_ptr->session_msec == 0) ? msec : (server_ptr->session_msec + msec) / 2;
+        server_ptr->failures = 0;
+        LOGD("loc_eng_slp_session_fix: %s:%d fixed in %u ms, score %u ms",
+             server_ptr->host, server_ptr->port, msec, server_ptr->session_msec);
+    }
+    slp_ptr->session_active = FALSE;
+    pthread_mutex_unlock (&slp_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_slp_session_failed
+
+DESCRIPTION
+   The session failed. If the framework's server has another cached
+   address, that one takes over. Otherwise the server is passed over for
+   LOC_ENG_SLP_HOLD_TIME and the next best one takes over.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if another server or address took over, the modem has to be
+   pointed to it
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+boolean loc_eng_slp_session_failed (void)
+{
+    loc_eng_slp_data_s_type *slp_ptr = &loc_eng_slp_data;
+    loc_eng_slp_server_s_type *server_ptr;
+    boolean failed_over = FALSE;
+    int next;
+
+    pthread_mutex_lock (&slp_ptr->lock);
+    if (slp_ptr->session_active == TRUE && slp_ptr->current >= 0)
+    {
+        server_ptr = &slp_ptr->servers[slp_ptr->current];
+        server_ptr->failures++;
+        LOGE("loc_eng_slp_session_failed: %s:%d failed %u times", server_ptr->host,
+             server_ptr->port, server_ptr->failures);
+
+        if (server_ptr->from_dns == TRUE && loc_eng_dns_address_failed (slp_ptr->current_addr) == TRUE)
+        {
+            // Same server, the next select takes the new address
+            slp_ptr->failovers++;
+            failed_over = TRUE;
+        }
+        else
+        {
+            clock_gettime (CLOCK_MONOTONIC, &server_ptr->hold_time);
+            server_ptr->hold_time.tv_sec += LOC_ENG_SLP_HOLD_TIME;
+            next = loc_eng_slp_pick (slp_ptr);
+            if (next >= 0 && next != slp_ptr->current)
+            {
+                slp_ptr->failovers++;
+                failed_over = TRUE;
+            }
+        }
+    }
+    slp_ptr->session_active = FALSE;
+    pthread_mutex_unlock (&slp_ptr->lock);
+
+    return failed_over;
+}
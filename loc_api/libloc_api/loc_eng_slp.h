@@ -0,0 +1,110 @@
+/******************************************************************************
+  @file:  loc_eng_slp.h
+  @brief:
+
+  DESCRIPTION
+    This file defines the SUPL server (SLP) selection. The framework's server
+    and the ones configured in gps.supl.servers are probed in the background
+    and scored by latency, the modem is pointed to the best one before each
+    session and to the next one when a session fails.
+
+  INITIALIZATION AND SEQUENCING REQUIREMENTS
+    The server list outlives loc_eng_init/loc_eng_cleanup, a probe still
+    running at cleanup finishes on its own.
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+         Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer. 
+
+         Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution. 
+
+         Neither the name of the QUALCOMM USA, INC.  nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  -----------------------------------------------------------------------------
+
+******************************************************************************/
+
+/*=====================================================================
+$Header: $
+$DateTime: $
+$Author: $
+======================================================================*/
+
+#ifndef LOC_ENG_SLP_H
+#define LOC_ENG_SLP_H
+
+#define LOC_ENG_SLP_MAX_SERVERS          4
+
+// A probe is a TCP connect, one that takes longer counts as unreachable
+#define LOC_ENG_SLP_PROBE_TIMEOUT        2000   // msec
+// Probes are repeated at the first session after this long
+#define LOC_ENG_SLP_PROBE_INTERVAL       600    // seconds
+// A server whose session failed is passed over for this long
+#define LOC_ENG_SLP_HOLD_TIME            300    // seconds
+// A server not used yet is scored as this many connect times, about the
+// round trips of a SUPL session
+#define LOC_ENG_SLP_ROUND_TRIPS          10
+
+typedef struct
+{
+    char                           host[LOC_ENG_DNS_MAX_HOST_LEN];
+    int                            port;
+    // IPv4 address in network byte order, 0 until the first probe resolved it
+    uint32                         addr;
+    // The framework's server, its address comes from the loc_eng_dns cache
+    boolean                        from_dns;
+    boolean                        reachable;
+    uint32                         connect_msec;
+    // Smoothed time from loc_eng_start to the first fix, 0 until measured
+    uint32                         session_msec;
+    uint32                         failures;
+    // CLOCK_MONOTONIC, until when the server is passed over
+    struct timespec                hold_time;
+} loc_eng_slp_server_s_type;
+
+typedef struct
+{
+    pthread_mutex_t                lock;
+    loc_eng_slp_server_s_type      servers[LOC_ENG_SLP_MAX_SERVERS];
+    int                            server_count;
+    // Bumped whenever the list changes, a probe of an older one is dropped
+    uint32                         generation;
+    boolean                        probing;
+    // CLOCK_MONOTONIC, when the last probe round ended, 0 before the first
+    struct timespec                probe_time;
+
+    // Server of the running session, -1 for none, and the address handed out
+    int                            current;
+    uint32                         current_addr;
+    boolean                        session_active;
+    struct timespec                session_start;
+
+    uint32                         probe_rounds;
+    uint32                         switches;
+    uint32                         failovers;
+} loc_eng_slp_data_s_type;
+
+extern loc_eng_slp_data_s_type loc_eng_slp_data;
+
+// Sets the framework's server and a list of "host:port" separated by commas,
+// and starts probing them
+extern void loc_eng_slp_set_servers (const char* host, int port, const char* list);
+
+// Picks the server to point the modem to, without blocking. Returns FALSE
+// if no address is known yet.
+extern boolean loc_eng_slp_select (uint32* addr_ptr, int* port_ptr);
+
+// A session starts with the server picked, its outcome comes from the
+// position reports
+extern void loc_eng_slp_session_start (void);
+extern void loc_eng_slp_session_fix (void);
+// TRUE if the session failed over to another server or address
+extern boolean loc_eng_slp_session_failed (void);
+
+#endif // LOC_ENG_SLP_H
@@ -34,108 +34,1588 @@ $Author: $
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <string.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <errno.h>
 #include <math.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <zlib.h>
 
 #include <rpc/rpc.h>
 #include <loc_api_rpc_glue.h>
 
-#include <hardware_legacy/gps.h>
+#include <hardware_legacy/gps.h>
+
+#include <loc_eng.h>
+
+#define LOG_TAG "lib_locapi"
+#include <utils/Log.h>
+
+// comment this out to enable logging
+// #undef LOGD
+// #define LOGD(...) {}
+
+#define LOC_XTRA_INJECT_DEFAULT_TIMEOUT (3100)
+// Part size used when the modem did not tell its limits
+#define XTRA_BLOCK_SIZE                 (400)
+
+// Hash of the last XTRA file the modem took, kept across restarts
+static const char* loc_eng_xtra_hash_file = LOC_ENG_XTRA_HASH_FILE;
+
+static int qct_loc_eng_xtra_init (GpsXtraCallbacks* callbacks);
+static int qct_loc_eng_inject_xtra_data(char* data, int length);
+static void loc_eng_xtra_source_cb (loc_eng_ioctl_handle_type ioctl_handle,
+                                    const rpc_loc_ioctl_callback_s_type *cb_data_ptr,
+                                    void *user_data);
+static void* loc_eng_xtra_inject_thread (void* arg);
+static void loc_eng_xtra_hand_over (char* data, uint32 length, uint32 inflated_length,
+                                    boolean is_mapped, boolean streaming);
+static void loc_eng_xtra_query_validity (boolean download_requested);
+static void loc_eng_xtra_load_hash (loc_eng_xtra_data_s_type *xtra_ptr);
+static void loc_eng_xtra_forward_request (loc_eng_xtra_data_s_type *xtra_ptr);
+
+const GpsXtraInterface sLocEngXTRAInterface =
+{
+    qct_loc_eng_xtra_init,
+    qct_loc_eng_inject_xtra_data,
+};
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_module_init
+
+DESCRIPTION
+   Initializes the XTRA module data and starts the injection thread.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_xtra_module_init (loc_eng_xtra_data_s_type *xtra_ptr)
+{
+    xtra_ptr->download_request_cb = NULL;
+    xtra_ptr->download_request_pending = FALSE;
+    xtra_ptr->source_is_valid = FALSE;
+    xtra_ptr->download_in_flight = FALSE;
+    xtra_ptr->refresh_time_utc = 0;
+    xtra_ptr->download_requests_received = 0;
+    xtra_ptr->download_requests_forwarded = 0;
+    xtra_ptr->inject_data = NULL;
+    xtra_ptr->inject_length = 0;
+    xtra_ptr->inject_is_mapped = FALSE;
+    xtra_ptr->inject_seq = 0;
+    xtra_ptr->inject_status_cb = NULL;
+    xtra_ptr->inject_thread_need_exit = FALSE;
+    xtra_ptr->inject_skipped = 0;
+    xtra_ptr->inject_available = 0;
+    xtra_ptr->inject_streaming = FALSE;
+    xtra_ptr->stream_data = NULL;
+    xtra_ptr->stream_length = 0;
+    loc_eng_xtra_load_hash (xtra_ptr);
+
+    pthread_mutex_init (&xtra_ptr->xtra_mutex, NULL);
+    pthread_cond_init (&xtra_ptr->inject_cond, NULL);
+    pthread_create (&xtra_ptr->inject_thread, NULL, loc_eng_xtra_inject_thread, xtra_ptr);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_module_deinit
+
+DESCRIPTION
+   Cancels the XTRA injection in progress, stops the injection thread and
+   releases the XTRA module resources.
+
+DEPENDENCIES
+   Called before the loc client is closed
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_xtra_module_deinit (loc_eng_xtra_data_s_type *xtra_ptr)
+{
+    pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+    xtra_ptr->inject_thread_need_exit = TRUE;
+    xtra_ptr->inject_seq++;
+    pthread_cond_signal (&xtra_ptr->inject_cond);
+    pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+
+    pthread_join (xtra_ptr->inject_thread, NULL);
+
+    pthread_cond_destroy (&xtra_ptr->inject_cond);
+    pthread_mutex_destroy (&xtra_ptr->xtra_mutex);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_set_inject_status_cb
+
+DESCRIPTION
+   Registers the callback that follows the background XTRA injections.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_xtra_set_inject_status_cb (loc_eng_xtra_inject_status_cb_type status_cb)
+{
+    pthread_mutex_lock (&loc_eng_data.xtra_module_data.xtra_mutex);
+    loc_eng_data.xtra_module_data.inject_status_cb = status_cb;
+    pthread_mutex_unlock (&loc_eng_data.xtra_module_data.xtra_mutex);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_report_status
+
+DESCRIPTION
+   Passes the progress of an injection to the registered status callback.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_xtra_report_status (loc_eng_xtra_inject_status_e_type status,
+                                        uint32 bytes_injected,
+                                        uint32 total_size)
+{
+    loc_eng_xtra_inject_status_cb_type status_cb;
+
+    pthread_mutex_lock (&loc_eng_data.xtra_module_data.xtra_mutex);
+    status_cb = loc_eng_data.xtra_module_data.inject_status_cb;
+    pthread_mutex_unlock (&loc_eng_data.xtra_module_data.xtra_mutex);
+
+    if (status_cb != NULL)
+    {
+        status_cb (status, bytes_injected, total_size);
+    }
+}
+
+/*===========================================================================
+FUNCTION    qct_loc_eng_xtra_init
+
+DESCRIPTION
+   Initialize XTRA module.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   0: success
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static int qct_loc_eng_xtra_init (GpsXtraCallbacks* callbacks)
+{
+    boolean forward = FALSE;
+
+    pthread_mutex_lock(&loc_eng_data.xtra_module_data.xtra_mutex);
+    loc_eng_data.xtra_module_data.download_request_cb = callbacks->download_request_cb;
+    if (loc_eng_data.xtra_module_data.download_request_pending == TRUE) {
+        LOGD("qct_loc_eng_xtra_init: forwarding previous xtra download request");
+        loc_eng_data.xtra_module_data.download_request_pending = FALSE;
+        loc_eng_data.xtra_module_data.download_in_flight = TRUE;
+        clock_gettime (CLOCK_MONOTONIC, &loc_eng_data.xtra_module_data.download_request_time);
+        forward = TRUE;
+    }
+    pthread_mutex_unlock(&loc_eng_data.xtra_module_data.xtra_mutex);
+
+    // The downloader or the framework's callback is called without the lock
+    if (forward == TRUE)
+    {
+        loc_eng_xtra_forward_request (&loc_eng_data.xtra_module_data);
+    }
+
+    // Learn the part size limits before the first injection
+    if (loc_eng_data.xtra_module_data.source_is_valid == FALSE)
+    {
+        rpc_loc_ioctl_data_u_type ioctl_data;
+
+        ioctl_data.disc = RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_SOURCE;
+        (void) loc_eng_ioctl_async (loc_eng_data.client_handle,
+                                    RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_SOURCE,
+                                    &ioctl_data,
+                                    LOC_IOCTL_DEFAULT_TIMEOUT,
+                                    loc_eng_xtra_source_cb,
+                                    NULL);
+    }
+
+    return 0;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_source_cb
+
+DESCRIPTION
+   Caches the XTRA file and part size limits of the modem from the report of
+   RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_SOURCE.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_xtra_source_cb (loc_eng_ioctl_handle_type ioctl_handle,
+                                    const rpc_loc_ioctl_callback_s_type *cb_data_ptr,
+                                    void *user_data)
+{
+    const rpc_loc_predicted_orbits_data_source_s_type *source_ptr;
+
+    if (cb_data_ptr->status != RPC_LOC_API_SUCCESS)
+    {
+        LOGE("loc_eng_xtra_source_cb: query failed, status = %d", (int) cb_data_ptr->status);
+        return;
+    }
+
+    source_ptr = &(cb_data_ptr->data.rpc_loc_ioctl_callback_data_u_type_u.predicted_orbits_data_source);
+
+    pthread_mutex_lock(&loc_eng_data.xtra_module_data.xtra_mutex);
+    loc_eng_data.xtra_module_data.max_file_size = source_ptr->max_file_size;
+    loc_eng_data.xtra_module_data.max_part_size = source_ptr->max_part_size;
+    loc_eng_data.xtra_module_data.source_is_valid = TRUE;
+    pthread_mutex_unlock(&loc_eng_data.xtra_module_data.xtra_mutex);
+
+    // The server names live in RPC memory, only valid in the completion
+    // callback itself and not in a copy of the result
+    if (ioctl_handle != LOC_ENG_IOCTL_HANDLE_INVALID)
+    {
+        loc_eng_xtra_download_set_servers (source_ptr->servers, LOC_ENG_XTRA_MAX_SERVERS);
+    }
+
+    LOGD("loc_eng_xtra_source_cb: max file size = %d, max part size = %d",
+         source_ptr->max_file_size, source_ptr->max_part_size);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_get_part_size
+
+DESCRIPTION
+   Picks the part size to inject an XTRA file of length bytes with, the
+   largest the modem accepts. Queries the modem if its limits are not known
+   yet.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   Part size in bytes
+   0 if the modem does not accept a file of this size
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static uint32 loc_eng_xtra_get_part_size (int length)
+{
+    loc_eng_xtra_data_s_type *xtra_ptr = &(loc_eng_data.xtra_module_data);
+    rpc_loc_ioctl_data_u_type     ioctl_data;
+    rpc_loc_ioctl_callback_s_type cb_data;
+    uint32 max_file_size = 0, part_size = XTRA_BLOCK_SIZE;
+    boolean source_is_valid;
+
+    pthread_mutex_lock(&xtra_ptr->xtra_mutex);
+    source_is_valid = xtra_ptr->source_is_valid;
+    pthread_mutex_unlock(&xtra_ptr->xtra_mutex);
+
+    if (source_is_valid == FALSE)
+    {
+        ioctl_data.disc = RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_SOURCE;
+        if (loc_eng_ioctl (loc_eng_data.client_handle,
+                           RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_SOURCE,
+                           &ioctl_data,
+                           LOC_IOCTL_DEFAULT_TIMEOUT,
+                           &cb_data) == TRUE)
+        {
+            loc_eng_xtra_source_cb (LOC_ENG_IOCTL_HANDLE_INVALID, &cb_data, NULL);
+        }
+    }
+
+    pthread_mutex_lock(&xtra_ptr->xtra_mutex);
+    if (xtra_ptr->source_is_valid == TRUE)
+    {
+        max_file_size = xtra_ptr->max_file_size;
+        part_size = xtra_ptr->max_part_size;
+    }
+    pthread_mutex_unlock(&xtra_ptr->xtra_mutex);
+
+    if (part_size == 0 || part_size > LOC_ENG_XTRA_MAX_PART_SIZE)
+    {
+        part_size = LOC_ENG_XTRA_MAX_PART_SIZE;
+    }
+
+    if (max_file_size != 0 && (uint32) length > max_file_size)
+    {
+        LOGE("loc_eng_xtra_get_part_size: xtra size %d exceeds the modem maximum %d", length, max_file_size);
+        return 0;
+    }
+
+    if ((length + part_size - 1) / part_size > LOC_ENG_XTRA_MAX_PARTS)
+    {
+        LOGE("loc_eng_xtra_get_part_size: xtra size %d needs more than %d parts of %d",
+             length, LOC_ENG_XTRA_MAX_PARTS, part_size);
+        return 0;
+    }
+
+    return part_size;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_request_download
+
+DESCRIPTION
+   Handles an XTRA download request of the modem, or the proactive refresh.
+   Requests made while a download is on the way are dropped. Otherwise the
+   validity of the modem's data is queried first, see loc_eng_xtra_validity_cb.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_xtra_request_download (void)
+{
+    loc_eng_xtra_data_s_type *xtra_ptr = &(loc_eng_data.xtra_module_data);
+    struct timespec now;
+    boolean coalesced = FALSE;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+    xtra_ptr->download_requests_received++;
+    if (xtra_ptr->download_in_flight == TRUE &&
+        now.tv_sec - xtra_ptr->download_request_time.tv_sec < LOC_ENG_XTRA_DOWNLOAD_TIMEOUT)
+    {
+        coalesced = TRUE;
+    }
+    else
+    {
+        // Covers the validity query too, requests meanwhile are coalesced
+        xtra_ptr->download_in_flight = TRUE;
+        xtra_ptr->download_request_time = now;
+    }
+    pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+
+    if (coalesced == TRUE)
+    {
+        LOGD("loc_eng_xtra_request_download: download already in flight");
+        return;
+    }
+
+    loc_eng_xtra_query_validity (TRUE);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_forward_to_framework
+
+DESCRIPTION
+   Asks the framework to download an XTRA file, or keeps the request for
+   when the callback is registered. The callback is called with xtra_mutex
+   released.
+
+DEPENDENCIES
+   Called without xtra_mutex held
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_xtra_forward_to_framework (loc_eng_xtra_data_s_type *xtra_ptr)
+{
+    gps_xtra_download_request download_request_cb;
+
+    pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+    download_request_cb = xtra_ptr->download_request_cb;
+    if (download_request_cb != NULL) {
+        xtra_ptr->download_requests_forwarded++;
+    } else {
+        LOGD("loc_eng_xtra_forward_to_framework: no xtra callback, will download when callback registered");
+        xtra_ptr->download_request_pending = TRUE;
+        xtra_ptr->download_in_flight = FALSE;
+    }
+    pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+
+    // Call Registered callback
+    if (download_request_cb != NULL) {
+        download_request_cb();
+    }
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_forward_request
+
+DESCRIPTION
+   Starts the HAL download of an XTRA file, or asks the framework for it if
+   the HAL does not know the servers.
+
+DEPENDENCIES
+   Called without xtra_mutex held
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_xtra_forward_request (loc_eng_xtra_data_s_type *xtra_ptr)
+{
+    // The HAL downloads the file itself if it knows the servers
+    if (loc_eng_xtra_download_start () == TRUE) {
+        LOGD("loc_eng_xtra_forward_request: downloading in the HAL");
+        return;
+    }
+
+    loc_eng_xtra_forward_to_framework (xtra_ptr);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_expiry_time
+
+DESCRIPTION
+   Computes when the modem's XTRA data expires from the result of
+   RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_VALIDITY.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   UTC expiry time, 0 if the modem has no valid data or the query failed
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static time_t loc_eng_xtra_expiry_time (const rpc_loc_ioctl_callback_s_type *cb_data_ptr)
+{
+    const rpc_loc_predicted_orbits_data_validity_report_s_type *validity_ptr;
+
+    if (cb_data_ptr == NULL || cb_data_ptr->status != RPC_LOC_API_SUCCESS)
+    {
+        return 0;
+    }
+
+    validity_ptr = &(cb_data_ptr->data.rpc_loc_ioctl_callback_data_u_type_u.predicted_orbits_data_validity);
+    LOGD("loc_eng_xtra_expiry_time: start = %lld, valid for %d hours",
+         (long long) validity_ptr->start_time_utc, validity_ptr->valid_duration_hrs);
+    if (validity_ptr->valid_duration_hrs == 0)
+    {
+        return 0;
+    }
+
+    // start_time_utc is in seconds
+    return (time_t) validity_ptr->start_time_utc + validity_ptr->valid_duration_hrs * 3600;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_forward_download
+
+DESCRIPTION
+   Passes a download request to the framework after the HAL download
+   failed.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_xtra_forward_download (void)
+{
+    loc_eng_xtra_forward_to_framework (&(loc_eng_data.xtra_module_data));
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_validity_cb
+
+DESCRIPTION
+   Completion of RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_VALIDITY. While
+   the modem's data is fresh, a requested download is suppressed and the
+   refresh is scheduled LOC_ENG_XTRA_REFRESH_MARGIN before the data expires.
+   Otherwise, or if the validity is unknown, the download is forwarded to
+   the framework, unless every visible SV has a fresh ephemeris; the request
+   is then checked again after LOC_ENG_COVERAGE_RECHECK_TIME. user_data is
+   non-NULL if a download was requested.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_xtra_validity_cb (loc_eng_ioctl_handle_type ioctl_handle,
+                                      const rpc_loc_ioctl_callback_s_type *cb_data_ptr,
+                                      void *user_data)
+{
+    loc_eng_xtra_data_s_type *xtra_ptr = &(loc_eng_data.xtra_module_data);
+    time_t expiry_time, refresh_time = 0;
+    boolean forward = FALSE;
+
+    expiry_time = loc_eng_xtra_expiry_time (cb_data_ptr);
+    if (expiry_time != 0)
+    {
+        refresh_time = expiry_time - LOC_ENG_XTRA_REFRESH_MARGIN;
+    }
+
+    pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+    if (refresh_time > time (NULL))
+    {
+        LOGD("loc_eng_xtra_validity_cb: xtra data is fresh, refresh in %ld s",
+             (long) (refresh_time - time (NULL)));
+        if (user_data != NULL)
+        {
+            xtra_ptr->download_in_flight = FALSE;
+        }
+        xtra_ptr->refresh_time_utc = refresh_time;
+        pthread_cond_signal (&xtra_ptr->inject_cond);
+    }
+    else if (user_data != NULL && loc_eng_coverage_xtra_needed () == FALSE)
+    {
+        xtra_ptr->download_in_flight = FALSE;
+        xtra_ptr->refresh_time_utc = time (NULL) + LOC_ENG_COVERAGE_RECHECK_TIME;
+        pthread_cond_signal (&xtra_ptr->inject_cond);
+    }
+    else if (user_data != NULL)
+    {
+        forward = TRUE;
+    }
+    pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+
+    // Runs on the RPC callback or ioctl timer thread, which must not call
+    // out with the lock held
+    if (forward == TRUE)
+    {
+        loc_eng_xtra_forward_request (xtra_ptr);
+    }
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_query_validity
+
+DESCRIPTION
+   Sends RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_VALIDITY, the result is
+   handled by loc_eng_xtra_validity_cb.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_xtra_query_validity (boolean download_requested)
+{
+    rpc_loc_ioctl_data_u_type ioctl_data;
+    void* user_data = download_requested ? (void*) &loc_eng_data.xtra_module_data : NULL;
+
+    ioctl_data.disc = RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_VALIDITY;
+    if (loc_eng_ioctl_async (loc_eng_data.client_handle,
+                             RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_VALIDITY,
+                             &ioctl_data,
+                             LOC_IOCTL_DEFAULT_TIMEOUT,
+                             loc_eng_xtra_validity_cb,
+                             user_data) == LOC_ENG_IOCTL_HANDLE_INVALID)
+    {
+        // Validity unknown
+        loc_eng_xtra_validity_cb (LOC_ENG_IOCTL_HANDLE_INVALID, NULL, user_data);
+    }
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_check_size
+
+DESCRIPTION
+   Checks the size of an XTRA file against the limits of the modem.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if the size is acceptable
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_xtra_check_size (uint32 length)
+{
+    loc_eng_xtra_data_s_type *xtra_ptr = &(loc_eng_data.xtra_module_data);
+    uint32 max_file_size = LOC_ENG_XTRA_MAX_PART_SIZE * LOC_ENG_XTRA_MAX_PARTS;
+
+    pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+    if (xtra_ptr->source_is_valid == TRUE && xtra_ptr->max_file_size != 0)
+    {
+        max_file_size = xtra_ptr->max_file_size;
+    }
+    pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+
+    if (length < LOC_ENG_XTRA_MIN_FILE_SIZE || length > max_file_size)
+    {
+        LOGE("loc_eng_xtra_check_size: bad size %d, limits %d - %d", length,
+             LOC_ENG_XTRA_MIN_FILE_SIZE, max_file_size);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_check_content
+
+DESCRIPTION
+   Rejects HTML or HTTP error pages saved in place of an XTRA file, and
+   downloads cut short into a zero-filled file.
+
+DEPENDENCIES
+   head holds the first bytes of a file of at least LOC_ENG_XTRA_MIN_FILE_SIZE
+
+RETURN VALUE
+   TRUE if the content is plausible
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_xtra_check_content (const char* head, uint32 zero_tail)
+{
+    if (head[0] == '<' || strncmp (head, "HTTP/", 5) == 0)
+    {
+        LOGE("loc_eng_xtra_check_content: not an xtra file, starts with %.16s", head);
+        return FALSE;
+    }
+
+    if (zero_tail >= LOC_ENG_XTRA_ZERO_TAIL_SIZE)
+    {
+        LOGE("loc_eng_xtra_check_content: truncated xtra file, ends in %d zero bytes", zero_tail);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_is_compressed
+
+DESCRIPTION
+   Recognizes gzip and zlib (HTTP "deflate") compressed XTRA files by their
+   header. The zlib header is only 16 bits with a 5 bit check, about one
+   raw file in a thousand starts like one; such a file is taken as raw
+   once it does not inflate.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if the file must be inflated before injection
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+boolean loc_eng_xtra_is_compressed (const char* data, uint32 length)
+{
+    const unsigned char* header = (const unsigned char*) data;
+
+    if (length < 2)
+    {
+        return FALSE;
+    }
+
+    // gzip magic
+    if (header[0] == 0x1f && header[1] == 0x8b)
+    {
+        return TRUE;
+    }
+
+    // zlib: deflate with a window of at most 32K, header check bits
+    return (header[0] & 0x0f) == Z_DEFLATED && (header[0] >> 4) <= 7 &&
+           ((header[0] << 8) | header[1]) % 31 == 0;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_is_gzip
+
+DESCRIPTION
+   Recognizes gzip compressed XTRA files by their 16 bit magic.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE for gzip, FALSE for zlib and raw files
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_xtra_is_gzip (const char* data, uint32 length)
+{
+    const unsigned char* header = (const unsigned char*) data;
+
+    return length >= 2 && header[0] == 0x1f && header[1] == 0x8b;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_inflate_init
+
+DESCRIPTION
+   Prepares inflating a gzip or zlib compressed XTRA file.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE on success, release with inflateEnd
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_xtra_inflate_init (z_stream* stream_ptr, const char* data, uint32 length)
+{
+    memset (stream_ptr, 0, sizeof (*stream_ptr));
+    stream_ptr->next_in = (Bytef*) data;
+    stream_ptr->avail_in = length;
+
+    // 32 added to the window bits detects gzip and zlib headers
+    return inflateInit2 (stream_ptr, MAX_WBITS + 32) == Z_OK;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_inflate_check
+
+DESCRIPTION
+   Inflates a compressed XTRA file into a small scratch buffer, to learn its
+   size and check it before anything is injected. The checksum of the
+   compressed stream catches corrupt and truncated downloads, and inflating
+   stops as soon as the file grows beyond what the modem takes.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if the file is worth injecting, its inflated size in inflated_length
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_xtra_inflate_check (const char* data, uint32 length, uint32* inflated_length)
+{
+    char head[LOC_ENG_XTRA_INFLATE_BUF_SIZE];
+    char buf[LOC_ENG_XTRA_INFLATE_BUF_SIZE];
+    z_stream stream;
+    uint32 size = 0, zero_tail = 0, i, n;
+    int zret = Z_OK;
+
+    if (loc_eng_xtra_inflate_init (&stream, data, length) == FALSE)
+    {
+        return FALSE;
+    }
+
+    while (zret == Z_OK && size <= LOC_ENG_XTRA_MAX_PART_SIZE * LOC_ENG_XTRA_MAX_PARTS)
+    {
+        stream.next_out = (Bytef*) buf;
+        stream.avail_out = sizeof (buf);
+        zret = inflate (&stream, Z_NO_FLUSH);
+        n = sizeof (buf) - stream.avail_out;
+        if (size == 0)
+        {
+            memcpy (head, buf, n);
+        }
+        size += n;
+
+        for (i = n; i > 0 && buf[i - 1] == 0; i--)
+        {
+        }
+        zero_tail = (i == 0) ? zero_tail + n : n - i;
+    }
+    inflateEnd (&stream);
+
+    if (zret != Z_STREAM_END || stream.avail_in != 0)
+    {
+        LOGE("loc_eng_xtra_inflate_check: broken compressed xtra file, inflate returned %d after %d bytes",
+             zret, size);
+        return FALSE;
+    }
+
+    LOGD("loc_eng_xtra_inflate_check: %d bytes inflate to %d", length, size);
+    *inflated_length = size;
+
+    return loc_eng_xtra_check_size (size) == TRUE && loc_eng_xtra_check_content (head, zero_tail) == TRUE;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_check_raw
+
+DESCRIPTION
+   loc_eng_xtra_check_file for a file that is injected as it is.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if the file is worth injecting
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_xtra_check_raw (const char* data, uint32 length)
+{
+    uint32 zero_tail;
+
+    if (loc_eng_xtra_check_size (length) == FALSE)
+    {
+        return FALSE;
+    }
+
+    for (zero_tail = 0; zero_tail < LOC_ENG_XTRA_ZERO_TAIL_SIZE && data[length - 1 - zero_tail] == 0; zero_tail++)
+    {
+    }
+
+    return loc_eng_xtra_check_content (data, zero_tail);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_check_file
+
+DESCRIPTION
+   Rejects XTRA files that cannot be good before any part is sent: files
+   too short or too large for the modem, HTML or HTTP error pages saved in
+   place of the file, and downloads cut short into a zero-filled file.
+   Compressed files are checked by inflating them, a file with only a zlib
+   header that does not inflate is checked as raw.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if the file is worth injecting, the inflated size of a compressed
+   file in inflated_length, 0 for others
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_xtra_check_file (const char* data, uint32 length, uint32* inflated_length)
+{
+    *inflated_length = 0;
+    if (loc_eng_xtra_is_compressed (data, length) == TRUE)
+    {
+        if (loc_eng_xtra_inflate_check (data, length, inflated_length) == TRUE)
+        {
+            return TRUE;
+        }
+        if (loc_eng_xtra_is_gzip (data, length) == TRUE)
+        {
+            return FALSE;
+        }
+        LOGD("loc_eng_xtra_check_file: zlib header does not inflate, checking the file as raw");
+        *inflated_length = 0;
+    }
+
+    return loc_eng_xtra_check_raw (data, length);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_hash
+
+DESCRIPTION
+   64 bit FNV-1a hash of an XTRA file, taken a word at a time.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   hash value
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static uint64_t loc_eng_xtra_hash (const char* data, uint32 length)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint64_t word;
+    uint32 i;
+
+    for (i = 0; i + sizeof (word) <= length; i += sizeof (word))
+    {
+        memcpy (&word, data + i, sizeof (word));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    for (; i < length; i++)
+    {
+        hash = (hash ^ (unsigned char) data[i]) * 0x100000001b3ULL;
+    }
+
+    return hash ^ length;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_load_hash
+
+DESCRIPTION
+   Reads the hash of the last XTRA file the modem took, stored by
+   loc_eng_xtra_save_hash before the last restart.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_xtra_load_hash (loc_eng_xtra_data_s_type *xtra_ptr)
+{
+    unsigned long long hash;
+    FILE* file;
+
+    xtra_ptr->last_hash_is_valid = FALSE;
+
+    file = fopen (loc_eng_xtra_hash_file, "r");
+    if (file == NULL)
+    {
+        return;
+    }
+    if (fscanf (file, "%llx", &hash) == 1)
+    {
+        xtra_ptr->last_hash = hash;
+        xtra_ptr->last_hash_is_valid = TRUE;
+    }
+    fclose (file);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_save_hash
+
+DESCRIPTION
+   Stores the hash of the XTRA file the modem just took. The file is
+   replaced by a rename, a crash never leaves half a hash behind.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_xtra_save_hash (loc_eng_xtra_data_s_type *xtra_ptr, uint64_t hash)
+{
+    char tmp_path[PATH_MAX];
+    FILE* file;
+
+    pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+    xtra_ptr->last_hash = hash;
+    xtra_ptr->last_hash_is_valid = TRUE;
+    pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+
+    snprintf (tmp_path, sizeof (tmp_path), "%s.tmp", loc_eng_xtra_hash_file);
+    file = fopen (tmp_path, "w");
+    if (file == NULL)
+    {
+        LOGE("loc_eng_xtra_save_hash: cannot create %s, errno = %d", tmp_path, errno);
+        return;
+    }
+    fprintf (file, "%llx\n", (unsigned long long) hash);
+    if (fclose (file) != 0 || rename (tmp_path, loc_eng_xtra_hash_file) != 0)
+    {
+        LOGE("loc_eng_xtra_save_hash: cannot write %s, errno = %d", loc_eng_xtra_hash_file, errno);
+        unlink (tmp_path);
+    }
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_set_hash_file
+
+DESCRIPTION
+   Moves the file keeping the hash of the last injected XTRA file.
+
+DEPENDENCIES
+   Called before loc_eng_init
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_xtra_set_hash_file (const char* path)
+{
+    loc_eng_xtra_hash_file = path;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_is_duplicate
+
+DESCRIPTION
+   Checks if an XTRA file is the one the modem took last and the modem
+   still holds valid data, so injecting it again would change nothing.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if the injection can be skipped
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_xtra_is_duplicate (uint64_t hash)
+{
+    loc_eng_xtra_data_s_type *xtra_ptr = &(loc_eng_data.xtra_module_data);
+    rpc_loc_ioctl_callback_s_type cb_data;
+    rpc_loc_ioctl_data_u_type ioctl_data;
+    boolean same_file;
+
+    pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+    same_file = xtra_ptr->last_hash_is_valid == TRUE && xtra_ptr->last_hash == hash;
+    pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+
+    if (same_file == FALSE)
+    {
+        return FALSE;
+    }
+
+    // The modem may have lost the data since, e.g. after a modem restart
+    ioctl_data.disc = RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_VALIDITY;
+    if (loc_eng_ioctl (loc_eng_data.client_handle,
+                       RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_VALIDITY,
+                       &ioctl_data,
+                       LOC_IOCTL_DEFAULT_TIMEOUT,
+                       &cb_data) != TRUE)
+    {
+        return FALSE;
+    }
+
+    return loc_eng_xtra_expiry_time (&cb_data) > time (NULL);
+}
+
+/*===========================================================================
+FUNCTION    qct_loc_eng_inject_xtra_data
+
+DESCRIPTION
+   Injects XTRA file into the engine. The file is copied and injected by the
+   injection thread, the caller is not held up for the injection.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   0: success
+   >0: failure
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static int qct_loc_eng_inject_xtra_data(char* data, int length)
+{
+    char* copy;
+    uint32 inflated_length;
+
+    LOGV("qct_loc_eng_inject_xtra_data: xtra size = %d, data ptr = 0x%x", length, (int)data);
+
+    if (length <= 0 || loc_eng_xtra_check_file (data, length, &inflated_length) == FALSE)
+    {
+        return EINVAL;
+    }
+
+    // The caller releases data on return
+    copy = (char*) malloc (length);
+    if (copy == NULL)
+    {
+        LOGE("qct_loc_eng_inject_xtra_data: no memory for %d bytes", length);
+        return ENOMEM;
+    }
+    memcpy (copy, data, length);
+
+    loc_eng_xtra_hand_over (copy, length, inflated_length, FALSE, FALSE);
+
+    return 0;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_release_data
+
+DESCRIPTION
+   Frees or unmaps an XTRA file handed over to the injection thread.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_xtra_release_data (char* data, uint32 length, boolean is_mapped)
+{
+    if (data == NULL)
+    {
+        return;
+    }
+
+    if (is_mapped == TRUE)
+    {
+        munmap (data, length);
+    }
+    else
+    {
+        free (data);
+    }
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_hand_over
+
+DESCRIPTION
+   Hands an XTRA file over to the injection thread. A file still waiting to
+   be injected is dropped, and an injection in progress is cancelled, in
+   favour of the new one. A streamed file is handed over empty and filled
+   by loc_eng_xtra_stream_append. inflated_length is the size found by
+   loc_eng_xtra_check_file, 0 if the file was not checked.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   Takes ownership of data
+
+===========================================================================*/
+static void loc_eng_xtra_hand_over (char* data, uint32 length, uint32 inflated_length,
+                                    boolean is_mapped, boolean streaming)
+{
+    loc_eng_xtra_data_s_type *xtra_ptr = &(loc_eng_data.xtra_module_data);
+    char*   dropped_data;
+    uint32  dropped_length;
+    boolean dropped_is_mapped;
+
+    pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+    dropped_data = xtra_ptr->inject_data;
+    dropped_length = xtra_ptr->inject_length;
+    dropped_is_mapped = xtra_ptr->inject_is_mapped;
+    xtra_ptr->inject_data = data;
+    xtra_ptr->inject_length = length;
+    xtra_ptr->inject_is_mapped = is_mapped;
+    xtra_ptr->inject_inflated_length = inflated_length;
+    xtra_ptr->inject_seq++;
+    xtra_ptr->inject_available = streaming ? 0 : length;
+    xtra_ptr->inject_streaming = streaming;
+    xtra_ptr->stream_data = streaming ? data : NULL;
+    xtra_ptr->stream_length = streaming ? length : 0;
+    // The requested download has come in
+    xtra_ptr->download_in_flight = FALSE;
+    pthread_cond_signal (&xtra_ptr->inject_cond);
+    pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+
+    if (dropped_data != NULL)
+    {
+        LOGD("loc_eng_xtra_hand_over: dropped a pending xtra file of %d bytes", dropped_length);
+        loc_eng_xtra_release_data (dropped_data, dropped_length, dropped_is_mapped);
+        loc_eng_xtra_report_status (LOC_ENG_XTRA_INJECT_CANCELLED, 0, dropped_length);
+    }
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_inject_async
+
+DESCRIPTION
+   Injects an XTRA file from memory in the background.
+
+DEPENDENCIES
+   data has been allocated with malloc
+
+RETURN VALUE
+   0: success
+
+SIDE EFFECTS
+   Takes ownership of data
+
+===========================================================================*/
+int loc_eng_xtra_inject_async (char* data, uint32 length)
+{
+    loc_eng_xtra_hand_over (data, length, 0, FALSE, FALSE);
+
+    return 0;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_inject_file
+
+DESCRIPTION
+   Injects an XTRA file in the background. The file is mapped read-only and
+   the parts are sent straight from the mapping, it is never read into
+   memory of its own.
 
-#include <loc_eng.h>
+DEPENDENCIES
+   N/A
 
-#define LOG_TAG "lib_locapi"
-#include <utils/Log.h>
+RETURN VALUE
+   0: success
+   errno of the failed file operation otherwise
 
-// comment this out to enable logging
-// #undef LOGD
-// #define LOGD(...) {}
+SIDE EFFECTS
+   N/A
 
-#define LOC_XTRA_INJECT_DEFAULT_TIMEOUT (3100)
-#define XTRA_BLOCK_SIZE                 (400)
+===========================================================================*/
+int loc_eng_xtra_inject_file (const char* path)
+{
+    struct stat st;
+    void* data;
+    uint32 inflated_length;
+    int fd, ret_val = 0;
 
-static int qct_loc_eng_xtra_init (GpsXtraCallbacks* callbacks);
-static int qct_loc_eng_inject_xtra_data(char* data, int length);
+    fd = open (path, O_RDONLY);
+    if (fd < 0)
+    {
+        LOGE("loc_eng_xtra_inject_file: cannot open %s, errno = %d", path, errno);
+        return errno;
+    }
 
-const GpsXtraInterface sLocEngXTRAInterface =
+    if (fstat (fd, &st) != 0)
+    {
+        ret_val = errno;
+    }
+    else if (st.st_size <= 0 || st.st_size > LOC_ENG_XTRA_MAX_PART_SIZE * LOC_ENG_XTRA_MAX_PARTS)
+    {
+        LOGE("loc_eng_xtra_inject_file: %s has a bad size %ld", path, (long) st.st_size);
+        ret_val = EINVAL;
+    }
+    else
+    {
+        data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            ret_val = errno;
+        }
+        else
+        {
+            // The parts are read once, front to back
+            madvise (data, st.st_size, MADV_SEQUENTIAL);
+            if (loc_eng_xtra_check_file ((const char*) data, st.st_size, &inflated_length) == FALSE)
+            {
+                munmap (data, st.st_size);
+                ret_val = EINVAL;
+            }
+            else
+            {
+                loc_eng_xtra_hand_over ((char*) data, st.st_size, inflated_length, TRUE, FALSE);
+            }
+        }
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    close (fd);
+
+    if (ret_val != 0)
+    {
+        LOGE("loc_eng_xtra_inject_file: cannot inject %s, error = %d", path, ret_val);
+    }
+
+    return ret_val;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_stream_begin
+
+DESCRIPTION
+   Starts the injection of an XTRA file that is still being downloaded.
+   The bytes are passed in with loc_eng_xtra_stream_append as they arrive,
+   and each part is injected as soon as it is complete. The last part is
+   held back until loc_eng_xtra_stream_finish. A gzip or zlib compressed
+   file, recognized by its first bytes, is injected once complete.
+
+DEPENDENCIES
+   total_size is known up front, e.g. from the Content-Length of the download
+
+RETURN VALUE
+   0: success
+   EINVAL, ENOMEM
+
+SIDE EFFECTS
+   Cancels the injection in progress
+
+===========================================================================*/
+int loc_eng_xtra_stream_begin (uint32 total_size)
 {
-    qct_loc_eng_xtra_init,
-    qct_loc_eng_inject_xtra_data,
-};
+    char* data;
+
+    // A compressed file may be shorter than any raw one, it is checked
+    // once complete
+    if (total_size == 0 ||
+        (total_size >= LOC_ENG_XTRA_MIN_FILE_SIZE && loc_eng_xtra_check_size (total_size) == FALSE))
+    {
+        return EINVAL;
+    }
+
+    data = (char*) malloc (total_size);
+    if (data == NULL)
+    {
+        LOGE("loc_eng_xtra_stream_begin: no memory for %d bytes", total_size);
+        return ENOMEM;
+    }
+
+    loc_eng_xtra_hand_over (data, total_size, 0, FALSE, TRUE);
+
+    return 0;
+}
 
 /*===========================================================================
-FUNCTION    qct_loc_eng_xtra_init
+FUNCTION    loc_eng_xtra_stream_append
 
 DESCRIPTION
-   Initialize XTRA module.
+   Adds the next bytes of the XTRA file started by loc_eng_xtra_stream_begin.
 
 DEPENDENCIES
    N/A
 
 RETURN VALUE
    0: success
+   ECANCELED if the stream has been replaced or its injection failed
+   EINVAL if the file grows beyond its total size, the stream is dropped
 
 SIDE EFFECTS
    N/A
 
 ===========================================================================*/
-static int qct_loc_eng_xtra_init (GpsXtraCallbacks* callbacks)
+int loc_eng_xtra_stream_append (const char* data, uint32 length)
 {
-    pthread_mutex_lock(&loc_eng_data.xtra_module_data.xtra_mutex);
-    loc_eng_data.xtra_module_data.download_request_cb = callbacks->download_request_cb;
-    if (loc_eng_data.xtra_module_data.download_request_pending == TRUE) {
-        LOGD("qct_loc_eng_xtra_init: callback for previous xtra download request");
-        loc_eng_data.xtra_module_data.download_request_cb();
-        loc_eng_data.xtra_module_data.download_request_pending = FALSE;
+    loc_eng_xtra_data_s_type *xtra_ptr = &(loc_eng_data.xtra_module_data);
+    int ret_val = 0;
+
+    // The injection thread only reads below inject_available, and frees
+    // stream_data only after taking it back under the lock
+    pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+    if (xtra_ptr->stream_data == NULL)
+    {
+        ret_val = ECANCELED;
     }
-    pthread_mutex_unlock(&loc_eng_data.xtra_module_data.xtra_mutex);
+    else if (length > xtra_ptr->stream_length - xtra_ptr->inject_available)
+    {
+        LOGE("loc_eng_xtra_stream_append: xtra file larger than %d bytes", xtra_ptr->stream_length);
+        xtra_ptr->inject_streaming = FALSE;
+        xtra_ptr->stream_data = NULL;
+        ret_val = EINVAL;
+    }
+    else
+    {
+        memcpy (xtra_ptr->stream_data + xtra_ptr->inject_available, data, length);
+        xtra_ptr->inject_available += length;
+    }
+    pthread_cond_signal (&xtra_ptr->inject_cond);
+    pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
 
-    return 0;
+    return ret_val;
 }
 
 /*===========================================================================
-FUNCTION    qct_loc_eng_inject_xtra_data
+FUNCTION    loc_eng_xtra_stream_finish
 
 DESCRIPTION
-   Injects XTRA file into the engine. 
+   Ends the XTRA file started by loc_eng_xtra_stream_begin. The last part
+   is injected if the file is complete, otherwise the injection fails.
 
 DEPENDENCIES
    N/A
 
 RETURN VALUE
    0: success
-   >0: failure
+   ECANCELED if the stream has been replaced or its injection failed
+   EINVAL if the file is short of its total size
 
 SIDE EFFECTS
    N/A
 
 ===========================================================================*/
-static int qct_loc_eng_inject_xtra_data(char* data, int length)
+int loc_eng_xtra_stream_finish (void)
+{
+    loc_eng_xtra_data_s_type *xtra_ptr = &(loc_eng_data.xtra_module_data);
+    int ret_val = 0;
+
+    pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+    if (xtra_ptr->stream_data == NULL)
+    {
+        ret_val = ECANCELED;
+    }
+    else if (xtra_ptr->inject_available != xtra_ptr->stream_length)
+    {
+        LOGE("loc_eng_xtra_stream_finish: truncated xtra file, %d of %d bytes",
+             xtra_ptr->inject_available, xtra_ptr->stream_length);
+        ret_val = EINVAL;
+    }
+    xtra_ptr->inject_streaming = FALSE;
+    xtra_ptr->stream_data = NULL;
+    pthread_cond_signal (&xtra_ptr->inject_cond);
+    pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+
+    return ret_val;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_wait_for_part
+
+DESCRIPTION
+   Waits until the bytes up to needed of the file being injected are there.
+   Files handed over whole are complete from the start; a streamed file is
+   complete once loc_eng_xtra_stream_finish has been called.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   LOC_ENG_XTRA_INJECT_IN_PROGRESS if the part can be injected,
+   LOC_ENG_XTRA_INJECT_CANCELLED or LOC_ENG_XTRA_INJECT_FAILED otherwise
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static loc_eng_xtra_inject_status_e_type loc_eng_xtra_wait_for_part (uint32 needed, boolean last_part, uint32 seq)
+{
+    loc_eng_xtra_data_s_type *xtra_ptr = &(loc_eng_data.xtra_module_data);
+    loc_eng_xtra_inject_status_e_type ret_val = LOC_ENG_XTRA_INJECT_IN_PROGRESS;
+
+    pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+    while (xtra_ptr->inject_seq == seq && xtra_ptr->inject_streaming == TRUE &&
+           (last_part == TRUE || xtra_ptr->inject_available < needed))
+    {
+        pthread_cond_wait (&xtra_ptr->inject_cond, &xtra_ptr->xtra_mutex);
+    }
+    if (xtra_ptr->inject_seq != seq)
+    {
+        ret_val = LOC_ENG_XTRA_INJECT_CANCELLED;
+    }
+    else if (xtra_ptr->inject_available < needed || (last_part == TRUE && xtra_ptr->inject_available != needed))
+    {
+        ret_val = LOC_ENG_XTRA_INJECT_FAILED;
+    }
+    pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+
+    return ret_val;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_inject_parts
+
+DESCRIPTION
+   Injects XTRA file into the engine, in the largest parts the modem
+   accepts. Stops between two parts when the injection is cancelled. Parts
+   of a streamed file are sent as they come in, and the complete file is
+   checked before the last one. With an inflater, each part is inflated
+   into a buffer of its own and length is the inflated size.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   LOC_ENG_XTRA_INJECT_DONE, _FAILED or _CANCELLED
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static loc_eng_xtra_inject_status_e_type loc_eng_xtra_inject_parts(char* data, uint32 length, uint32 seq,
+                                                                    boolean streamed, z_stream* inflater)
 {
     int     rpc_ret_val = RPC_LOC_API_GENERAL_FAILURE;
-    boolean ret_val = 0;
-    uint8   part;
-    uint8   total_parts;
-    uint16  part_len;
-    uint16  len_injected;
+    loc_eng_xtra_inject_status_e_type ret_val = LOC_ENG_XTRA_INJECT_DONE;
+    uint32  part;
+    uint32  total_parts;
+    uint32  part_size;
+    uint32  len_injected;
+    uint32  inflated_length;
+    int     zret;
+    char*   part_buf = NULL;
     rpc_loc_ioctl_data_u_type            ioctl_data;
     rpc_loc_predicted_orbits_data_s_type *predicted_orbits_data_ptr;
 
-    LOGV("qct_loc_eng_inject_xtra_data: xtra size = %d, data ptr = 0x%x", length, (int)data);
+    part_size = loc_eng_xtra_get_part_size (length);
+    if (part_size == 0)
+    {
+        return LOC_ENG_XTRA_INJECT_FAILED;
+    }
+
+    // Only one inflated part is held at a time
+    if (inflater != NULL)
+    {
+        part_buf = (char*) malloc (part_size);
+        if (part_buf == NULL)
+        {
+            return LOC_ENG_XTRA_INJECT_FAILED;
+        }
+    }
 
     ioctl_data.disc = RPC_LOC_IOCTL_INJECT_PREDICTED_ORBITS_DATA;
 
     predicted_orbits_data_ptr = &(ioctl_data.rpc_loc_ioctl_data_u_type_u.predicted_orbits_data);
     predicted_orbits_data_ptr->format_type = RPC_LOC_PREDICTED_ORBITS_XTRA;
     predicted_orbits_data_ptr->total_size = length;
-    total_parts = (length / XTRA_BLOCK_SIZE);
-    if ((total_parts % XTRA_BLOCK_SIZE) != 0)
-    {
-        total_parts += 1;
-    }
+    total_parts = (length + part_size - 1) / part_size;
     predicted_orbits_data_ptr->total_parts = total_parts;
 
     len_injected = 0; // O bytes injected
@@ -143,15 +1623,61 @@ static int qct_loc_eng_inject_xtra_data(char* data, int length)
     for (part = 1; part <= total_parts; part++)
     {
         predicted_orbits_data_ptr->part = part;
-        predicted_orbits_data_ptr->part_len = XTRA_BLOCK_SIZE;
-        if (XTRA_BLOCK_SIZE > (length - len_injected))
+        predicted_orbits_data_ptr->part_len = part_size;
+        if (part_size > (length - len_injected))
         {
             predicted_orbits_data_ptr->part_len = length - len_injected;
         }
+
+        if (inflater != NULL)
+        {
+            // The compressed file is complete, only check for cancellation
+            ret_val = loc_eng_xtra_wait_for_part (0, FALSE, seq);
+        }
+        else
+        {
+            ret_val = loc_eng_xtra_wait_for_part (len_injected + predicted_orbits_data_ptr->part_len,
+                                                  part == total_parts, seq);
+        }
+        if (ret_val != LOC_ENG_XTRA_INJECT_IN_PROGRESS)
+        {
+            LOGD("loc_eng_xtra_inject_parts: stopped after %d of %d bytes, status %d", len_injected, length, ret_val);
+            break;
+        }
+        ret_val = LOC_ENG_XTRA_INJECT_DONE;
+
+        if (part == total_parts && streamed == TRUE &&
+            loc_eng_xtra_check_file (data, length, &inflated_length) == FALSE)
+        {
+            ret_val = LOC_ENG_XTRA_INJECT_FAILED;
+            break;
+        }
         predicted_orbits_data_ptr->data_ptr.data_ptr_len = predicted_orbits_data_ptr->part_len;
-        predicted_orbits_data_ptr->data_ptr.data_ptr_val = data + len_injected;
+        if (inflater == NULL)
+        {
+            predicted_orbits_data_ptr->data_ptr.data_ptr_val = data + len_injected;
+        }
+        else
+        {
+            inflater->next_out = (Bytef*) part_buf;
+            inflater->avail_out = predicted_orbits_data_ptr->part_len;
+            zret = inflate (inflater, Z_SYNC_FLUSH);
+            if (zret != Z_OK && zret != Z_STREAM_END)
+            {
+                LOGE("loc_eng_xtra_inject_parts: inflate returned %d after %d bytes", zret, len_injected);
+                ret_val = LOC_ENG_XTRA_INJECT_FAILED;
+                break;
+            }
+            if (inflater->avail_out != 0)
+            {
+                LOGE("loc_eng_xtra_inject_parts: compressed xtra file ended after %d bytes", len_injected);
+                ret_val = LOC_ENG_XTRA_INJECT_FAILED;
+                break;
+            }
+            predicted_orbits_data_ptr->data_ptr.data_ptr_val = part_buf;
+        }
 
-        LOGV("qct_loc_eng_inject_xtra_data: inject part = %d/%d, len = %d, len = %d",
+        LOGV("loc_eng_xtra_inject_parts: inject part = %d/%d, len = %d, len = %d",
              predicted_orbits_data_ptr->part, predicted_orbits_data_ptr->total_parts,
              predicted_orbits_data_ptr->part_len, predicted_orbits_data_ptr->data_ptr.data_ptr_len);
 
@@ -164,29 +1690,235 @@ static int qct_loc_eng_inject_xtra_data(char* data, int length)
 
             if (rpc_ret_val != RPC_LOC_API_SUCCESS)
             {
-                LOGE("qct_loc_eng_inject_xtra_data: loc_ioctl for xtra returned %d", rpc_ret_val);
-                ret_val = EINVAL; // return error
+                LOGE("loc_eng_xtra_inject_parts: loc_ioctl for xtra returned %d", rpc_ret_val);
+                ret_val = LOC_ENG_XTRA_INJECT_FAILED;
                 break;
             }
         }
         else // part == total_parts
         {
             // Last part injection, will need to wait for callback
-            ret_val = loc_eng_ioctl (loc_eng_data.client_handle,
-                                  RPC_LOC_IOCTL_INJECT_PREDICTED_ORBITS_DATA,
-                                  &ioctl_data,
-                                  LOC_XTRA_INJECT_DEFAULT_TIMEOUT,
-                                  NULL /* No output information is expected*/);
-            if (ret_val != TRUE)
+            if (loc_eng_ioctl (loc_eng_data.client_handle,
+                               RPC_LOC_IOCTL_INJECT_PREDICTED_ORBITS_DATA,
+                               &ioctl_data,
+                               LOC_XTRA_INJECT_DEFAULT_TIMEOUT,
+                               NULL /* No output information is expected*/) != TRUE)
             {
-                LOGE("qct_loc_eng_inject_xtra_data: loc_eng_ioctl for xtra returned FALSE");
+                LOGE("loc_eng_xtra_inject_parts: loc_eng_ioctl for xtra returned FALSE");
+                ret_val = LOC_ENG_XTRA_INJECT_FAILED;
                 break;
             }
         }
 
         len_injected += predicted_orbits_data_ptr->part_len;
-        LOGV("qct_loc_eng_inject_xtra_data: loc_ioctl for xtra len injected %d", len_injected);
+        LOGV("loc_eng_xtra_inject_parts: loc_ioctl for xtra len injected %d", len_injected);
+
+        if (part < total_parts)
+        {
+            loc_eng_xtra_report_status (LOC_ENG_XTRA_INJECT_IN_PROGRESS, len_injected, length);
+        }
+    }
+
+    free (part_buf);
+
+    return ret_val;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_inject_compressed
+
+DESCRIPTION
+   Injects a gzip or zlib compressed XTRA file. The file is inflated a part
+   at a time while it is injected, the inflated file is never held whole.
+   inflated_length is the size found when the file was checked, a file
+   handed over unchecked, with 0, is checked first. A file with only a
+   zlib header that does not inflate is injected raw.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   LOC_ENG_XTRA_INJECT_DONE, _FAILED or _CANCELLED
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static loc_eng_xtra_inject_status_e_type loc_eng_xtra_inject_compressed (char* data, uint32 length,
+                                                                        uint32 inflated_length, uint32 seq)
+{
+    loc_eng_xtra_inject_status_e_type ret_val;
+    z_stream inflater;
+
+    // The parts need the inflated size up front
+    if (inflated_length == 0 && loc_eng_xtra_inflate_check (data, length, &inflated_length) == FALSE)
+    {
+        if (loc_eng_xtra_is_gzip (data, length) == FALSE && loc_eng_xtra_check_raw (data, length) == TRUE)
+        {
+            LOGD("loc_eng_xtra_inject_compressed: zlib header does not inflate, injecting the file raw");
+            return loc_eng_xtra_inject_parts (data, length, seq, FALSE, NULL);
+        }
+        return LOC_ENG_XTRA_INJECT_FAILED;
+    }
+    if (loc_eng_xtra_inflate_init (&inflater, data, length) == FALSE)
+    {
+        return LOC_ENG_XTRA_INJECT_FAILED;
     }
 
+    ret_val = loc_eng_xtra_inject_parts (NULL, inflated_length, seq, FALSE, &inflater);
+    inflateEnd (&inflater);
+
     return ret_val;
 }
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_inject_thread
+
+DESCRIPTION
+   Injects the XTRA files handed over by loc_eng_xtra_hand_over, one at a
+   time, and reports how each one ended.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void* loc_eng_xtra_inject_thread (void* arg)
+{
+    loc_eng_xtra_data_s_type *xtra_ptr = (loc_eng_xtra_data_s_type *) arg;
+    loc_eng_xtra_inject_status_e_type status;
+    char*   data;
+    uint32  length;
+    uint32  inflated_length;
+    uint32  seq;
+    uint64_t hash;
+    boolean is_mapped;
+    boolean streamed;
+    boolean whole;
+
+    pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+    while (xtra_ptr->inject_thread_need_exit == FALSE)
+    {
+        if (xtra_ptr->inject_data == NULL)
+        {
+            if (xtra_ptr->refresh_time_utc == 0)
+            {
+                pthread_cond_wait (&xtra_ptr->inject_cond, &xtra_ptr->xtra_mutex);
+            }
+            else if (time (NULL) < xtra_ptr->refresh_time_utc)
+            {
+                // Wall clock deadline, the validity is in UTC
+                struct timespec refresh_time = { xtra_ptr->refresh_time_utc, 0 };
+                pthread_cond_timedwait (&xtra_ptr->inject_cond, &xtra_ptr->xtra_mutex, &refresh_time);
+            }
+            else
+            {
+                LOGD("loc_eng_xtra_inject_thread: xtra data about to expire, refreshing");
+                xtra_ptr->refresh_time_utc = 0;
+                pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+                loc_eng_xtra_request_download ();
+                pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+            }
+            continue;
+        }
+
+        data = xtra_ptr->inject_data;
+        length = xtra_ptr->inject_length;
+        inflated_length = xtra_ptr->inject_inflated_length;
+        is_mapped = xtra_ptr->inject_is_mapped;
+        seq = xtra_ptr->inject_seq;
+        streamed = xtra_ptr->inject_streaming;
+        xtra_ptr->inject_data = NULL;
+        pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+
+        // A streamed file is only hashed once it is complete
+        hash = streamed ? 0 : loc_eng_xtra_hash (data, length);
+        if (streamed == FALSE && loc_eng_xtra_is_duplicate (hash) == TRUE)
+        {
+            LOGD("loc_eng_xtra_inject_thread: modem already has this xtra file, hash %llx",
+                 (unsigned long long) hash);
+            pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+            xtra_ptr->inject_skipped++;
+            pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+            status = LOC_ENG_XTRA_INJECT_DONE;
+        }
+        else
+        {
+            status = LOC_ENG_XTRA_INJECT_IN_PROGRESS;
+            whole = (streamed == TRUE) ? FALSE : TRUE;
+            if (streamed == TRUE)
+            {
+                // The parts of a compressed stream need its inflated size,
+                // and a stream too short for a raw file can only be a
+                // compressed one: these go in once complete, as a whole file
+                status = loc_eng_xtra_wait_for_part (2, FALSE, seq);
+                if (status == LOC_ENG_XTRA_INJECT_IN_PROGRESS &&
+                    (length < LOC_ENG_XTRA_MIN_FILE_SIZE || loc_eng_xtra_is_compressed (data, 2) == TRUE))
+                {
+                    LOGD("loc_eng_xtra_inject_thread: compressed stream, injected once complete");
+                    whole = TRUE;
+                    status = loc_eng_xtra_wait_for_part (length, TRUE, seq);
+                    if (status == LOC_ENG_XTRA_INJECT_IN_PROGRESS &&
+                        loc_eng_xtra_check_file (data, length, &inflated_length) == FALSE)
+                    {
+                        status = LOC_ENG_XTRA_INJECT_FAILED;
+                    }
+                }
+            }
+
+            if (status != LOC_ENG_XTRA_INJECT_IN_PROGRESS)
+            {
+                LOGD("loc_eng_xtra_inject_thread: stream not injected, status %d", status);
+            }
+            else if (whole == TRUE && loc_eng_xtra_is_compressed (data, length) == TRUE)
+            {
+                status = loc_eng_xtra_inject_compressed (data, length, inflated_length, seq);
+            }
+            else
+            {
+                status = loc_eng_xtra_inject_parts (data, length, seq, whole == FALSE, NULL);
+            }
+            if (status == LOC_ENG_XTRA_INJECT_DONE)
+            {
+                loc_eng_xtra_save_hash (xtra_ptr, streamed ? loc_eng_xtra_hash (data, length) : hash);
+            }
+        }
+
+        // Later appends to a failed stream must not touch the released file
+        pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+        if (xtra_ptr->stream_data == data)
+        {
+            xtra_ptr->inject_streaming = FALSE;
+            xtra_ptr->stream_data = NULL;
+        }
+        pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+        loc_eng_xtra_release_data (data, length, is_mapped);
+
+        LOGD("loc_eng_xtra_inject_thread: xtra file of %d bytes, status %d", length, status);
+        loc_eng_xtra_report_status (status, status == LOC_ENG_XTRA_INJECT_DONE ? length : 0, length);
+
+        // Schedule the refresh of the new data
+        if (status == LOC_ENG_XTRA_INJECT_DONE)
+        {
+            loc_eng_xtra_query_validity (FALSE);
+        }
+
+        pthread_mutex_lock (&xtra_ptr->xtra_mutex);
+    }
+
+    // A file handed over during cleanup is never injected
+    data = xtra_ptr->inject_data;
+    length = xtra_ptr->inject_length;
+    is_mapped = xtra_ptr->inject_is_mapped;
+    xtra_ptr->inject_data = NULL;
+    pthread_mutex_unlock (&xtra_ptr->xtra_mutex);
+
+    loc_eng_xtra_release_data (data, length, is_mapped);
+
+    return NULL;
+}
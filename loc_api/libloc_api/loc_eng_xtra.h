@@ -36,6 +36,40 @@ $Author: $
 
 extern const GpsXtraInterface sLocEngXTRAInterface;
 
+// part_len of an XTRA part is 16 bit and total_parts 8 bit on the wire
+#define LOC_ENG_XTRA_MAX_PART_SIZE      0xFFFF
+#define LOC_ENG_XTRA_MAX_PARTS          0xFF
+
+// Files failing these checks are refused before any part is sent
+#define LOC_ENG_XTRA_MIN_FILE_SIZE      1024
+#define LOC_ENG_XTRA_ZERO_TAIL_SIZE     512
+// Scratch buffer for checking a compressed XTRA file
+#define LOC_ENG_XTRA_INFLATE_BUF_SIZE   4096
+
+#define LOC_ENG_XTRA_HASH_FILE          "/data/misc/gps/xtra_hash"
+
+// A download request is considered lost after this long without a file
+#define LOC_ENG_XTRA_DOWNLOAD_TIMEOUT   (5 * 60)   // seconds
+// Data is refreshed this long before it expires
+#define LOC_ENG_XTRA_REFRESH_MARGIN     (4 * 3600) // seconds
+
+// Progress of a background XTRA injection
+typedef enum
+{
+    LOC_ENG_XTRA_INJECT_IN_PROGRESS,   // a part has been injected
+    LOC_ENG_XTRA_INJECT_DONE,          // the modem took the file
+    LOC_ENG_XTRA_INJECT_FAILED,
+    LOC_ENG_XTRA_INJECT_CANCELLED      // replaced by a newer file or cleanup
+} loc_eng_xtra_inject_status_e_type;
+
+// Called from the injection thread after each part and once at the end
+typedef void (*loc_eng_xtra_inject_status_cb_type)
+(
+    loc_eng_xtra_inject_status_e_type    status,
+    uint32                               bytes_injected,
+    uint32                               total_size
+);
+
 // Module data
 typedef struct
 {
@@ -43,6 +77,68 @@ typedef struct
     gps_xtra_download_request      download_request_cb;
     pthread_mutex_t                xtra_mutex;
 
+    // A download has been asked for and no file has come in yet
+    boolean                        download_in_flight;
+    struct timespec                download_request_time;    // CLOCK_MONOTONIC
+    // UTC time of the proactive refresh before the data expires, 0 if none
+    time_t                         refresh_time_utc;
+    uint32                         download_requests_received;
+    uint32                         download_requests_forwarded;
+
+    // Limits from RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_SOURCE
+    boolean                        source_is_valid;
+    uint32                         max_file_size;
+    uint32                         max_part_size;
+
+    // Background injection, the thread owns inject_data once handed over
+    pthread_t                      inject_thread;
+    pthread_cond_t                 inject_cond;
+    boolean                        inject_thread_need_exit;
+    char                          *inject_data;
+    uint32                         inject_length;
+    // inject_data is a read-only mapping of an XTRA file instead of malloc'd
+    boolean                        inject_is_mapped;
+    // Inflated size of a compressed inject_data found when it was checked,
+    // 0 if it is not compressed or was handed over unchecked
+    uint32                         inject_inflated_length;
+    // Incremented by each new file, the running injection stops on a change
+    uint32                         inject_seq;
+    loc_eng_xtra_inject_status_cb_type inject_status_cb;
+
+    // Hash of the last file the modem took, see loc_eng_xtra_is_duplicate
+    boolean                        last_hash_is_valid;
+    uint64_t                       last_hash;
+    uint32                         inject_skipped;
+
+    // Bytes of inject_data present so far, all of them unless streaming
+    uint32                         inject_available;
+    boolean                        inject_streaming;
+    // File filled by loc_eng_xtra_stream_append, NULL once the stream ended
+    char                          *stream_data;
+    uint32                         stream_length;
+
 } loc_eng_xtra_data_s_type;
 
+extern void loc_eng_xtra_module_init (loc_eng_xtra_data_s_type *xtra_ptr);
+extern void loc_eng_xtra_module_deinit (loc_eng_xtra_data_s_type *xtra_ptr);
+
+// Asks the framework for an XTRA file unless one is on the way or the
+// modem's data is still fresh
+extern void loc_eng_xtra_request_download (void);
+
+// Asks the framework for the XTRA file, when the HAL download failed
+extern void loc_eng_xtra_forward_download (void);
+extern boolean loc_eng_xtra_is_compressed (const char* data, uint32 length);
+
+// Injects a malloc'd XTRA file in the background and frees it when done
+extern int loc_eng_xtra_inject_async (char* data, uint32 length);
+// Injects an XTRA file in the background straight from a mapping of path
+extern int loc_eng_xtra_inject_file (const char* path);
+// Injects an XTRA file while it is being downloaded
+extern int loc_eng_xtra_stream_begin (uint32 total_size);
+extern int loc_eng_xtra_stream_append (const char* data, uint32 length);
+extern int loc_eng_xtra_stream_finish (void);
+extern void loc_eng_xtra_set_inject_status_cb (loc_eng_xtra_inject_status_cb_type status_cb);
+extern void loc_eng_xtra_set_hash_file (const char* path);
+
 #endif // LOC_ENG_XTRA_H
@@ -0,0 +1,1136 @@
+/******************************************************************************
+  @file:  loc_eng_xtra_download.cpp
+  @brief:
+
+  DESCRIPTION
+    This file implements the HAL side XTRA downloader: a small HTTP/1.0
+    client that fetches the XTRA file from the servers advertised by the
+    modem, keeps a latency and success score per server and feeds the file
+    to the XTRA injection as it arrives.
+
+  INITIALIZATION AND SEQUENCING REQUIREMENTS
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+         Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer. 
+
+         Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution. 
+
+         Neither the name of the QUALCOMM USA, INC.  nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  -----------------------------------------------------------------------------
+
+******************************************************************************/
+
+/*=====================================================================
+$Header: $
+$DateTime: $
+$Author: $
+======================================================================*/
+#define LOG_NDEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <rpc/rpc.h>
+#include <loc_api_rpc_glue.h>
+
+#include <hardware_legacy/gps.h>
+#include <cutils/properties.h>
+#include <cutils/memory.h>
+
+#include <loc_eng.h>
+
+#define LOG_TAG "lib_locapi"
+#include <utils/Log.h>
+
+// comment this out to enable logging
+// #undef LOGD
+// #define LOGD(...) {}
+
+// Room for the status line and headers of a response
+#define LOC_ENG_XTRA_HTTP_HEADER_SIZE    2048
+#define LOC_ENG_XTRA_HTTP_REQUEST_SIZE   (LOC_ENG_XTRA_MAX_URL_LEN + 256)
+// Bytes read from the socket at a time
+#define LOC_ENG_XTRA_HTTP_CHUNK_SIZE     4096
+
+// Progress of one server connection until the response headers are in
+typedef enum
+{
+    LOC_ENG_XTRA_HTTP_IDLE,
+    LOC_ENG_XTRA_HTTP_CONNECTING,
+    LOC_ENG_XTRA_HTTP_SENDING,
+    LOC_ENG_XTRA_HTTP_HEADERS,
+    LOC_ENG_XTRA_HTTP_BODY
+} loc_eng_xtra_http_state_e_type;
+
+typedef struct
+{
+    loc_eng_xtra_http_state_e_type state;
+    int                            server;
+    int                            fd;
+    struct timespec                start_time;
+    char                           request[LOC_ENG_XTRA_HTTP_REQUEST_SIZE];
+    uint32                         request_len;
+    uint32                         request_sent;
+    // Headers, followed by the first bytes of the body once they are in
+    char                           header[LOC_ENG_XTRA_HTTP_HEADER_SIZE + 1];
+    uint32                         header_len;
+    uint32                         body_offset;
+    int32                          content_length;    // -1 if not given
+    boolean                        content_encoded;
+} loc_eng_xtra_http_conn_s_type;
+
+static void* loc_eng_xtra_download_thread (void* arg);
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_download_init
+
+DESCRIPTION
+   Initializes the downloader and starts its thread.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_xtra_download_init (loc_eng_xtra_download_data_s_type *dl_ptr)
+{
+    char propBuf[PROPERTY_VALUE_MAX];
+
+    property_get("gps.xtra.hal_download", propBuf, "0");
+    dl_ptr->enabled = propBuf[0] == '1';
+    dl_ptr->requested = FALSE;
+    dl_ptr->thread_need_exit = FALSE;
+    dl_ptr->server_count = 0;
+    dl_ptr->downloads_ok = 0;
+    dl_ptr->downloads_failed = 0;
+    dl_ptr->last_server = -1;
+
+    if (pipe (dl_ptr->wake_fd) != 0)
+    {
+        LOGE("loc_eng_xtra_download_init: pipe failed, errno = %d", errno);
+        dl_ptr->wake_fd[0] = dl_ptr->wake_fd[1] = -1;
+    }
+    pthread_mutex_init (&dl_ptr->lock, NULL);
+    pthread_cond_init (&dl_ptr->cond, NULL);
+    pthread_create (&dl_ptr->thread, NULL, loc_eng_xtra_download_thread, dl_ptr);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_download_deinit
+
+DESCRIPTION
+   Aborts the download in progress and stops the downloader thread.
+
+DEPENDENCIES
+   Called before the XTRA module is deinitialized
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_xtra_download_deinit (loc_eng_xtra_download_data_s_type *dl_ptr)
+{
+    pthread_mutex_lock (&dl_ptr->lock);
+    dl_ptr->thread_need_exit = TRUE;
+    pthread_cond_signal (&dl_ptr->cond);
+    pthread_mutex_unlock (&dl_ptr->lock);
+    if (dl_ptr->wake_fd[1] >= 0)
+    {
+        ssize_t written;
+        do
+        {
+            written = write (dl_ptr->wake_fd[1], "x", 1);
+        } while (written < 0 && errno == EINTR);
+        if (written < 0)
+        {
+            // The download still ends at its next timeout
+            LOGE ("loc_eng_xtra_download_deinit: wake up failed, errno = %d", errno);
+        }
+    }
+
+    pthread_join (dl_ptr->thread, NULL);
+
+    if (dl_ptr->wake_fd[0] >= 0)
+    {
+        close (dl_ptr->wake_fd[0]);
+        close (dl_ptr->wake_fd[1]);
+    }
+    pthread_cond_destroy (&dl_ptr->cond);
+    pthread_mutex_destroy (&dl_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_download_enable
+
+DESCRIPTION
+   Turns the HAL side download on or off, overriding gps.xtra.hal_download.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_xtra_download_enable (boolean enable)
+{
+    loc_eng_xtra_download_data_s_type *dl_ptr = &(loc_eng_data.xtra_download_data);
+
+    pthread_mutex_lock (&dl_ptr->lock);
+    dl_ptr->enabled = enable;
+    pthread_mutex_unlock (&dl_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_download_set_servers
+
+DESCRIPTION
+   Takes the XTRA servers advertised by the modem. A server that was
+   already known keeps its score.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+void loc_eng_xtra_download_set_servers (char* const servers[], int count)
+{
+    loc_eng_xtra_download_data_s_type *dl_ptr = &(loc_eng_data.xtra_download_data);
+    loc_eng_xtra_server_s_type old_servers[LOC_ENG_XTRA_MAX_SERVERS];
+    loc_eng_xtra_server_s_type *server_ptr;
+    int old_count, i, j;
+
+    pthread_mutex_lock (&dl_ptr->lock);
+    memcpy (old_servers, dl_ptr->servers, sizeof (old_servers));
+    old_count = dl_ptr->server_count;
+    dl_ptr->server_count = 0;
+
+    for (i = 0; i < count && i < LOC_ENG_XTRA_MAX_SERVERS; i++)
+    {
+        if (servers[i] == NULL || servers[i][0] == '\0')
+        {
+            continue;
+        }
+
+        server_ptr = &(dl_ptr->servers[dl_ptr->server_count++]);
+        memset (server_ptr, 0, sizeof (*server_ptr));
+        strlcpy (server_ptr->url, servers[i], sizeof (server_ptr->url));
+        for (j = 0; j < old_count; j++)
+        {
+            if (strcmp (old_servers[j].url, server_ptr->url) == 0)
+            {
+                *server_ptr = old_servers[j];
+                break;
+            }
+        }
+        LOGD("loc_eng_xtra_download_set_servers: server %d = %s", dl_ptr->server_count - 1, server_ptr->url);
+    }
+    pthread_mutex_unlock (&dl_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_download_start
+
+DESCRIPTION
+   Starts downloading the XTRA file in the downloader thread. A download
+   already in progress covers the request.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if the HAL downloads the file
+   FALSE if it is disabled or no server is known, the framework has to
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+boolean loc_eng_xtra_download_start (void)
+{
+    loc_eng_xtra_download_data_s_type *dl_ptr = &(loc_eng_data.xtra_download_data);
+    boolean ret_val = FALSE;
+
+    pthread_mutex_lock (&dl_ptr->lock);
+    if (dl_ptr->enabled == TRUE && dl_ptr->server_count > 0)
+    {
+        dl_ptr->requested = TRUE;
+        pthread_cond_signal (&dl_ptr->cond);
+        ret_val = TRUE;
+    }
+    pthread_mutex_unlock (&dl_ptr->lock);
+
+    return ret_val;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_download_msec_since
+
+DESCRIPTION
+   Milliseconds from a CLOCK_MONOTONIC time to now, negative if it is ahead.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   msec
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static int32 loc_eng_xtra_download_msec_since (const struct timespec *time_ptr)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (int32) ((now.tv_sec - time_ptr->tv_sec) * 1000 + (now.tv_nsec - time_ptr->tv_nsec) / 1000000);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_download_order
+
+DESCRIPTION
+   Sorts the servers in the order they are tried: servers not backing off
+   from a failure first, unmeasured ones before the rest so they get a
+   score, then by latency; servers backing off last, the one free soonest
+   first.
+
+DEPENDENCIES
+   Called with the downloader lock held
+
+RETURN VALUE
+   Number of servers in order
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static int loc_eng_xtra_download_order (loc_eng_xtra_download_data_s_type *dl_ptr, int order[])
+{
+    int32 key[LOC_ENG_XTRA_MAX_SERVERS];
+    int i, j, tmp;
+
+    for (i = 0; i < dl_ptr->server_count; i++)
+    {
+        order[i] = i;
+        if (loc_eng_xtra_download_msec_since (&dl_ptr->servers[i].retry_time) < 0)
+        {
+            key[i] = LOC_ENG_XTRA_BACKOFF_MAX * 1000 - loc_eng_xtra_download_msec_since (&dl_ptr->servers[i].retry_time);
+        }
+        else
+        {
+            key[i] = dl_ptr->servers[i].latency_msec;
+        }
+    }
+
+    // At most three servers
+    for (i = 1; i < dl_ptr->server_count; i++)
+    {
+        for (j = i; j > 0 && key[order[j]] < key[order[j - 1]]; j--)
+        {
+            tmp = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = tmp;
+        }
+    }
+
+    return dl_ptr->server_count;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_download_score
+
+DESCRIPTION
+   Updates the score of a server after a download from it.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_xtra_download_score (loc_eng_xtra_download_data_s_type *dl_ptr, int server,
+                                         boolean success, uint32 latency_msec)
+{
+    loc_eng_xtra_server_s_type *server_ptr;
+    uint32 backoff, i;
+
+    pthread_mutex_lock (&dl_ptr->lock);
+    server_ptr = &(dl_ptr->servers[server]);
+    if (success == TRUE)
+    {
+        server_ptr->successes++;
+        server_ptr->consecutive_failures = 0;
+        server_ptr->retry_time.tv_sec = 0;
+        server_ptr->retry_time.tv_nsec = 0;
+        if (latency_msec == 0)
+        {
+            latency_msec = 1;
+        }
+        server_ptr->latency_msec = server_ptr->latency_msec == 0 ? latency_msec :
+                                   (3 * server_ptr->latency_msec + latency_msec) / 4;
+    }
+    else
+    {
+        server_ptr->failures++;
+        server_ptr->consecutive_failures++;
+        backoff = LOC_ENG_XTRA_BACKOFF_MIN;
+        for (i = 1; i < server_ptr->consecutive_failures && backoff < LOC_ENG_XTRA_BACKOFF_MAX; i++)
+        {
+            backoff *= 2;
+        }
+        if (backoff > LOC_ENG_XTRA_BACKOFF_MAX)
+        {
+            backoff = LOC_ENG_XTRA_BACKOFF_MAX;
+        }
+        clock_gettime (CLOCK_MONOTONIC, &server_ptr->retry_time);
+        server_ptr->retry_time.tv_sec += backoff;
+    }
+    LOGD("loc_eng_xtra_download_score: %s %s, latency %d ms, %d ok, %d failed", server_ptr->url,
+         success ? "ok" : "failed", server_ptr->latency_msec, server_ptr->successes, server_ptr->failures);
+    pthread_mutex_unlock (&dl_ptr->lock);
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_http_open
+
+DESCRIPTION
+   Starts a non-blocking connection to an http:// URL and prepares the GET
+   request. Name resolution blocks the downloader thread.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if the connection is on its way
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_xtra_http_open (loc_eng_xtra_http_conn_s_type *conn_ptr, int server, const char* url)
+{
+    char host[LOC_ENG_XTRA_MAX_URL_LEN];
+    const char *host_ptr, *path_ptr, *port_ptr;
+    char port[8] = "80";
+    struct addrinfo hints, *res;
+    size_t host_len;
+    int fd;
+
+    memset (conn_ptr, 0, sizeof (*conn_ptr));
+    conn_ptr->server = server;
+    conn_ptr->fd = -1;
+    conn_ptr->content_length = -1;
+    clock_gettime (CLOCK_MONOTONIC, &conn_ptr->start_time);
+
+    if (strncmp (url, "http://", 7) != 0)
+    {
+        LOGE("loc_eng_xtra_http_open: unsupported url %s", url);
+        return FALSE;
+    }
+    host_ptr = url + 7;
+    path_ptr = strchr (host_ptr, '/');
+    if (path_ptr == NULL)
+    {
+        path_ptr = "/";
+        host_len = strlen (host_ptr);
+    }
+    else
+    {
+        host_len = path_ptr - host_ptr;
+    }
+    if (host_len == 0 || host_len >= sizeof (host))
+    {
+        return FALSE;
+    }
+    memcpy (host, host_ptr, host_len);
+    host[host_len] = '\0';
+
+    port_ptr = strchr (host, ':');
+    if (port_ptr != NULL)
+    {
+        strlcpy (port, port_ptr + 1, sizeof (port));
+        host[port_ptr - host] = '\0';
+    }
+
+    conn_ptr->request_len = snprintf (conn_ptr->request, sizeof (conn_ptr->request),
+                                      "GET %s HTTP/1.0\r\n"
+                                      "Host: %s\r\n"
+                                      "Accept: */*\r\n"
+                                      "Accept-Encoding: gzip, deflate\r\n"
+                                      "Connection: close\r\n\r\n",
+                                      path_ptr, host);
+    if (conn_ptr->request_len >= sizeof (conn_ptr->request))
+    {
+        return FALSE;
+    }
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo (host, port, &hints, &res) != 0)
+    {
+        LOGE("loc_eng_xtra_http_open: cannot resolve %s", host);
+        return FALSE;
+    }
+
+    fd = socket (res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0)
+    {
+        fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+        if (connect (fd, res->ai_addr, res->ai_addrlen) != 0 && errno != EINPROGRESS)
+        {
+            close (fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo (res);
+
+    if (fd < 0)
+    {
+        LOGE("loc_eng_xtra_http_open: cannot connect to %s, errno = %d", url, errno);
+        return FALSE;
+    }
+
+    conn_ptr->fd = fd;
+    conn_ptr->state = LOC_ENG_XTRA_HTTP_CONNECTING;
+    return TRUE;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_http_close
+
+DESCRIPTION
+   Closes a server connection.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void loc_eng_xtra_http_close (loc_eng_xtra_http_conn_s_type *conn_ptr)
+{
+    if (conn_ptr->fd >= 0)
+    {
+        close (conn_ptr->fd);
+    }
+    conn_ptr->fd = -1;
+    conn_ptr->state = LOC_ENG_XTRA_HTTP_IDLE;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_http_parse_header
+
+DESCRIPTION
+   Parses the status line and the headers of a response once they are
+   complete.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   1 if the response is a 200 and the body follows at body_offset
+   0 if the headers are not complete yet
+  -1 on any other response
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static int loc_eng_xtra_http_parse_header (loc_eng_xtra_http_conn_s_type *conn_ptr)
+{
+    char *end_ptr, *line_ptr, *next_ptr;
+    int status = 0;
+
+    conn_ptr->header[conn_ptr->header_len] = '\0';
+    end_ptr = strstr (conn_ptr->header, "\r\n\r\n");
+    if (end_ptr == NULL)
+    {
+        return conn_ptr->header_len < LOC_ENG_XTRA_HTTP_HEADER_SIZE ? 0 : -1;
+    }
+    conn_ptr->body_offset = end_ptr + 4 - conn_ptr->header;
+    *end_ptr = '\0';
+
+    if (sscanf (conn_ptr->header, "HTTP/%*d.%*d %d", &status) != 1 || status != 200)
+    {
+        LOGE("loc_eng_xtra_http_parse_header: server answered %d", status);
+        return -1;
+    }
+
+    for (line_ptr = strstr (conn_ptr->header, "\r\n"); line_ptr != NULL; line_ptr = next_ptr)
+    {
+        line_ptr += 2;
+        next_ptr = strstr (line_ptr, "\r\n");
+        if (strncasecmp (line_ptr, "Content-Length:", 15) == 0)
+        {
+            conn_ptr->content_length = atoi (line_ptr + 15);
+        }
+        else if (strncasecmp (line_ptr, "Content-Encoding:", 17) == 0)
+        {
+            conn_ptr->content_encoded = strstr (line_ptr + 17, "identity") == NULL;
+        }
+    }
+
+    return 1;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_http_progress
+
+DESCRIPTION
+   Moves a connection on after poll reported it ready: completes the
+   connect, sends the request and reads the response headers.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   1 once the headers of a 200 response are in, 0 to keep going, -1 if the
+   server failed
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static int loc_eng_xtra_http_progress (loc_eng_xtra_http_conn_s_type *conn_ptr)
+{
+    socklen_t len;
+    ssize_t n;
+    int err = 0;
+
+    switch (conn_ptr->state)
+    {
+        case LOC_ENG_XTRA_HTTP_CONNECTING:
+            len = sizeof (err);
+            if (getsockopt (conn_ptr->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0)
+            {
+                LOGE("loc_eng_xtra_http_progress: connect failed, error = %d", err);
+                return -1;
+            }
+            conn_ptr->state = LOC_ENG_XTRA_HTTP_SENDING;
+            // fall through
+
+        case LOC_ENG_XTRA_HTTP_SENDING:
+            n = send (conn_ptr->fd, conn_ptr->request + conn_ptr->request_sent,
+                      conn_ptr->request_len - conn_ptr->request_sent, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                return errno == EAGAIN ? 0 : -1;
+            }
+            conn_ptr->request_sent += n;
+            if (conn_ptr->request_sent == conn_ptr->request_len)
+            {
+                conn_ptr->state = LOC_ENG_XTRA_HTTP_HEADERS;
+            }
+            return 0;
+
+        case LOC_ENG_XTRA_HTTP_HEADERS:
+            n = recv (conn_ptr->fd, conn_ptr->header + conn_ptr->header_len,
+                      LOC_ENG_XTRA_HTTP_HEADER_SIZE - conn_ptr->header_len, 0);
+            if (n < 0)
+            {
+                return errno == EAGAIN ? 0 : -1;
+            }
+            if (n == 0)
+            {
+                return -1;
+            }
+            conn_ptr->header_len += n;
+            return loc_eng_xtra_http_parse_header (conn_ptr);
+
+        default:
+            return -1;
+    }
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_download_wait
+
+DESCRIPTION
+   poll() on the given descriptors and the wake pipe.
+
+DEPENDENCIES
+   fds[count] is free for the wake pipe
+
+RETURN VALUE
+   FALSE if the downloader has to stop
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_xtra_download_wait (loc_eng_xtra_download_data_s_type *dl_ptr,
+                                           struct pollfd fds[], int count, int timeout_msec)
+{
+    fds[count].fd = dl_ptr->wake_fd[0];
+    fds[count].events = POLLIN;
+    fds[count].revents = 0;
+
+    if (poll (fds, count + 1, timeout_msec) < 0 && errno != EINTR)
+    {
+        return FALSE;
+    }
+
+    return fds[count].revents == 0;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_download_connect
+
+DESCRIPTION
+   Gets the response headers of the first server to answer. The servers
+   are tried in order; when one fails the next is tried at once, and when
+   one is slow to answer the next one is raced against it. The losers of a
+   race are closed without counting as failures, but their latency is
+   raised to the time they had already taken so they stop leading the
+   order.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE with the winning connection in conn_ptr
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_xtra_download_connect (loc_eng_xtra_download_data_s_type *dl_ptr,
+                                              const int order[], int count,
+                                              loc_eng_xtra_http_conn_s_type *conn_ptr)
+{
+    loc_eng_xtra_http_conn_s_type conns[LOC_ENG_XTRA_MAX_SERVERS];
+    struct pollfd fds[LOC_ENG_XTRA_MAX_SERVERS + 1];
+    int map[LOC_ENG_XTRA_MAX_SERVERS];
+    char url[LOC_ENG_XTRA_MAX_URL_LEN];
+    struct timespec hedge_time;
+    uint32 latency;
+    int next = 0, active, winner = -1, timeout, elapsed, i, n;
+    boolean ret_val = FALSE;
+
+    for (i = 0; i < count; i++)
+    {
+        conns[i].fd = -1;
+        conns[i].state = LOC_ENG_XTRA_HTTP_IDLE;
+    }
+
+    while (winner < 0)
+    {
+        // Start the next server if none is running or the hedge delay is over
+        active = 0;
+        for (i = 0; i < next; i++)
+        {
+            active += conns[i].state != LOC_ENG_XTRA_HTTP_IDLE;
+        }
+        if (next < count && (active == 0 || loc_eng_xtra_download_msec_since (&hedge_time) >= 0))
+        {
+            pthread_mutex_lock (&dl_ptr->lock);
+            strlcpy (url, dl_ptr->servers[order[next]].url, sizeof (url));
+            latency = dl_ptr->servers[order[next]].latency_msec;
+            pthread_mutex_unlock (&dl_ptr->lock);
+
+            LOGD("loc_eng_xtra_download_connect: trying %s", url);
+            if (loc_eng_xtra_http_open (&conns[next], order[next], url) == FALSE)
+            {
+                loc_eng_xtra_download_score (dl_ptr, order[next], FALSE, 0);
+                loc_eng_xtra_http_close (&conns[next]);
+            }
+            else
+            {
+                active++;
+            }
+            clock_gettime (CLOCK_MONOTONIC, &hedge_time);
+            latency = latency == 0 ? LOC_ENG_XTRA_HEDGE_DELAY : 2 * latency;
+            if (latency < LOC_ENG_XTRA_HEDGE_MIN_DELAY)
+            {
+                latency = LOC_ENG_XTRA_HEDGE_MIN_DELAY;
+            }
+            hedge_time.tv_sec += latency / 1000;
+            hedge_time.tv_nsec += (latency % 1000) * 1000000;
+            if (hedge_time.tv_nsec >= 1000000000)
+            {
+                hedge_time.tv_sec++;
+                hedge_time.tv_nsec -= 1000000000;
+            }
+            next++;
+            continue;
+        }
+        if (active == 0)
+        {
+            break;
+        }
+
+        // Wait for the running connections, the connect timeout or the hedge
+        timeout = next < count ? -loc_eng_xtra_download_msec_since (&hedge_time) : LOC_ENG_XTRA_CONNECT_TIMEOUT;
+        for (i = 0, n = 0; i < next; i++)
+        {
+            if (conns[i].state == LOC_ENG_XTRA_HTTP_IDLE)
+            {
+                continue;
+            }
+            elapsed = loc_eng_xtra_download_msec_since (&conns[i].start_time);
+            if (LOC_ENG_XTRA_CONNECT_TIMEOUT - elapsed < timeout)
+            {
+                timeout = LOC_ENG_XTRA_CONNECT_TIMEOUT - elapsed;
+            }
+            fds[n].fd = conns[i].fd;
+            fds[n].events = conns[i].state == LOC_ENG_XTRA_HTTP_HEADERS ? POLLIN : POLLOUT;
+            fds[n].revents = 0;
+            map[n++] = i;
+        }
+        if (loc_eng_xtra_download_wait (dl_ptr, fds, n, timeout < 0 ? 0 : timeout) == FALSE)
+        {
+            break;
+        }
+
+        for (i = 0; i < n && winner < 0; i++)
+        {
+            loc_eng_xtra_http_conn_s_type *c_ptr = &conns[map[i]];
+            int progress = 0;
+
+            if (fds[i].revents != 0)
+            {
+                progress = loc_eng_xtra_http_progress (c_ptr);
+            }
+            else if (loc_eng_xtra_download_msec_since (&c_ptr->start_time) >= LOC_ENG_XTRA_CONNECT_TIMEOUT)
+            {
+                LOGE("loc_eng_xtra_download_connect: server %d timed out", c_ptr->server);
+                progress = -1;
+            }
+
+            if (progress < 0)
+            {
+                loc_eng_xtra_download_score (dl_ptr, c_ptr->server, FALSE, 0);
+                loc_eng_xtra_http_close (c_ptr);
+                // Fail over without waiting for the hedge delay
+                clock_gettime (CLOCK_MONOTONIC, &hedge_time);
+            }
+            else if (progress > 0)
+            {
+                winner = map[i];
+            }
+        }
+    }
+
+    for (i = 0; i < next; i++)
+    {
+        if (i == winner)
+        {
+            *conn_ptr = conns[i];
+            conn_ptr->state = LOC_ENG_XTRA_HTTP_BODY;
+            ret_val = TRUE;
+        }
+        else if (conns[i].state != LOC_ENG_XTRA_HTTP_IDLE)
+        {
+            elapsed = loc_eng_xtra_download_msec_since (&conns[i].start_time);
+            pthread_mutex_lock (&dl_ptr->lock);
+            if (dl_ptr->servers[conns[i].server].latency_msec < (uint32) elapsed)
+            {
+                dl_ptr->servers[conns[i].server].latency_msec = elapsed;
+            }
+            pthread_mutex_unlock (&dl_ptr->lock);
+            loc_eng_xtra_http_close (&conns[i]);
+        }
+    }
+
+    return ret_val;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_download_body
+
+DESCRIPTION
+   Reads the response body and hands it to the XTRA injection. A plain file
+   of known length is streamed into the modem while it downloads, anything
+   else is read whole and injected, so compressed files are inflated.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if the file has been handed over
+
+SIDE EFFECTS
+   Closes the connection
+
+===========================================================================*/
+static boolean loc_eng_xtra_download_body (loc_eng_xtra_download_data_s_type *dl_ptr,
+                                           loc_eng_xtra_http_conn_s_type *conn_ptr)
+{
+    struct pollfd fds[2];
+    uint32 max_size = LOC_ENG_XTRA_MAX_PART_SIZE * LOC_ENG_XTRA_MAX_PARTS;
+    uint32 size, capacity = 0;
+    char *buf = NULL, *new_buf;
+    boolean streamed = FALSE, ok = TRUE, done = FALSE;
+    ssize_t n;
+
+    // The first bytes tell a compressed file, read until there are two
+    size = conn_ptr->header_len - conn_ptr->body_offset;
+    while (size < 2 && ok == TRUE)
+    {
+        fds[0].fd = conn_ptr->fd;
+        fds[0].events = POLLIN;
+        ok = loc_eng_xtra_download_wait (dl_ptr, fds, 1, LOC_ENG_XTRA_READ_TIMEOUT) && fds[0].revents != 0;
+        if (ok == TRUE)
+        {
+            n = recv (conn_ptr->fd, conn_ptr->header + conn_ptr->header_len,
+                      LOC_ENG_XTRA_HTTP_HEADER_SIZE - conn_ptr->header_len, 0);
+            ok = n > 0;
+            if (ok == TRUE)
+            {
+                conn_ptr->header_len += n;
+                size += n;
+            }
+        }
+    }
+
+    if (ok == TRUE && conn_ptr->content_length > 0 && conn_ptr->content_encoded == FALSE &&
+        loc_eng_xtra_is_compressed (conn_ptr->header + conn_ptr->body_offset, size) == FALSE)
+    {
+        streamed = loc_eng_xtra_stream_begin (conn_ptr->content_length) == 0 &&
+                   loc_eng_xtra_stream_append (conn_ptr->header + conn_ptr->body_offset, size) == 0;
+        ok = streamed;
+    }
+    else if (ok == TRUE)
+    {
+        capacity = conn_ptr->content_length > 0 ? conn_ptr->content_length : LOC_ENG_XTRA_HTTP_CHUNK_SIZE * 16;
+        if (capacity < size || capacity > max_size)
+        {
+            capacity = max_size;
+        }
+        buf = (char*) malloc (capacity);
+        ok = buf != NULL;
+        if (ok == TRUE)
+        {
+            memcpy (buf, conn_ptr->header + conn_ptr->body_offset, size);
+        }
+    }
+
+    while (ok == TRUE && done == FALSE)
+    {
+        if (conn_ptr->content_length >= 0 && size >= (uint32) conn_ptr->content_length)
+        {
+            done = TRUE;
+            break;
+        }
+
+        fds[0].fd = conn_ptr->fd;
+        fds[0].events = POLLIN;
+        if (loc_eng_xtra_download_wait (dl_ptr, fds, 1, LOC_ENG_XTRA_READ_TIMEOUT) == FALSE ||
+            fds[0].revents == 0)
+        {
+            LOGE("loc_eng_xtra_download_body: stopped or timed out after %d bytes", size);
+            ok = FALSE;
+            break;
+        }
+
+        if (streamed == TRUE)
+        {
+            char chunk[LOC_ENG_XTRA_HTTP_CHUNK_SIZE];
+
+            n = recv (conn_ptr->fd, chunk, sizeof (chunk), 0);
+            if (n > 0)
+            {
+                ok = loc_eng_xtra_stream_append (chunk, n) == 0;
+            }
+        }
+        else
+        {
+            if (size == capacity)
+            {
+                new_buf = capacity < max_size ? (char*) realloc (buf, capacity * 2 < max_size ? capacity * 2 : max_size) : NULL;
+                if (new_buf == NULL)
+                {
+                    LOGE("loc_eng_xtra_download_body: xtra file larger than %d bytes", capacity);
+                    ok = FALSE;
+                    break;
+                }
+                buf = new_buf;
+                capacity = capacity * 2 < max_size ? capacity * 2 : max_size;
+            }
+            n = recv (conn_ptr->fd, buf + size, capacity - size, 0);
+        }
+
+        if (n < 0 && errno != EAGAIN)
+        {
+            ok = FALSE;
+        }
+        else if (n == 0)
+        {
+            // Without a length the end of the connection ends the file
+            done = TRUE;
+            ok = conn_ptr->content_length < 0;
+        }
+        else if (n > 0)
+        {
+            size += n;
+        }
+    }
+
+    loc_eng_xtra_http_close (conn_ptr);
+
+    if (streamed == TRUE)
+    {
+        // Fails the injection of an incomplete file
+        ok = loc_eng_xtra_stream_finish () == 0 && ok == TRUE;
+    }
+    else if (ok == TRUE)
+    {
+        ok = loc_eng_xtra_inject_async (buf, size) == 0;
+        buf = NULL;
+    }
+    free (buf);
+
+    LOGD("loc_eng_xtra_download_body: %d bytes %s, %s", size, streamed ? "streamed" : "read",
+         ok ? "ok" : "failed");
+    return ok;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_download_file
+
+DESCRIPTION
+   Downloads the XTRA file from the best server that works, failing over
+   to the others if the body breaks off.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   TRUE if a file has been handed to the injection
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static boolean loc_eng_xtra_download_file (loc_eng_xtra_download_data_s_type *dl_ptr)
+{
+    loc_eng_xtra_http_conn_s_type conn;
+    int order[LOC_ENG_XTRA_MAX_SERVERS];
+    int count, i, latency;
+
+    pthread_mutex_lock (&dl_ptr->lock);
+    count = loc_eng_xtra_download_order (dl_ptr, order);
+    pthread_mutex_unlock (&dl_ptr->lock);
+
+    while (count > 0 && loc_eng_xtra_download_connect (dl_ptr, order, count, &conn) == TRUE)
+    {
+        latency = loc_eng_xtra_download_msec_since (&conn.start_time);
+        if (loc_eng_xtra_download_body (dl_ptr, &conn) == TRUE)
+        {
+            loc_eng_xtra_download_score (dl_ptr, conn.server, TRUE, latency);
+            pthread_mutex_lock (&dl_ptr->lock);
+            dl_ptr->last_server = conn.server;
+            pthread_mutex_unlock (&dl_ptr->lock);
+            return TRUE;
+        }
+        loc_eng_xtra_download_score (dl_ptr, conn.server, FALSE, 0);
+
+        // Try the servers after the one that broke off
+        for (i = 0; i < count && order[i] != conn.server; i++)
+        {
+        }
+        memmove (&order[0], &order[i + 1], (count - i - 1) * sizeof (order[0]));
+        count -= i + 1;
+    }
+
+    return FALSE;
+}
+
+/*===========================================================================
+FUNCTION    loc_eng_xtra_download_thread
+
+DESCRIPTION
+   Runs the downloads requested with loc_eng_xtra_download_start. When all
+   servers fail, the request goes to the framework after all.
+
+DEPENDENCIES
+   N/A
+
+RETURN VALUE
+   N/A
+
+SIDE EFFECTS
+   N/A
+
+===========================================================================*/
+static void* loc_eng_xtra_download_thread (void* arg)
+{
+    loc_eng_xtra_download_data_s_type *dl_ptr = (loc_eng_xtra_download_data_s_type *) arg;
+    boolean ok;
+
+    pthread_mutex_lock (&dl_ptr->lock);
+    while (dl_ptr->thread_need_exit == FALSE)
+    {
+        if (dl_ptr->requested == FALSE)
+        {
+            pthread_cond_wait (&dl_ptr->cond, &dl_ptr->lock);
+            continue;
+        }
+        dl_ptr->requested = FALSE;
+        pthread_mutex_unlock (&dl_ptr->lock);
+
+        ok = loc_eng_xtra_download_file (dl_ptr);
+
+        pthread_mutex_lock (&dl_ptr->lock);
+        if (ok == TRUE)
+        {
+            dl_ptr->downloads_ok++;
+        }
+        else if (dl_ptr->thread_need_exit == FALSE)
+        {
+            dl_ptr->downloads_failed++;
+            pthread_mutex_unlock (&dl_ptr->lock);
+            LOGE("loc_eng_xtra_download_thread: no server worked, asking the framework");
+            loc_eng_xtra_forward_download ();
+            pthread_mutex_lock (&dl_ptr->lock);
+        }
+    }
+    pthread_mutex_unlock (&dl_ptr->lock);
+
+    return NULL;
+}
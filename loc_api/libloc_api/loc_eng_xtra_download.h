@@ -0,0 +1,102 @@
+/******************************************************************************
+  @file:  loc_eng_xtra_download.h
+  @brief:
+
+  DESCRIPTION
+    This file defines the HAL side XTRA downloader. It fetches the XTRA file
+    from the servers the modem advertises in
+    RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_SOURCE, racing a second server
+    when the first one is slow and failing over when one breaks, and hands
+    the file to the XTRA injection.
+
+  INITIALIZATION AND SEQUENCING REQUIREMENTS
+    Disabled unless the gps.xtra.hal_download property is 1, the framework
+    then downloads the file as before.
+
+  -----------------------------------------------------------------------------
+Copyright (c) 2009, QUALCOMM USA, INC.
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+         Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer. 
+
+         Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution. 
+
+         Neither the name of the QUALCOMM USA, INC.  nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  -----------------------------------------------------------------------------
+
+******************************************************************************/
+
+/*=====================================================================
+$Header: $
+$DateTime: $
+$Author: $
+======================================================================*/
+
+#ifndef LOC_ENG_XTRA_DOWNLOAD_H
+#define LOC_ENG_XTRA_DOWNLOAD_H
+
+#define LOC_ENG_XTRA_MAX_SERVERS         3
+#define LOC_ENG_XTRA_MAX_URL_LEN         256
+
+// Time a server has to answer with the response headers
+#define LOC_ENG_XTRA_CONNECT_TIMEOUT     5000   // msec
+// Longest pause in the response body
+#define LOC_ENG_XTRA_READ_TIMEOUT        10000  // msec
+// The next server is raced after twice the latency of the one tried, at
+// least this long, or after LOC_ENG_XTRA_HEDGE_DELAY for an unknown server
+#define LOC_ENG_XTRA_HEDGE_MIN_DELAY     300    // msec
+#define LOC_ENG_XTRA_HEDGE_DELAY         1000   // msec
+// A failed server is skipped for 30 s, doubled on each further failure
+#define LOC_ENG_XTRA_BACKOFF_MIN         30     // seconds
+#define LOC_ENG_XTRA_BACKOFF_MAX         3600   // seconds
+
+// Score of one advertised server
+typedef struct
+{
+    char                           url[LOC_ENG_XTRA_MAX_URL_LEN];
+    // Smoothed time to the response headers, 0 until measured
+    uint32                         latency_msec;
+    uint32                         successes;
+    uint32                         failures;
+    uint32                         consecutive_failures;
+    // CLOCK_MONOTONIC, the server is only tried before if all others fail
+    struct timespec                retry_time;
+} loc_eng_xtra_server_s_type;
+
+// Module data
+typedef struct
+{
+    pthread_mutex_t                lock;
+    pthread_cond_t                 cond;
+    pthread_t                      thread;
+    boolean                        thread_need_exit;
+    // Wakes the downloader out of poll on cleanup
+    int                            wake_fd[2];
+
+    boolean                        enabled;
+    boolean                        requested;
+    loc_eng_xtra_server_s_type     servers[LOC_ENG_XTRA_MAX_SERVERS];
+    int                            server_count;
+
+    uint32                         downloads_ok;
+    uint32                         downloads_failed;
+    // Server the last good file came from, -1 if none
+    int                            last_server;
+} loc_eng_xtra_download_data_s_type;
+
+extern void loc_eng_xtra_download_init (loc_eng_xtra_download_data_s_type *dl_ptr);
+extern void loc_eng_xtra_download_deinit (loc_eng_xtra_download_data_s_type *dl_ptr);
+
+// Takes the server list from RPC_LOC_IOCTL_QUERY_PREDICTED_ORBITS_DATA_SOURCE
+extern void loc_eng_xtra_download_set_servers (char* const servers[], int count);
+extern void loc_eng_xtra_download_enable (boolean enable);
+
+// Starts a download, FALSE if the framework has to download the file
+extern boolean loc_eng_xtra_download_start (void);
+
+#endif // LOC_ENG_XTRA_DOWNLOAD_H